@@ -29,6 +29,7 @@
 #include "boxes-private.h"
 #include <meta/util.h>
 #include <X11/Xutil.h>  /* Just for the definition of the various gravities */
+#include <string.h>
 
 /* It would make sense to use GSlice here, but until we clean up the
  * rest of this file and the internal API to use these functions, we
@@ -421,114 +422,344 @@ meta_rectangle_resize_with_gravity (const MetaRectangle *old_rect,
   rect->height = new_height;
 }
 
-/* Not so simple helper function for get_minimal_spanning_set_for_region() */
+/* The region and edge computations below work on flat arrays instead of
+ * lists of separately allocated rectangles.  The first few elements live
+ * in the array struct itself, so the usual handful of rectangles doesn't
+ * need any allocation at all, and only the final results get turned into
+ * lists for the GList API.
+ */
+#define N_EMBEDDED 16
+
+typedef struct
+{
+  MetaRectangle *rects;
+  int            n_rects;
+  int            size;
+  MetaRectangle  embedded[N_EMBEDDED];
+} RectArray;
+
+typedef struct
+{
+  MetaEdge *edges;
+  int       n_edges;
+  int       size;
+  MetaEdge  embedded[N_EMBEDDED];
+} EdgeArray;
+
+static void
+rect_array_init (RectArray *array)
+{
+  array->rects = array->embedded;
+  array->n_rects = 0;
+  array->size = N_EMBEDDED;
+}
+
+static void
+rect_array_clear (RectArray *array)
+{
+  if (array->rects != array->embedded)
+    g_free (array->rects);
+}
+
+static void
+rect_array_reserve (RectArray *array,
+                    int        n_more)
+{
+  int needed = array->n_rects + n_more;
+
+  if (needed <= array->size)
+    return;
+
+  while (array->size < needed)
+    array->size *= 2;
+
+  if (array->rects == array->embedded)
+    {
+      array->rects = g_new (MetaRectangle, array->size);
+      memcpy (array->rects, array->embedded,
+              array->n_rects * sizeof (MetaRectangle));
+    }
+  else
+    array->rects = g_renew (MetaRectangle, array->rects, array->size);
+}
+
+static void
+rect_array_append (RectArray           *array,
+                   const MetaRectangle *rect)
+{
+  rect_array_reserve (array, 1);
+  array->rects[array->n_rects++] = *rect;
+}
+
+/* Replaces the rectangle at index with the n_rects given ones, which
+ * must not point into the array.
+ */
+static void
+rect_array_splice (RectArray           *array,
+                   int                  index,
+                   const MetaRectangle *rects,
+                   int                  n_rects)
+{
+  rect_array_reserve (array, n_rects - 1);
+  memmove (&array->rects[index + n_rects], &array->rects[index + 1],
+           (array->n_rects - index - 1) * sizeof (MetaRectangle));
+  if (n_rects > 0)
+    memcpy (&array->rects[index], rects, n_rects * sizeof (MetaRectangle));
+  array->n_rects += n_rects - 1;
+}
+
+static void
+rect_array_reverse (RectArray *array)
+{
+  int i, j;
+
+  for (i = 0, j = array->n_rects - 1; i < j; i++, j--)
+    {
+      MetaRectangle tmp = array->rects[i];
+      array->rects[i] = array->rects[j];
+      array->rects[j] = tmp;
+    }
+}
+
 static GList*
-merge_spanning_rects_in_region (GList *region)
+rect_array_to_list (const RectArray *array)
+{
+  GList *list = NULL;
+  int i;
+
+  for (i = array->n_rects - 1; i >= 0; i--)
+    list = g_list_prepend (list, meta_rectangle_copy (&array->rects[i]));
+
+  return list;
+}
+
+static void
+edge_array_init (EdgeArray *array)
+{
+  array->edges = array->embedded;
+  array->n_edges = 0;
+  array->size = N_EMBEDDED;
+}
+
+static void
+edge_array_clear (EdgeArray *array)
+{
+  if (array->edges != array->embedded)
+    g_free (array->edges);
+}
+
+static void
+edge_array_reserve (EdgeArray *array,
+                    int        n_more)
+{
+  int needed = array->n_edges + n_more;
+
+  if (needed <= array->size)
+    return;
+
+  while (array->size < needed)
+    array->size *= 2;
+
+  if (array->edges == array->embedded)
+    {
+      array->edges = g_new (MetaEdge, array->size);
+      memcpy (array->edges, array->embedded,
+              array->n_edges * sizeof (MetaEdge));
+    }
+  else
+    array->edges = g_renew (MetaEdge, array->edges, array->size);
+}
+
+static void
+edge_array_append (EdgeArray      *array,
+                   const MetaEdge *edge)
+{
+  edge_array_reserve (array, 1);
+  array->edges[array->n_edges++] = *edge;
+}
+
+static void
+edge_array_append_array (EdgeArray       *array,
+                         const EdgeArray *other)
+{
+  edge_array_reserve (array, other->n_edges);
+  memcpy (&array->edges[array->n_edges], other->edges,
+          other->n_edges * sizeof (MetaEdge));
+  array->n_edges += other->n_edges;
+}
+
+/* Edges that are no longer wanted get a side_type of 0, and are only
+ * squeezed out afterwards, so that deleting lots of them stays cheap.
+ */
+static void
+edge_array_squeeze (EdgeArray *array)
+{
+  int i, n_kept;
+
+  n_kept = 0;
+  for (i = 0; i < array->n_edges; i++)
+    if (array->edges[i].side_type != 0)
+      array->edges[n_kept++] = array->edges[i];
+  array->n_edges = n_kept;
+}
+
+/* Sorts the way g_list_sort() does, i.e. stably; which of several equal
+ * elements comes first shows in the results.
+ */
+static void
+sort_stably (gpointer     base,
+             int          n_elements,
+             gsize        element_size,
+             GCompareFunc compare)
+{
+  guint8 *elements = base;
+  guint8 *sorted;
+  int width, i;
+
+  if (n_elements <= N_EMBEDDED)
+    {
+      guint8 key[sizeof (MetaEdge)];
+
+      g_assert (element_size <= sizeof (key));
+
+      /* Insertion sort for the common tiny arrays */
+      for (i = 1; i < n_elements; i++)
+        {
+          int j = i;
+
+          memcpy (key, elements + i * element_size, element_size);
+          while (j > 0 && compare (elements + (j - 1) * element_size, key) > 0)
+            j--;
+
+          memmove (elements + (j + 1) * element_size, elements + j * element_size,
+                   (i - j) * element_size);
+          memcpy (elements + j * element_size, key, element_size);
+        }
+      return;
+    }
+
+  sorted = g_malloc (n_elements * element_size);
+
+  for (width = 1; width < n_elements; width *= 2)
+    {
+      for (i = 0; i < n_elements; i += 2 * width)
+        {
+          int mid   = MIN (i + width, n_elements);
+          int right = MIN (i + 2 * width, n_elements);
+          int l     = i;
+          int r     = mid;
+          int out   = i;
+
+          while (l < mid && r < right)
+            {
+              if (compare (elements + l * element_size,
+                           elements + r * element_size) <= 0)
+                memcpy (sorted + out++ * element_size,
+                        elements + l++ * element_size, element_size);
+              else
+                memcpy (sorted + out++ * element_size,
+                        elements + r++ * element_size, element_size);
+            }
+          memcpy (sorted + out * element_size, elements + l * element_size,
+                  (mid - l) * element_size);
+          out += mid - l;
+          memcpy (sorted + out * element_size, elements + r * element_size,
+                  (right - r) * element_size);
+        }
+
+      memcpy (elements, sorted, n_elements * element_size);
+    }
+
+  g_free (sorted);
+}
+
+/* Not so simple helper function for get_minimal_spanning_set_for_region() */
+static void
+merge_spanning_rects_in_region (RectArray *region)
 {
   /* NOTE FOR ANY OPTIMIZATION PEOPLE OUT THERE: Please see the
    * documentation of get_minimal_spanning_set_for_region() for performance
    * considerations that also apply to this function.
    */
 
-  GList* compare;
-  compare = region;
+  int i, j, n_kept;
 
-  if (region == NULL)
+  if (region->n_rects == 0)
     {
       meta_warning ("Region to merge was empty!  Either you have a some "
                     "pathological STRUT list or there's a bug somewhere!\n");
-      return NULL;
+      return;
     }
 
-  while (compare && compare->next)
+  /* Rectangles that are no longer wanted get a width of 0 and are
+   * skipped, and only squeezed out at the end, so that deleting stays
+   * cheap with lots of rectangles.
+   */
+  for (i = 0; i < region->n_rects; i++)
     {
-      MetaRectangle *a = compare->data;
-      GList *other = compare->next;
+      MetaRectangle *a = &region->rects[i];
+
+      if (a->width == 0)
+        continue;
 
       g_assert (a->width > 0 && a->height > 0);
 
-      while (other)
+      for (j = i + 1; j < region->n_rects; j++)
         {
-          MetaRectangle *b = other->data;
-          GList *delete_me = NULL;
+          MetaRectangle *b = &region->rects[j];
+          gboolean delete_b = FALSE;
+
+          if (b->width == 0)
+            continue;
 
           g_assert (b->width > 0 && b->height > 0);
 
-          /* If a contains b, just remove b */
+          /* If a contains b, just remove b.  (The region is sorted by
+           * area and a only grows, so b can't contain a unless they are
+           * the same.)
+           */
           if (meta_rectangle_contains_rect (a, b))
             {
-              delete_me = other;
-            }
-          /* If b contains a, just remove a */
-          else if (meta_rectangle_contains_rect (a, b))
-            {
-              delete_me = compare;
+              delete_b = TRUE;
             }
           /* If a and b might be mergeable horizontally */
           else if (a->y == b->y && a->height == b->height)
             {
-              /* If a and b overlap */
-              if (meta_rectangle_overlap (a, b))
-                {
-                  int new_x = MIN (a->x, b->x);
-                  a->width = MAX (a->x + a->width, b->x + b->width) - new_x;
-                  a->x = new_x;
-                  delete_me = other;
-                }
-              /* If a and b are adjacent */
-              else if (a->x + a->width == b->x || a->x == b->x + b->width)
+              /* If a and b overlap or are adjacent */
+              if (meta_rectangle_overlap (a, b) ||
+                  a->x + a->width == b->x || a->x == b->x + b->width)
                 {
                   int new_x = MIN (a->x, b->x);
                   a->width = MAX (a->x + a->width, b->x + b->width) - new_x;
                   a->x = new_x;
-                  delete_me = other;
+                  delete_b = TRUE;
                 }
             }
           /* If a and b might be mergeable vertically */
           else if (a->x == b->x && a->width == b->width)
             {
-              /* If a and b overlap */
-              if (meta_rectangle_overlap (a, b))
+              /* If a and b overlap or are adjacent */
+              if (meta_rectangle_overlap (a, b) ||
+                  a->y + a->height == b->y || a->y == b->y + b->height)
                 {
                   int new_y = MIN (a->y, b->y);
                   a->height = MAX (a->y + a->height, b->y + b->height) - new_y;
                   a->y = new_y;
-                  delete_me = other;
-                }
-              /* If a and b are adjacent */
-              else if (a->y + a->height == b->y || a->y == b->y + b->height)
-                {
-                  int new_y = MIN (a->y, b->y);
-                  a->height = MAX (a->y + a->height, b->y + b->height) - new_y;
-                  a->y = new_y;
-                  delete_me = other;
-                }
-            }
-
-          other = other->next;
-
-          /* Delete any rectangle in the list that is no longer wanted */
-          if (delete_me != NULL)
-            {
-              /* Deleting the rect we compare others to is a little tricker */
-              if (compare == delete_me)
-                {
-                  compare = compare->next;
-                  other = compare->next;
-                  a = compare->data;
+                  delete_b = TRUE;
                 }
-
-              /* Okay, we can free it now */
-              g_free (delete_me->data);
-              region = g_list_delete_link (region, delete_me);
             }
 
+          if (delete_b)
+            b->width = 0;
         }
-
-      compare = compare->next;
     }
 
-  return region;
+  /* Squeeze out the deleted rectangles */
+  n_kept = 0;
+  for (i = 0; i < region->n_rects; i++)
+    if (region->rects[i].width != 0)
+      region->rects[n_kept++] = region->rects[i];
+  region->n_rects = n_kept;
 }
 
 /* Simple helper function for get_minimal_spanning_set_for_region()... */
@@ -571,9 +802,10 @@ meta_rectangle_get_minimal_spanning_set_for_region (
 {
   /* NOTE FOR OPTIMIZERS: This function *might* be somewhat slow,
    * especially due to the call to merge_spanning_rects_in_region() (which
-   * is O(n^2) where n is the size of the list generated in this function).
-   * This is made more onerous due to the fact that it involves a fair
-   * number of memory allocation and deallocation calls.  However, n is 1
+   * is O(n^2) where n is the size of the array generated in this function).
+   * The splitting and merging work in place on flat arrays, so apart from
+   * the returned list nothing gets allocated unless the arrays outgrow
+   * N_EMBEDDED.  Anyway, n is 1
    * for default installations of Gnome (because partial struts aren't used
    * by default and only partial struts increase the size of the spanning
    * set generated).  With one partial strut, n will be 2 or 3.  With 2
@@ -606,9 +838,11 @@ meta_rectangle_get_minimal_spanning_set_for_region (
    */
 
   GList         *ret;
-  GList         *tmp_list;
+  RectArray      arrays[2];
+  RectArray     *rects;
+  RectArray     *split;
   const GSList  *strut_iter;
-  MetaRectangle *temp_rect;
+  int            i;
 
   /* The algorithm is basically as follows:
    *   Initialize rectangle_set to basic_rect
@@ -619,78 +853,91 @@ meta_rectangle_get_minimal_spanning_set_for_region (
    *       - Remove the old (pre-split) rectangle from the rectangle_set,
    *         and replace it with the new rectangles generated from the
    *         splitting
+   *
+   * rectangle_set is walked and refilled back to front and only reversed
+   * at the end; the order of the result decides which of several equally
+   * good rectangles meta_rectangle_clip_to_region() and friends pick, so
+   * it shouldn't depend on how the set is stored.
    */
 
-  temp_rect = g_new (MetaRectangle, 1);
-  *temp_rect = *basic_rect;
-  ret = g_list_prepend (NULL, temp_rect);
+  rect_array_init (&arrays[0]);
+  rect_array_init (&arrays[1]);
+  rects = &arrays[0];
+  split = &arrays[1];
+
+  rect_array_append (rects, basic_rect);
 
-  strut_iter = all_struts;
   for (strut_iter = all_struts; strut_iter; strut_iter = strut_iter->next)
     {
-      GList *rect_iter; 
       MetaRectangle *strut_rect = &((MetaStrut*)strut_iter->data)->rect;
+      RectArray     *tmp;
 
-      tmp_list = ret;
-      ret = NULL;
-      rect_iter = tmp_list;
-      while (rect_iter)
+      split->n_rects = 0;
+      for (i = rects->n_rects - 1; i >= 0; i--)
         {
-          MetaRectangle *rect = (MetaRectangle*) rect_iter->data;
+          const MetaRectangle *rect = &rects->rects[i];
+          MetaRectangle        temp_rect;
+
           if (!meta_rectangle_overlap (rect, strut_rect))
-            ret = g_list_prepend (ret, rect);
-          else
             {
-              /* If there is area in rect left of strut */
-              if (BOX_LEFT (*rect) < BOX_LEFT (*strut_rect))
-                {
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  temp_rect->width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              /* If there is area in rect right of strut */
-              if (BOX_RIGHT (*rect) > BOX_RIGHT (*strut_rect))
-                {
-                  int new_x;
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  new_x = BOX_RIGHT (*strut_rect);
-                  temp_rect->width = BOX_RIGHT(*rect) - new_x;
-                  temp_rect->x = new_x;
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              /* If there is area in rect above strut */
-              if (BOX_TOP (*rect) < BOX_TOP (*strut_rect))
-                {
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  temp_rect->height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              /* If there is area in rect below strut */
-              if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*strut_rect))
-                {
-                  int new_y;
-                  temp_rect = g_new (MetaRectangle, 1);
-                  *temp_rect = *rect;
-                  new_y = BOX_BOTTOM (*strut_rect);
-                  temp_rect->height = BOX_BOTTOM (*rect) - new_y;
-                  temp_rect->y = new_y;
-                  ret = g_list_prepend (ret, temp_rect);
-                }
-              g_free (rect);
+              rect_array_append (split, rect);
+              continue;
+            }
+
+          /* If there is area in rect left of strut */
+          if (BOX_LEFT (*rect) < BOX_LEFT (*strut_rect))
+            {
+              temp_rect = *rect;
+              temp_rect.width = BOX_LEFT (*strut_rect) - BOX_LEFT (*rect);
+              rect_array_append (split, &temp_rect);
+            }
+          /* If there is area in rect right of strut */
+          if (BOX_RIGHT (*rect) > BOX_RIGHT (*strut_rect))
+            {
+              int new_x;
+              temp_rect = *rect;
+              new_x = BOX_RIGHT (*strut_rect);
+              temp_rect.width = BOX_RIGHT(*rect) - new_x;
+              temp_rect.x = new_x;
+              rect_array_append (split, &temp_rect);
+            }
+          /* If there is area in rect above strut */
+          if (BOX_TOP (*rect) < BOX_TOP (*strut_rect))
+            {
+              temp_rect = *rect;
+              temp_rect.height = BOX_TOP (*strut_rect) - BOX_TOP (*rect);
+              rect_array_append (split, &temp_rect);
+            }
+          /* If there is area in rect below strut */
+          if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*strut_rect))
+            {
+              int new_y;
+              temp_rect = *rect;
+              new_y = BOX_BOTTOM (*strut_rect);
+              temp_rect.height = BOX_BOTTOM (*rect) - new_y;
+              temp_rect.y = new_y;
+              rect_array_append (split, &temp_rect);
             }
-          rect_iter = rect_iter->next;
         }
-      g_list_free (tmp_list);
+
+      tmp = rects;
+      rects = split;
+      split = tmp;
     }
 
+  rect_array_reverse (rects);
+
   /* Sort by maximal area, just because I feel like it... */
-  ret = g_list_sort (ret, compare_rect_areas);
+  sort_stably (rects->rects, rects->n_rects, sizeof (MetaRectangle),
+               compare_rect_areas);
 
   /* Merge rectangles if possible so that the list really is minimal */
-  ret = merge_spanning_rects_in_region (ret);
+  merge_spanning_rects_in_region (rects);
+
+  ret = rect_array_to_list (rects);
+
+  rect_array_clear (&arrays[0]);
+  rect_array_clear (&arrays[1]);
 
   return ret;
 }
@@ -1216,84 +1463,47 @@ meta_rectangle_edge_aligns (const MetaRectangle *rect, const MetaEdge *edge)
     }
 }
 
-static GList*
-get_rect_minus_overlap (const GList   *rect_in_list, 
-                        MetaRectangle *overlap)
+/* Stores the parts of rect that lie outside of overlap in pieces, bottom
+ * one first, and returns how many there are.
+ */
+static int
+get_rect_minus_overlap (const MetaRectangle *rect,
+                        const MetaRectangle *overlap,
+                        MetaRectangle       *pieces)
 {
-  MetaRectangle *temp;
-  MetaRectangle *rect = rect_in_list->data;
-  GList *ret = NULL;
+  int n_pieces = 0;
 
-  if (BOX_LEFT (*rect) < BOX_LEFT (*overlap))
-    {
-      temp = g_new (MetaRectangle, 1);
-      *temp = *rect;
-      temp->width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
-      ret = g_list_prepend (ret, temp);
-    }
-  if (BOX_RIGHT (*rect) > BOX_RIGHT (*overlap))
+  if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
-      *temp = *rect;
-      temp->x = BOX_RIGHT (*overlap);
-      temp->width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
-      ret = g_list_prepend (ret, temp);
+      MetaRectangle *temp = &pieces[n_pieces++];
+      temp->x      = overlap->x;
+      temp->width  = overlap->width;
+      temp->y      = BOX_BOTTOM (*overlap);
+      temp->height = BOX_BOTTOM (*rect) - BOX_BOTTOM (*overlap);
     }
   if (BOX_TOP (*rect) < BOX_TOP (*overlap))
     {
-      temp = g_new (MetaRectangle, 1);
+      MetaRectangle *temp = &pieces[n_pieces++];
       temp->x      = overlap->x;
       temp->width  = overlap->width;
       temp->y      = BOX_TOP (*rect);
       temp->height = BOX_TOP (*overlap) - BOX_TOP (*rect);
-      ret = g_list_prepend (ret, temp);
     }
-  if (BOX_BOTTOM (*rect) > BOX_BOTTOM (*overlap))
-    {
-      temp = g_new (MetaRectangle, 1);
-      temp->x      = overlap->x;
-      temp->width  = overlap->width;
-      temp->y      = BOX_BOTTOM (*overlap);
-      temp->height = BOX_BOTTOM (*rect) - BOX_BOTTOM (*overlap);
-      ret = g_list_prepend (ret, temp);
-    }
-
-  return ret;
-}
-
-static GList*
-replace_rect_with_list (GList *old_element, 
-                        GList *new_list)
-{
-  GList *ret;
-  g_assert (old_element != NULL);
-
-  if (!new_list)
+  if (BOX_RIGHT (*rect) > BOX_RIGHT (*overlap))
     {
-      /* If there is no new list, just remove the old_element */
-      ret = g_list_remove_link (old_element, old_element);
+      MetaRectangle *temp = &pieces[n_pieces++];
+      *temp = *rect;
+      temp->x = BOX_RIGHT (*overlap);
+      temp->width = BOX_RIGHT (*rect) - BOX_RIGHT (*overlap);
     }
-  else
+  if (BOX_LEFT (*rect) < BOX_LEFT (*overlap))
     {
-      /* Fix up the prev and next pointers everywhere */
-      ret = new_list;
-      if (old_element->prev)
-        {
-          old_element->prev->next = new_list;
-          new_list->prev = old_element->prev;
-        }
-      if (old_element->next)
-        {
-          GList *tmp = g_list_last (new_list);
-          old_element->next->prev = tmp;
-          tmp->next = old_element->next;
-        }
+      MetaRectangle *temp = &pieces[n_pieces++];
+      *temp = *rect;
+      temp->width = BOX_LEFT (*overlap) - BOX_LEFT (*rect);
     }
 
-  /* Free the old_element and return the appropriate "next" point */
-  g_free (old_element->data);
-  g_list_free_1 (old_element);
-  return ret;
+  return n_pieces;
 }
 
 /* Make a copy of the strut list, make sure that copy only contains parts
@@ -1302,80 +1512,68 @@ replace_rect_with_list (GList *old_element,
  * that aren't disjoint in a way that the overlapping part is only included
  * once, so it's not really magic...).
  */
-static GList*
-get_disjoint_strut_rect_list_in_region (const GSList        *old_struts,
-                                        const MetaRectangle *region)
+static void
+get_disjoint_strut_rects_in_region (const GSList        *old_struts,
+                                    const MetaRectangle *region,
+                                    RectArray           *strut_rects)
 {
-  GList *strut_rects;
-  GList *tmp;
+  int i, j;
 
-  /* First, copy the list */
-  strut_rects = NULL;
-  while (old_struts)
+  /* First, copy the list; the last strut goes first */
+  for (; old_struts; old_struts = old_struts->next)
     {
       MetaRectangle *cur = &((MetaStrut*)old_struts->data)->rect;
-      MetaRectangle *copy = g_new (MetaRectangle, 1);
-      *copy = *cur;
-      if (meta_rectangle_intersect (copy, region, copy))
-        strut_rects = g_list_prepend (strut_rects, copy);
-      else
-        g_free (copy);
-
-      old_struts = old_struts->next;
+      MetaRectangle  copy;
+
+      if (meta_rectangle_intersect (cur, region, &copy))
+        rect_array_append (strut_rects, &copy);
     }
+  rect_array_reverse (strut_rects);
 
-  /* Now, loop over the list and check for intersections, fixing things up
+  /* Now, loop over the array and check for intersections, fixing things up
    * where they do intersect.
    */
-  tmp = strut_rects;
-  while (tmp)
+  for (i = 0; i < strut_rects->n_rects; i++)
     {
-      GList *compare;
-
-      MetaRectangle *cur = tmp->data;
-
-      compare = tmp->next;
-      while (compare)
+      j = i + 1;
+      while (j < strut_rects->n_rects)
         {
-          MetaRectangle *comp = compare->data;
           MetaRectangle overlap;
+          MetaRectangle cur_leftover[5];
+          MetaRectangle comp_leftover[4];
+          int           n_cur_leftover, n_comp_leftover;
 
-          if (meta_rectangle_intersect (cur, comp, &overlap))
+          if (!meta_rectangle_intersect (&strut_rects->rects[i],
+                                         &strut_rects->rects[j],
+                                         &overlap))
             {
-              /* Get a list of rectangles for each strut that don't overlap
-               * the intersection region.
-               */
-              GList *cur_leftover  = get_rect_minus_overlap (tmp,  &overlap);
-              GList *comp_leftover = get_rect_minus_overlap (compare, &overlap);
-
-              /* Add the intersection region to cur_leftover */
-              MetaRectangle *overlap_allocated = g_new (MetaRectangle, 1);
-              *overlap_allocated = overlap;
-              cur_leftover = g_list_prepend (cur_leftover, overlap_allocated);
-
-              /* Fix up tmp, compare, and cur -- maybe struts too */
-              if (strut_rects == tmp)
-                {
-                  strut_rects = replace_rect_with_list (tmp, cur_leftover);
-                  tmp = strut_rects;
-                }
-              else
-                tmp   = replace_rect_with_list (tmp,     cur_leftover);
-              compare = replace_rect_with_list (compare, comp_leftover);
-
-              if (compare == NULL)
-                break;
-
-              cur = tmp->data;
+              j++;
+              continue;
             }
 
-          compare = compare->next;
+          /* Get the rectangles for each strut that don't overlap the
+           * intersection region, and put the intersection region first
+           * in those of cur.
+           */
+          cur_leftover[0] = overlap;
+          n_cur_leftover = 1 +
+            get_rect_minus_overlap (&strut_rects->rects[i], &overlap,
+                                    &cur_leftover[1]);
+          n_comp_leftover =
+            get_rect_minus_overlap (&strut_rects->rects[j], &overlap,
+                                    comp_leftover);
+
+          /* Replace compare first so that i stays valid, then cur */
+          rect_array_splice (strut_rects, j, comp_leftover, n_comp_leftover);
+          rect_array_splice (strut_rects, i, cur_leftover, n_cur_leftover);
+          j += n_cur_leftover - 1;
+
+          /* cur is just the overlap now, which the first leftover piece
+           * of compare can't intersect, so carry on after that one.
+           */
+          j++;
         }
-
-      tmp = tmp->next;
     }
-
-  return strut_rects;
 }
 
 gint
@@ -1540,63 +1738,59 @@ rectangle_and_edge_intersection (const MetaRectangle *rect,
   return intersect;
 }
 
-/* Add all edges of the given rect to cur_edges and return the result.  If
- * rect_is_internal is false, the side types are switched (LEFT<->RIGHT and
- * TOP<->BOTTOM).
+/* Add all edges of the given rect to cur_edges.  If rect_is_internal is
+ * false, the side types are switched (LEFT<->RIGHT and TOP<->BOTTOM).
  */
-static GList*
-add_edges (GList               *cur_edges, 
+static void
+add_edges (EdgeArray           *cur_edges,
            const MetaRectangle *rect,
            gboolean             rect_is_internal)
 {
-  MetaEdge *temp_edge;
+  MetaEdge temp_edge;
   int i;
 
   for (i=0; i<4; i++)
     {
-      temp_edge = g_new (MetaEdge, 1);
-      temp_edge->rect = *rect;
+      temp_edge.rect = *rect;
       switch (i)
         {
         case 0:
-          temp_edge->side_type = 
+          temp_edge.side_type = 
             rect_is_internal ? META_SIDE_LEFT : META_SIDE_RIGHT;
-          temp_edge->rect.width = 0;
+          temp_edge.rect.width = 0;
           break;
         case 1:
-          temp_edge->side_type = 
+          temp_edge.side_type = 
             rect_is_internal ? META_SIDE_RIGHT : META_SIDE_LEFT;
-          temp_edge->rect.x     += temp_edge->rect.width;
-          temp_edge->rect.width  = 0;
+          temp_edge.rect.x     += temp_edge.rect.width;
+          temp_edge.rect.width  = 0;
           break;
         case 2:
-          temp_edge->side_type = 
+          temp_edge.side_type = 
             rect_is_internal ? META_SIDE_TOP : META_SIDE_BOTTOM;
-          temp_edge->rect.height = 0;
+          temp_edge.rect.height = 0;
           break;
         case 3:
-          temp_edge->side_type = 
+          temp_edge.side_type = 
             rect_is_internal ? META_SIDE_BOTTOM : META_SIDE_TOP;
-          temp_edge->rect.y      += temp_edge->rect.height;
-          temp_edge->rect.height  = 0;
+          temp_edge.rect.y      += temp_edge.rect.height;
+          temp_edge.rect.height  = 0;
           break;
         }
-      temp_edge->edge_type = META_EDGE_SCREEN;
-      cur_edges = g_list_prepend (cur_edges, temp_edge);
+      temp_edge.edge_type = META_EDGE_SCREEN;
+      edge_array_append (cur_edges, &temp_edge);
     }
-
-  return cur_edges;
 }
 
 /* Remove any part of old_edge that intersects remove and add any resulting
- * edges to cur_list.  Return cur_list when finished.
+ * edges to cur_edges, which old_edge must not point into.
  */
-static GList*
-split_edge (GList *cur_list, 
+static void
+split_edge (EdgeArray      *cur_edges,
             const MetaEdge *old_edge, 
             const MetaEdge *remove)
 {
-  MetaEdge *temp_edge;
+  MetaEdge temp_edge;
   switch (old_edge->side_type)
     {
     case META_SIDE_LEFT:
@@ -1604,20 +1798,18 @@ split_edge (GList *cur_list,
       g_assert (meta_rectangle_vert_overlap (&old_edge->rect, &remove->rect));
       if (BOX_TOP (old_edge->rect)  < BOX_TOP (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.height = BOX_TOP (remove->rect)
-                                 - BOX_TOP (old_edge->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.height = BOX_TOP (remove->rect)
+                                - BOX_TOP (old_edge->rect);
+          edge_array_append (cur_edges, &temp_edge);
         }
       if (BOX_BOTTOM (old_edge->rect) > BOX_BOTTOM (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.y      = BOX_BOTTOM (remove->rect);
-          temp_edge->rect.height = BOX_BOTTOM (old_edge->rect)
-                                 - BOX_BOTTOM (remove->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.y      = BOX_BOTTOM (remove->rect);
+          temp_edge.rect.height = BOX_BOTTOM (old_edge->rect)
+                                - BOX_BOTTOM (remove->rect);
+          edge_array_append (cur_edges, &temp_edge);
         }
       break;
     case META_SIDE_TOP:
@@ -1625,36 +1817,32 @@ split_edge (GList *cur_list,
       g_assert (meta_rectangle_horiz_overlap (&old_edge->rect, &remove->rect));
       if (BOX_LEFT (old_edge->rect)  < BOX_LEFT (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.width = BOX_LEFT (remove->rect)
-                                - BOX_LEFT (old_edge->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.width = BOX_LEFT (remove->rect)
+                               - BOX_LEFT (old_edge->rect);
+          edge_array_append (cur_edges, &temp_edge);
         }
       if (BOX_RIGHT (old_edge->rect) > BOX_RIGHT (remove->rect))
         {
-          temp_edge = g_new (MetaEdge, 1);
-          *temp_edge = *old_edge;
-          temp_edge->rect.x     = BOX_RIGHT (remove->rect);
-          temp_edge->rect.width = BOX_RIGHT (old_edge->rect)
-                                - BOX_RIGHT (remove->rect);
-          cur_list = g_list_prepend (cur_list, temp_edge);
+          temp_edge = *old_edge;
+          temp_edge.rect.x     = BOX_RIGHT (remove->rect);
+          temp_edge.rect.width = BOX_RIGHT (old_edge->rect)
+                               - BOX_RIGHT (remove->rect);
+          edge_array_append (cur_edges, &temp_edge);
         }
       break;
     default:
       g_assert_not_reached ();
     }
-
-  return cur_list;
 }
 
 /* Split up edge and remove preliminary edges from strut_edges depending on
  * if and how rect and edge intersect.
  */
 static void
-fix_up_edges (MetaRectangle *rect,         MetaEdge *edge, 
-              GList         **strut_edges, GList    **edge_splits,
-              gboolean      *edge_needs_removal)
+fix_up_edges (const MetaRectangle *rect,        const MetaEdge *edge,
+              EdgeArray           *strut_edges, EdgeArray      *edge_splits,
+              gboolean            *edge_needs_removal)
 {
   MetaEdge overlap;
   int      handle_type;
@@ -1665,7 +1853,7 @@ fix_up_edges (MetaRectangle *rect,         MetaEdge *edge,
   if (handle_type == 0 || handle_type == 1)
     {
       /* Put the result of removing overlap from edge into edge_splits */
-      *edge_splits = split_edge (*edge_splits, edge, &overlap);
+      split_edge (edge_splits, edge, &overlap);
       *edge_needs_removal = TRUE;
     }
 
@@ -1673,55 +1861,49 @@ fix_up_edges (MetaRectangle *rect,         MetaEdge *edge,
     {
       /* Remove the overlap from strut_edges */
       /* First, loop over the edges of the strut */
-      GList *tmp = *strut_edges;
-      while (tmp)
-        {
-          MetaEdge *cur = tmp->data;
-          /* If this is the edge that overlaps, then we need to split it */
-          if (edges_overlap (cur, &overlap))
-            {
-              GList *delete_me = tmp;
+      int i;
 
-              /* Split this edge into some new ones */
-              *strut_edges = split_edge (*strut_edges, cur, &overlap);
+      for (i = strut_edges->n_edges - 1; i >= 0; i--)
+        {
+          MetaEdge cur = strut_edges->edges[i];
 
-              /* Delete the old one */
-              tmp = tmp->next;
-              g_free (cur);
-              *strut_edges = g_list_delete_link (*strut_edges, delete_me);
+          /* If this is the edge that overlaps, then we need to split it
+           * into some new ones and delete the old one
+           */
+          if (edges_overlap (&cur, &overlap))
+            {
+              split_edge (strut_edges, &cur, &overlap);
+              strut_edges->edges[i].side_type = 0;
             }
-          else
-            tmp = tmp->next;
         }
+      edge_array_squeeze (strut_edges);
     }
 }
 
-/**
- * meta_rectangle_remove_intersections_with_boxes_from_edges: (skip)
- *
- * This function removes intersections of edges with the rectangles from the
- * list of edges.
- */
-GList*
-meta_rectangle_remove_intersections_with_boxes_from_edges (
-  GList        *edges,
-  const GSList *rectangles)
+/* Removes intersections of the edges with the rectangles; see below */
+static void
+remove_intersections_with_boxes (EdgeArray    *edges,
+                                 const GSList *rectangles)
 {
   const GSList *rect_iter;
+  EdgeArray     splits;
   const int opposing = 1;
 
+  edge_array_init (&splits);
+
   /* Now remove all intersections of rectangles with the edge list */
-  rect_iter = rectangles;
-  while (rect_iter)
+  for (rect_iter = rectangles; rect_iter; rect_iter = rect_iter->next)
     {
       MetaRectangle *rect = rect_iter->data;
-      GList *edge_iter = edges;
-      while (edge_iter)
+      gboolean any_removed = FALSE;
+      int i;
+
+      splits.n_edges = 0;
+      for (i = edges->n_edges - 1; i >= 0; i--)
         {
-          MetaEdge *edge = edge_iter->data;
-          MetaEdge overlap;
-          int      handle;
-          gboolean edge_iter_advanced = FALSE;
+          MetaEdge *edge = &edges->edges[i];
+          MetaEdge  overlap;
+          int       handle;
 
           /* If this edge overlaps with this rect... */
           if (rectangle_and_edge_intersection (rect, edge, &overlap, &handle))
@@ -1741,27 +1923,79 @@ meta_rectangle_remove_intersections_with_boxes_from_edges (
                */
               if (handle != opposing)
                 {
-                  /* Keep track of this edge so we can delete it below */
-                  GList *delete_me = edge_iter;
-                  edge_iter = edge_iter->next;
-                  edge_iter_advanced = TRUE;
-
-                  /* Split the edge and add the result to beginning of edges */
-                  edges = split_edge (edges, edge, &overlap);
-
-                  /* Now free the edge... */
-                  g_free (edge);
-                  edges = g_list_delete_link (edges, delete_me);
+                  /* Split the edge and delete it; the parts get added
+                   * after the loop
+                   */
+                  split_edge (&splits, edge, &overlap);
+                  edge->side_type = 0;
+                  any_removed = TRUE;
                 }
             }
-
-          if (!edge_iter_advanced)
-            edge_iter = edge_iter->next;
         }
 
-      rect_iter = rect_iter->next;
+      if (any_removed)
+        {
+          edge_array_squeeze (edges);
+          edge_array_append_array (edges, &splits);
+        }
     }
 
+  edge_array_clear (&splits);
+}
+
+/* The edge arrays hold their lists back to front, which turns the
+ * prepending and concatenating at the head done by the functions above
+ * into appending.  These convert between the two.
+ */
+static void
+edge_array_append_list (EdgeArray   *array,
+                        const GList *list)
+{
+  for (list = g_list_last ((GList *) list); list; list = list->prev)
+    edge_array_append (array, list->data);
+}
+
+static GList*
+edge_array_to_list (const EdgeArray *array)
+{
+  GList *list = NULL;
+  int i;
+
+  for (i = 0; i < array->n_edges; i++)
+    list = g_list_prepend (list, g_memdup (&array->edges[i], sizeof (MetaEdge)));
+
+  return list;
+}
+
+static GList*
+edge_array_to_sorted_list (const EdgeArray *array)
+{
+  /* Sorting the list only moves pointers around */
+  return g_list_sort (edge_array_to_list (array), meta_rectangle_edge_cmp);
+}
+
+/**
+ * meta_rectangle_remove_intersections_with_boxes_from_edges: (skip)
+ *
+ * This function removes intersections of edges with the rectangles from the
+ * list of edges.
+ */
+GList*
+meta_rectangle_remove_intersections_with_boxes_from_edges (
+  GList        *edges,
+  const GSList *rectangles)
+{
+  EdgeArray array;
+
+  edge_array_init (&array);
+  edge_array_append_list (&array, edges);
+  meta_rectangle_free_list_and_elements (edges);
+
+  remove_intersections_with_boxes (&array, rectangles);
+
+  edges = edge_array_to_list (&array);
+  edge_array_clear (&array);
+
   return edges;
 }
 
@@ -1775,9 +2009,12 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
                                     const GSList        *all_struts)
 {
   GList        *ret;
-  GList        *fixed_strut_rects;
-  GList        *edge_iter; 
-  const GList  *strut_rect_iter;
+  RectArray     fixed_strut_rects;
+  EdgeArray     edges;
+  EdgeArray     strut_edges;
+  EdgeArray     splits;
+  gboolean      any_removed;
+  int           i, j;
 
   /* The algorithm is basically as follows:
    *   Make sure the struts are disjoint
@@ -1795,59 +2032,60 @@ meta_rectangle_find_onscreen_edges (const MetaRectangle *basic_rect,
    */
 
   /* Make sure the struts are disjoint */
-  fixed_strut_rects =
-    get_disjoint_strut_rect_list_in_region (all_struts, basic_rect);
+  rect_array_init (&fixed_strut_rects);
+  get_disjoint_strut_rects_in_region (all_struts, basic_rect,
+                                      &fixed_strut_rects);
+
+  edge_array_init (&edges);
+  edge_array_init (&strut_edges);
+  edge_array_init (&splits);
 
   /* Start off the list with the edges of basic_rect */
-  ret = add_edges (NULL, basic_rect, TRUE);
+  add_edges (&edges, basic_rect, TRUE);
 
-  strut_rect_iter = fixed_strut_rects;
-  while (strut_rect_iter)
+  for (i = 0; i < fixed_strut_rects.n_rects; i++)
     {
-      MetaRectangle *strut_rect = (MetaRectangle*) strut_rect_iter->data;
+      const MetaRectangle *strut_rect = &fixed_strut_rects.rects[i];
 
       /* Get the new possible edges we may need to add from the strut */
-      GList *new_strut_edges = add_edges (NULL, strut_rect, FALSE);
+      strut_edges.n_edges = 0;
+      add_edges (&strut_edges, strut_rect, FALSE);
 
-      edge_iter = ret;
-      while (edge_iter)
+      any_removed = FALSE;
+      splits.n_edges = 0;
+      for (j = edges.n_edges - 1; j >= 0; j--)
         {
-          MetaEdge *cur_edge = edge_iter->data;
-          GList *splits_of_cur_edge = NULL;
           gboolean edge_needs_removal = FALSE;
 
-          fix_up_edges (strut_rect,       cur_edge, 
-                        &new_strut_edges, &splits_of_cur_edge,
+          fix_up_edges (strut_rect,   &edges.edges[j],
+                        &strut_edges, &splits,
                         &edge_needs_removal);
 
+          /* Delete the old edge; the new split parts of it get added
+           * below
+           */
           if (edge_needs_removal)
             {
-              /* Delete the old edge */
-              GList *delete_me = edge_iter;
-              edge_iter = edge_iter->next;
-              g_free (cur_edge);
-              ret = g_list_delete_link (ret, delete_me);
-
-              /* Add the new split parts of the edge */
-              ret = g_list_concat (splits_of_cur_edge, ret);
+              edges.edges[j].side_type = 0;
+              any_removed = TRUE;
             }
-          else
-            {
-              edge_iter = edge_iter->next;
-            }
-
-          /* edge_iter was already advanced above */
         }
 
-      ret = g_list_concat (new_strut_edges, ret);
-      strut_rect_iter = strut_rect_iter->next;
+      if (any_removed)
+        {
+          edge_array_squeeze (&edges);
+          edge_array_append_array (&edges, &splits);
+        }
+      edge_array_append_array (&edges, &strut_edges);
     }
 
   /* Sort the list */
-  ret = g_list_sort (ret, meta_rectangle_edge_cmp);
+  ret = edge_array_to_sorted_list (&edges);
 
-  /* Free the fixed struts list */
-  meta_rectangle_free_list_and_elements (fixed_strut_rects);
+  rect_array_clear (&fixed_strut_rects);
+  edge_array_clear (&edges);
+  edge_array_clear (&strut_edges);
+  edge_array_clear (&splits);
 
   return ret;
 }
@@ -1867,11 +2105,12 @@ meta_rectangle_find_nonintersected_monitor_edges (
    * immediately on the other side"; monitor edges are different.
    */
   GList *ret;
+  EdgeArray edges;
   const GList  *cur;
   GSList *temp_rects;
 
-  /* Initialize the return list to be empty */
-  ret = NULL;
+  /* Initialize the edge list to be empty */
+  edge_array_init (&edges);
 
   /* start of ret with all the edges of monitors that are adjacent to
    * another monitor.
@@ -1918,13 +2157,13 @@ meta_rectangle_find_nonintersected_monitor_edges (
                    * a right edge for the monitor on the left.  Just fill
                    * up the edges and stick 'em on the list.
                    */
-                  MetaEdge *new_edge  = g_new (MetaEdge, 1);
+                  MetaEdge new_edge;
 
-                  new_edge->rect = meta_rect (x, y, width, height);
-                  new_edge->side_type = side_type;
-                  new_edge->edge_type = META_EDGE_MONITOR;
+                  new_edge.rect = meta_rect (x, y, width, height);
+                  new_edge.side_type = side_type;
+                  new_edge.edge_type = META_EDGE_MONITOR;
 
-                  ret = g_list_prepend (ret, new_edge);
+                  edge_array_append (&edges, &new_edge);
                 }
             }
 
@@ -1961,13 +2200,13 @@ meta_rectangle_find_nonintersected_monitor_edges (
                    * a bottom edge for the monitor on the top.  Just fill
                    * up the edges and stick 'em on the list.
                    */
-                  MetaEdge *new_edge = g_new (MetaEdge, 1);
+                  MetaEdge new_edge;
 
-                  new_edge->rect = meta_rect (x, y, width, height);
-                  new_edge->side_type = side_type;
-                  new_edge->edge_type = META_EDGE_MONITOR;
+                  new_edge.rect = meta_rect (x, y, width, height);
+                  new_edge.side_type = side_type;
+                  new_edge.edge_type = META_EDGE_MONITOR;
 
-                  ret = g_list_prepend (ret, new_edge);
+                  edge_array_append (&edges, &new_edge);
                 }
             }
 
@@ -1980,12 +2219,12 @@ meta_rectangle_find_nonintersected_monitor_edges (
   for (; all_struts; all_struts = all_struts->next)
     temp_rects = g_slist_prepend (temp_rects,
                                   &((MetaStrut*)all_struts->data)->rect);
-  ret = meta_rectangle_remove_intersections_with_boxes_from_edges (ret, 
-                                                                   temp_rects);
+  remove_intersections_with_boxes (&edges, temp_rects);
   g_slist_free (temp_rects);
 
   /* Sort the list */
-  ret = g_list_sort (ret, meta_rectangle_edge_cmp);
+  ret = edge_array_to_sorted_list (&edges);
+  edge_array_clear (&edges);
 
   return ret;
 }
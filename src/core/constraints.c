@@ -31,6 +31,7 @@
 #include <meta/prefs.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #if 0
@@ -277,6 +278,175 @@ do_all_constraints (MetaWindow         *window,
   return TRUE;
 }
 
+/* A window's last few meta_window_constrain() results, so that asking
+ * for the same geometry again doesn't run all the constraints again;
+ * that happens a lot while a move or resize is held against an edge or
+ * a size limit, and when everything gets re-constrained after a strut
+ * or monitor change that didn't really affect the window.
+ *
+ * The key is everything the constraints look at: the ConstraintInfo,
+ * the generations of the work areas and monitors its regions come from,
+ * and the few bits of window state the constraints read.  Windows which
+ * make the constraints look at more than that (maximized, tiled or
+ * fullscreen ones, attached dialogs and windows still to be placed)
+ * never use the memo.
+ */
+#define N_MEMO_ENTRIES 4
+
+typedef struct
+{
+  MetaRectangle        orig;
+  MetaRectangle        current;
+  MetaFrameBorders     borders;
+  ActionType           action_type;
+  gboolean             is_user_action;
+  int                  resize_gravity;
+  FixedDirections      fixed_directions;
+  MetaRectangle        work_area_monitor;
+  MetaRectangle        entire_monitor;
+  GList               *usable_screen_region;
+  GList               *usable_monitor_region;
+  guint                work_area_generation;
+  guint                monitor_generation;
+
+  XSizeHints           size_hints;
+  MetaWindowType       type;
+  guint                requirements;
+  gboolean             has_frame;
+  gboolean             decorated;
+  gboolean             grab_frame_action;
+} MemoKey;
+
+typedef struct
+{
+  MemoKey              key;
+  MetaRectangle        result;
+  guint                requirements;
+} MemoEntry;
+
+struct _MetaConstraintMemo
+{
+  MemoEntry entries[N_MEMO_ENTRIES];
+  int       n_entries;
+  int       next;
+};
+
+static gboolean memo_enabled = TRUE;
+
+void
+meta_constraints_set_memo_enabled (gboolean enabled)
+{
+  memo_enabled = enabled;
+}
+
+#define REQUIRE_FULLY_ONSCREEN    (1 << 0)
+#define REQUIRE_ON_SINGLE_MONITOR (1 << 1)
+#define REQUIRE_TITLEBAR_VISIBLE  (1 << 2)
+
+static gboolean
+window_can_use_memo (MetaWindow *window)
+{
+  return window->placed &&
+         !window->maximized_horizontally &&
+         !window->maximized_vertically &&
+         !window->fullscreen &&
+         !window->attached &&
+         !window->maximize_horizontally_after_placement &&
+         !window->maximize_vertically_after_placement &&
+         !window->fullscreen_after_placement &&
+         !window->minimize_after_placement;
+}
+
+static guint
+get_requirements (MetaWindow *window)
+{
+  return (window->require_fully_onscreen ? REQUIRE_FULLY_ONSCREEN : 0) |
+         (window->require_on_single_monitor ? REQUIRE_ON_SINGLE_MONITOR : 0) |
+         (window->require_titlebar_visible ? REQUIRE_TITLEBAR_VISIBLE : 0);
+}
+
+static void
+set_requirements (MetaWindow *window,
+                  guint       requirements)
+{
+  window->require_fully_onscreen =
+    (requirements & REQUIRE_FULLY_ONSCREEN) != 0;
+  window->require_on_single_monitor =
+    (requirements & REQUIRE_ON_SINGLE_MONITOR) != 0;
+  window->require_titlebar_visible =
+    (requirements & REQUIRE_TITLEBAR_VISIBLE) != 0;
+}
+
+static void
+fill_memo_key (MemoKey              *key,
+               MetaWindow           *window,
+               const ConstraintInfo *info)
+{
+  /* The keys are compared with memcmp(), so clear the padding too */
+  memset (key, 0, sizeof (MemoKey));
+
+  key->orig                  = info->orig;
+  key->current               = info->current;
+  key->borders               = *info->borders;
+  key->action_type           = info->action_type;
+  key->is_user_action        = info->is_user_action;
+  key->resize_gravity        = info->resize_gravity;
+  key->fixed_directions      = info->fixed_directions;
+  key->work_area_monitor     = info->work_area_monitor;
+  key->entire_monitor        = info->entire_monitor;
+  key->usable_screen_region  = info->usable_screen_region;
+  key->usable_monitor_region = info->usable_monitor_region;
+  key->work_area_generation  = window->screen->work_area_generation;
+  key->monitor_generation    = window->screen->monitor_generation;
+
+  key->size_hints            = window->size_hints;
+  key->type                  = window->type;
+  key->requirements          = get_requirements (window);
+  key->has_frame             = window->frame != NULL;
+  key->decorated             = window->decorated;
+  key->grab_frame_action     = window->display->grab_frame_action;
+}
+
+static const MemoEntry*
+lookup_memo (MetaWindow    *window,
+             const MemoKey *key)
+{
+  MetaConstraintMemo *memo = window->constraint_memo;
+  int i;
+
+  if (memo == NULL)
+    return NULL;
+
+  for (i = 0; i < memo->n_entries; i++)
+    if (memcmp (&memo->entries[i].key, key, sizeof (MemoKey)) == 0)
+      return &memo->entries[i];
+
+  return NULL;
+}
+
+static void
+add_to_memo (MetaWindow          *window,
+             const MemoKey       *key,
+             const MetaRectangle *result)
+{
+  MetaConstraintMemo *memo;
+  MemoEntry *entry;
+
+  if (window->constraint_memo == NULL)
+    window->constraint_memo = g_new0 (MetaConstraintMemo, 1);
+  memo = window->constraint_memo;
+
+  /* Replace the oldest entry once they're all in use */
+  entry = &memo->entries[memo->next];
+  memo->next = (memo->next + 1) % N_MEMO_ENTRIES;
+  if (memo->n_entries < N_MEMO_ENTRIES)
+    memo->n_entries++;
+
+  entry->key = *key;
+  entry->result = *result;
+  entry->requirements = get_requirements (window);
+}
+
 void
 meta_window_constrain (MetaWindow          *window,
                        MetaFrameBorders    *orig_borders,
@@ -288,6 +458,8 @@ meta_window_constrain (MetaWindow          *window,
   ConstraintInfo info;
   ConstraintPriority priority = PRIORITY_MINIMUM;
   gboolean satisfied = FALSE;
+  gboolean use_memo;
+  MemoKey key;
 
   /* WARNING: orig and new specify positions and sizes of the inner window,
    * not the outer.  This is a common gotcha since half the constraints
@@ -309,6 +481,35 @@ meta_window_constrain (MetaWindow          *window,
                          new);
   place_window_if_needed (window, &info);
 
+  use_memo = memo_enabled && window_can_use_memo (window);
+  if (use_memo)
+    {
+      const MemoEntry *entry;
+
+      fill_memo_key (&key, window, &info);
+      entry = lookup_memo (window, &key);
+      if (entry)
+        {
+          meta_topic (META_DEBUG_GEOMETRY,
+                      "Reusing earlier constraint result %d,%d +%d,%d\n",
+                      entry->result.x, entry->result.y,
+                      entry->result.width, entry->result.height);
+
+          *new = entry->result;
+          set_requirements (window, entry->requirements);
+
+          if (!orig_borders)
+            g_free (info.borders);
+          return;
+        }
+    }
+
+  /* Most of the time nothing needs to be done at all, so check that
+   * first.  If every constraint is already satisfied, enforcing them
+   * below would leave info.current alone anyway.
+   */
+  satisfied = do_all_constraints (window, &info, PRIORITY_MINIMUM, TRUE);
+
   while (!satisfied && priority <= PRIORITY_MAXIMUM) {
     gboolean check_only = TRUE;
 
@@ -333,6 +534,9 @@ meta_window_constrain (MetaWindow          *window,
    */
   update_onscreen_requirements (window, &info);
 
+  if (use_memo)
+    add_to_memo (window, &key, &info.current);
+
   /* Ew, what an ugly way to do things.  Destructors (in a real OOP language,
    * not gobject-style--gobject would be more pain than it's worth) or
    * smart pointers would be so much nicer here.  *shrug*
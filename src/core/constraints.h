@@ -45,4 +45,7 @@ void meta_window_constrain (MetaWindow          *window,
                             const MetaRectangle *orig,
                             MetaRectangle       *new);
 
+/* For testconstraints, to compare results with and without the memo */
+void meta_constraints_set_memo_enabled (gboolean enabled);
+
 #endif /* META_CONSTRAINTS_H */
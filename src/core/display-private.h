@@ -34,6 +34,7 @@
 #include <glib.h>
 #include <X11/Xlib.h>
 #include "eventqueue.h"
+#include "xid-map.h"
 #include <meta/common.h>
 #include <meta/boxes.h>
 #include <meta/display.h>
@@ -53,8 +54,10 @@ typedef struct _MetaUISlave    MetaUISlave;
 
 typedef struct _MetaGroupPropHooks  MetaGroupPropHooks;
 typedef struct _MetaWindowPropHooks MetaWindowPropHooks;
+typedef struct _MetaPropCache       MetaPropCache;
 
 typedef struct MetaEdgeResistanceData MetaEdgeResistanceData;
+typedef struct MetaEdgeCache MetaEdgeCache;
 
 typedef void (* MetaWindowPingFunc) (MetaDisplay *display,
 				     Window       xwindow,
@@ -145,7 +148,7 @@ struct _MetaDisplay
   MetaEventQueue *events;
   GSList *screens;
   MetaScreen *active_screen;
-  GHashTable *window_ids;
+  MetaXidMap *window_ids;
   int error_traps;
   int (* error_trap_handler) (Display     *display,
                               XErrorEvent *error);  
@@ -207,6 +210,7 @@ struct _MetaDisplay
   guint32     grab_motion_notify_time;
   GList*      grab_old_window_stacking;
   MetaEdgeResistanceData *grab_edge_resistance_data;
+  MetaEdgeCache *grab_edge_cache;
   unsigned int grab_last_user_action_was_snap;
 
   /* we use property updates as sentinels for certain window focus events
@@ -227,6 +231,16 @@ struct _MetaDisplay
   /* Keybindings stuff */
   MetaKeyBinding *key_bindings;
   int             n_key_bindings;
+  MetaKeyBindingIndex key_binding_index;
+  /* Passive grabs held by every root window and every client or frame
+   * window that has keys_grabbed set; see regrab_key_bindings()
+   */
+  GArray *screen_key_grabs;
+  GArray *window_key_grabs;
+  /* Grab per-window bindings once on the root window and hand them to
+   * the focus window, instead of grabbing them on every window
+   */
+  guint key_grabs_on_root_only : 1;
   int             min_keycode;
   int             max_keycode;
   KeySym *keymap;
@@ -266,6 +280,9 @@ struct _MetaDisplay
   /* Managed by group-props.c */
   MetaGroupPropHooks *group_prop_hooks;
 
+  /* Managed by xprops.c */
+  MetaPropCache *prop_cache;
+
   /* Managed by compositor.c */
   MetaCompositor *compositor;
 
@@ -395,8 +412,9 @@ void meta_display_grab_focus_window_button   (MetaDisplay *display,
 void meta_display_ungrab_focus_window_button (MetaDisplay *display,
                                               MetaWindow  *window);
 
-/* Next function is defined in edge-resistance.c */
+/* Next functions are defined in edge-resistance.c */
 void meta_display_cleanup_edges              (MetaDisplay *display);
+void meta_display_free_edge_cache            (MetaDisplay *display);
 
 /* make a request to ensure the event serial has changed */
 void     meta_display_increment_event_serial (MetaDisplay *display);
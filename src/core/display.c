@@ -504,6 +504,7 @@ meta_display_open (void)
   the_display->monitor_cache_invalidated = TRUE;
 
   the_display->groups_by_leader = NULL;
+  the_display->prop_cache = NULL;
 
   the_display->window_with_menu = NULL;
   the_display->window_menu = NULL;
@@ -524,8 +525,7 @@ meta_display_open (void)
                           event_callback,
                           the_display);
   
-  the_display->window_ids = g_hash_table_new (meta_unsigned_long_hash,
-                                          meta_unsigned_long_equal);
+  the_display->window_ids = meta_xid_map_new ();
   
   i = 0;
   while (i < N_IGNORED_CROSSING_SERIALS)
@@ -553,6 +553,7 @@ meta_display_open (void)
   the_display->grab_tile_monitor_number = -1;
 
   the_display->grab_edge_resistance_data = NULL;
+  the_display->grab_edge_cache = NULL;
 
 #ifdef HAVE_XSYNC
   {
@@ -878,17 +879,6 @@ meta_display_open (void)
   return TRUE;
 }
 
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
-{
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
-}
-
 /**
  * meta_display_list_windows:
  * @display: a #MetaDisplay
@@ -905,59 +895,29 @@ meta_display_list_windows (MetaDisplay          *display,
                            MetaListWindowsFlags  flags)
 {
   GSList *winlist;
-  GSList *tmp;
-  GSList *prev;
-  GHashTableIter iter;
-  gpointer key, value;
+  MetaXidMapIter iter;
+  XID xid;
+  gpointer value;
 
   winlist = NULL;
 
-  g_hash_table_iter_init (&iter, display->window_ids);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  /* Frames and user time windows map to their MetaWindow too, so
+   * only take the entry for the client window itself; that way each
+   * window is listed exactly once.
+   */
+  meta_xid_map_iter_init (&iter, display->window_ids);
+  while (meta_xid_map_iter_next (&iter, &xid, &value))
     {
       MetaWindow *window = value;
 
+      if (xid != window->xwindow)
+        continue;
+
       if (!window->override_redirect ||
           (flags & META_LIST_INCLUDE_OVERRIDE_REDIRECT) != 0)
         winlist = g_slist_prepend (winlist, window);
     }
 
-  /* Uniquify the list, since both frame windows and plain
-   * windows are in the hash
-   */
-  winlist = g_slist_sort (winlist, ptrcmp);
-
-  prev = NULL;
-  tmp = winlist;
-  while (tmp != NULL)
-    {
-      GSList *next;
-
-      next = tmp->next;
-      
-      if (next &&
-          next->data == tmp->data)
-        {
-          /* Delete tmp from list */
-
-          if (prev)
-            prev->next = next;
-
-          if (tmp == winlist)
-            winlist = next;
-          
-          g_slist_free_1 (tmp);
-
-          /* leave prev unchanged */
-        }
-      else
-        {
-          prev = tmp;
-        }
-      
-      tmp = next;
-    }
-
   return winlist;
 }
 
@@ -1015,7 +975,11 @@ meta_display_close (MetaDisplay *display,
   /* Must be after all calls to meta_window_unmanage() since they
    * unregister windows
    */
-  g_hash_table_destroy (display->window_ids);
+  meta_xid_map_free (display->window_ids);
+
+  meta_prop_cache_free (display);
+
+  meta_display_free_edge_cache (display);
 
   if (display->leader_window != None)
     XDestroyWindow (display->xdisplay, display->leader_window);
@@ -1605,6 +1569,12 @@ event_callback (XEvent   *event,
   display->monitor_cache_invalidated = TRUE;
   
   modified = event_get_modified_window (display, event);
+
+  /* Before anything gets a chance to read the new value */
+  if (event->type == PropertyNotify)
+    meta_prop_cache_invalidate (display,
+                                event->xproperty.window,
+                                event->xproperty.atom);
   
   if (event->type == UnmapNotify)
     {
@@ -3246,7 +3216,7 @@ MetaWindow*
 meta_display_lookup_x_window (MetaDisplay *display,
                               Window       xwindow)
 {
-  return g_hash_table_lookup (display->window_ids, &xwindow);
+  return meta_xid_map_lookup (display->window_ids, xwindow);
 }
 
 void
@@ -3254,18 +3224,23 @@ meta_display_register_x_window (MetaDisplay *display,
                                 Window      *xwindowp,
                                 MetaWindow  *window)
 {
-  g_return_if_fail (g_hash_table_lookup (display->window_ids, xwindowp) == NULL);
+  g_return_if_fail (meta_xid_map_lookup (display->window_ids, *xwindowp) == NULL);
   
-  g_hash_table_insert (display->window_ids, xwindowp, window);
+  meta_xid_map_insert (display->window_ids, *xwindowp, window);
 }
 
 void
 meta_display_unregister_x_window (MetaDisplay *display,
                                   Window       xwindow)
 {
-  g_return_if_fail (g_hash_table_lookup (display->window_ids, &xwindow) != NULL);
+  g_return_if_fail (meta_xid_map_lookup (display->window_ids, xwindow) != NULL);
 
-  g_hash_table_remove (display->window_ids, &xwindow);
+  meta_xid_map_remove (display->window_ids, xwindow);
+
+  /* We won't hear about property changes anymore, and the XID
+   * may get reused.
+   */
+  meta_prop_cache_forget_window (display, xwindow);
 
   /* Remove any pending pings */
   remove_pending_pings_for_window (display, xwindow);
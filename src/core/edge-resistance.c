@@ -27,6 +27,8 @@
 #include "display-private.h"
 #include "workspace-private.h"
 
+#include <string.h>
+
 /* A simple macro for whether a given window's edges are potentially
  * relevant for resistance/snapping during a move/resize operation
  */
@@ -50,12 +52,59 @@ struct ResistanceDataForAnEdge
 };
 typedef struct ResistanceDataForAnEdge ResistanceDataForAnEdge;
 
+/* Edges sorted by position, plus a binary tree over them in which each
+ * node holds the span along the other axis covered by the edges below
+ * it.  Looking for the nearest edge that lines up with a window can then
+ * skip whole runs of edges that can't, instead of checking each one.
+ */
+struct MetaEdgeIndex
+{
+  GArray *edges;
+  int     n_leaves;
+  int    *span_start;
+  int    *span_end;
+};
+typedef struct MetaEdgeIndex MetaEdgeIndex;
+
+/* A window whose edges are relevant to the grab op */
+struct EdgeSourceWindow
+{
+  MetaRectangle rect;
+  gboolean      is_dock;
+};
+typedef struct EdgeSourceWindow EdgeSourceWindow;
+
+/* The edges found for the last move/resize, kept across grab ops along
+ * with what they were computed from; starting another grab op with
+ * nothing changed can then use them as they are.
+ */
+struct MetaEdgeCache
+{
+  /* The windows with relevant edges, bottom to top */
+  GArray        *windows;
+  MetaRectangle  screen_rect;
+
+  /* Visible portions of the windows' edges, and copies of the
+   * workspace's monitor and screen edges; all owned by the cache.
+   */
+  GList         *window_edges;
+  GList         *monitor_edges;
+  GList         *screen_edges;
+
+  /* Left and right edges, then top and bottom ones */
+  MetaEdgeIndex  vertical;
+  MetaEdgeIndex  horizontal;
+};
+
 struct MetaEdgeResistanceData
 {
+  /* These all belong to display->grab_edge_cache */
   GArray *left_edges;
   GArray *right_edges;
   GArray *top_edges;
   GArray *bottom_edges;
+  const MetaEdgeIndex *vertical_index;
+  const MetaEdgeIndex *horizontal_index;
 
   ResistanceDataForAnEdge left_data;
   ResistanceDataForAnEdge right_data;
@@ -177,8 +226,53 @@ points_on_same_side (int ref, int pt1, int pt2)
   return (pt1 - ref) * (pt2 - ref) > 0;
 }
 
+/* Returns the first (or if last is TRUE, the last) index in [lo, hi]
+ * of an edge overlapping [start, end) along the other axis, or -1.
+ */
 static int
-find_nearest_position (const GArray        *edges,
+edge_index_find (const MetaEdgeIndex *index,
+                 int                  node,
+                 int                  node_lo,
+                 int                  node_hi,
+                 int                  lo,
+                 int                  hi,
+                 int                  start,
+                 int                  end,
+                 gboolean             last)
+{
+  int node_mid, found;
+
+  if (hi < node_lo || node_hi < lo ||
+      index->span_start[node] >= end ||
+      index->span_end[node] <= start)
+    return -1;
+
+  if (node_lo == node_hi)
+    return node_lo;
+
+  node_mid = node_lo + (node_hi - node_lo) / 2;
+  if (last)
+    {
+      found = edge_index_find (index, 2 * node + 1, node_mid + 1, node_hi,
+                               lo, hi, start, end, last);
+      if (found < 0)
+        found = edge_index_find (index, 2 * node, node_lo, node_mid,
+                                 lo, hi, start, end, last);
+    }
+  else
+    {
+      found = edge_index_find (index, 2 * node, node_lo, node_mid,
+                               lo, hi, start, end, last);
+      if (found < 0)
+        found = edge_index_find (index, 2 * node + 1, node_mid + 1, node_hi,
+                                 lo, hi, start, end, last);
+    }
+
+  return found;
+}
+
+static int
+find_nearest_position (const MetaEdgeIndex *index,
                        int                  position,
                        int                  old_position,
                        const MetaRectangle *new_rect,
@@ -190,10 +284,12 @@ find_nearest_position (const GArray        *edges,
    * actual value.  Also, we ignore any edges that aren't relevant
    * given the horizontal/vertical position of new_rect.
    */
+  const GArray *edges = index->edges;
   int low, high, mid;
   int compare;
   MetaEdge *edge;
   int best, best_dist, i;
+  int start, end;
   gboolean edges_align;
 
   /* Initialize mid, edge, & compare in the off change that the array only
@@ -243,51 +339,52 @@ find_nearest_position (const GArray        *edges,
         }
     }
 
-  /* Now start searching higher than mid */
-  for (i = mid + 1; i < (int)edges->len; i++)
+  /* Edges on the same side of position as old_position don't count
+   * if only_forward; since the edges are sorted, that leaves a range.
+   */
+  low  = 0;
+  high = edges->len - 1;
+  if (only_forward && old_position > position)
+    high = find_index_of_edge_near_position (edges, position, FALSE, horizontal);
+  else if (only_forward && old_position < position)
+    low = find_index_of_edge_near_position (edges, position, TRUE, horizontal);
+
+  if (horizontal)
+    {
+      start = new_rect->y;
+      end   = new_rect->y + new_rect->height;
+    }
+  else
+    {
+      start = new_rect->x;
+      end   = new_rect->x + new_rect->width;
+    }
+
+  /* Now find the nearest overlapping edge higher than mid... */
+  i = edge_index_find (index, 1, 0, index->n_leaves - 1,
+                       MAX (low, mid + 1), high, start, end, FALSE);
+  if (i >= 0)
     {
       edge = g_array_index (edges, MetaEdge*, i);
       compare = horizontal ? edge->rect.x : edge->rect.y;
-  
-      edges_align = horizontal ? 
-        meta_rectangle_vert_overlap (&edge->rect, new_rect) :
-        meta_rectangle_horiz_overlap (&edge->rect, new_rect);
-
-      if (edges_align &&
-          (!only_forward ||
-           !points_on_same_side (position, compare, old_position)))
+      if (ABS (compare - position) < best_dist)
         {
-          int dist = ABS (compare - position);
-          if (dist < best_dist)
-            {
-              best = compare;
-              best_dist = dist;
-            }
-          break;
+          best = compare;
+          best_dist = ABS (compare - position);
         }
     }
 
-  /* Now start searching lower than mid */
-  for (i = mid-1; i >= 0; i--)
+  /* ...and lower than mid */
+  i = edge_index_find (index, 1, 0, index->n_leaves - 1,
+                       low, MIN (high, mid - 1), start, end, TRUE);
+  if (i >= 0)
     {
       edge = g_array_index (edges, MetaEdge*, i);
       compare = horizontal ? edge->rect.x : edge->rect.y;
-  
-      edges_align = horizontal ? 
-        meta_rectangle_vert_overlap (&edge->rect, new_rect) :
-        meta_rectangle_horiz_overlap (&edge->rect, new_rect);
-
-      if (edges_align &&
-          (!only_forward ||
-           !points_on_same_side (position, compare, old_position)))
+      if (ABS (compare - position) < best_dist)
         {
-          int dist = ABS (compare - position);
-          if (dist < best_dist)
-            {
-              best = compare;
-              best_dist = dist;
-            }
-          break;
+          best = compare;
+          best_dist = ABS (compare - position);
         }
     }
 
@@ -499,7 +596,7 @@ static int
 apply_edge_snapping (int                  old_pos,
                      int                  new_pos,
                      const MetaRectangle *new_rect,
-                     GArray              *edges,
+                     const MetaEdgeIndex *edges,
                      gboolean             xdir,
                      gboolean             keyboard_op)
 {
@@ -567,28 +664,28 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
       new_left   = apply_edge_snapping (BOX_LEFT (*old_outer),
                                         BOX_LEFT (*new_outer),
                                         new_outer,
-                                        edge_data->left_edges,
+                                        edge_data->vertical_index,
                                         TRUE,
                                         keyboard_op);
 
       new_right  = apply_edge_snapping (BOX_RIGHT (*old_outer),
                                         BOX_RIGHT (*new_outer),
                                         new_outer,
-                                        edge_data->right_edges,
+                                        edge_data->vertical_index,
                                         TRUE,
                                         keyboard_op);
 
       new_top    = apply_edge_snapping (BOX_TOP (*old_outer),
                                         BOX_TOP (*new_outer),
                                         new_outer,
-                                        edge_data->top_edges,
+                                        edge_data->horizontal_index,
                                         FALSE,
                                         keyboard_op);
 
       new_bottom = apply_edge_snapping (BOX_BOTTOM (*old_outer),
                                         BOX_BOTTOM (*new_outer),
                                         new_outer,
-                                        edge_data->bottom_edges,
+                                        edge_data->horizontal_index,
                                         FALSE,
                                         keyboard_op);
     }
@@ -671,70 +768,15 @@ apply_edge_resistance_to_each_side (MetaDisplay         *display,
 void
 meta_display_cleanup_edges (MetaDisplay *display)
 {
-  guint i,j;
   MetaEdgeResistanceData *edge_data = display->grab_edge_resistance_data;
-  GHashTable *edges_to_be_freed;
 
   if (edge_data == NULL) /* Not currently cached */
     return;
 
-  /* We first need to clean out any window edges */
-  edges_to_be_freed = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                             g_free, NULL);
-  for (i = 0; i < 4; i++)
-    {
-      GArray *tmp = NULL;
-      MetaSide side;
-      switch (i)
-        {
-        case 0:
-          tmp = edge_data->left_edges;
-          side = META_SIDE_LEFT;
-          break;
-        case 1:
-          tmp = edge_data->right_edges;
-          side = META_SIDE_RIGHT;
-          break;
-        case 2:
-          tmp = edge_data->top_edges;
-          side = META_SIDE_TOP;
-          break;
-        case 3:
-          tmp = edge_data->bottom_edges;
-          side = META_SIDE_BOTTOM;
-          break;
-        default:
-          g_assert_not_reached ();
-        }
-
-      for (j = 0; j < tmp->len; j++)
-        {
-          MetaEdge *edge = g_array_index (tmp, MetaEdge*, j);
-          if (edge->edge_type == META_EDGE_WINDOW &&
-              edge->side_type == side)
-            {
-              /* The same edge will appear in two arrays, and we can't free
-               * it yet we still need to compare edge->side_type for the other
-               * array that it is in.  So store it in a hash table for later
-               * freeing.  Could also do this in a simple linked list.
-               */
-              g_hash_table_insert (edges_to_be_freed, edge, edge);
-            }
-        }
-    }
-
-  /* Now free all the window edges (the key destroy function is g_free) */
-  g_hash_table_destroy (edges_to_be_freed);
-
-  /* Now free the arrays and data */
-  g_array_free (edge_data->left_edges, TRUE);
-  g_array_free (edge_data->right_edges, TRUE);
-  g_array_free (edge_data->top_edges, TRUE);
-  g_array_free (edge_data->bottom_edges, TRUE);
-  edge_data->left_edges = NULL;
-  edge_data->right_edges = NULL;
-  edge_data->top_edges = NULL;
-  edge_data->bottom_edges = NULL;
+  /* The edges themselves stay in display->grab_edge_cache for the next
+   * grab op; copies of the workspace's edges are kept there rather than
+   * pointers, so nothing dangles if they change meanwhile.
+   */
 
   /* Cleanup the timeouts */
   if (edge_data->left_data.timeout_setup   &&
@@ -754,6 +796,119 @@ meta_display_cleanup_edges (MetaDisplay *display)
   display->grab_edge_resistance_data = NULL;
 }
 
+static void
+edge_index_init (MetaEdgeIndex *index,
+                 GArray        *edges)
+{
+  int i;
+
+  index->edges = edges;
+
+  index->n_leaves = 1;
+  while (index->n_leaves < (int) edges->len)
+    index->n_leaves *= 2;
+
+  index->span_start = g_new (int, 2 * index->n_leaves);
+  index->span_end   = g_new (int, 2 * index->n_leaves);
+
+  for (i = 0; i < index->n_leaves; i++)
+    {
+      int node = index->n_leaves + i;
+
+      if (i < (int) edges->len)
+        {
+          MetaEdge *edge = g_array_index (edges, MetaEdge*, i);
+
+          if (edge->side_type == META_SIDE_LEFT ||
+              edge->side_type == META_SIDE_RIGHT)
+            {
+              index->span_start[node] = BOX_TOP (edge->rect);
+              index->span_end[node]   = BOX_BOTTOM (edge->rect);
+            }
+          else
+            {
+              index->span_start[node] = BOX_LEFT (edge->rect);
+              index->span_end[node]   = BOX_RIGHT (edge->rect);
+            }
+        }
+      else
+        {
+          /* Padding that never overlaps anything */
+          index->span_start[node] = INT_MAX;
+          index->span_end[node]   = INT_MIN;
+        }
+    }
+
+  for (i = index->n_leaves - 1; i > 0; i--)
+    {
+      index->span_start[i] = MIN (index->span_start[2 * i],
+                                  index->span_start[2 * i + 1]);
+      index->span_end[i]   = MAX (index->span_end[2 * i],
+                                  index->span_end[2 * i + 1]);
+    }
+}
+
+static void
+edge_index_free (MetaEdgeIndex *index)
+{
+  g_array_free (index->edges, TRUE);
+  g_free (index->span_start);
+  g_free (index->span_end);
+}
+
+static void
+edge_cache_free (MetaEdgeCache *cache)
+{
+  edge_index_free (&cache->vertical);
+  edge_index_free (&cache->horizontal);
+
+  g_array_free (cache->windows, TRUE);
+  meta_rectangle_free_list_and_elements (cache->window_edges);
+  meta_rectangle_free_list_and_elements (cache->monitor_edges);
+  meta_rectangle_free_list_and_elements (cache->screen_edges);
+
+  g_free (cache);
+}
+
+void
+meta_display_free_edge_cache (MetaDisplay *display)
+{
+  meta_display_cleanup_edges (display);
+
+  if (display->grab_edge_cache)
+    edge_cache_free (display->grab_edge_cache);
+  display->grab_edge_cache = NULL;
+}
+
+static GList *
+copy_edges (const GList *edges)
+{
+  GList *copy = NULL;
+
+  for (; edges; edges = edges->next)
+    copy = g_list_prepend (copy, g_memdup (edges->data, sizeof (MetaEdge)));
+
+  return g_list_reverse (copy);
+}
+
+static gboolean
+edge_lists_equal (const GList *a,
+                  const GList *b)
+{
+  for (; a && b; a = a->next, b = b->next)
+    {
+      const MetaEdge *a_edge = a->data;
+      const MetaEdge *b_edge = b->data;
+
+      if (!meta_rectangle_equal (&a_edge->rect, &b_edge->rect) ||
+          a_edge->side_type != b_edge->side_type ||
+          a_edge->edge_type != b_edge->edge_type)
+        return FALSE;
+    }
+
+  return a == NULL && b == NULL;
+}
+
 static int
 stupid_sort_requiring_extra_pointer_dereference (gconstpointer a, 
                                                  gconstpointer b)
@@ -764,14 +919,11 @@ stupid_sort_requiring_extra_pointer_dereference (gconstpointer a,
 }
 
 static void
-cache_edges (MetaDisplay *display,
-             GList *window_edges,
-             GList *monitor_edges,
-             GList *screen_edges)
+cache_edges (MetaEdgeCache *cache)
 {
-  MetaEdgeResistanceData *edge_data;
+  GArray *vertical_edges, *horizontal_edges;
   GList *tmp;
-  int num_left, num_right, num_top, num_bottom;
+  int num_vertical, num_horizontal;
   int i;
 
   /*
@@ -780,20 +932,20 @@ cache_edges (MetaDisplay *display,
 #ifdef WITH_VERBOSE_MODE
   if (meta_is_verbose())
     {
-      int max_edges = MAX (MAX( g_list_length (window_edges), 
-                                g_list_length (monitor_edges)),
-                           g_list_length (screen_edges));
+      int max_edges = MAX (MAX( g_list_length (cache->window_edges), 
+                                g_list_length (cache->monitor_edges)),
+                           g_list_length (cache->screen_edges));
       char big_buffer[(EDGE_LENGTH+2)*max_edges];
 
-      meta_rectangle_edge_list_to_string (window_edges, ", ", big_buffer);
+      meta_rectangle_edge_list_to_string (cache->window_edges, ", ", big_buffer);
       meta_topic (META_DEBUG_EDGE_RESISTANCE,
                   "Window edges for resistance  : %s\n", big_buffer);
 
-      meta_rectangle_edge_list_to_string (monitor_edges, ", ", big_buffer);
+      meta_rectangle_edge_list_to_string (cache->monitor_edges, ", ", big_buffer);
       meta_topic (META_DEBUG_EDGE_RESISTANCE,
                   "Monitor edges for resistance: %s\n", big_buffer);
 
-      meta_rectangle_edge_list_to_string (screen_edges, ", ", big_buffer);
+      meta_rectangle_edge_list_to_string (cache->screen_edges, ", ", big_buffer);
       meta_topic (META_DEBUG_EDGE_RESISTANCE,
                   "Screen edges for resistance  : %s\n", big_buffer);
     }
@@ -802,20 +954,20 @@ cache_edges (MetaDisplay *display,
   /*
    * 1st: Get the total number of each kind of edge
    */
-  num_left = num_right = num_top = num_bottom = 0;
+  num_vertical = num_horizontal = 0;
   for (i = 0; i < 3; i++)
     {
       tmp = NULL;
       switch (i)
         {
         case 0:
-          tmp = window_edges;
+          tmp = cache->window_edges;
           break;
         case 1:
-          tmp = monitor_edges;
+          tmp = cache->monitor_edges;
           break;
         case 2:
-          tmp = screen_edges;
+          tmp = cache->screen_edges;
           break;
         default:
           g_assert_not_reached ();
@@ -827,16 +979,12 @@ cache_edges (MetaDisplay *display,
           switch (edge->side_type)
             {
             case META_SIDE_LEFT:
-              num_left++;
-              break;
             case META_SIDE_RIGHT:
-              num_right++;
+              num_vertical++;
               break;
             case META_SIDE_TOP:
-              num_top++;
-              break;
             case META_SIDE_BOTTOM:
-              num_bottom++;
+              num_horizontal++;
               break;
             default:
               g_assert_not_reached ();
@@ -848,25 +996,14 @@ cache_edges (MetaDisplay *display,
   /*
    * 2nd: Allocate the edges
    */
-  g_assert (display->grab_edge_resistance_data == NULL);
-  display->grab_edge_resistance_data = g_new0 (MetaEdgeResistanceData, 1);
-  edge_data = display->grab_edge_resistance_data;
-  edge_data->left_edges   = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_left + num_right);
-  edge_data->right_edges  = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_left + num_right);
-  edge_data->top_edges    = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_top + num_bottom);
-  edge_data->bottom_edges = g_array_sized_new (FALSE,
-                                               FALSE,
-                                               sizeof(MetaEdge*),
-                                               num_top + num_bottom);
+  vertical_edges   = g_array_sized_new (FALSE,
+                                        FALSE,
+                                        sizeof(MetaEdge*),
+                                        num_vertical);
+  horizontal_edges = g_array_sized_new (FALSE,
+                                        FALSE,
+                                        sizeof(MetaEdge*),
+                                        num_horizontal);
 
   /*
    * 3rd: Add the edges to the arrays
@@ -877,13 +1014,13 @@ cache_edges (MetaDisplay *display,
       switch (i)
         {
         case 0:
-          tmp = window_edges;
+          tmp = cache->window_edges;
           break;
         case 1:
-          tmp = monitor_edges;
+          tmp = cache->monitor_edges;
           break;
         case 2:
-          tmp = screen_edges;
+          tmp = cache->screen_edges;
           break;
         default:
           g_assert_not_reached ();
@@ -896,13 +1033,11 @@ cache_edges (MetaDisplay *display,
             {
             case META_SIDE_LEFT:
             case META_SIDE_RIGHT:
-              g_array_append_val (edge_data->left_edges, edge);
-              g_array_append_val (edge_data->right_edges, edge);
+              g_array_append_val (vertical_edges, edge);
               break;
             case META_SIDE_TOP:
             case META_SIDE_BOTTOM:
-              g_array_append_val (edge_data->top_edges, edge);
-              g_array_append_val (edge_data->bottom_edges, edge);
+              g_array_append_val (horizontal_edges, edge);
               break;
             default:
               g_assert_not_reached ();
@@ -917,14 +1052,16 @@ cache_edges (MetaDisplay *display,
    * avoided this sort by sticking them into the array with some simple
    * merging of the lists).
    */
-  g_array_sort (display->grab_edge_resistance_data->left_edges, 
-                stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->right_edges, 
-                stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->top_edges, 
+  g_array_sort (vertical_edges, 
                 stupid_sort_requiring_extra_pointer_dereference);
-  g_array_sort (display->grab_edge_resistance_data->bottom_edges, 
+  g_array_sort (horizontal_edges, 
                 stupid_sort_requiring_extra_pointer_dereference);
+
+  /*
+   * 5th: Index them for snapping
+   */
+  edge_index_init (&cache->vertical, vertical_edges);
+  edge_index_init (&cache->horizontal, horizontal_edges);
 }
 
 static void
@@ -943,81 +1080,46 @@ initialize_grab_edge_resistance_data (MetaDisplay *display)
   edge_data->bottom_data.keyboard_buildup = 0;
 }
 
-static void
-compute_resistance_and_snapping_edges (MetaDisplay *display)
+static GList *
+compute_window_edges (MetaDisplay *display,
+                      GArray      *windows)
 {
-  GList *stacked_windows;
-  GList *cur_window_iter;
+  GSList *obscuring_windows;
+  GSList *rem_windows;
   GList *edges;
-  /* Lists of window positions (rects) and their relative stacking positions */
-  int stack_position;
-  GSList *obscuring_windows, *window_stacking;
-  /* The portions of the above lists that still remain at the stacking position
-   * in the layer that we are working on
-   */
-  GSList *rem_windows, *rem_win_stacking;
-
-  g_assert (display->grab_window != NULL);
-  meta_topic (META_DEBUG_WINDOW_OPS,
-              "Computing edges to resist-movement or snap-to for %s.\n",
-              display->grab_window->desc);
-
-  /*
-   * 1st: Get the list of relevant windows, from bottom to top
-   */
-  stacked_windows = 
-    meta_stack_list_windows (display->grab_screen->stack,
-                             display->grab_screen->active_workspace);
+  int i;
 
   /*
-   * 2nd: we need to separate that stacked list into a list of windows that
-   * can obscure other edges.  To make sure we only have windows obscuring
-   * those below it instead of going both ways, we also need to keep a
-   * counter list.  Messy, I know.
+   * 1st: get a list of the rectangles of the windows, from bottom to top,
+   * which can obscure edges of the ones below them.
    */
-  obscuring_windows = window_stacking = NULL;
-  cur_window_iter = stacked_windows;
-  stack_position = 0;
-  while (cur_window_iter != NULL)
-    {
-      MetaWindow *cur_window = cur_window_iter->data;
-      if (WINDOW_EDGES_RELEVANT (cur_window, display))
-        {
-          MetaRectangle *new_rect;
-          new_rect = g_new (MetaRectangle, 1);
-          meta_window_get_outer_rect (cur_window, new_rect);
-          obscuring_windows = g_slist_prepend (obscuring_windows, new_rect);
-          window_stacking = 
-            g_slist_prepend (window_stacking, GINT_TO_POINTER (stack_position));
-        }
-
-      stack_position++;
-      cur_window_iter = cur_window_iter->next;
-    }
-  /* Put 'em in bottom to top order */
-  rem_windows = obscuring_windows = g_slist_reverse (obscuring_windows);
-  rem_win_stacking = window_stacking = g_slist_reverse (window_stacking);
+  obscuring_windows = NULL;
+  for (i = windows->len - 1; i >= 0; i--)
+    obscuring_windows =
+      g_slist_prepend (obscuring_windows,
+                       &g_array_index (windows, EdgeSourceWindow, i).rect);
 
   /*
-   * 3rd: loop over the windows again, this time getting the edges from
+   * 2nd: loop over the windows again, this time getting the edges from
    * them and removing intersections with the relevant obscuring_windows &
    * obscuring_docks.
    */
   edges = NULL;
-  stack_position = 0;
-  cur_window_iter = stacked_windows;
-  while (cur_window_iter != NULL)
+  rem_windows = obscuring_windows;
+  for (i = 0; i < (int) windows->len; i++)
     {
-      MetaRectangle  cur_rect;
-      MetaWindow    *cur_window = cur_window_iter->data;
-      meta_window_get_outer_rect (cur_window, &cur_rect);
+      EdgeSourceWindow *cur_window = &g_array_index (windows, EdgeSourceWindow, i);
+
+      /* The remaining windows are only those at a higher stacking
+       * position than this one.
+       */
+      rem_windows = rem_windows->next;
 
       /* Check if we want to use this window's edges for edge
        * resistance (note that dock edges are considered screen edges
        * which are handled separately
        */
-      if (WINDOW_EDGES_RELEVANT (cur_window, display) &&
-          cur_window->type != META_WINDOW_DOCK)
+      if (!cur_window->is_dock)
         {
           GList *new_edges;
           MetaEdge *new_edge;
@@ -1027,7 +1129,7 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
            * is offscreen (we also don't care about parts of edges covered
            * by other windows or DOCKS, but that's handled below).
            */
-          meta_rectangle_intersect (&cur_rect, 
+          meta_rectangle_intersect (&cur_window->rect, 
                                     &display->grab_screen->rect,
                                     &reduced);
 
@@ -1075,16 +1177,6 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
           new_edge->edge_type = META_EDGE_WINDOW;
           new_edges = g_list_prepend (new_edges, new_edge);
 
-          /* Update the remaining windows to only those at a higher
-           * stacking position than this one.
-           */
-          while (rem_win_stacking && 
-                 stack_position >= GPOINTER_TO_INT (rem_win_stacking->data))
-            {
-              rem_windows      = rem_windows->next;
-              rem_win_stacking = rem_win_stacking->next;
-            }
-
           /* Remove edge portions overlapped by rem_windows and rem_docks */
           new_edges = 
             meta_rectangle_remove_intersections_with_boxes_from_edges (
@@ -1094,43 +1186,107 @@ compute_resistance_and_snapping_edges (MetaDisplay *display)
           /* Save the new edges */
           edges = g_list_concat (new_edges, edges);
         }
-
-      stack_position++;
-      cur_window_iter = cur_window_iter->next;
     }
 
   /*
-   * 4th: Free the extra memory not needed and sort the list
-   */
-  g_list_free (stacked_windows);
-  /* Free the memory used by the obscuring windows/docks lists */
-  g_slist_free (window_stacking);
-  /* FIXME: Shouldn't there be a helper function to make this one line of code
-   * to free a list instead of four ugly ones?
+   * 3rd: Free the extra memory not needed
    */
-  g_slist_foreach (obscuring_windows, 
-                   (void (*)(gpointer,gpointer))&g_free, /* ew, for ugly */
-                   NULL);
   g_slist_free (obscuring_windows);
 
-  /* Sort the list.  FIXME: Should I bother with this sorting?  I just
-   * sort again later in cache_edges() anyway...
+  return edges;
+}
+
+static void
+compute_resistance_and_snapping_edges (MetaDisplay *display)
+{
+  MetaEdgeCache *cache;
+  MetaWorkspace *workspace;
+  GList *stacked_windows;
+  GList *cur_window_iter;
+  GArray *windows;
+
+  g_assert (display->grab_window != NULL);
+  meta_topic (META_DEBUG_WINDOW_OPS,
+              "Computing edges to resist-movement or snap-to for %s.\n",
+              display->grab_window->desc);
+
+  workspace = display->grab_screen->active_workspace;
+
+  /*
+   * 1st: Get the relevant windows and their positions, from bottom to top;
+   * the edges depend on nothing else besides the workspace's edges.
    */
-  edges = g_list_sort (edges, meta_rectangle_edge_cmp);
+  stacked_windows = 
+    meta_stack_list_windows (display->grab_screen->stack, workspace);
+
+  windows = g_array_new (FALSE, FALSE, sizeof (EdgeSourceWindow));
+  for (cur_window_iter = stacked_windows;
+       cur_window_iter != NULL;
+       cur_window_iter = cur_window_iter->next)
+    {
+      MetaWindow *cur_window = cur_window_iter->data;
+
+      if (WINDOW_EDGES_RELEVANT (cur_window, display))
+        {
+          EdgeSourceWindow source;
+
+          meta_window_get_outer_rect (cur_window, &source.rect);
+          source.is_dock = cur_window->type == META_WINDOW_DOCK;
+          g_array_append_val (windows, source);
+        }
+    }
+  g_list_free (stacked_windows);
 
   /*
-   * 5th: Cache the combination of these edges with the onscreen and
-   * monitor edges in an array for quick access.  Free the edges since
-   * they've been cached elsewhere.
+   * 2nd: If none of that changed since the last grab op, reuse its edges
    */
-  cache_edges (display,
-               edges,
-               display->grab_screen->active_workspace->monitor_edges,
-               display->grab_screen->active_workspace->screen_edges);
-  g_list_free (edges);
+  cache = display->grab_edge_cache;
+  if (cache != NULL &&
+      cache->windows->len == windows->len &&
+      memcmp (cache->windows->data, windows->data,
+              windows->len * sizeof (EdgeSourceWindow)) == 0 &&
+      meta_rectangle_equal (&cache->screen_rect, &display->grab_screen->rect) &&
+      edge_lists_equal (cache->monitor_edges, workspace->monitor_edges) &&
+      edge_lists_equal (cache->screen_edges, workspace->screen_edges))
+    {
+      meta_topic (META_DEBUG_WINDOW_OPS,
+                  "Reusing edges from the last move/resize\n");
+      g_array_free (windows, TRUE);
+    }
+  else
+    {
+      if (cache != NULL)
+        edge_cache_free (cache);
+
+      cache = g_new0 (MetaEdgeCache, 1);
+      cache->windows = windows;
+      cache->screen_rect = display->grab_screen->rect;
+      cache->window_edges = compute_window_edges (display, windows);
+      cache->monitor_edges = copy_edges (workspace->monitor_edges);
+      cache->screen_edges = copy_edges (workspace->screen_edges);
+
+      /* Cache the combination of these edges with the onscreen and
+       * monitor edges in arrays for quick access.
+       */
+      cache_edges (cache);
+
+      display->grab_edge_cache = cache;
+    }
+
+  /*
+   * 3rd: Point this grab op at the edges
+   */
+  g_assert (display->grab_edge_resistance_data == NULL);
+  display->grab_edge_resistance_data = g_new0 (MetaEdgeResistanceData, 1);
+  display->grab_edge_resistance_data->left_edges   = cache->vertical.edges;
+  display->grab_edge_resistance_data->right_edges  = cache->vertical.edges;
+  display->grab_edge_resistance_data->top_edges    = cache->horizontal.edges;
+  display->grab_edge_resistance_data->bottom_edges = cache->horizontal.edges;
+  display->grab_edge_resistance_data->vertical_index   = &cache->vertical;
+  display->grab_edge_resistance_data->horizontal_index = &cache->horizontal;
 
   /*
-   * 6th: Initialize the resistance timeouts and buildups
+   * 4th: Initialize the resistance timeouts and buildups
    */
   initialize_grab_edge_resistance_data (display);
 }
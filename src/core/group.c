@@ -194,6 +194,10 @@ meta_window_group_leader_changed (MetaWindow *window)
 {
   remove_window_from_group (window);
   meta_window_compute_group (window);
+
+  /* Group membership decides which windows it is constrained against */
+  if (!window->override_redirect)
+    meta_stack_update_transient (window->screen->stack, window);
 }
 
 void
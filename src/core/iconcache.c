@@ -27,6 +27,7 @@
 #include <meta/errors.h>
 
 #include <X11/Xatom.h>
+#include <string.h>
 
 /* The icon-reading code is also in libwnck, please sync bugfixes */
 
@@ -174,51 +175,186 @@ find_best_size (gulong  *data,
     return FALSE;
 }
 
-static void
-argbdata_to_pixdata (gulong *argb_data, int len, guchar **pixdata)
+/* Converts len pixels of _NET_WM_ICON data, ARGB in the low 32 bits
+ * of each long, to the RGBA bytes GdkPixbuf uses.
+ */
+void
+meta_icon_argb_to_rgba (const gulong *argb_data,
+                        int           len,
+                        guchar       *rgba)
 {
-  guchar *p;
+  guint32 *p = (guint32 *) rgba;
   int i;
 
+  /* A word at a time, so the compiler can turn this into a byte
+   * shuffle over several pixels at once.
+   */
+  for (i = 0; i < len; i++)
+    {
+      guint32 argb = argb_data[i];
+
+      p[i] = GUINT32_TO_BE ((argb << 8) | (argb >> 24));
+    }
+}
+
+static void
+argbdata_to_pixdata (const gulong *argb_data, int len, guchar **pixdata)
+{
   *pixdata = g_new (guchar, len * 4);
-  p = *pixdata;
+  meta_icon_argb_to_rgba (argb_data, len, *pixdata);
+}
 
-  /* One could speed this up a lot. */
-  i = 0;
-  while (i < len)
+static void
+free_pixels (guchar *pixels, gpointer data)
+{
+  g_free (pixels);
+}
+
+#define ICON_DIGEST_LENGTH 32
+
+/* SHA-256 of the pixels, so that a hit doesn't need the unscaled
+ * image kept around to compare against.
+ */
+static void
+digest_argbdata (const gulong *argb_data,
+                 int           len,
+                 guint8        digest[ICON_DIGEST_LENGTH])
+{
+  GChecksum *checksum;
+  guint32 chunk[256];
+  gsize digest_length;
+  int i, j, n;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+  /* Longs may be wider than a pixel, so pack them first */
+  for (i = 0; i < len; i += n)
     {
-      guint argb;
-      guint rgba;
+      n = MIN (len - i, (int) G_N_ELEMENTS (chunk));
+      for (j = 0; j < n; j++)
+        chunk[j] = argb_data[i + j];
+      g_checksum_update (checksum, (const guchar *) chunk,
+                         n * sizeof (guint32));
+    }
 
-      argb = argb_data[i];
-      rgba = (argb << 8) | (argb >> 24);
+  digest_length = ICON_DIGEST_LENGTH;
+  g_checksum_get_digest (checksum, digest, &digest_length);
+  g_checksum_free (checksum);
+}
 
-      *p = rgba >> 24;
-      ++p;
-      *p = (rgba >> 16) & 0xff;
-      ++p;
-      *p = (rgba >> 8) & 0xff;
-      ++p;
-      *p = rgba & 0xff;
-      ++p;
+static GdkPixbuf* scaled_from_pixdata (guchar *pixdata,
+                                       int     w,
+                                       int     h,
+                                       int     new_w,
+                                       int     new_h);
 
-      ++i;
+/* Windows of the same application usually carry identical
+ * _NET_WM_ICON data, so scaled icons are shared between them, found
+ * by a digest of the image they were scaled from.  The table holds
+ * no reference; an icon leaves it when the last window drops it.
+ */
+typedef struct
+{
+  int width, height;
+  int scaled_width, scaled_height;
+  guint8 digest[ICON_DIGEST_LENGTH];
+  GdkPixbuf *pixbuf;
+} SharedIcon;
+
+static GHashTable *shared_icons = NULL;
+
+static guint
+shared_icon_hash (gconstpointer data)
+{
+  const SharedIcon *icon = data;
+  guint hash;
+
+  memcpy (&hash, icon->digest, sizeof (hash));
+
+  return hash ^ (icon->width << 24) ^ (icon->height << 16) ^
+    (icon->scaled_width << 8) ^ icon->scaled_height;
+}
+
+static gboolean
+shared_icon_equal (gconstpointer a,
+                   gconstpointer b)
+{
+  const SharedIcon *ia = a;
+  const SharedIcon *ib = b;
+
+  return ia->width == ib->width &&
+         ia->height == ib->height &&
+         ia->scaled_width == ib->scaled_width &&
+         ia->scaled_height == ib->scaled_height &&
+         memcmp (ia->digest, ib->digest, ICON_DIGEST_LENGTH) == 0;
+}
+
+static void
+shared_icon_finalized (gpointer  data,
+                       GObject  *where_the_object_was)
+{
+  SharedIcon *icon = data;
+
+  g_hash_table_remove (shared_icons, icon);
+  g_free (icon);
+}
+
+static GdkPixbuf*
+get_shared_icon (const gulong *argb_data,
+                 int           w,
+                 int           h,
+                 int           new_w,
+                 int           new_h)
+{
+  SharedIcon lookup;
+  SharedIcon *icon;
+  guchar *pixdata;
+
+  if (shared_icons == NULL)
+    shared_icons = g_hash_table_new (shared_icon_hash, shared_icon_equal);
+
+  lookup.width = w;
+  lookup.height = h;
+  lookup.scaled_width = new_w;
+  lookup.scaled_height = new_h;
+  digest_argbdata (argb_data, w * h, lookup.digest);
+  lookup.pixbuf = NULL;
+
+  icon = g_hash_table_lookup (shared_icons, &lookup);
+  if (icon)
+    {
+      meta_verbose ("Sharing %dx%d icon scaled to %dx%d\n",
+                    w, h, new_w, new_h);
+      return g_object_ref (G_OBJECT (icon->pixbuf));
     }
+
+  /* The pixbuf owns the pixels, so they are gone right after scaling
+   * and only kept when the icon is used at its own size.
+   */
+  argbdata_to_pixdata (argb_data, w * h, &pixdata);
+  lookup.pixbuf = scaled_from_pixdata (pixdata, w, h, new_w, new_h);
+  if (lookup.pixbuf == NULL)
+    return NULL;
+
+  icon = g_new (SharedIcon, 1);
+  *icon = lookup;
+
+  g_object_weak_ref (G_OBJECT (icon->pixbuf), shared_icon_finalized, icon);
+  g_hash_table_insert (shared_icons, icon, icon);
+
+  return icon->pixbuf;
 }
 
 static gboolean
 read_rgb_icon (MetaDisplay   *display,
                Window         xwindow,
+               MetaIconCache *icon_cache,
                int            ideal_width,
                int            ideal_height,
                int            ideal_mini_width,
                int            ideal_mini_height,
-               int           *width,
-               int           *height,
-               guchar       **pixdata,
-               int           *mini_width,
-               int           *mini_height,
-               guchar       **mini_pixdata)
+               GdkPixbuf    **iconp,
+               GdkPixbuf    **mini_iconp)
 {
   Atom type;
   int format;
@@ -232,25 +368,39 @@ read_rgb_icon (MetaDisplay   *display,
   int mini_w, mini_h;
   gulong *data_as_long;
 
-  meta_error_trap_push_with_return (display);
-  type = None;
-  data = NULL;
-  result = XGetWindowProperty (display->xdisplay,
-			       xwindow,
-                               display->atom__NET_WM_ICON,
-			       0, G_MAXLONG,
-			       False, XA_CARDINAL, &type, &format, &nitems,
-			       &bytes_after, &data);
-  err = meta_error_trap_pop_with_return (display);
+  if (icon_cache->net_wm_icon_fetched)
+    {
+      data = (guchar *) icon_cache->net_wm_icon;
+      nitems = icon_cache->net_wm_icon_nitems;
 
-  if (err != Success ||
-      result != Success)
-    return FALSE;
+      icon_cache->net_wm_icon = NULL;
+      icon_cache->net_wm_icon_fetched = FALSE;
 
-  if (type != XA_CARDINAL)
+      if (data == NULL)
+        return FALSE;
+    }
+  else
     {
-      XFree (data);
-      return FALSE;
+      meta_error_trap_push_with_return (display);
+      type = None;
+      data = NULL;
+      result = XGetWindowProperty (display->xdisplay,
+                                   xwindow,
+                                   display->atom__NET_WM_ICON,
+                                   0, G_MAXLONG,
+                                   False, XA_CARDINAL, &type, &format, &nitems,
+                                   &bytes_after, &data);
+      err = meta_error_trap_pop_with_return (display);
+
+      if (err != Success ||
+          result != Success)
+        return FALSE;
+
+      if (type != XA_CARDINAL)
+        {
+          XFree (data);
+          return FALSE;
+        }
     }
 
   data_as_long = (gulong *)data;
@@ -271,24 +421,23 @@ read_rgb_icon (MetaDisplay   *display,
       return FALSE;
     }
 
-  *width = w;
-  *height = h;
-
-  *mini_width = mini_w;
-  *mini_height = mini_h;
-
-  argbdata_to_pixdata (best, w * h, pixdata);
-  argbdata_to_pixdata (best_mini, mini_w * mini_h, mini_pixdata);
+  *iconp = get_shared_icon (best, w, h, ideal_width, ideal_height);
+  *mini_iconp = get_shared_icon (best_mini, mini_w, mini_h,
+                                 ideal_mini_width, ideal_mini_height);
 
   XFree (data);
 
-  return TRUE;
-}
+  if (*iconp && *mini_iconp)
+    return TRUE;
 
-static void
-free_pixels (guchar *pixels, gpointer data)
-{
-  g_free (pixels);
+  if (*iconp)
+    g_object_unref (G_OBJECT (*iconp));
+  if (*mini_iconp)
+    g_object_unref (G_OBJECT (*mini_iconp));
+  *iconp = NULL;
+  *mini_iconp = NULL;
+
+  return FALSE;
 }
 
 static void
@@ -556,6 +705,18 @@ meta_icon_cache_init (MetaIconCache *icon_cache)
   icon_cache->wm_hints_dirty = TRUE;
   icon_cache->kwm_win_icon_dirty = TRUE;
   icon_cache->net_wm_icon_dirty = TRUE;
+  icon_cache->net_wm_icon_fetched = FALSE;
+  icon_cache->net_wm_icon = NULL;
+  icon_cache->net_wm_icon_nitems = 0;
+}
+
+static void
+forget_fetched_icon (MetaIconCache *icon_cache)
+{
+  if (icon_cache->net_wm_icon)
+    XFree (icon_cache->net_wm_icon);
+  icon_cache->net_wm_icon = NULL;
+  icon_cache->net_wm_icon_fetched = FALSE;
 }
 
 static void
@@ -586,6 +747,7 @@ void
 meta_icon_cache_free (MetaIconCache *icon_cache)
 {
   clear_icon_cache (icon_cache, FALSE);
+  forget_fetched_icon (icon_cache);
 }
 
 void
@@ -594,7 +756,10 @@ meta_icon_cache_property_changed (MetaIconCache *icon_cache,
                                   Atom           atom)
 {
   if (atom == display->atom__NET_WM_ICON)
-    icon_cache->net_wm_icon_dirty = TRUE;
+    {
+      icon_cache->net_wm_icon_dirty = TRUE;
+      forget_fetched_icon (icon_cache);
+    }
   else if (atom == display->atom__KWM_WIN_ICON)
     icon_cache->kwm_win_icon_dirty = TRUE;
   else if (atom == XA_WM_HINTS)
@@ -625,6 +790,58 @@ meta_icon_cache_get_icon_invalidated (MetaIconCache *icon_cache)
     return FALSE;
 }
 
+/* Sends the request for _NET_WM_ICON if meta_read_icons() is going to
+ * need it, so that the icons of several windows can be fetched with a
+ * single round trip; returns NULL if there is nothing to fetch.  Each
+ * task must be handed to meta_icon_cache_finish_fetch(), in order,
+ * before any other property requests are made.
+ */
+AgGetPropertyTask*
+meta_icon_cache_begin_fetch (MetaIconCache *icon_cache,
+                             MetaDisplay   *display,
+                             Window         xwindow)
+{
+  if (icon_cache->net_wm_icon_fetched ||
+      !meta_icon_cache_get_icon_invalidated (icon_cache) ||
+      icon_cache->origin > USING_NET_WM_ICON ||
+      !icon_cache->net_wm_icon_dirty)
+    return NULL;
+
+  return ag_task_create (display->xdisplay, xwindow,
+                         display->atom__NET_WM_ICON,
+                         0, G_MAXLONG,
+                         False, XA_CARDINAL);
+}
+
+void
+meta_icon_cache_finish_fetch (MetaIconCache     *icon_cache,
+                              AgGetPropertyTask *task)
+{
+  Atom type;
+  int format;
+  gulong nitems;
+  gulong bytes_after;
+  guchar *data;
+
+  forget_fetched_icon (icon_cache);
+
+  type = None;
+  data = NULL;
+  if (ag_task_get_reply_and_free (task, &type, &format, &nitems,
+                                  &bytes_after, &data) != Success)
+    data = NULL;
+
+  if (data && (type != XA_CARDINAL || format != 32))
+    {
+      XFree (data);
+      data = NULL;
+    }
+
+  icon_cache->net_wm_icon = (gulong *) data;
+  icon_cache->net_wm_icon_nitems = data ? nitems : 0;
+  icon_cache->net_wm_icon_fetched = TRUE;
+}
+
 static void
 replace_cache (MetaIconCache *icon_cache,
                IconOrigin     origin,
@@ -717,10 +934,6 @@ meta_read_icons (MetaScreen     *screen,
                  int             ideal_mini_width,
                  int             ideal_mini_height)
 {
-  guchar *pixdata;
-  int w, h;
-  guchar *mini_pixdata;
-  int mini_w, mini_h;
   Pixmap pixmap;
   Pixmap mask;
 
@@ -747,8 +960,6 @@ meta_read_icons (MetaScreen     *screen,
   if (!meta_icon_cache_get_icon_invalidated (icon_cache))
     return FALSE; /* we have no new info to use */
 
-  pixdata = NULL;
-
   /* Our algorithm here assumes that we can't have for example origin
    * < USING_NET_WM_ICON and icon_cache->net_wm_icon_dirty == FALSE
    * unless we have tried to read NET_WM_ICON.
@@ -764,32 +975,15 @@ meta_read_icons (MetaScreen     *screen,
     {
       icon_cache->net_wm_icon_dirty = FALSE;
 
-      if (read_rgb_icon (screen->display, xwindow,
+      if (read_rgb_icon (screen->display, xwindow, icon_cache,
                          ideal_width, ideal_height,
                          ideal_mini_width, ideal_mini_height,
-                         &w, &h, &pixdata,
-                         &mini_w, &mini_h, &mini_pixdata))
+                         iconp, mini_iconp))
         {
-          *iconp = scaled_from_pixdata (pixdata, w, h,
-                                        ideal_width, ideal_height);
+          replace_cache (icon_cache, USING_NET_WM_ICON,
+                         *iconp, *mini_iconp);
 
-          *mini_iconp = scaled_from_pixdata (mini_pixdata, mini_w, mini_h,
-                                             ideal_mini_width, ideal_mini_height);
-
-          if (*iconp && *mini_iconp)
-            {
-              replace_cache (icon_cache, USING_NET_WM_ICON,
-                             *iconp, *mini_iconp);
-              
-              return TRUE;
-            }
-          else
-            {
-              if (*iconp)
-                g_object_unref (G_OBJECT (*iconp));
-              if (*mini_iconp)
-                g_object_unref (G_OBJECT (*mini_iconp));
-            }
+          return TRUE;
         }
     }
 
@@ -25,6 +25,7 @@
 #define META_ICON_CACHE_H
 
 #include "screen-private.h"
+#include "async-getprop.h"
 
 typedef struct _MetaIconCache MetaIconCache;
 
@@ -51,6 +52,12 @@ struct _MetaIconCache
   guint wm_hints_dirty : 1;
   guint kwm_win_icon_dirty : 1;
   guint net_wm_icon_dirty : 1;
+  /* TRUE if _NET_WM_ICON was fetched ahead of meta_read_icons(),
+   * net_wm_icon is NULL if the window had none
+   */
+  guint net_wm_icon_fetched : 1;
+  gulong *net_wm_icon;
+  gulong net_wm_icon_nitems;
 };
 
 void           meta_icon_cache_init                 (MetaIconCache *icon_cache);
@@ -60,6 +67,16 @@ void           meta_icon_cache_property_changed     (MetaIconCache *icon_cache,
                                                      Atom           atom);
 gboolean       meta_icon_cache_get_icon_invalidated (MetaIconCache *icon_cache);
 
+AgGetPropertyTask* meta_icon_cache_begin_fetch  (MetaIconCache     *icon_cache,
+                                                 MetaDisplay       *display,
+                                                 Window             xwindow);
+void               meta_icon_cache_finish_fetch (MetaIconCache     *icon_cache,
+                                                 AgGetPropertyTask *task);
+
+void meta_icon_argb_to_rgba (const gulong *argb_data,
+                             int           len,
+                             guchar       *rgba);
+
 gboolean meta_read_icons         (MetaScreen     *screen,
                                   Window          xwindow,
                                   MetaIconCache  *icon_cache,
@@ -51,6 +51,33 @@ struct _MetaKeyBinding
   MetaKeyHandler *handler;
 };
 
+/* Maps (keycode, modifier mask) to the first matching binding in the
+ * display's binding table, so key presses don't need to walk it.
+ * Linear probing, kept at most half full.
+ */
+typedef struct
+{
+  guint key;            /* keycode << 8 | mask; 0 marks a free slot */
+  int   first_binding;  /* first binding for this key */
+  int   first_global;   /* first one that isn't per-window, or -1 */
+} MetaKeyBindingSlot;
+
+typedef struct
+{
+  MetaKeyBindingSlot *slots;
+  guint               bits;
+} MetaKeyBindingIndex;
+
+void     meta_key_binding_index_rebuild     (MetaKeyBindingIndex *index,
+                                             MetaKeyBinding      *bindings,
+                                             int                  n_bindings,
+                                             unsigned int         ignored_mask);
+int      meta_key_binding_index_lookup      (const MetaKeyBindingIndex *index,
+                                             unsigned int         keycode,
+                                             unsigned int         mask,
+                                             gboolean             on_window);
+void     meta_key_binding_index_free        (MetaKeyBindingIndex *index);
+
 void     meta_display_init_keys             (MetaDisplay *display);
 void     meta_display_shutdown_keys         (MetaDisplay *display);
 void     meta_screen_grab_keys              (MetaScreen  *screen);
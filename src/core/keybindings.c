@@ -143,6 +143,12 @@ static gboolean process_workspace_switch_grab (MetaDisplay *display,
                                                KeySym       keysym);
 
 static void regrab_key_bindings         (MetaDisplay *display);
+static GArray *compute_key_grabs        (MetaDisplay *display,
+                                         gboolean     binding_per_window);
+static void change_key_grabs            (MetaDisplay *display,
+                                         Window       xwindow,
+                                         GArray      *old_grabs,
+                                         GArray      *new_grabs);
 
 
 static GHashTable *key_handlers;
@@ -345,8 +351,120 @@ reload_modifiers (MetaDisplay *display)
           ++i;
         }
     }
+
+  /* Both the keycodes and the masks are final now */
+  meta_key_binding_index_rebuild (&display->key_binding_index,
+                                  display->key_bindings,
+                                  display->n_key_bindings,
+                                  display->ignored_modifier_mask);
+}
+
+#define KEY_BINDING_INDEX_KEY(keycode, mask) (((keycode) << 8) | (mask))
+
+static inline guint
+key_binding_index_first_slot (const MetaKeyBindingIndex *index,
+                              guint                      key)
+{
+  /* Fibonacci hashing; the top bits are the well-mixed ones */
+  return (key * 2654435769u) >> (32 - index->bits);
+}
+
+static MetaKeyBindingSlot *
+key_binding_index_find_slot (const MetaKeyBindingIndex *index,
+                             guint                      key)
+{
+  guint i;
+  guint slot_mask;
+
+  slot_mask = (1u << index->bits) - 1;
+  i = key_binding_index_first_slot (index, key);
+
+  /* There is always a free slot, so this terminates */
+  while (index->slots[i].key != 0 && index->slots[i].key != key)
+    i = (i + 1) & slot_mask;
+
+  return &index->slots[i];
 }
 
+void
+meta_key_binding_index_rebuild (MetaKeyBindingIndex *index,
+                                MetaKeyBinding      *bindings,
+                                int                  n_bindings,
+                                unsigned int         ignored_mask)
+{
+  int i;
+  int n_indexed;
+
+  g_free (index->slots);
+
+  index->bits = 4;
+  while ((1u << index->bits) < 2 * (guint) n_bindings)
+    index->bits += 1;
+
+  index->slots = g_new0 (MetaKeyBindingSlot, 1u << index->bits);
+
+  n_indexed = 0;
+  for (i = 0; i < n_bindings; i++)
+    {
+      MetaKeyBindingSlot *slot;
+      guint key;
+
+      /* Bindings that no event can match: no keycode for the keysym,
+       * or a mask that process_event() would always strip bits from.
+       */
+      if (bindings[i].keycode == 0 ||
+          (bindings[i].mask & ~0xff) != 0 ||
+          (bindings[i].mask & ignored_mask) != 0)
+        continue;
+
+      key = KEY_BINDING_INDEX_KEY (bindings[i].keycode, bindings[i].mask);
+      slot = key_binding_index_find_slot (index, key);
+
+      if (slot->key == 0)
+        {
+          slot->key = key;
+          slot->first_binding = i;
+          slot->first_global = -1;
+          n_indexed += 1;
+        }
+
+      if (slot->first_global < 0 &&
+          !(bindings[i].handler != NULL &&
+            bindings[i].handler->flags & META_KEY_BINDING_PER_WINDOW))
+        slot->first_global = i;
+    }
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              " %d distinct keys indexed in %u slots\n",
+              n_indexed, 1u << index->bits);
+}
+
+int
+meta_key_binding_index_lookup (const MetaKeyBindingIndex *index,
+                               unsigned int               keycode,
+                               unsigned int               mask,
+                               gboolean                   on_window)
+{
+  MetaKeyBindingSlot *slot;
+
+  if (index->slots == NULL || keycode == 0 || keycode > 0xff || mask > 0xff)
+    return -1;
+
+  slot = key_binding_index_find_slot (index,
+                                      KEY_BINDING_INDEX_KEY (keycode, mask));
+  if (slot->key == 0)
+    return -1;
+
+  return on_window ? slot->first_binding : slot->first_global;
+}
+
+void
+meta_key_binding_index_free (MetaKeyBindingIndex *index)
+{
+  g_free (index->slots);
+  index->slots = NULL;
+  index->bits = 0;
+}
 
 static int
 count_bindings (GList *prefs)
@@ -484,11 +602,24 @@ rebuild_special_bindings (MetaDisplay *display)
     }
 }
 
+/* Every screen with keys_grabbed holds display->screen_key_grabs and
+ * every window with keys_grabbed holds display->window_key_grabs, so
+ * after a keymap or preference change we work out once what changed
+ * and only send that, instead of ungrabbing and regrabbing everything
+ * on every window.
+ */
 static void
 regrab_key_bindings (MetaDisplay *display)
 {
   GSList *tmp;
   GSList *windows;
+  GArray *old_screen_grabs;
+  GArray *old_window_grabs;
+
+  old_screen_grabs = display->screen_key_grabs;
+  old_window_grabs = display->window_key_grabs;
+  display->screen_key_grabs = compute_key_grabs (display, FALSE);
+  display->window_key_grabs = compute_key_grabs (display, TRUE);
 
   meta_error_trap_push (display); /* for efficiency push outer trap */
   
@@ -497,8 +628,11 @@ regrab_key_bindings (MetaDisplay *display)
     {
       MetaScreen *screen = tmp->data;
 
-      meta_screen_ungrab_keys (screen);
-      meta_screen_grab_keys (screen);
+      if (screen->keys_grabbed)
+        change_key_grabs (display, screen->xroot,
+                          old_screen_grabs, display->screen_key_grabs);
+      else
+        meta_screen_grab_keys (screen);
 
       tmp = tmp->next;
     }
@@ -508,15 +642,29 @@ regrab_key_bindings (MetaDisplay *display)
   while (tmp != NULL)
     {
       MetaWindow *w = tmp->data;
-      
-      meta_window_ungrab_keys (w);
-      meta_window_grab_keys (w);
+
+      if (w->keys_grabbed &&
+          w->grab_on_frame == (w->frame != NULL))
+        change_key_grabs (display,
+                          w->frame ? w->frame->xwindow : w->xwindow,
+                          old_window_grabs, display->window_key_grabs);
+      else
+        {
+          /* Grabs are on the wrong window, or there are none */
+          meta_window_ungrab_keys (w);
+          meta_window_grab_keys (w);
+        }
       
       tmp = tmp->next;
     }
   meta_error_trap_pop (display);
 
   g_slist_free (windows);
+
+  if (old_screen_grabs)
+    g_array_free (old_screen_grabs, TRUE);
+  if (old_window_grabs)
+    g_array_free (old_window_grabs, TRUE);
 }
 
 static MetaKeyBinding *
@@ -776,6 +924,12 @@ meta_display_shutdown_keys (MetaDisplay *display)
   if (display->modmap)
     XFreeModifiermap (display->modmap);
   g_free (display->key_bindings);
+  meta_key_binding_index_free (&display->key_binding_index);
+
+  if (display->screen_key_grabs)
+    g_array_free (display->screen_key_grabs, TRUE);
+  if (display->window_key_grabs)
+    g_array_free (display->window_key_grabs, TRUE);
 }
 
 static const char*
@@ -790,116 +944,196 @@ keysym_name (int keysym)
   return name;
 }
 
-/* Grab/ungrab, ignoring all annoying modifiers like NumLock etc. */
-static void
-meta_change_keygrab (MetaDisplay *display,
-                     Window       xwindow,
-                     gboolean     grab,
-                     int          keysym,
-                     unsigned int keycode,
-                     int          modmask)
+/* One passive grab as it is made on the server: ignored modifiers
+ * like NumLock are already folded into the mask.
+ */
+typedef struct
 {
-  unsigned int ignored_mask;
+  guint        keycode;
+  unsigned int mask;
+  KeySym       keysym; /* only for messages */
+} MetaKeyGrab;
 
-  /* Grab keycode/modmask, together with
-   * all combinations of ignored modifiers.
-   * X provides no better way to do this.
-   */
+static int
+key_grab_compare (gconstpointer a,
+                  gconstpointer b)
+{
+  const MetaKeyGrab *grab_a = a;
+  const MetaKeyGrab *grab_b = b;
 
-  meta_topic (META_DEBUG_KEYBINDINGS,
-              "%s keybinding %s keycode %d mask 0x%x on 0x%lx\n",
-              grab ? "Grabbing" : "Ungrabbing",
-              keysym_name (keysym), keycode,
-              modmask, xwindow);
+  if (grab_a->keycode != grab_b->keycode)
+    return grab_a->keycode < grab_b->keycode ? -1 : 1;
+  if (grab_a->mask != grab_b->mask)
+    return grab_a->mask < grab_b->mask ? -1 : 1;
+  return 0;
+}
+
+/* Add keycode/modmask, together with all combinations of
+ * ignored modifiers.  X provides no better way to do this.
+ */
+static void
+add_key_grab (MetaDisplay  *display,
+              GArray       *grabs,
+              KeySym        keysym,
+              unsigned int  keycode,
+              unsigned int  modmask)
+{
+  unsigned int ignored_mask;
 
-  /* efficiency, avoid so many XSync() */
-  meta_error_trap_push (display);
-  
   ignored_mask = 0;
   while (ignored_mask <= display->ignored_modifier_mask)
     {
-      if (ignored_mask & ~(display->ignored_modifier_mask))
+      if ((ignored_mask & ~(display->ignored_modifier_mask)) == 0)
         {
-          /* Not a combination of ignored modifiers
-           * (it contains some non-ignored modifiers)
-           */
-          ++ignored_mask;
-          continue;
-        }
+          MetaKeyGrab grab;
 
-      if (meta_is_debugging ())
-        meta_error_trap_push_with_return (display);
-      if (grab)
-        XGrabKey (display->xdisplay, keycode,
-                  modmask | ignored_mask,
-                  xwindow,
-                  True,
-                  GrabModeAsync, GrabModeSync);
-      else
-        XUngrabKey (display->xdisplay, keycode,
-                    modmask | ignored_mask,
-                    xwindow);
-
-      if (meta_is_debugging ())
-        {
-          int result;
-          
-          result = meta_error_trap_pop_with_return (display);
-          
-          if (grab && result != Success)
-            {      
-              if (result == BadAccess)
-                meta_warning (_("Some other program is already using the key %s with modifiers %x as a binding\n"), keysym_name (keysym), modmask | ignored_mask);
-              else
-                meta_topic (META_DEBUG_KEYBINDINGS,
-                            "Failed to grab key %s with modifiers %x\n",
-                            keysym_name (keysym), modmask | ignored_mask);
-            }
+          grab.keycode = keycode;
+          grab.mask = modmask | ignored_mask;
+          grab.keysym = keysym;
+          g_array_append_val (grabs, grab);
         }
 
       ++ignored_mask;
     }
+}
 
-  meta_error_trap_pop (display);
+/* The grabs every screen root (binding_per_window == FALSE) or every
+ * window (TRUE) should hold, sorted and without duplicates.  With
+ * key_grabs_on_root_only the roots hold everything and windows nothing.
+ */
+static GArray *
+compute_key_grabs (MetaDisplay *display,
+                   gboolean     binding_per_window)
+{
+  GArray *grabs;
+  MetaKeyGrab *items;
+  int i, n_unique;
+
+  grabs = g_array_new (FALSE, FALSE, sizeof (MetaKeyGrab));
+
+  if (display->key_grabs_on_root_only && binding_per_window)
+    return grabs;
+
+  if (!binding_per_window &&
+      display->overlay_key_combo.keycode != 0)
+    add_key_grab (display, grabs,
+                  display->overlay_key_combo.keysym,
+                  display->overlay_key_combo.keycode,
+                  display->overlay_key_combo.modifiers);
+
+  for (i = 0; i < display->n_key_bindings; i++)
+    {
+      MetaKeyBinding *binding = &display->key_bindings[i];
+
+      if ((display->key_grabs_on_root_only ||
+           !!binding_per_window ==
+           !!(binding->handler->flags & META_KEY_BINDING_PER_WINDOW)) &&
+          binding->keycode != 0)
+        add_key_grab (display, grabs,
+                      binding->keysym, binding->keycode, binding->mask);
+    }
+
+  g_array_sort (grabs, key_grab_compare);
+
+  items = (MetaKeyGrab *) grabs->data;
+  n_unique = 0;
+  for (i = 0; i < (int) grabs->len; i++)
+    {
+      if (n_unique > 0 && key_grab_compare (&items[n_unique - 1], &items[i]) == 0)
+        continue;
+      items[n_unique++] = items[i];
+    }
+  g_array_set_size (grabs, n_unique);
+
+  return grabs;
 }
 
 static void
-meta_grab_key (MetaDisplay *display,
-               Window       xwindow,
-               int          keysym,
-               unsigned int keycode,
-               int          modmask)
+change_key_grab (MetaDisplay       *display,
+                 Window             xwindow,
+                 gboolean           grab,
+                 const MetaKeyGrab *key_grab)
 {
-  meta_change_keygrab (display, xwindow, TRUE, keysym, keycode, modmask);
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "%s keybinding %s keycode %d mask 0x%x on 0x%lx\n",
+              grab ? "Grabbing" : "Ungrabbing",
+              keysym_name (key_grab->keysym), key_grab->keycode,
+              key_grab->mask, xwindow);
+
+  if (meta_is_debugging ())
+    meta_error_trap_push_with_return (display);
+  if (grab)
+    XGrabKey (display->xdisplay, key_grab->keycode,
+              key_grab->mask,
+              xwindow,
+              True,
+              GrabModeAsync, GrabModeSync);
+  else
+    XUngrabKey (display->xdisplay, key_grab->keycode,
+                key_grab->mask,
+                xwindow);
+
+  if (meta_is_debugging ())
+    {
+      int result;
+
+      result = meta_error_trap_pop_with_return (display);
+
+      if (grab && result != Success)
+        {
+          if (result == BadAccess)
+            meta_warning (_("Some other program is already using the key %s with modifiers %x as a binding\n"), keysym_name (key_grab->keysym), key_grab->mask);
+          else
+            meta_topic (META_DEBUG_KEYBINDINGS,
+                        "Failed to grab key %s with modifiers %x\n",
+                        keysym_name (key_grab->keysym), key_grab->mask);
+        }
+    }
 }
 
+/* Takes xwindow from holding old_grabs to holding new_grabs, only
+ * touching the grabs that differ.  Either array may be NULL for
+ * "no grabs".
+ */
 static void
-grab_keys (MetaKeyBinding *bindings,
-           int             n_bindings,
-           MetaDisplay    *display,
-           Window          xwindow,
-           gboolean        binding_per_window)
+change_key_grabs (MetaDisplay *display,
+                  Window       xwindow,
+                  GArray      *old_grabs,
+                  GArray      *new_grabs)
 {
-  int i;
+  const MetaKeyGrab *old_items, *new_items;
+  guint n_old, n_new;
+  guint i, j;
 
-  g_assert (n_bindings == 0 || bindings != NULL);
+  n_old = old_grabs ? old_grabs->len : 0;
+  n_new = new_grabs ? new_grabs->len : 0;
+  old_items = old_grabs ? (const MetaKeyGrab *) old_grabs->data : NULL;
+  new_items = new_grabs ? (const MetaKeyGrab *) new_grabs->data : NULL;
 
+  /* efficiency, avoid so many XSync() */
   meta_error_trap_push (display);
-  
-  i = 0;
-  while (i < n_bindings)
+
+  i = j = 0;
+  while (i < n_old || j < n_new)
     {
-      if (!!binding_per_window ==
-          !!(bindings[i].handler->flags & META_KEY_BINDING_PER_WINDOW) &&
-          bindings[i].keycode != 0)
+      int cmp;
+
+      if (i == n_old)
+        cmp = 1;
+      else if (j == n_new)
+        cmp = -1;
+      else
+        cmp = key_grab_compare (&old_items[i], &new_items[j]);
+
+      if (cmp < 0)
+        change_key_grab (display, xwindow, FALSE, &old_items[i++]);
+      else if (cmp > 0)
+        change_key_grab (display, xwindow, TRUE, &new_items[j++]);
+      else
         {
-          meta_grab_key (display, xwindow,
-                         bindings[i].keysym,
-                         bindings[i].keycode,
-                         bindings[i].mask);
+          ++i;
+          ++j;
         }
-      
-      ++i;
     }
 
   meta_error_trap_pop (display);
@@ -941,16 +1175,8 @@ meta_screen_grab_keys (MetaScreen *screen)
   if (screen->keys_grabbed)
     return;
   
-  if (display->overlay_key_combo.keycode != 0)
-    meta_grab_key (display, screen->xroot,
-                   display->overlay_key_combo.keysym,
-                   display->overlay_key_combo.keycode,
-                   display->overlay_key_combo.modifiers);
-
-  grab_keys (screen->display->key_bindings,
-             screen->display->n_key_bindings,
-             screen->display, screen->xroot,
-             FALSE);
+  change_key_grabs (display, screen->xroot,
+                    NULL, display->screen_key_grabs);
 
   screen->keys_grabbed = TRUE;
 }
@@ -971,6 +1197,10 @@ meta_window_grab_keys (MetaWindow  *window)
   if (window->all_keys_grabbed)
     return;
 
+  /* The root window grabs cover us; see route_root_key_event() */
+  if (window->display->key_grabs_on_root_only)
+    return;
+
   if (window->type == META_WINDOW_DOCK
       || window->override_redirect)
     {
@@ -991,11 +1221,9 @@ meta_window_grab_keys (MetaWindow  *window)
         return; /* already all good */
     }
   
-  grab_keys (window->display->key_bindings,
-             window->display->n_key_bindings,
-             window->display,
-             window->frame ? window->frame->xwindow : window->xwindow,
-             TRUE);
+  change_key_grabs (window->display,
+                    window->frame ? window->frame->xwindow : window->xwindow,
+                    NULL, window->display->window_key_grabs);
 
   window->keys_grabbed = TRUE;
   window->grab_on_frame = window->frame != NULL;
@@ -1384,68 +1612,115 @@ invoke_handler_by_name (MetaDisplay    *display,
 
 /* now called from only one place, may be worth merging */
 static gboolean
-process_event (MetaKeyBinding       *bindings,
-               int                   n_bindings,
-               MetaDisplay          *display,
-               MetaScreen           *screen,
-               MetaWindow           *window,
-               XEvent               *event,
-               KeySym                keysym,
-               gboolean              on_window)
+process_event (MetaKeyBinding            *bindings,
+               const MetaKeyBindingIndex *index,
+               MetaDisplay               *display,
+               MetaScreen                *screen,
+               MetaWindow                *window,
+               XEvent                    *event,
+               KeySym                     keysym,
+               gboolean                   on_window)
 {
+  MetaKeyHandler *handler;
   int i;
 
   /* we used to have release-based bindings but no longer. */
-  if (event->type == KeyRelease)
+  if (event->type != KeyPress)
     return FALSE;
 
+  /* Per-window bindings are skipped unless on_window; the index
+   * remembers the first global binding for each key for that case.
+   */
+  i = meta_key_binding_index_lookup (index,
+                                     event->xkey.keycode,
+                                     event->xkey.state & 0xff &
+                                     ~(display->ignored_modifier_mask),
+                                     on_window);
+  if (i < 0)
+    {
+      meta_topic (META_DEBUG_KEYBINDINGS,
+                  "No handler found for this event in this binding table\n");
+      return FALSE;
+    }
+
   /*
-   * TODO: This would be better done with a hash table;
-   * it doesn't suit to use O(n) for such a common operation.
+   * window must be non-NULL for on_window to be true,
+   * and so also window must be non-NULL if we get here and
+   * this is a META_KEY_BINDING_PER_WINDOW binding.
    */
-  for (i=0; i<n_bindings; i++)
+
+  meta_topic (META_DEBUG_KEYBINDINGS,
+              "Binding keycode 0x%x mask 0x%x matches event 0x%x state 0x%x\n",
+              bindings[i].keycode, bindings[i].mask,
+              event->xkey.keycode, event->xkey.state);
+
+  handler = bindings[i].handler;
+  if (handler == NULL)
     {
-      MetaKeyHandler *handler = bindings[i].handler;
+      meta_bug ("Binding %s has no handler\n", bindings[i].name);
+      return FALSE;
+    }
+  else
+    meta_topic (META_DEBUG_KEYBINDINGS,
+                "Running handler for %s\n",
+                bindings[i].name);
 
-      if ((!on_window && handler->flags & META_KEY_BINDING_PER_WINDOW) ||
-          event->type != KeyPress ||
-          bindings[i].keycode != event->xkey.keycode ||
-          ((event->xkey.state & 0xff & ~(display->ignored_modifier_mask)) !=
-           bindings[i].mask))
-        continue;
+  /* Global keybindings count as a let-the-terminal-lose-focus
+   * due to new window mapping until the user starts
+   * interacting with the terminal again.
+   */
+  display->allow_terminal_deactivation = TRUE;
 
-      /*
-       * window must be non-NULL for on_window to be true,
-       * and so also window must be non-NULL if we get here and
-       * this is a META_KEY_BINDING_PER_WINDOW binding.
-       */
+  invoke_handler (display, screen, handler, window, event, &bindings[i]);
 
-      meta_topic (META_DEBUG_KEYBINDINGS,
-                  "Binding keycode 0x%x mask 0x%x matches event 0x%x state 0x%x\n",
-                  bindings[i].keycode, bindings[i].mask,
-                  event->xkey.keycode, event->xkey.state);
+  return TRUE;
+}
 
-      if (handler == NULL)
-        meta_bug ("Binding %s has no handler\n", bindings[i].name);
-      else
-        meta_topic (META_DEBUG_KEYBINDINGS,
-                    "Running handler for %s\n",
-                    bindings[i].name);
+/* With key_grabs_on_root_only, a per-window binding fires through the
+ * root window grab, and we have to work out which window the frame or
+ * client grab would have delivered it to.  Global bindings still win,
+ * just as the root grab would have been activated first otherwise.
+ * Returns TRUE if only a per-window binding matches this press; then
+ * *window_p is the window to run it on, or NULL if no window's own
+ * grab would have caught it and the key belongs to the client.
+ */
+static gboolean
+route_root_key_event (MetaDisplay  *display,
+                      MetaScreen   *screen,
+                      XEvent       *event,
+                      MetaWindow  **window_p)
+{
+  MetaWindow *focus;
+  unsigned int mask;
 
-      /* Global keybindings count as a let-the-terminal-lose-focus
-       * due to new window mapping until the user starts
-       * interacting with the terminal again.
-       */
-      display->allow_terminal_deactivation = TRUE;
+  *window_p = NULL;
 
-      invoke_handler (display, screen, handler, window, event, &bindings[i]);
+  if (event->type != KeyPress)
+    return FALSE;
 
-      return TRUE;
-    }
+  mask = event->xkey.state & 0xff & ~(display->ignored_modifier_mask);
+
+  if (meta_key_binding_index_lookup (&display->key_binding_index,
+                                     event->xkey.keycode, mask, FALSE) >= 0 ||
+      meta_key_binding_index_lookup (&display->key_binding_index,
+                                     event->xkey.keycode, mask, TRUE) < 0)
+    return FALSE;
+
+  /* Same windows meta_window_grab_keys() would have grabbed on */
+  focus = display->focus_window;
+  if (focus == NULL ||
+      focus->screen != screen ||
+      focus->type == META_WINDOW_DOCK ||
+      focus->override_redirect)
+    return TRUE;
 
   meta_topic (META_DEBUG_KEYBINDINGS,
-              "No handler found for this event in this binding table\n");
-  return FALSE;
+              "Routing key press on root to focus window %s\n",
+              focus->desc);
+
+  *window_p = focus;
+
+  return TRUE;
 }
 
 static gboolean
@@ -1458,6 +1733,8 @@ process_overlay_key (MetaDisplay *display,
     {
       if (event->xkey.keycode != display->overlay_key_combo.keycode)
         {
+          MetaWindow *window;
+
           display->overlay_key_only_pressed = FALSE;
 
           /* OK, the user hit modifier+key rather than pressing and
@@ -1473,7 +1750,7 @@ process_overlay_key (MetaDisplay *display,
            * luck.
            */
           if (process_event (display->key_bindings,
-                             display->n_key_bindings,
+                             &display->key_binding_index,
                              display, screen, NULL, event, keysym,
                              FALSE))
             {
@@ -1483,6 +1760,20 @@ process_overlay_key (MetaDisplay *display,
                * windows */
               XAllowEvents (display->xdisplay, AsyncKeyboard, event->xkey.time);
             }
+          else if (display->key_grabs_on_root_only &&
+                   route_root_key_event (display, screen, event, &window) &&
+                   window != NULL)
+            {
+              /* Replaying wouldn't get to our per-window bindings,
+               * they are grabbed on the root too.
+               */
+              XAllowEvents (display->xdisplay, AsyncKeyboard, event->xkey.time);
+              meta_window_set_user_time (window, event->xkey.time);
+              process_event (display->key_bindings,
+                             &display->key_binding_index,
+                             display, screen, window, event, keysym,
+                             TRUE);
+            }
           else
             {
               /* Replay the event so it gets delivered to our
@@ -1591,6 +1882,30 @@ meta_display_process_key_event (MetaDisplay *display,
         return TRUE;
     }
 
+  if (display->key_grabs_on_root_only && !all_keys_grabbed &&
+      event->type == KeyPress &&
+      meta_display_screen_for_root (display, event->xkey.window) != NULL)
+    {
+      MetaWindow *focus;
+
+      if (route_root_key_event (display, screen, event, &focus))
+        {
+          if (focus == NULL)
+            {
+              /* Only a per-window binding matches, and there's no
+               * window whose own grab would have caught it: let the
+               * focused client have the key.
+               */
+              XAllowEvents (display->xdisplay, ReplayKeyboard,
+                            event->xkey.time);
+              return FALSE;
+            }
+
+          window = focus;
+          meta_window_set_user_time (window, event->xkey.time);
+        }
+    }
+
   XAllowEvents (display->xdisplay, AsyncKeyboard, event->xkey.time);
 
   keep_grab = TRUE;
@@ -1681,7 +1996,7 @@ meta_display_process_key_event (MetaDisplay *display,
   
   /* Do the normal keybindings */
   return process_event (display->key_bindings,
-                        display->n_key_bindings,
+                        &display->key_binding_index,
                         display, screen, window, event, keysym,
                         !all_keys_grabbed && window);
 }
@@ -3061,6 +3376,10 @@ do_choose_window (MetaDisplay    *display,
 {
   MetaTabList type = binding->handler->data;
   MetaWindow *initial_selection;
+  gint64 requested_time;
+
+  /* The popup logs how long it took to show up from the keypress */
+  requested_time = g_get_monotonic_time ();
 
   meta_topic (META_DEBUG_KEYBINDINGS,
               "Tab list = %u show_popup = %d\n", type, show_popup);
@@ -3143,7 +3462,8 @@ do_choose_window (MetaDisplay    *display,
   meta_screen_tab_popup_create (screen, type,
                                 show_popup ? META_TAB_SHOW_ICON :
                                 META_TAB_SHOW_INSTANTLY,
-                                initial_selection);
+                                initial_selection,
+                                requested_time);
 
   if (!show_popup)
     {
@@ -4234,6 +4554,18 @@ meta_display_init_keys (MetaDisplay *display)
   display->meta_mask = 0;
   display->key_bindings = NULL;
   display->n_key_bindings = 0;
+  display->key_binding_index.slots = NULL;
+  display->key_binding_index.bits = 0;
+  display->screen_key_grabs = NULL;
+  display->window_key_grabs = NULL;
+  /* Note that this moves the per-window bindings onto the root, where
+   * they conflict with other clients' root grabs.  Normally a client's
+   * root grab is activated before our frame grab and wins; here only
+   * one of the two grabs can exist, and once we hold it our per-window
+   * binding takes precedence over the other client.
+   */
+  display->key_grabs_on_root_only =
+    g_getenv ("MUTTER_KEY_GRABS_ON_ROOT_ONLY") != NULL;
 
   XDisplayKeycodes (display->xdisplay,
                     &display->min_keycode,
@@ -4258,6 +4590,8 @@ meta_display_init_keys (MetaDisplay *display)
   reload_modifiers (display);
 
   /* Keys are actually grabbed in meta_screen_grab_keys() */
+  display->screen_key_grabs = compute_key_grabs (display, FALSE);
+  display->window_key_grabs = compute_key_grabs (display, TRUE);
 
   meta_prefs_add_listener (bindings_changed_callback, display);
 
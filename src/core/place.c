@@ -376,106 +376,251 @@ avoid_being_obscured_as_second_modal_dialog (MetaWindow *window,
 }
 
 static gboolean
-rectangle_overlaps_some_window (MetaRectangle *rect,
-                                GList         *windows)
+window_is_placement_obstacle (MetaWindow *window)
 {
-  GList *tmp;
-  MetaRectangle dest;
-  
-  tmp = windows;
-  while (tmp != NULL)
+  switch (window->type)
     {
-      MetaWindow *other = tmp->data;
-      MetaRectangle other_rect;      
-
-      switch (other->type)
-        {
-        case META_WINDOW_DOCK:
-        case META_WINDOW_SPLASHSCREEN:
-        case META_WINDOW_DESKTOP:
-        case META_WINDOW_DIALOG:
-        case META_WINDOW_MODAL_DIALOG:
-	/* override redirect window types: */
-	case META_WINDOW_DROPDOWN_MENU:
-	case META_WINDOW_POPUP_MENU:
-	case META_WINDOW_TOOLTIP:
-	case META_WINDOW_NOTIFICATION:
-	case META_WINDOW_COMBO:
-	case META_WINDOW_DND:
-	case META_WINDOW_OVERRIDE_OTHER:
-          break;
+    case META_WINDOW_DOCK:
+    case META_WINDOW_SPLASHSCREEN:
+    case META_WINDOW_DESKTOP:
+    case META_WINDOW_DIALOG:
+    case META_WINDOW_MODAL_DIALOG:
+    /* override redirect window types: */
+    case META_WINDOW_DROPDOWN_MENU:
+    case META_WINDOW_POPUP_MENU:
+    case META_WINDOW_TOOLTIP:
+    case META_WINDOW_NOTIFICATION:
+    case META_WINDOW_COMBO:
+    case META_WINDOW_DND:
+    case META_WINDOW_OVERRIDE_OTHER:
+      return FALSE;
 
-        case META_WINDOW_NORMAL:
-        case META_WINDOW_UTILITY:
-        case META_WINDOW_TOOLBAR:
-        case META_WINDOW_MENU:
-          meta_window_get_outer_rect (other, &other_rect);
-          
-          if (meta_rectangle_intersect (rect, &other_rect, &dest))
-            return TRUE;
-          break;
-        }
-      
-      tmp = tmp->next;
+    case META_WINDOW_NORMAL:
+    case META_WINDOW_UTILITY:
+    case META_WINDOW_TOOLBAR:
+    case META_WINDOW_MENU:
+      return TRUE;
     }
 
   return FALSE;
 }
 
-static gint
-leftmost_cmp (gconstpointer a, gconstpointer b)
+typedef struct
 {
-  MetaWindow *aw = (gpointer) a;
-  MetaWindow *bw = (gpointer) b;
-  int ax, bx;
+  int x;
+  int delta;
+  int y1, y2;
+} SweepEvent;
 
-  /* we're interested in the frame position for cascading,
-   * not meta_window_get_position()
-   */
-  if (aw->frame)
-    ax = aw->frame->rect.x;
-  else
-    ax = aw->rect.x;
+static int
+compare_ints (const void *a, const void *b)
+{
+  int ia = *(const int *) a;
+  int ib = *(const int *) b;
 
-  if (bw->frame)
-    bx = bw->frame->rect.x;
-  else
-    bx = bw->rect.x;
+  return (ia > ib) - (ia < ib);
+}
 
-  if (ax < bx)
-    return -1;
-  else if (ax > bx)
-    return 1;
-  else
-    return 0;
+static int
+compare_sweep_events (const void *a, const void *b)
+{
+  const SweepEvent *ea = a;
+  const SweepEvent *eb = b;
+
+  return (ea->x > eb->x) - (ea->x < eb->x);
 }
 
 static gint
-topmost_cmp (gconstpointer a, gconstpointer b)
+compare_position_x (gconstpointer a, gconstpointer b, gpointer data)
 {
-  MetaWindow *aw = (gpointer) a;
-  MetaWindow *bw = (gpointer) b;
-  int ay, by;
+  const MetaRectangle *positions = data;
+  int xa = positions[*(const int *) a].x;
+  int xb = positions[*(const int *) b].x;
 
-  /* we're interested in the frame position for cascading,
+  return (xa > xb) - (xa < xb);
+}
+
+/* Index of the first of the n sorted values that is >= value */
+static int
+lower_bound (const int *values, int n, int value)
+{
+  int lo = 0, hi = n;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+
+      if (values[mid] < value)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Adds delta to the counts of positions index..n-1 of a Fenwick tree */
+static void
+fenwick_add (int *tree, int n, int index, int delta)
+{
+  for (index++; index <= n; index += index & -index)
+    tree[index - 1] += delta;
+}
+
+static int
+fenwick_get (const int *tree, int index)
+{
+  int sum = 0;
+
+  for (index++; index > 0; index -= index & -index)
+    sum += tree[index - 1];
+
+  return sum;
+}
+
+/* Works out for each of the candidate positions whether a rectangle of
+ * the given size placed there overlaps any of the obstacles.
+ *
+ * A rectangle at (x, y) overlaps an obstacle exactly when
+ *   obstacle.x - width < x < obstacle.x + obstacle.width
+ * and the same goes for y, i.e. when (x, y) lies inside the obstacle
+ * grown by the size of the rectangle.  So rather than testing every
+ * candidate against every obstacle, we sweep across the grown obstacles
+ * from left to right, keeping count of how many cover each candidate y,
+ * and look the candidates up as the sweep passes them.
+ */
+static void
+find_overlapped_positions (const MetaRectangle *obstacles,
+                           int                  n_obstacles,
+                           int                  width,
+                           int                  height,
+                           const MetaRectangle *positions,
+                           int                  n_positions,
+                           gboolean            *overlapped)
+{
+  SweepEvent *events;
+  int *order;
+  int *ys;
+  int *tree;
+  int n_events, n_ys;
+  int i, j;
+
+  for (i = 0; i < n_positions; i++)
+    overlapped[i] = FALSE;
+
+  if (width <= 0 || height <= 0 || n_obstacles == 0 || n_positions == 0)
+    return;
+
+  /* The distinct candidate y's, which are all we ever need counts for */
+  ys = g_new (int, n_positions);
+  for (i = 0; i < n_positions; i++)
+    ys[i] = positions[i].y;
+  qsort (ys, n_positions, sizeof (int), compare_ints);
+  for (i = 1, n_ys = 1; i < n_positions; i++)
+    if (ys[i] != ys[n_ys - 1])
+      ys[n_ys++] = ys[i];
+
+  /* Each grown obstacle covers x's from x1 up to but not including x2 */
+  events = g_new (SweepEvent, 2 * n_obstacles);
+  n_events = 0;
+  for (i = 0; i < n_obstacles; i++)
+    {
+      const MetaRectangle *obstacle = &obstacles[i];
+      int y1, y2;
+
+      if (obstacle->width <= 0 || obstacle->height <= 0)
+        continue;
+
+      /* The candidate y's inside the grown obstacle are ys[y1..y2-1] */
+      y1 = lower_bound (ys, n_ys, obstacle->y - height + 1);
+      y2 = lower_bound (ys, n_ys, obstacle->y + obstacle->height);
+      if (y1 == y2)
+        continue;
+
+      events[n_events].x = obstacle->x - width + 1;
+      events[n_events].delta = 1;
+      events[n_events].y1 = y1;
+      events[n_events].y2 = y2;
+      n_events++;
+
+      events[n_events] = events[n_events - 1];
+      events[n_events].x = obstacle->x + obstacle->width;
+      events[n_events].delta = -1;
+      n_events++;
+    }
+  qsort (events, n_events, sizeof (SweepEvent), compare_sweep_events);
+
+  /* Visit the candidates from left to right too */
+  order = g_new (int, n_positions);
+  for (i = 0; i < n_positions; i++)
+    order[i] = i;
+  g_qsort_with_data (order, n_positions, sizeof (int),
+                     compare_position_x, (gpointer) positions);
+
+  tree = g_new0 (int, n_ys);
+  j = 0;
+  for (i = 0; i < n_positions; i++)
+    {
+      const MetaRectangle *position = &positions[order[i]];
+
+      for (; j < n_events && events[j].x <= position->x; j++)
+        {
+          fenwick_add (tree, n_ys, events[j].y1, events[j].delta);
+          if (events[j].y2 < n_ys)
+            fenwick_add (tree, n_ys, events[j].y2, -events[j].delta);
+        }
+
+      overlapped[order[i]] =
+        fenwick_get (tree, lower_bound (ys, n_ys, position->y)) > 0;
+    }
+
+  g_free (tree);
+  g_free (order);
+  g_free (events);
+  g_free (ys);
+}
+
+/* What find_first_fit() needs to know about each of the windows; it's
+ * worked out once up front, since getting the outer rect of a window
+ * means asking the theme about its frame.
+ */
+typedef struct
+{
+  MetaRectangle outer;
+
+  /* we're interested in the frame position for sorting,
    * not meta_window_get_position()
    */
-  if (aw->frame)
-    ay = aw->frame->rect.y;
-  else
-    ay = aw->rect.y;
+  int frame_x, frame_y;
 
-  if (bw->frame)
-    by = bw->frame->rect.y;
-  else
-    by = bw->rect.y;
+  /* position in the window list, to keep the sorts stable */
+  int index;
+} PlacementWindow;
 
-  if (ay < by)
-    return -1;
-  else if (ay > by)
-    return 1;
-  else
-    return 0;
+static gint
+topmost_then_leftmost_cmp (gconstpointer a, gconstpointer b)
+{
+  const PlacementWindow *aw = *(PlacementWindow * const *) a;
+  const PlacementWindow *bw = *(PlacementWindow * const *) b;
+
+  if (aw->frame_y != bw->frame_y)
+    return aw->frame_y < bw->frame_y ? -1 : 1;
+  if (aw->frame_x != bw->frame_x)
+    return aw->frame_x < bw->frame_x ? -1 : 1;
+  return aw->index - bw->index;
+}
+
+static gint
+leftmost_then_topmost_cmp (gconstpointer a, gconstpointer b)
+{
+  const PlacementWindow *aw = *(PlacementWindow * const *) a;
+  const PlacementWindow *bw = *(PlacementWindow * const *) b;
+
+  if (aw->frame_x != bw->frame_x)
+    return aw->frame_x < bw->frame_x ? -1 : 1;
+  if (aw->frame_y != bw->frame_y)
+    return aw->frame_y < bw->frame_y ? -1 : 1;
+  return aw->index - bw->index;
 }
 
 static void
@@ -515,31 +660,55 @@ find_first_fit (MetaWindow *window,
                 int        *new_x,
                 int        *new_y)
 {
-  /* This algorithm is limited - it just brute-force tries
-   * to fit the window in a small number of locations that are aligned
-   * with existing windows. It tries to place the window on
-   * the bottom of each existing window, and then to the right
-   * of each existing window, aligned with the left/top of the
-   * existing window in each of those cases.
+  /* This algorithm is limited - it just tries to fit the window in a
+   * small number of locations that are aligned with existing windows.
+   * It tries to place the window on the bottom of each existing window,
+   * and then to the right of each existing window, aligned with the
+   * left/top of the existing window in each of those cases.
    */  
   int retval;
-  GList *below_sorted;
-  GList *right_sorted;
+  PlacementWindow *placement_windows;
+  PlacementWindow **below_sorted;
+  PlacementWindow **right_sorted;
+  MetaRectangle *obstacles;
+  MetaRectangle *candidates;
+  gboolean *overlapped;
+  int n_windows, n_obstacles, n_candidates;
   GList *tmp;
   MetaRectangle rect;
   MetaRectangle work_area;
+  int i;
   
   retval = FALSE;
 
-  /* Below each window */
-  below_sorted = g_list_copy (windows);
-  below_sorted = g_list_sort (below_sorted, leftmost_cmp);
-  below_sorted = g_list_sort (below_sorted, topmost_cmp);  
+  n_windows = g_list_length (windows);
+  placement_windows = g_new (PlacementWindow, n_windows);
+  obstacles = g_new (MetaRectangle, n_windows);
+  n_obstacles = 0;
+
+  for (tmp = windows, i = 0; tmp != NULL; tmp = tmp->next, i++)
+    {
+      MetaWindow *w = tmp->data;
+      PlacementWindow *pw = &placement_windows[i];
+
+      meta_window_get_outer_rect (w, &pw->outer);
+      pw->frame_x = w->frame ? w->frame->rect.x : w->rect.x;
+      pw->frame_y = w->frame ? w->frame->rect.y : w->rect.y;
+      pw->index = i;
 
-  /* To the right of each window */
-  right_sorted = g_list_copy (windows);
-  right_sorted = g_list_sort (right_sorted, topmost_cmp);
-  right_sorted = g_list_sort (right_sorted, leftmost_cmp);
+      if (window_is_placement_obstacle (w))
+        obstacles[n_obstacles++] = pw->outer;
+    }
+
+  /* Below each window, and to the right of each window */
+  below_sorted = g_new (PlacementWindow *, n_windows);
+  right_sorted = g_new (PlacementWindow *, n_windows);
+  for (i = 0; i < n_windows; i++)
+    below_sorted[i] = right_sorted[i] = &placement_windows[i];
+  qsort (below_sorted, n_windows, sizeof (PlacementWindow *),
+         topmost_then_leftmost_cmp);
+  qsort (right_sorted, n_windows, sizeof (PlacementWindow *),
+         leftmost_then_topmost_cmp);
   
   rect.width = window->rect.width;
   rect.height = window->rect.height;
@@ -565,88 +734,60 @@ find_first_fit (MetaWindow *window,
 
     center_tile_rect_in_area (&rect, &work_area);
 
-    if (meta_rectangle_contains_rect (&work_area, &rect) &&
-        !rectangle_overlaps_some_window (&rect, windows))
-      {
-        *new_x = rect.x;
-        *new_y = rect.y;
-        if (borders)
-          {
-            *new_x += borders->visible.left;
-            *new_y += borders->visible.top;
-          }
-    
-        retval = TRUE;
-       
-        goto out;
-      }
+    /* All the places to try, in order: centered, then below each
+     * window, then to the right of each window.
+     */
+    n_candidates = 1 + 2 * n_windows;
+    candidates = g_new (MetaRectangle, n_candidates);
 
-    /* try below each window */
-    tmp = below_sorted;
-    while (tmp != NULL)
+    candidates[0] = rect;
+    for (i = 0; i < n_windows; i++)
       {
-        MetaWindow *w = tmp->data;
-        MetaRectangle outer_rect;
+        const MetaRectangle *outer_rect = &below_sorted[i]->outer;
 
-        meta_window_get_outer_rect (w, &outer_rect);
-      
-        rect.x = outer_rect.x;
-        rect.y = outer_rect.y + outer_rect.height;
-      
-        if (meta_rectangle_contains_rect (&work_area, &rect) &&
-            !rectangle_overlaps_some_window (&rect, below_sorted))
-          {
-            *new_x = rect.x;
-            *new_y = rect.y;
-            if (borders)
-              {
-                *new_x += borders->visible.left;
-                *new_y += borders->visible.top;
-              }
-          
-            retval = TRUE;
-          
-            goto out;
-          }
+        candidates[1 + i] = rect;
+        candidates[1 + i].x = outer_rect->x;
+        candidates[1 + i].y = outer_rect->y + outer_rect->height;
+      }
+    for (i = 0; i < n_windows; i++)
+      {
+        const MetaRectangle *outer_rect = &right_sorted[i]->outer;
 
-        tmp = tmp->next;
+        candidates[1 + n_windows + i] = rect;
+        candidates[1 + n_windows + i].x = outer_rect->x + outer_rect->width;
+        candidates[1 + n_windows + i].y = outer_rect->y;
       }
 
-    /* try to the right of each window */
-    tmp = right_sorted;
-    while (tmp != NULL)
+    overlapped = g_new (gboolean, n_candidates);
+    find_overlapped_positions (obstacles, n_obstacles,
+                               rect.width, rect.height,
+                               candidates, n_candidates,
+                               overlapped);
+
+    for (i = 0; i < n_candidates; i++)
       {
-        MetaWindow *w = tmp->data;
-        MetaRectangle outer_rect;
-   
-        meta_window_get_outer_rect (w, &outer_rect);
-     
-        rect.x = outer_rect.x + outer_rect.width;
-        rect.y = outer_rect.y;
-   
-        if (meta_rectangle_contains_rect (&work_area, &rect) &&
-            !rectangle_overlaps_some_window (&rect, right_sorted))
+        if (meta_rectangle_contains_rect (&work_area, &candidates[i]) &&
+            !overlapped[i])
           {
-            *new_x = rect.x;
-            *new_y = rect.y;
+            *new_x = candidates[i].x;
+            *new_y = candidates[i].y;
             if (borders)
               {
                 *new_x += borders->visible.left;
                 *new_y += borders->visible.top;
               }
-        
+
             retval = TRUE;
-       
-            goto out;
+            break;
           }
-
-        tmp = tmp->next;
       }
-      
- out:
 
-  g_list_free (below_sorted);
-  g_list_free (right_sorted);
+  g_free (overlapped);
+  g_free (candidates);
+  g_free (below_sorted);
+  g_free (right_sorted);
+  g_free (obstacles);
+  g_free (placement_windows);
   return retval;
 }
 
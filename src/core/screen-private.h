@@ -89,6 +89,11 @@ struct _MetaScreen
   
   GList *workspaces;
 
+  /* Windows that belong to one of the workspaces but are shown on
+   * all of them; maintained by workspace.c.
+   */
+  GList *sticky_windows;
+
   MetaStack *stack;
   MetaStackTracker *stack_tracker;
 
@@ -118,6 +123,19 @@ struct _MetaScreen
 
   guint work_area_later;
 
+  /* Work areas and per-monitor regions shared between workspaces,
+   * see workspace.c
+   */
+  GList *work_area_cache;
+  GList *monitor_region_cache;
+
+  /* Bumped whenever new work areas get computed or the monitors
+   * change, so that results computed from the old ones can be told
+   * apart; see constraints.c
+   */
+  guint work_area_generation;
+  guint monitor_generation;
+
   int rows_of_workspaces;
   int columns_of_workspaces;
   MetaScreenCorner starting_corner;
@@ -166,7 +184,8 @@ void          meta_screen_update_cursor       (MetaScreen                 *scree
 void          meta_screen_tab_popup_create       (MetaScreen              *screen,
                                                   MetaTabList              list_type,
                                                   MetaTabShowType          show_type,
-                                                  MetaWindow              *initial_window);
+                                                  MetaWindow              *initial_window,
+                                                  gint64                   requested_time);
 void          meta_screen_tab_popup_forward      (MetaScreen              *screen);
 void          meta_screen_tab_popup_backward     (MetaScreen              *screen);
 MetaWindow*   meta_screen_tab_popup_get_selected (MetaScreen              *screen);
@@ -433,6 +433,8 @@ reload_monitor_infos (MetaScreen *screen)
 {
   MetaDisplay *display;
 
+  screen->monitor_generation++;
+
   {
     GList *tmp;
 
@@ -857,9 +859,14 @@ meta_screen_new (MetaDisplay *display,
                                                                  xroot, 
                                                                  NoEventMask);
   screen->work_area_later = 0;
+  screen->work_area_cache = NULL;
+  screen->monitor_region_cache = NULL;
+  screen->work_area_generation = 0;
+  screen->monitor_generation = 0;
 
   screen->active_workspace = NULL;
   screen->workspaces = NULL;
+  screen->sticky_windows = NULL;
   screen->rows_of_workspaces = 1;
   screen->columns_of_workspaces = -1;
   screen->vertical_workspaces = FALSE;
@@ -1021,6 +1028,8 @@ meta_screen_free (MetaScreen *screen,
   if (screen->work_area_later != 0)
     g_source_remove (screen->work_area_later);
 
+  meta_workspace_free_work_area_cache (screen);
+
   if (screen->monitor_infos)
     g_free (screen->monitor_infos);
 
@@ -1223,27 +1232,6 @@ get_screen_name (MetaDisplay *display,
   return scr;
 }
 
-static gint
-ptrcmp (gconstpointer a, gconstpointer b)
-{
-  if (a < b)
-    return -1;
-  else if (a > b)
-    return 1;
-  else
-    return 0;
-}
-
-static void
-listify_func (gpointer key, gpointer value, gpointer data)
-{
-  GSList **listp;
-  
-  listp = data;
-
-  *listp = g_slist_prepend (*listp, value);
-}
-
 /**
  * meta_screen_foreach_window:
  * @screen: a #MetaScreen
@@ -1261,33 +1249,14 @@ meta_screen_foreach_window (MetaScreen *screen,
   GSList *winlist;
   GSList *tmp;
 
-  /* If we end up doing this often, just keeping a list
-   * of windows might be sensible.
-   */
-  
-  winlist = NULL;
-  g_hash_table_foreach (screen->display->window_ids,
-                        listify_func,
-                        &winlist);
-  
-  winlist = g_slist_sort (winlist, ptrcmp);
-  
-  tmp = winlist;
-  while (tmp != NULL)
+  winlist = meta_display_list_windows (screen->display, META_LIST_DEFAULT);
+
+  for (tmp = winlist; tmp != NULL; tmp = tmp->next)
     {
-      /* If the next node doesn't contain this window
-       * a second time, delete the window.
-       */
-      if (tmp->next == NULL ||
-          (tmp->next && tmp->next->data != tmp->data))
-        {
-          MetaWindow *window = tmp->data;
+      MetaWindow *window = tmp->data;
 
-          if (window->screen == screen && !window->override_redirect)
-            (* func) (screen, window, data);
-        }
-      
-      tmp = tmp->next;
+      if (window->screen == screen)
+        (* func) (screen, window, data);
     }
   g_slist_free (winlist);
 }
@@ -1677,7 +1646,8 @@ void
 meta_screen_tab_popup_create (MetaScreen      *screen,
                               MetaTabList      list_type,
                               MetaTabShowType  show_type,
-                              MetaWindow      *initial_selection)
+                              MetaWindow      *initial_selection,
+                              gint64           requested_time)
 {
   MetaTabEntry *entries;
   GList *tab_list;
@@ -1771,7 +1741,8 @@ meta_screen_tab_popup_create (MetaScreen      *screen,
                                                screen->number,
                                                len,
                                                5, /* FIXME */
-                                               TRUE);
+                                               TRUE,
+                                               requested_time);
 
   for (i = 0; i < len; i++)
     g_object_unref (entries[i].icon);
@@ -1882,7 +1853,8 @@ meta_screen_workspace_popup_create (MetaScreen    *screen,
                                             screen->number,
                                             len,
                                             layout.cols,
-                                            FALSE);
+                                            FALSE,
+                                            0);
 
   g_free (entries);
   meta_screen_free_workspace_layout (&layout);
@@ -54,14 +54,14 @@
  *
  * When we receive a new event: a) we compare the serial in the event to
  * the serial of the queued requests and remove any that are now
- * no longer pending b) if necessary, drop the predicted stacking
- * order to recompute it at the next opportunity.
+ * no longer pending b) if the event was just the server carrying out
+ * the request at the head of the queue, the predicted stacking order
+ * is still right and we keep it; otherwise we drop it to recompute it
+ * at the next opportunity.
  *
- * Possible optimizations:
- *  Keep the stacks as an array + reverse-mapping hash table to avoid
- *    linear lookups.
- *  Keep the stacks as a GList + reverse-mapping hash table to avoid
- *    linear lookups and to make restacking constant-time.
+ * The stacks are kept as a GQueue of windows with a map from each
+ * window to its link, so finding a window and restacking it are both
+ * constant-time.
  */
 
 typedef union _MetaStackOp MetaStackOp;
@@ -108,6 +108,22 @@ union _MetaStackOp
   } lower_below;
 };
 
+/* A stack of windows, bottom to top */
+typedef struct
+{
+  GQueue     *windows;
+
+  /* Maps each window to its link in windows */
+  MetaXidMap *links;
+
+  /* The same windows flattened into an array for
+   * meta_stack_tracker_get_stack(), or NULL if out of date.
+   */
+  GArray     *array;
+} MetaTrackedStack;
+
+#define WINDOW_OF_LINK(l) ((Window) GPOINTER_TO_SIZE ((l)->data))
+
 struct _MetaStackTracker
 {
   MetaScreen *screen;
@@ -115,7 +131,7 @@ struct _MetaStackTracker
   /* This is the last state of the stack as based on events received
    * from the X server.
    */
-  GArray *server_stack;
+  MetaTrackedStack *server_stack;
 
   /* This is the serial of the last request we made that was reflected
    * in server_stack
@@ -130,12 +146,20 @@ struct _MetaStackTracker
   /* This is how we think the stack is, based on server_stack, and
    * on requests we've made subsequent to server_stack
    */
-  GArray *predicted_stack;
+  MetaTrackedStack *predicted_stack;
 
   /* Idle function used to sync the compositor's view of the window
    * stack up with our best guess before a frame is drawn.
    */
   guint sync_stack_later;
+
+  /* The MetaWindows we last passed to the compositor, top to bottom */
+  GArray *synced_windows;
+
+  /* Set when the compositor has to be told about the stack even if
+   * the MetaWindows in it haven't moved.
+   */
+  gboolean force_sync;
 };
 
 static void
@@ -173,20 +197,19 @@ meta_stack_op_dump (MetaStackOp *op,
 static void
 meta_stack_tracker_dump (MetaStackTracker *tracker)
 {
-  guint i;
   GList *l;
 
   meta_topic (META_DEBUG_STACK, "MetaStackTracker state (screen=%d)\n", tracker->screen->number);
   meta_push_no_msg_prefix ();
   meta_topic (META_DEBUG_STACK, "  server_serial: %ld\n", tracker->server_serial);
   meta_topic (META_DEBUG_STACK, "  server_stack: ");
-  for (i = 0; i < tracker->server_stack->len; i++)
-    meta_topic (META_DEBUG_STACK, "  %#lx", g_array_index (tracker->server_stack, Window, i));
+  for (l = tracker->server_stack->windows->head; l; l = l->next)
+    meta_topic (META_DEBUG_STACK, "  %#lx", WINDOW_OF_LINK (l));
   if (tracker->predicted_stack)
     {
       meta_topic (META_DEBUG_STACK, "\n  predicted_stack: ");
-      for (i = 0; i < tracker->predicted_stack->len; i++)
-	meta_topic (META_DEBUG_STACK, "  %#lx", g_array_index (tracker->predicted_stack, Window, i));
+      for (l = tracker->predicted_stack->windows->head; l; l = l->next)
+	meta_topic (META_DEBUG_STACK, "  %#lx", WINDOW_OF_LINK (l));
     }
   meta_topic (META_DEBUG_STACK, "\n  queued_requests: [");
   for (l = tracker->queued_requests->head; l; l = l->next)
@@ -204,88 +227,152 @@ meta_stack_op_free (MetaStackOp *op)
   g_slice_free (MetaStackOp, op);
 }
 
-static int
-find_window (GArray *stack,
-	     Window  window)
+static MetaTrackedStack *
+tracked_stack_new (Window *windows,
+                   guint   n_windows)
 {
+  MetaTrackedStack *stack = g_slice_new (MetaTrackedStack);
   guint i;
 
-  for (i = 0; i < stack->len; i++)
-    if (g_array_index (stack, Window, i) == window)
-      return i;
+  stack->windows = g_queue_new ();
+  stack->links = meta_xid_map_new ();
+  stack->array = NULL;
+
+  for (i = 0; i < n_windows; i++)
+    {
+      g_queue_push_tail (stack->windows, GSIZE_TO_POINTER (windows[i]));
+      meta_xid_map_insert (stack->links, windows[i], stack->windows->tail);
+    }
 
-  return -1;
+  return stack;
 }
 
-/* Returns TRUE if stack was changed */
-static gboolean
-move_window_above (GArray *stack,
-                   Window  window,
-                   int     old_pos,
-                   int     above_pos)
+static MetaTrackedStack *
+tracked_stack_copy (MetaTrackedStack *stack)
 {
-  int i;
+  MetaTrackedStack *copy = tracked_stack_new (NULL, 0);
+  GList *l;
 
-  if (old_pos < above_pos)
+  for (l = stack->windows->head; l; l = l->next)
     {
-      for (i = old_pos; i < above_pos; i++)
-	g_array_index (stack, Window, i) = g_array_index (stack, Window, i + 1);
+      g_queue_push_tail (copy->windows, l->data);
+      meta_xid_map_insert (copy->links, WINDOW_OF_LINK (l), copy->windows->tail);
+    }
 
-      g_array_index (stack, Window, above_pos) = window;
+  return copy;
+}
 
-      return TRUE;
-    }
-  else if (old_pos > above_pos + 1)
+static void
+tracked_stack_free (MetaTrackedStack *stack)
+{
+  g_queue_free (stack->windows);
+  meta_xid_map_free (stack->links);
+  if (stack->array)
+    g_array_free (stack->array, TRUE);
+
+  g_slice_free (MetaTrackedStack, stack);
+}
+
+static GList *
+tracked_stack_find (MetaTrackedStack *stack,
+                    Window            window)
+{
+  return meta_xid_map_lookup (stack->links, window);
+}
+
+static GArray *
+tracked_stack_get_array (MetaTrackedStack *stack)
+{
+  if (stack->array == NULL)
     {
-      for (i = old_pos; i > above_pos + 1; i--)
-	g_array_index (stack, Window, i) = g_array_index (stack, Window, i - 1);
+      GList *l;
+      guint i;
 
-      g_array_index (stack, Window, above_pos + 1) = window;
+      stack->array = g_array_sized_new (FALSE, FALSE, sizeof (Window),
+                                        stack->windows->length);
+      g_array_set_size (stack->array, stack->windows->length);
 
-      return TRUE;
+      for (l = stack->windows->head, i = 0; l; l = l->next, i++)
+        g_array_index (stack->array, Window, i) = WINDOW_OF_LINK (l);
     }
-  else
+
+  return stack->array;
+}
+
+/* Moves the window at link to just above the one at above_link, or to
+ * the bottom if above_link is NULL.  Returns TRUE if stack was changed
+ */
+static gboolean
+move_window_above (MetaTrackedStack *stack,
+                   GList            *link,
+                   GList            *above_link)
+{
+  Window window = WINDOW_OF_LINK (link);
+
+  if (link == above_link || link->prev == above_link)
     return FALSE;
+
+  g_queue_delete_link (stack->windows, link);
+
+  if (above_link)
+    {
+      g_queue_insert_after (stack->windows, above_link, GSIZE_TO_POINTER (window));
+      link = above_link->next;
+    }
+  else
+    {
+      g_queue_push_head (stack->windows, GSIZE_TO_POINTER (window));
+      link = stack->windows->head;
+    }
+
+  meta_xid_map_insert (stack->links, window, link);
+
+  return TRUE;
 }
 
 /* Returns TRUE if stack was changed */
 static gboolean
-meta_stack_op_apply (MetaStackOp *op,
-		     GArray      *stack)
+meta_stack_op_apply (MetaStackOp      *op,
+		     MetaTrackedStack *stack)
 {
+  gboolean changed = FALSE;
+
   switch (op->any.type)
     {
     case STACK_OP_ADD:
       {
-	int old_pos = find_window (stack, op->add.window);
-	if (old_pos >= 0)
+	if (tracked_stack_find (stack, op->add.window))
 	  {
 	    g_warning ("STACK_OP_ADD: window %#lx already in stack",
 		       op->add.window);
 	    return FALSE;
 	  }
 
-	g_array_append_val (stack, op->add.window);
-	return TRUE;
+	g_queue_push_tail (stack->windows, GSIZE_TO_POINTER (op->add.window));
+	meta_xid_map_insert (stack->links, op->add.window, stack->windows->tail);
+	changed = TRUE;
+	break;
       }
     case STACK_OP_REMOVE:
       {
-	int old_pos = find_window (stack, op->remove.window);
-	if (old_pos < 0)
+	GList *link = tracked_stack_find (stack, op->remove.window);
+	if (link == NULL)
 	  {
 	    g_warning ("STACK_OP_REMOVE: window %#lx not in stack",
 		       op->remove.window);
 	    return FALSE;
 	  }
 
-	g_array_remove_index (stack, old_pos);
-	return TRUE;
+	g_queue_delete_link (stack->windows, link);
+	meta_xid_map_remove (stack->links, op->remove.window);
+	changed = TRUE;
+	break;
       }
     case STACK_OP_RAISE_ABOVE:
       {
-	int old_pos = find_window (stack, op->raise_above.window);
-	int above_pos;
-	if (old_pos < 0)
+	GList *link = tracked_stack_find (stack, op->raise_above.window);
+	GList *above_link;
+	if (link == NULL)
 	  {
 	    g_warning ("STACK_OP_RAISE_ABOVE: window %#lx not in stack",
 		       op->raise_above.window);
@@ -294,8 +381,8 @@ meta_stack_op_apply (MetaStackOp *op,
 
 	if (op->raise_above.sibling != None)
 	  {
-	    above_pos = find_window (stack, op->raise_above.sibling);
-	    if (above_pos < 0)
+	    above_link = tracked_stack_find (stack, op->raise_above.sibling);
+	    if (above_link == NULL)
 	      {
 		g_warning ("STACK_OP_RAISE_ABOVE: sibling window %#lx not in stack",
 			   op->raise_above.sibling);
@@ -304,16 +391,17 @@ meta_stack_op_apply (MetaStackOp *op,
 	  }
 	else
 	  {
-	    above_pos = -1;
+	    above_link = NULL;
 	  }
 
-	return move_window_above (stack, op->raise_above.window, old_pos, above_pos);
+	changed = move_window_above (stack, link, above_link);
+	break;
       }
     case STACK_OP_LOWER_BELOW:
       {
-	int old_pos = find_window (stack, op->lower_below.window);
-	int above_pos;
-	if (old_pos < 0)
+	GList *link = tracked_stack_find (stack, op->lower_below.window);
+	GList *above_link;
+	if (link == NULL)
 	  {
 	    g_warning ("STACK_OP_LOWER_BELOW: window %#lx not in stack",
 		       op->lower_below.window);
@@ -322,39 +410,97 @@ meta_stack_op_apply (MetaStackOp *op,
 
 	if (op->lower_below.sibling != None)
 	  {
-	    int below_pos = find_window (stack, op->lower_below.sibling);
-	    if (below_pos < 0)
+	    GList *below_link = tracked_stack_find (stack, op->lower_below.sibling);
+	    if (below_link == NULL)
 	      {
 		g_warning ("STACK_OP_LOWER_BELOW: sibling window %#lx not in stack",
 			   op->lower_below.sibling);
 		return FALSE;
 	      }
 
-	    above_pos = below_pos - 1;
+	    /* Lowering a window below itself does nothing */
+	    if (below_link == link)
+	      return FALSE;
+
+	    above_link = below_link->prev;
 	  }
 	else
 	  {
-	    above_pos = stack->len - 1;
+	    above_link = stack->windows->tail;
 	  }
 
-	return move_window_above (stack, op->lower_below.window, old_pos, above_pos);
+	changed = move_window_above (stack, link, above_link);
+	break;
       }
     }
 
-  g_assert_not_reached ();
-  return FALSE;
+  if (changed && stack->array)
+    {
+      g_array_free (stack->array, TRUE);
+      stack->array = NULL;
+    }
+
+  return changed;
 }
 
-static GArray *
-copy_stack (Window *windows,
-	    guint   n_windows)
+/* Would applying op to stack leave it the same as applying event does?
+ * Both restack or add or remove the same window, so it's enough to
+ * check that they leave it in the same place.
+ */
+static gboolean
+meta_stack_op_matches_event (MetaStackOp      *op,
+                             MetaStackOp      *event,
+                             MetaTrackedStack *stack)
 {
-  GArray *stack = g_array_new (FALSE, FALSE, sizeof (Window));
+  GList *link, *sibling_link;
+  Window window, below;
 
-  g_array_set_size (stack, n_windows);
-  memcpy (stack->data, windows, sizeof (Window) * n_windows);
+  switch (event->any.type)
+    {
+    case STACK_OP_ADD:
+      return op->any.type == STACK_OP_ADD && op->add.window == event->add.window;
+    case STACK_OP_REMOVE:
+      return op->any.type == STACK_OP_REMOVE && op->remove.window == event->remove.window;
+    case STACK_OP_LOWER_BELOW:
+      return FALSE;
+    case STACK_OP_RAISE_ABOVE:
+      break;
+    }
 
-  return stack;
+  /* Configure events say which window ended up directly below the
+   * restacked window, so work out which window the op would put there.
+   */
+  switch (op->any.type)
+    {
+    case STACK_OP_RAISE_ABOVE:
+      window = op->raise_above.window;
+      below = op->raise_above.sibling;
+      break;
+    case STACK_OP_LOWER_BELOW:
+      window = op->lower_below.window;
+      link = tracked_stack_find (stack, window);
+      if (op->lower_below.sibling != None)
+        sibling_link = tracked_stack_find (stack, op->lower_below.sibling);
+      else
+        sibling_link = NULL;
+
+      if (link == NULL || (op->lower_below.sibling != None && sibling_link == NULL))
+        return FALSE;
+
+      if (sibling_link)
+        below = sibling_link->prev ? WINDOW_OF_LINK (sibling_link->prev) : None;
+      else
+        below = WINDOW_OF_LINK (stack->windows->tail);
+
+      /* The window itself moves out from under its sibling */
+      if (below == window)
+        below = link->prev ? WINDOW_OF_LINK (link->prev) : None;
+      break;
+    default:
+      return FALSE;
+    }
+
+  return window == event->raise_above.window && below == event->raise_above.sibling;
 }
 
 MetaStackTracker *
@@ -373,11 +519,13 @@ meta_stack_tracker_new (MetaScreen *screen)
   XQueryTree (screen->display->xdisplay,
               screen->xroot,
               &ignored1, &ignored2, &children, &n_children);
-  tracker->server_stack = copy_stack (children, n_children);
+  tracker->server_stack = tracked_stack_new (children, n_children);
   XFree (children);
 
   tracker->queued_requests = g_queue_new ();
 
+  tracker->synced_windows = g_array_new (FALSE, FALSE, sizeof (MetaWindow *));
+
   return tracker;
 }
 
@@ -387,15 +535,19 @@ meta_stack_tracker_free (MetaStackTracker *tracker)
   if (tracker->sync_stack_later)
     meta_later_remove (tracker->sync_stack_later);
 
-  g_array_free (tracker->server_stack, TRUE);
+  tracked_stack_free (tracker->server_stack);
   if (tracker->predicted_stack)
-    g_array_free (tracker->predicted_stack, TRUE);
+    tracked_stack_free (tracker->predicted_stack);
+
+  g_array_free (tracker->synced_windows, TRUE);
 
   g_queue_foreach (tracker->queued_requests, (GFunc)meta_stack_op_free, NULL);
   g_queue_free (tracker->queued_requests);
   tracker->queued_requests = NULL;
 }
 
+static void stack_tracker_queue_sync_stack (MetaStackTracker *tracker);
+
 static void
 stack_tracker_queue_request (MetaStackTracker *tracker,
 			     MetaStackOp      *op)
@@ -404,7 +556,7 @@ stack_tracker_queue_request (MetaStackTracker *tracker,
   g_queue_push_tail (tracker->queued_requests, op);
   if (!tracker->predicted_stack ||
       meta_stack_op_apply (op, tracker->predicted_stack))
-    meta_stack_tracker_queue_sync_stack (tracker);
+    stack_tracker_queue_sync_stack (tracker);
 
   meta_stack_tracker_dump (tracker);
 }
@@ -505,7 +657,9 @@ static void
 stack_tracker_event_received (MetaStackTracker *tracker,
 			      MetaStackOp      *op)
 {
-  gboolean need_sync = FALSE;
+  gboolean was_predicted = FALSE;
+  gboolean changed;
+  int n_retired = 0;
 
   meta_stack_op_dump (op, "Stack op event received: ", "\n");
 
@@ -514,8 +668,19 @@ stack_tracker_event_received (MetaStackTracker *tracker,
 
   tracker->server_serial = op->any.serial;
 
-  if (meta_stack_op_apply (op, tracker->server_stack))
-    need_sync = TRUE;
+  /* Usually the event is the server doing what we asked for in the
+   * oldest queued request, and the predicted stack already has it.
+   */
+  if (tracker->queued_requests->head)
+    {
+      MetaStackOp *queued_op = tracker->queued_requests->head->data;
+
+      if (queued_op->any.serial <= op->any.serial)
+        was_predicted = meta_stack_op_matches_event (queued_op, op,
+                                                     tracker->server_stack);
+    }
+
+  changed = meta_stack_op_apply (op, tracker->server_stack);
 
   while (tracker->queued_requests->head)
     {
@@ -525,20 +690,36 @@ stack_tracker_event_received (MetaStackTracker *tracker,
 
       g_queue_pop_head (tracker->queued_requests);
       meta_stack_op_free (queued_op);
-      need_sync = TRUE;
+      n_retired++;
     }
 
-  if (need_sync)
+  if (n_retired == 0 && tracker->predicted_stack &&
+      tracker->queued_requests->length == 0)
+    {
+      /* Nothing of ours was pending, so the prediction was just the
+       * server stack and the event applies to it the same way.
+       */
+      meta_stack_op_apply (op, tracker->predicted_stack);
+    }
+  else if (n_retired == 1 && was_predicted)
+    {
+      /* The predicted stack already reflects this */
+      changed = FALSE;
+    }
+  else if (changed || n_retired > 0)
     {
       if (tracker->predicted_stack)
         {
-          g_array_free (tracker->predicted_stack, TRUE);
+          tracked_stack_free (tracker->predicted_stack);
           tracker->predicted_stack = NULL;
         }
 
-      meta_stack_tracker_queue_sync_stack (tracker);
+      changed = TRUE;
     }
 
+  if (changed)
+    stack_tracker_queue_sync_stack (tracker);
+
   meta_stack_tracker_dump (tracker);
 }
 
@@ -632,9 +813,9 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
 {
   GArray *stack;
 
-  if (tracker->queued_requests->length == 0)
+  if (tracker->queued_requests->length == 0 && tracker->predicted_stack == NULL)
     {
-      stack = tracker->server_stack;
+      stack = tracked_stack_get_array (tracker->server_stack);
     }
   else
     {
@@ -642,8 +823,7 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
         {
           GList *l;
 
-          tracker->predicted_stack = copy_stack ((Window *)tracker->server_stack->data,
-                                                 tracker->server_stack->len);
+          tracker->predicted_stack = tracked_stack_copy (tracker->server_stack);
           for (l = tracker->queued_requests->head; l; l = l->next)
             {
               MetaStackOp *op = l->data;
@@ -651,7 +831,7 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
             }
         }
 
-      stack = tracker->predicted_stack;
+      stack = tracked_stack_get_array (tracker->predicted_stack);
     }
 
   if (windows)
@@ -660,17 +840,11 @@ meta_stack_tracker_get_stack (MetaStackTracker *tracker,
     *n_windows = stack->len;
 }
 
-/**
- * meta_stack_tracker_sync_stack:
- * @tracker: a #MetaStackTracker
- *
- * Informs the compositor of the current stacking order of windows,
- * based on the predicted view maintained by the #MetaStackTracker.
- */
-void
-meta_stack_tracker_sync_stack (MetaStackTracker *tracker)
+static void
+stack_tracker_sync_stack (MetaStackTracker *tracker)
 {
-  GList *meta_windows;
+  GArray *meta_windows;
+  GList *meta_window_list;
   Window *windows;
   int n_windows;
   int i;
@@ -683,8 +857,8 @@ meta_stack_tracker_sync_stack (MetaStackTracker *tracker)
 
   meta_stack_tracker_get_stack (tracker, &windows, &n_windows);
 
-  meta_windows = NULL;
-  for (i = 0; i < n_windows; i++)
+  meta_windows = g_array_new (FALSE, FALSE, sizeof (MetaWindow *));
+  for (i = n_windows - 1; i >= 0; i--)
     {
       MetaWindow *meta_window;
 
@@ -699,26 +873,77 @@ meta_stack_tracker_sync_stack (MetaStackTracker *tracker)
       if (meta_window &&
           (windows[i] == meta_window->xwindow ||
            (meta_window->frame && windows[i] == meta_window->frame->xwindow)))
-        meta_windows = g_list_prepend (meta_windows, meta_window);
+        g_array_append_val (meta_windows, meta_window);
+    }
+
+  /* Restacking windows that have no MetaWindow, such as our own
+   * guard and UI windows or the toolkit windows described above,
+   * doesn't change anything the compositor sees.
+   */
+  if (!tracker->force_sync &&
+      meta_windows->len == tracker->synced_windows->len &&
+      memcmp (meta_windows->data, tracker->synced_windows->data,
+              meta_windows->len * sizeof (MetaWindow *)) == 0)
+    {
+      meta_topic (META_DEBUG_STACK, "Stack of MetaWindows unchanged, not syncing\n");
+      g_array_free (meta_windows, TRUE);
+      return;
     }
 
+  g_array_free (tracker->synced_windows, TRUE);
+  tracker->synced_windows = meta_windows;
+  tracker->force_sync = FALSE;
+
+  meta_window_list = NULL;
+  for (i = meta_windows->len - 1; i >= 0; i--)
+    meta_window_list = g_list_prepend (meta_window_list,
+                                       g_array_index (meta_windows, MetaWindow *, i));
+
   if (tracker->screen->display->compositor)
     meta_compositor_sync_stack (tracker->screen->display->compositor,
                                 tracker->screen,
-                                meta_windows);
-  g_list_free (meta_windows);
+                                meta_window_list);
+  g_list_free (meta_window_list);
 
   meta_screen_restacked (tracker->screen);
 }
 
+/**
+ * meta_stack_tracker_sync_stack:
+ * @tracker: a #MetaStackTracker
+ *
+ * Informs the compositor of the current stacking order of windows,
+ * based on the predicted view maintained by the #MetaStackTracker.
+ */
+void
+meta_stack_tracker_sync_stack (MetaStackTracker *tracker)
+{
+  tracker->force_sync = TRUE;
+  stack_tracker_sync_stack (tracker);
+}
+
 static gboolean
 stack_tracker_sync_stack_later (gpointer data)
 {
-  meta_stack_tracker_sync_stack (data);
+  stack_tracker_sync_stack (data);
 
   return FALSE;
 }
 
+/* Queues a sync because the X stack changed; if none of the MetaWindows
+ * moved, the compositor won't be bothered with it.
+ */
+static void
+stack_tracker_queue_sync_stack (MetaStackTracker *tracker)
+{
+  if (tracker->sync_stack_later == 0)
+    {
+      tracker->sync_stack_later = meta_later_add (META_LATER_BEFORE_REDRAW,
+                                                  stack_tracker_sync_stack_later,
+                                                  tracker, NULL);
+    }
+}
+
 /**
  * meta_stack_tracker_queue_sync_stack:
  * @tracker: a #MetaStackTracker
@@ -735,11 +960,6 @@ stack_tracker_sync_stack_later (gpointer data)
 void
 meta_stack_tracker_queue_sync_stack (MetaStackTracker *tracker)
 {
-  if (tracker->sync_stack_later == 0)
-    {
-      tracker->sync_stack_later = meta_later_add (META_LATER_BEFORE_REDRAW,
-                                                  stack_tracker_sync_stack_later,
-                                                  tracker, NULL);
-    }
+  tracker->force_sync = TRUE;
+  stack_tracker_queue_sync_stack (tracker);
 }
-
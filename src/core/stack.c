@@ -37,6 +37,8 @@
 
 #include <X11/Xatom.h>
 
+#include <string.h>
+
 #define WINDOW_HAS_TRANSIENT_TYPE(w)                    \
           (w->type == META_WINDOW_DIALOG ||             \
 	   w->type == META_WINDOW_MODAL_DIALOG ||       \
@@ -58,33 +60,45 @@ static void stack_do_window_deletions (MetaStack *stack);
 static void stack_do_window_additions (MetaStack *stack);
 static void stack_do_relayer          (MetaStack *stack);
 static void stack_do_constrain        (MetaStack *stack);
-static void stack_do_resort           (MetaStack *stack);
 
 static void stack_ensure_sorted (MetaStack *stack);
 
+static void free_constraints          (MetaStack  *stack);
+static void remove_window_constraints (MetaStack  *stack,
+                                       MetaWindow *window);
+static void queue_constrain           (MetaStack  *stack,
+                                       MetaWindow *window);
+
 MetaStack*
 meta_stack_new (MetaScreen *screen)
 {
   MetaStack *stack;
-  
+
   stack = g_new (MetaStack, 1);
 
   stack->screen = screen;
   stack->windows = g_array_new (FALSE, FALSE, sizeof (Window));
 
-  stack->sorted = NULL;
+  stack->sorted = g_array_new (FALSE, FALSE, sizeof (MetaWindow *));
+  stack->by_position = g_array_new (FALSE, FALSE, sizeof (MetaWindow *));
   stack->added = NULL;
   stack->removed = NULL;
 
   stack->freeze_count = 0;
   stack->last_root_children_stacked = NULL;
+  stack->last_all_hidden = NULL;
+  stack->last_client_list_stacking = NULL;
 
   stack->n_positions = 0;
 
-  stack->need_resort = FALSE;
+  stack->constraints = NULL;
+  stack->constrain_pending = NULL;
+
   stack->need_relayer = FALSE;
   stack->need_constrain = FALSE;
-  
+  stack->constraining = FALSE;
+  stack->need_client_list = TRUE;
+
   return stack;
 }
 
@@ -93,16 +107,136 @@ meta_stack_free (MetaStack *stack)
 {
   g_array_free (stack->windows, TRUE);
 
-  g_list_free (stack->sorted);
+  g_array_free (stack->sorted, TRUE);
+  g_array_free (stack->by_position, TRUE);
   g_list_free (stack->added);
   g_list_free (stack->removed);
 
+  free_constraints (stack);
+
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
-  
+  if (stack->last_all_hidden)
+    g_array_free (stack->last_all_hidden, TRUE);
+  if (stack->last_client_list_stacking)
+    g_array_free (stack->last_client_list_stacking, TRUE);
+
   g_free (stack);
 }
 
+/* Bottom to top: -1 means a is below b */
+static inline int
+compare_window_position (MetaWindow *window_a,
+                         MetaWindow *window_b)
+{
+  /* Go by layer, then stack_position */
+  if (window_a->layer < window_b->layer)
+    return -1;
+  else if (window_a->layer > window_b->layer)
+    return 1;
+  else if (window_a->stack_position < window_b->stack_position)
+    return -1;
+  else if (window_a->stack_position > window_b->stack_position)
+    return 1;
+  else
+    return 0; /* not reached */
+}
+
+static int
+compare_sorted_windows (gconstpointer a,
+                        gconstpointer b)
+{
+  return compare_window_position (*(MetaWindow **) a, *(MetaWindow **) b);
+}
+
+/* Index of the first window in stack->sorted that isn't below @window;
+ * that's where @window is, or where it should go if it isn't there.
+ */
+static int
+sorted_lower_bound (MetaStack  *stack,
+                    MetaWindow *window)
+{
+  MetaWindow **sorted = (MetaWindow **) stack->sorted->data;
+  int low, high;
+
+  low = 0;
+  high = stack->sorted->len;
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+
+      if (compare_window_position (sorted[mid], window) < 0)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  return low;
+}
+
+/* Returns the index of @window in stack->sorted, or -1 if it isn't
+ * there (yet).  Only valid while the window's layer and stack position
+ * are what they were when it was last put in place.
+ */
+static int
+find_sorted_index (MetaStack  *stack,
+                   MetaWindow *window)
+{
+  int i;
+
+  i = sorted_lower_bound (stack, window);
+  if (i < (int) stack->sorted->len &&
+      g_array_index (stack->sorted, MetaWindow *, i) == window)
+    return i;
+  else
+    return -1;
+}
+
+/* The window at index @i of stack->sorted has had its layer or stack
+ * position changed; move it to where it now belongs.  The rest of the
+ * array must still be in order, which holds because changing one
+ * window's stack position shifts the windows in between by one
+ * without changing their order among themselves.
+ */
+static void
+reposition_sorted_window (MetaStack *stack,
+                          int        i)
+{
+  MetaWindow **sorted = (MetaWindow **) stack->sorted->data;
+  MetaWindow *window = sorted[i];
+  int n = stack->sorted->len;
+
+  while (i + 1 < n && compare_window_position (sorted[i + 1], window) < 0)
+    {
+      sorted[i] = sorted[i + 1];
+      ++i;
+    }
+
+  while (i > 0 && compare_window_position (sorted[i - 1], window) > 0)
+    {
+      sorted[i] = sorted[i - 1];
+      --i;
+    }
+
+  sorted[i] = window;
+}
+
+static void
+set_window_layer (MetaStack      *stack,
+                  MetaWindow     *window,
+                  MetaStackLayer  layer)
+{
+  int i;
+
+  if (window->layer == layer)
+    return;
+
+  i = find_sorted_index (stack, window);
+  window->layer = layer;
+  if (i >= 0)
+    reposition_sorted_window (stack, i);
+}
+
 void
 meta_stack_add (MetaStack  *stack,
                 MetaWindow *window)
@@ -111,15 +245,16 @@ meta_stack_add (MetaStack  *stack,
 
   if (window->stack_position >= 0)
     meta_bug ("Window %s had stack position already\n", window->desc);
-  
+
   stack->added = g_list_prepend (stack->added, window);
 
   window->stack_position = stack->n_positions;
   stack->n_positions += 1;
+  g_array_append_val (stack->by_position, window);
   meta_topic (META_DEBUG_STACK,
               "Window %s has stack_position initialized to %d\n",
               window->desc, window->stack_position);
-  
+
   stack_sync_to_server (stack);
 }
 
@@ -127,6 +262,8 @@ void
 meta_stack_remove (MetaStack  *stack,
                    MetaWindow *window)
 {
+  int i;
+
   meta_topic (META_DEBUG_STACK, "Removing window %s from the stack\n", window->desc);
 
   if (window->stack_position < 0)
@@ -138,12 +275,18 @@ meta_stack_remove (MetaStack  *stack,
    */
   meta_window_set_stack_position_no_sync (window,
                                           stack->n_positions - 1);
-  window->stack_position = -1;
-  stack->n_positions -= 1;  
 
   /* We don't know if it's been moved from "added" to "stack" yet */
   stack->added = g_list_remove (stack->added, window);
-  stack->sorted = g_list_remove (stack->sorted, window);
+  i = find_sorted_index (stack, window);
+  if (i >= 0)
+    g_array_remove_index (stack->sorted, i);
+
+  remove_window_constraints (stack, window);
+
+  g_array_set_size (stack->by_position, stack->n_positions - 1);
+  window->stack_position = -1;
+  stack->n_positions -= 1;
 
   /* Remember the window ID to remove it from the stack array.
    * The macro is safe to use: Window is guaranteed to be 32 bits, and
@@ -154,7 +297,7 @@ meta_stack_remove (MetaStack  *stack,
   if (window->frame)
     stack->removed = g_list_prepend (stack->removed,
                                      GUINT_TO_POINTER (window->frame->xwindow));
-  
+
   stack_sync_to_server (stack);
 }
 
@@ -163,7 +306,7 @@ meta_stack_update_layer (MetaStack  *stack,
                          MetaWindow *window)
 {
   stack->need_relayer = TRUE;
-  
+
   stack_sync_to_server (stack);
 }
 
@@ -172,7 +315,7 @@ meta_stack_update_transient (MetaStack  *stack,
                              MetaWindow *window)
 {
   stack->need_constrain = TRUE;
-  
+
   stack_sync_to_server (stack);
 }
 
@@ -180,10 +323,10 @@ meta_stack_update_transient (MetaStack  *stack,
 void
 meta_stack_raise (MetaStack  *stack,
                   MetaWindow *window)
-{  
+{
   meta_window_set_stack_position_no_sync (window,
                                           stack->n_positions - 1);
-  
+
   stack_sync_to_server (stack);
 }
 
@@ -192,7 +335,7 @@ meta_stack_lower (MetaStack  *stack,
                   MetaWindow *window)
 {
   meta_window_set_stack_position_no_sync (window, 0);
-  
+
   stack_sync_to_server (stack);
 }
 
@@ -329,18 +472,20 @@ get_maximum_layer_in_group (MetaWindow *window)
   return max;
 }
 
-static void
+static MetaStackLayer
 compute_layer (MetaWindow *window)
 {
-  window->layer = get_standalone_layer (window);
-  
+  MetaStackLayer layer;
+
+  layer = get_standalone_layer (window);
+
   /* We can only do promotion-due-to-group for dialogs and other
    * transients, or weird stuff happens like the desktop window and
    * nautilus windows getting in the same layer, or all gnome-terminal
    * windows getting in fullscreen layer if any terminal is
    * fullscreen.
    */
-  if (window->layer != META_LAYER_DESKTOP &&
+  if (layer != META_LAYER_DESKTOP &&
       WINDOW_HAS_TRANSIENT_TYPE(window) &&
       (window->xtransient_for == None ||
        window->transient_parent_is_root_window))
@@ -350,51 +495,30 @@ compute_layer (MetaWindow *window)
        * and a dialog transient for the normal window; you don't want the dialog
        * above the dock if it wouldn't normally be.
        */
-      
+
       MetaStackLayer group_max;
-      
+
       group_max = get_maximum_layer_in_group (window);
-      
-      if (group_max > window->layer)
+
+      if (group_max > layer)
         {
           meta_topic (META_DEBUG_STACK,
                       "Promoting window %s from layer %u to %u due to group membership\n",
-                      window->desc, window->layer, group_max);
-          window->layer = group_max;
+                      window->desc, layer, group_max);
+          layer = group_max;
         }
     }
 
   meta_topic (META_DEBUG_STACK, "Window %s on layer %u type = %u has_focus = %d\n",
-              window->desc, window->layer,
+              window->desc, layer,
               window->type, window->has_focus);
-}
 
-/* Front of the layer list is the topmost window,
- * so the lower stack position is later in the list
- */
-static int
-compare_window_position (void *a,
-                         void *b)
-{
-  MetaWindow *window_a = a;
-  MetaWindow *window_b = b;
-
-  /* Go by layer, then stack_position */
-  if (window_a->layer < window_b->layer)
-    return 1; /* move window_a later in list */
-  else if (window_a->layer > window_b->layer)
-    return -1;
-  else if (window_a->stack_position < window_b->stack_position)
-    return 1; /* move window_a later in list */
-  else if (window_a->stack_position > window_b->stack_position)
-    return -1;
-  else
-    return 0; /* not reached */
+  return layer;
 }
-  
+
 /*
  * Stacking constraints
- * 
+ *
  * Assume constraints of the form "AB" meaning "window A must be
  * below window B"
  *
@@ -411,22 +535,24 @@ compare_window_position (void *a,
  *  apply BC: ABC
  *
  * but apply constraints in the wrong order and it breaks:
- * 
+ *
  *  start:    BCA
  *  apply BC: BCA
  *  apply AB: CAB
  *
- * We make a directed graph of the constraints by linking
- * from "above windows" to "below windows as follows:
- * 
- *   AB -> BC -> CD
- *          \
- *           CE
+ * So whenever we move a window above the window it is constrained to
+ * be above, we go on to the windows that are constrained above *it*,
+ * walking the graph of constraints from parents to transients.
  *
- * If we then walk that graph and apply the constraints in the order
- * that they appear, we will apply them correctly. Note that the
- * graph MAY have cycles, so we have to guard against that.
+ * Moving a window shifts every window in between by one place, which
+ * doesn't change their order among themselves; so a move can only
+ * break the constraints of the window that was moved.  Rather than
+ * applying every constraint each time anything moves, we keep the
+ * constraints around and only check those of the windows that moved
+ * since the last time.  They are only worked out again from scratch
+ * when transiency, types or groups change, or windows are added.
  *
+ * The graph MAY have cycles, so we have to guard against that.
  */
 
 typedef struct Constraint Constraint;
@@ -435,83 +561,129 @@ struct Constraint
 {
   MetaWindow *above;
   MetaWindow *below;
+};
 
-  /* used to keep the constraint in the
-   * list of constraints for window "below"
-   */
-  Constraint *next;
+typedef struct
+{
+  /* Constraints keeping this window above other windows */
+  GSList *parents;
 
-  /* used to create the graph. */
-  GSList *next_nodes;
-  
-  /* constraint has been applied, used
-   * to detect cycles.
+  /* Constraints keeping other windows above this one */
+  GSList *transients;
+
+  /* Window is in stack->constrain_pending */
+  unsigned int pending : 1;
+
+  /* Window is on the path of constraints being traversed,
+   * used to break cycles.
    */
-  unsigned int applied : 1;
-
-  /* constraint has a previous node in the graph,
-   * used to find places to start in the graph.
-   * (I think this also has the side effect
-   * of preventing cycles, since cycles will
-   * have no starting point - so maybe
-   * the "applied" flag isn't needed.)
+  unsigned int traversing : 1;
+} WindowConstraints;
+
+static WindowConstraints*
+get_window_constraints (MetaStack  *stack,
+                        MetaWindow *window,
+                        gboolean    create)
+{
+  WindowConstraints *node;
+
+  if (stack->constraints == NULL)
+    return NULL;
+
+  node = g_hash_table_lookup (stack->constraints, window);
+  if (node == NULL && create)
+    {
+      node = g_new0 (WindowConstraints, 1);
+      g_hash_table_insert (stack->constraints, window, node);
+    }
+
+  return node;
+}
+
+static gboolean
+constraint_is_broken (Constraint *c)
+{
+  return
+    (WINDOW_HAS_TRANSIENT_TYPE (c->above) &&
+     c->above->layer < c->below->layer) ||
+    c->above->stack_position < c->below->stack_position;
+}
+
+static void
+queue_constrain (MetaStack  *stack,
+                 MetaWindow *window)
+{
+  WindowConstraints *node;
+
+  /* Anything we move while applying constraints gets taken care of
+   * right away.
    */
-  unsigned int has_prev : 1;
-};
+  if (stack->constraining)
+    return;
+
+  node = get_window_constraints (stack, window, FALSE);
+  if (node == NULL || node->pending)
+    return;
+
+  node->pending = TRUE;
+  stack->constrain_pending = g_list_prepend (stack->constrain_pending,
+                                             window);
+}
 
-/* We index the array of constraints by window
- * stack positions, just because the stack
- * positions are a convenient index.
- */
 static void
-add_constraint (Constraint **constraints,
-                MetaWindow  *above,
-                MetaWindow  *below)
+add_constraint (MetaStack  *stack,
+                MetaWindow *above,
+                MetaWindow *below)
 {
+  WindowConstraints *below_node;
+  WindowConstraints *above_node;
   Constraint *c;
+  GSList *tmp;
 
   g_assert (above->screen == below->screen);
-  
+
   /* check if constraint is a duplicate */
-  c = constraints[below->stack_position];
-  while (c != NULL)
+  below_node = get_window_constraints (stack, below, TRUE);
+  for (tmp = below_node->transients; tmp != NULL; tmp = tmp->next)
     {
+      c = tmp->data;
       if (c->above == above)
         return;
-      c = c->next;
     }
 
   /* if not, add the constraint */
   c = g_new (Constraint, 1);
   c->above = above;
   c->below = below;
-  c->next = constraints[below->stack_position];
-  c->next_nodes = NULL;
-  c->applied = FALSE;
-  c->has_prev = FALSE;
 
-  constraints[below->stack_position] = c;
+  below_node->transients = g_slist_prepend (below_node->transients, c);
+
+  above_node = get_window_constraints (stack, above, TRUE);
+  above_node->parents = g_slist_prepend (above_node->parents, c);
+
+  if (constraint_is_broken (c))
+    queue_constrain (stack, above);
 }
 
 static void
-create_constraints (Constraint **constraints,
-                    GList       *windows)
+create_constraints (MetaStack *stack)
 {
-  GList *tmp;
-  
-  tmp = windows;
-  while (tmp != NULL)
+  int i;
+
+  stack->constraints = g_hash_table_new (NULL, NULL);
+
+  i = stack->sorted->len;
+  while (i > 0)
     {
-      MetaWindow *w = tmp->data;
+      MetaWindow *w = g_array_index (stack->sorted, MetaWindow *, --i);
 
       if (!WINDOW_IN_STACK (w))
         {
           meta_topic (META_DEBUG_STACK, "Window %s not in the stack, not constraining it\n",
                       w->desc);
-          tmp = tmp->next;
           continue;
         }
-      
+
       if (WINDOW_TRANSIENT_FOR_WHOLE_GROUP (w))
         {
           GSList *group_windows;
@@ -524,9 +696,9 @@ create_constraints (Constraint **constraints,
             group_windows = meta_group_list_windows (group);
           else
             group_windows = NULL;
-          
+
           tmp2 = group_windows;
-          
+
           while (tmp2 != NULL)
             {
               MetaWindow *group_window = tmp2->data;
@@ -538,7 +710,7 @@ create_constraints (Constraint **constraints,
                   tmp2 = tmp2->next;
                   continue;
                 }
-              
+
 #if 0
               /* old way of doing it */
               if (!(meta_window_is_ancestor_of_transient (w, group_window)) &&
@@ -552,9 +724,9 @@ create_constraints (Constraint **constraints,
                 {
                   meta_topic (META_DEBUG_STACK, "Constraining %s above %s as it's transient for its group\n",
                               w->desc, group_window->desc);
-                  add_constraint (constraints, w, group_window);
+                  add_constraint (stack, w, group_window);
                 }
-              
+
               tmp2 = tmp2->next;
             }
 
@@ -564,7 +736,7 @@ create_constraints (Constraint **constraints,
                !w->transient_parent_is_root_window)
         {
           MetaWindow *parent;
-          
+
           parent =
             meta_display_lookup_x_window (w->display, w->xtransient_for);
 
@@ -573,95 +745,93 @@ create_constraints (Constraint **constraints,
             {
               meta_topic (META_DEBUG_STACK, "Constraining %s above %s due to transiency\n",
                           w->desc, parent->desc);
-              add_constraint (constraints, w, parent);
+              add_constraint (stack, w, parent);
             }
         }
-      
-      tmp = tmp->next;
     }
 }
 
 static void
-graph_constraints (Constraint **constraints,
-                   int          n_constraints)
+free_constraints (MetaStack *stack)
 {
-  int i;
+  GHashTableIter iter;
+  gpointer value;
 
-  i = 0;
-  while (i < n_constraints)
+  if (stack->constraints == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, stack->constraints);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
     {
-      Constraint *c;
+      WindowConstraints *node = value;
 
-      /* If we have "A below B" and "B below C" then AB -> BC so we
-       * add BC to next_nodes in AB.
-       */
-      
-      c = constraints[i];
-      while (c != NULL)
-        {
-          Constraint *n;
-            
-          g_assert (c->below->stack_position == i);
+      /* Each constraint is in the transients list of exactly one window */
+      g_slist_foreach (node->transients, (GFunc) g_free, NULL);
+      g_slist_free (node->transients);
+      g_slist_free (node->parents);
+      g_free (node);
+    }
 
-          /* Constraints where ->above is below are our
-           * next_nodes and we are their previous
-           */
-          n = constraints[c->above->stack_position];
-          while (n != NULL)
-            {
-              c->next_nodes = g_slist_prepend (c->next_nodes,
-                                               n);
-              /* c is a previous node of n */
-              n->has_prev = TRUE;
-              
-              n = n->next;
-            }
-          
-          c = c->next;
-        }
+  g_hash_table_destroy (stack->constraints);
+  stack->constraints = NULL;
 
-      ++i;
-    }
+  g_list_free (stack->constrain_pending);
+  stack->constrain_pending = NULL;
 }
 
 static void
-free_constraints (Constraint **constraints,
-                  int          n_constraints)
+remove_window_constraints (MetaStack  *stack,
+                           MetaWindow *window)
 {
-  int i;
+  WindowConstraints *node;
+  GSList *tmp;
 
-  i = 0;
-  while (i < n_constraints)
+  node = get_window_constraints (stack, window, FALSE);
+  if (node == NULL)
+    return;
+
+  for (tmp = node->parents; tmp != NULL; tmp = tmp->next)
     {
-      Constraint *c;
-      
-      c = constraints[i];
-      while (c != NULL)
-        {
-          Constraint *next = c->next;
-          
-          g_slist_free (c->next_nodes);
+      Constraint *c = tmp->data;
+      WindowConstraints *below_node;
 
-          g_free (c);
-          
-          c = next;
-        }
+      below_node = get_window_constraints (stack, c->below, FALSE);
+      below_node->transients = g_slist_remove (below_node->transients, c);
+      g_free (c);
+    }
 
-      ++i;
+  for (tmp = node->transients; tmp != NULL; tmp = tmp->next)
+    {
+      Constraint *c = tmp->data;
+      WindowConstraints *above_node;
+
+      above_node = get_window_constraints (stack, c->above, FALSE);
+      above_node->parents = g_slist_remove (above_node->parents, c);
+      g_free (c);
     }
+
+  if (node->pending)
+    stack->constrain_pending = g_list_remove (stack->constrain_pending,
+                                              window);
+
+  g_slist_free (node->parents);
+  g_slist_free (node->transients);
+  g_hash_table_remove (stack->constraints, window);
+  g_free (node);
 }
 
 static void
-ensure_above (MetaWindow *above,
+ensure_above (MetaStack  *stack,
+              MetaWindow *above,
               MetaWindow *below)
-{  
+{
   if (WINDOW_HAS_TRANSIENT_TYPE(above) &&
       above->layer < below->layer)
     {
       meta_topic (META_DEBUG_STACK,
 		  "Promoting window %s from layer %u to %u due to contraint\n",
 		  above->desc, above->layer, below->layer);
-      above->layer = below->layer;
+      set_window_layer (stack, above, below->layer);
     }
 
   if (above->stack_position < below->stack_position)
@@ -675,65 +845,54 @@ ensure_above (MetaWindow *above,
               below->desc, below->stack_position);
 }
 
-static void
-traverse_constraint (Constraint *c)
+/* Topmost first */
+static gint
+compare_constraints_above (gconstpointer a,
+                           gconstpointer b)
 {
-  GSList *tmp;
-
-  if (c->applied)
-    return;
-  
-  ensure_above (c->above, c->below);
-  c->applied = TRUE;
-  
-  tmp = c->next_nodes;
-  while (tmp != NULL)
-    {
-      traverse_constraint (tmp->data);
+  const Constraint *ca = a;
+  const Constraint *cb = b;
 
-      tmp = tmp->next;
-    }
+  return cb->above->stack_position - ca->above->stack_position;
 }
 
+/* Fix up the constraints keeping windows above @window, and then
+ * theirs in turn for each window we had to move.
+ */
 static void
-apply_constraints (Constraint **constraints,
-                   int          n_constraints)
+traverse_constraints (MetaStack  *stack,
+                      MetaWindow *window)
 {
-  GSList *heads;
+  WindowConstraints *node;
+  GSList *transients;
   GSList *tmp;
-  int i;
 
-  /* List all heads in an ordered constraint chain */
-  heads = NULL;
-  i = 0;
-  while (i < n_constraints)
-    {
-      Constraint *c;
-      
-      c = constraints[i];
-      while (c != NULL)
-        {
-          if (!c->has_prev)
-            heads = g_slist_prepend (heads, c);
-          
-          c = c->next;
-        }
+  node = get_window_constraints (stack, window, FALSE);
+  if (node == NULL || node->transients == NULL || node->traversing)
+    return;
 
-      ++i;
-    }
+  node->traversing = TRUE;
 
-  /* Now traverse the chain and apply constraints */
-  tmp = heads;
-  while (tmp != NULL)
+  /* Do the topmost transient first; each one goes right above us,
+   * so this keeps the transients in their order.
+   */
+  transients = g_slist_sort (g_slist_copy (node->transients),
+                             compare_constraints_above);
+
+  for (tmp = transients; tmp != NULL; tmp = tmp->next)
     {
       Constraint *c = tmp->data;
 
-      traverse_constraint (c);
-      
-      tmp = tmp->next;
+      if (constraint_is_broken (c))
+        {
+          ensure_above (stack, c->above, c->below);
+          traverse_constraints (stack, c->above);
+        }
     }
 
-  g_slist_free (heads);
+  g_slist_free (transients);
+
+  node->traversing = FALSE;
 }
 
 /**
@@ -772,6 +931,7 @@ stack_do_window_deletions (MetaStack *stack)
           if (xwindow == g_array_index (stack->windows, Window, i))
             {
               g_array_remove_index (stack->windows, i);
+              stack->need_client_list = TRUE;
               goto next;
             }
         }
@@ -799,35 +959,37 @@ stack_do_window_additions (MetaStack *stack)
       meta_topic (META_DEBUG_STACK,
                   "Adding %d windows to sorted list\n",
                   n_added);
-      
+
       old_size = stack->windows->len;
       g_array_set_size (stack->windows, old_size + n_added);
-      
+      stack->need_client_list = TRUE;
+
       end = &g_array_index (stack->windows, Window, old_size);
 
       /* stack->added has the most recent additions at the
        * front of the list, so we need to reverse it
        */
       stack->added = g_list_reverse (stack->added);
-      
+
       i = 0;
       tmp = stack->added;
       while (tmp != NULL)
         {
           MetaWindow *w;
-          
+
           w = tmp->data;
-          
+
           end[i] = w->xwindow;
 
           /* add to the main list */
-          stack->sorted = g_list_prepend (stack->sorted, w);
-          
+          g_array_insert_val (stack->sorted,
+                              sorted_lower_bound (stack, w),
+                              w);
+
           ++i;
           tmp = tmp->next;
         }
-      
-      stack->need_resort = TRUE; /* may not be needed as we add to top */
+
       stack->need_constrain = TRUE;
       stack->need_relayer = TRUE;
     }
@@ -842,40 +1004,35 @@ stack_do_window_additions (MetaStack *stack)
 static void
 stack_do_relayer (MetaStack *stack)
 {
-  GList *tmp;
-    
+  int i;
+
   if (!stack->need_relayer)
       return;
-    
+
   meta_topic (META_DEBUG_STACK,
               "Recomputing layers\n");
-      
-  tmp = stack->sorted;
 
-  while (tmp != NULL)
+  /* Changing layers moves windows about in "sorted", but
+   * not in "by_position".
+   */
+  for (i = 0; i < stack->n_positions; i++)
     {
       MetaWindow *w;
       MetaStackLayer old_layer;
 
-      w = tmp->data;
+      w = g_array_index (stack->by_position, MetaWindow *, i);
       old_layer = w->layer;
 
-      compute_layer (w);
+      set_window_layer (stack, w, compute_layer (w));
 
       if (w->layer != old_layer)
         {
           meta_topic (META_DEBUG_STACK,
                       "Window %s moved from layer %u to %u\n",
                       w->desc, old_layer, w->layer);
-          stack->need_resort = TRUE;
+          /* Layer promotions due to constraints need redoing */
           stack->need_constrain = TRUE;
-          /* don't need to constrain as constraining
-           * purely operates in terms of stack_position
-           * not layer
-           */
         }
-          
-      tmp = tmp->next;
     }
 
   stack->need_relayer = FALSE;
@@ -888,57 +1045,61 @@ stack_do_relayer (MetaStack *stack)
 static void
 stack_do_constrain (MetaStack *stack)
 {
-  Constraint **constraints;
+  if (stack->need_constrain)
+    {
+      meta_topic (META_DEBUG_STACK,
+                  "Recomputing constraints\n");
 
-  /* It'd be nice if this were all faster, probably */
-  
-  if (!stack->need_constrain)
+      /* This queues every window with a broken constraint */
+      free_constraints (stack);
+      create_constraints (stack);
+
+      stack->need_constrain = FALSE;
+    }
+
+  if (stack->constrain_pending == NULL)
     return;
 
   meta_topic (META_DEBUG_STACK,
               "Reapplying constraints\n");
 
-  constraints = g_new0 (Constraint*,
-                        stack->n_positions);
+  stack->constraining = TRUE;
 
-  create_constraints (constraints, stack->sorted);
+  while (stack->constrain_pending != NULL)
+    {
+      MetaWindow *window = stack->constrain_pending->data;
+      WindowConstraints *node;
+      GSList *tmp;
 
-  graph_constraints (constraints, stack->n_positions);
+      stack->constrain_pending = g_list_delete_link (stack->constrain_pending,
+                                                     stack->constrain_pending);
 
-  apply_constraints (constraints, stack->n_positions);
-  
-  free_constraints (constraints, stack->n_positions);
-  g_free (constraints);
-  
-  stack->need_constrain = FALSE;
-}
+      node = get_window_constraints (stack, window, FALSE);
+      node->pending = FALSE;
 
-/**
- * Sort stack->sorted with layers having priority over stack_position.
- */
-static void
-stack_do_resort (MetaStack *stack)
-{
-  if (!stack->need_resort)
-    return;
-  
-  meta_topic (META_DEBUG_STACK,
-              "Sorting stack list\n");
-      
-  stack->sorted = g_list_sort (stack->sorted,
-                               (GCompareFunc) compare_window_position);
+      /* It may have been moved below a window it belongs above... */
+      for (tmp = node->parents; tmp != NULL; tmp = tmp->next)
+        {
+          Constraint *c = tmp->data;
+
+          if (constraint_is_broken (c))
+            ensure_above (stack, c->above, c->below);
+        }
 
-  stack->need_resort = FALSE;
+      /* ...or above windows that belong above it */
+      traverse_constraints (stack, window);
+    }
+
+  stack->constraining = FALSE;
 }
 
 /**
  * Puts the stack into canonical form.
  *
  * Honour the removed and added lists of the stack, and then recalculate
- * all the layers (if the flag is set), re-run all the constraint calculations
- * (if the flag is set), and finally re-sort the stack (if the flag is set,
- * and if it wasn't already it might have become so during all the previous
- * activity).
+ * all the layers (if the flag is set), and finally reapply the constraints
+ * of the windows that moved (or all of them, if the flag is set).  The
+ * sorted array is kept in order along the way.
  */
 static void
 stack_ensure_sorted (MetaStack *stack)
@@ -947,7 +1108,6 @@ stack_ensure_sorted (MetaStack *stack)
   stack_do_window_additions (stack);
   stack_do_relayer (stack);
   stack_do_constrain (stack);
-  stack_do_resort (stack);
 }
 
 /**
@@ -969,8 +1129,11 @@ stack_ensure_sorted (MetaStack *stack)
  * work by placing each window above the others, and start by lowering
  * a window to the bottom (instead of the current way, which works by
  * placing each window below another and starting with a raise)
+ *
+ * Returns %FALSE if there was no managed window to go above and
+ * xwindow was lowered to the very bottom instead.
  */
-static void
+static gboolean
 raise_window_relative_to_managed_windows (MetaScreen *screen,
                                           Window      xwindow)
 {
@@ -1047,15 +1210,98 @@ raise_window_relative_to_managed_windows (MetaScreen *screen,
       XLowerWindow (screen->display->xdisplay,
                     xwindow);
       meta_error_trap_pop (screen->display);
+
+      return FALSE;
     }
+
+  return TRUE;
+}
+
+/**
+ * Marks in @in_place the windows of @new_stack which can stay where they
+ * are on the server: the longest sequence of them, not necessarily next
+ * to each other, that is in the same order in @old_stack.  Every other
+ * window has to be moved, and that's as few moves as can be done.
+ */
+static void
+find_windows_in_place (const Window *old_stack,
+                       int           old_len,
+                       const Window *new_stack,
+                       int           new_len,
+                       gboolean     *in_place)
+{
+  MetaXidMap *old_positions;
+  int *old_pos;
+  int *tails;
+  int *prev;
+  int n_tails;
+  int i;
+
+  old_positions = meta_xid_map_new ();
+  for (i = 0; i < old_len; i++)
+    meta_xid_map_insert (old_positions, old_stack[i], GINT_TO_POINTER (i + 1));
+
+  /* Longest increasing subsequence of the old positions; tails[l] is
+   * the new index ending the best such sequence of length l + 1 found
+   * so far, and prev links each window back to the one before it.
+   */
+  old_pos = g_new (int, new_len);
+  tails = g_new (int, new_len);
+  prev = g_new (int, new_len);
+  n_tails = 0;
+
+  for (i = 0; i < new_len; i++)
+    {
+      int low, high;
+
+      in_place[i] = FALSE;
+      prev[i] = -1;
+      old_pos[i] = GPOINTER_TO_INT (meta_xid_map_lookup (old_positions,
+                                                         new_stack[i])) - 1;
+      if (old_pos[i] < 0)
+        continue;
+
+      low = 0;
+      high = n_tails;
+      while (low < high)
+        {
+          int mid = low + (high - low) / 2;
+
+          if (old_pos[tails[mid]] < old_pos[i])
+            low = mid + 1;
+          else
+            high = mid;
+        }
+
+      if (low > 0)
+        prev[i] = tails[low - 1];
+      tails[low] = i;
+      if (low == n_tails)
+        n_tails++;
+    }
+
+  for (i = n_tails > 0 ? tails[n_tails - 1] : -1; i >= 0; i = prev[i])
+    in_place[i] = TRUE;
+
+  g_free (prev);
+  g_free (tails);
+  g_free (old_pos);
+  meta_xid_map_free (old_positions);
+}
+
+static gboolean
+window_arrays_equal (GArray *a,
+                     GArray *b)
+{
+  return a != NULL && b != NULL && a->len == b->len &&
+    memcmp (a->data, b->data, a->len * sizeof (Window)) == 0;
 }
 
 /**
  * Order the windows on the X server to be the same as in our structure.
  * We do this using XRestackWindows if we don't know the previous order,
- * or XConfigureWindow on a few particular windows if we do and can figure
- * out the minimum set of changes.  After that, we set __NET_CLIENT_LIST
- * and __NET_CLIENT_LIST_STACKING.
+ * or XConfigureWindow on as few windows as possible if we do.  After that,
+ * we set __NET_CLIENT_LIST and __NET_CLIENT_LIST_STACKING if they changed.
  *
  * FIXME: Now that we have a good view of the stacking order on the server
  * with MetaStackTracker it should be possible to do a simpler and better
@@ -1066,8 +1312,9 @@ stack_sync_to_server (MetaStack *stack)
 {
   GArray *stacked;
   GArray *root_children_stacked;
-  GList *tmp;
   GArray *all_hidden;
+  gboolean restack_hidden;
+  int i;
   int n_override_redirect = 0;
   
   /* Bail out if frozen */
@@ -1083,31 +1330,37 @@ stack_sync_to_server (MetaStack *stack)
    * _NET hints, and "root_children_stacked" is in top-to-bottom
    * order for XRestackWindows()
    */
-  stacked = g_array_new (FALSE, FALSE, sizeof (Window));
-  root_children_stacked = g_array_new (FALSE, FALSE, sizeof (Window));
+  stacked = g_array_sized_new (FALSE, FALSE, sizeof (Window),
+                               stack->sorted->len);
+  root_children_stacked = g_array_sized_new (FALSE, FALSE, sizeof (Window),
+                                             stack->sorted->len);
   all_hidden = g_array_new (FALSE, FALSE, sizeof (Window));
 
   /* The screen guard window sits above all hidden windows and acts as
    * a barrier to input reaching these windows. */
   g_array_append_val (all_hidden, stack->screen->guard_window);
 
+  for (i = 0; i < (int) stack->sorted->len; i++)
+    {
+      MetaWindow *w = g_array_index (stack->sorted, MetaWindow *, i);
+
+      if (w->override_redirect)
+	n_override_redirect++;
+      else
+	g_array_append_val (stacked, w->xwindow);
+    }
+
   meta_topic (META_DEBUG_STACK, "Top to bottom: ");
   meta_push_no_msg_prefix ();
 
-  for (tmp = stack->sorted; tmp != NULL; tmp = tmp->next)
+  for (i = stack->sorted->len - 1; i >= 0; i--)
     {
-      MetaWindow *w = tmp->data;
+      MetaWindow *w = g_array_index (stack->sorted, MetaWindow *, i);
       Window top_level_window;
       
       meta_topic (META_DEBUG_STACK, "%u:%d - %s ",
 		  w->layer, w->stack_position, w->desc);
 
-      /* remember, stacked is in reverse order (bottom to top) */
-      if (w->override_redirect)
-	n_override_redirect++;
-      else
-	g_array_prepend_val (stacked, w->xwindow);
-      
       if (w->frame)
 	top_level_window = w->frame->xwindow;
       else
@@ -1141,6 +1394,9 @@ stack_sync_to_server (MetaStack *stack)
   
   meta_error_trap_push (stack->screen->display);
 
+  restack_hidden = !window_arrays_equal (all_hidden,
+                                         stack->last_all_hidden);
+
   if (stack->last_root_children_stacked == NULL)
     {
       /* Just impose our stack, we don't know the previous state.
@@ -1161,111 +1417,95 @@ stack_sync_to_server (MetaStack *stack)
     }
   else if (root_children_stacked->len > 0)
     {
-      /* Try to do minimal window moves to get the stack in order */
-      /* A point of note: these arrays include frames not client windows,
+      /* Move the fewest windows that gets the stack in order: the windows
+       * which are still in the same order relative to each other as last
+       * time stay put, and each of the others goes right below the window
+       * above it in the new stack.
+       *
+       * A point of note: these arrays include frames not client windows,
        * so if a client window has changed frame since last_root_children_stacked
        * was saved, then we may have inefficiency, but I don't think things
        * break...
        */
-      const Window *old_stack = (Window *) stack->last_root_children_stacked->data;
       const Window *new_stack = (Window *) root_children_stacked->data;
-      const int old_len = stack->last_root_children_stacked->len;
       const int new_len = root_children_stacked->len;
-      const Window *oldp = old_stack;
-      const Window *newp = new_stack;
-      const Window *old_end = old_stack + old_len;
-      const Window *new_end = new_stack + new_len;
+      gboolean *in_place;
       Window last_window = None;
-      
-      while (oldp != old_end &&
-             newp != new_end)
+
+      in_place = g_new (gboolean, new_len);
+      find_windows_in_place ((Window *) stack->last_root_children_stacked->data,
+                             stack->last_root_children_stacked->len,
+                             new_stack, new_len,
+                             in_place);
+
+      for (i = 0; i < new_len; i++)
         {
-          if (*oldp == *newp)
+          if (in_place[i])
             {
               /* Stacks are the same here, move on */
-              ++oldp;
-              last_window = *newp;
-              ++newp;
             }
-          else if (meta_display_lookup_x_window (stack->screen->display,
-                                                 *oldp) == NULL)
+          else if (last_window == None)
             {
-              /* *oldp is no longer known to us (probably destroyed),
-               * so we can just skip it
+              meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost (but leaving it in-place)\n", new_stack[i]);
+
+              /* Lowering it to the very bottom puts it below the
+               * guard window, so that needs redoing.
                */
-              ++oldp;
+              if (!raise_window_relative_to_managed_windows (stack->screen,
+                                                             new_stack[i]))
+                restack_hidden = TRUE;
             }
           else
             {
-              /* Move *newp below last_window */
-              if (last_window == None)
-                {
-                  meta_topic (META_DEBUG_STACK, "Using window 0x%lx as topmost (but leaving it in-place)\n", *newp);
+              /* This means that if last_window is dead, but not
+               * new_stack[i], then we fail to restack it; but on
+               * unmanaging last_window, we'll fix it up.
+               */
 
-                  raise_window_relative_to_managed_windows (stack->screen,
-                                                            *newp);
-                }
-              else
-                {
-                  /* This means that if last_window is dead, but not
-                   * *newp, then we fail to restack *newp; but on
-                   * unmanaging last_window, we'll fix it up.
-                   */
-                  
-                  XWindowChanges changes;
-
-                  changes.sibling = last_window;
-                  changes.stack_mode = Below;
-
-                  meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
-                              *newp, last_window);
-
-                  meta_stack_tracker_record_lower_below (stack->screen->stack_tracker,
-                                                         *newp, last_window,
-                                                         XNextRequest (stack->screen->display->xdisplay));
-                  XConfigureWindow (stack->screen->display->xdisplay,
-                                    *newp,
-                                    CWSibling | CWStackMode,
-                                    &changes);
-                }
+              XWindowChanges changes;
 
-              last_window = *newp;
-              ++newp;
-            }
-        }
+              changes.sibling = last_window;
+              changes.stack_mode = Below;
 
-      if (newp != new_end)
-        {
-          /* Restack remaining windows */
-          meta_topic (META_DEBUG_STACK, "Restacking remaining %d windows\n",
-                        (int) (new_end - newp));
-          /* We need to include an already-stacked window
-           * in the restack call, so we get in the proper position
-           * with respect to it.
-           */
-          if (newp != new_stack)
-            --newp;
-          meta_stack_tracker_record_restack_windows (stack->screen->stack_tracker,
-                                                     (Window *) newp, new_end - newp,
+              meta_topic (META_DEBUG_STACK, "Placing window 0x%lx below 0x%lx\n",
+                          new_stack[i], last_window);
+
+              meta_stack_tracker_record_lower_below (stack->screen->stack_tracker,
+                                                     new_stack[i], last_window,
                                                      XNextRequest (stack->screen->display->xdisplay));
-          XRestackWindows (stack->screen->display->xdisplay,
-                           (Window *) newp, new_end - newp);
+              XConfigureWindow (stack->screen->display->xdisplay,
+                                new_stack[i],
+                                CWSibling | CWStackMode,
+                                &changes);
+            }
+
+          last_window = new_stack[i];
         }
+
+      g_free (in_place);
     }
 
-  /* Push hidden windows to the bottom of the stack under the guard window */
-  meta_stack_tracker_record_lower (stack->screen->stack_tracker,
-                                   stack->screen->guard_window,
-                                   XNextRequest (stack->screen->display->xdisplay));
-  XLowerWindow (stack->screen->display->xdisplay, stack->screen->guard_window);
-  meta_stack_tracker_record_restack_windows (stack->screen->stack_tracker,
-                                             (Window *)all_hidden->data,
-                                             all_hidden->len,
-                                             XNextRequest (stack->screen->display->xdisplay));
-  XRestackWindows (stack->screen->display->xdisplay,
-		   (Window *)all_hidden->data,
-		   all_hidden->len);
-  g_array_free (all_hidden, TRUE);
+  /* Push hidden windows to the bottom of the stack under the guard window,
+   * unless they're there already.
+   */
+  if (restack_hidden || stack->last_root_children_stacked == NULL)
+    {
+      meta_stack_tracker_record_lower (stack->screen->stack_tracker,
+                                       stack->screen->guard_window,
+                                       XNextRequest (stack->screen->display->xdisplay));
+      XLowerWindow (stack->screen->display->xdisplay, stack->screen->guard_window);
+      meta_stack_tracker_record_restack_windows (stack->screen->stack_tracker,
+                                                 (Window *)all_hidden->data,
+                                                 all_hidden->len,
+                                                 XNextRequest (stack->screen->display->xdisplay));
+      XRestackWindows (stack->screen->display->xdisplay,
+                       (Window *)all_hidden->data,
+                       all_hidden->len);
+    }
+
+  if (stack->last_all_hidden)
+    g_array_free (stack->last_all_hidden, TRUE);
+  stack->last_all_hidden = all_hidden;
 
   meta_error_trap_pop (stack->screen->display);
   /* on error, a window was destroyed; it should eventually
@@ -1275,22 +1515,32 @@ stack_sync_to_server (MetaStack *stack)
   
   /* Sync _NET_CLIENT_LIST and _NET_CLIENT_LIST_STACKING */
 
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stack->windows->data,
-                   stack->windows->len);
-  XChangeProperty (stack->screen->display->xdisplay,
-                   stack->screen->xroot,
-                   stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
-                   XA_WINDOW,
-                   32, PropModeReplace,
-                   (unsigned char *)stacked->data,
-                   stacked->len);
-
-  g_array_free (stacked, TRUE);
+  if (stack->need_client_list)
+    {
+      XChangeProperty (stack->screen->display->xdisplay,
+                       stack->screen->xroot,
+                       stack->screen->display->atom__NET_CLIENT_LIST,
+                       XA_WINDOW,
+                       32, PropModeReplace,
+                       (unsigned char *)stack->windows->data,
+                       stack->windows->len);
+      stack->need_client_list = FALSE;
+    }
+
+  if (!window_arrays_equal (stacked, stack->last_client_list_stacking))
+    {
+      XChangeProperty (stack->screen->display->xdisplay,
+                       stack->screen->xroot,
+                       stack->screen->display->atom__NET_CLIENT_LIST_STACKING,
+                       XA_WINDOW,
+                       32, PropModeReplace,
+                       (unsigned char *)stacked->data,
+                       stacked->len);
+    }
+
+  if (stack->last_client_list_stacking)
+    g_array_free (stack->last_client_list_stacking, TRUE);
+  stack->last_client_list_stacking = stacked;
 
   if (stack->last_root_children_stacked)
     g_array_free (stack->last_root_children_stacked, TRUE);
@@ -1304,8 +1554,8 @@ meta_stack_get_top (MetaStack *stack)
 {
   stack_ensure_sorted (stack);
 
-  if (stack->sorted)
-    return stack->sorted->data;
+  if (stack->sorted->len > 0)
+    return g_array_index (stack->sorted, MetaWindow *, stack->sorted->len - 1);
   else
     return NULL;
 }
@@ -1313,13 +1563,10 @@ meta_stack_get_top (MetaStack *stack)
 MetaWindow*
 meta_stack_get_bottom (MetaStack  *stack)
 {
-  GList *link;
-
   stack_ensure_sorted (stack);
 
-  link = g_list_last (stack->sorted);
-  if (link != NULL)
-    return link->data;
+  if (stack->sorted->len > 0)
+    return g_array_index (stack->sorted, MetaWindow *, 0);
   else
     return NULL;
 }
@@ -1329,18 +1576,18 @@ meta_stack_get_above (MetaStack      *stack,
                       MetaWindow     *window,
                       gboolean        only_within_layer)
 {
-  GList *link;
+  int i;
   MetaWindow *above;
   
   stack_ensure_sorted (stack);
-  
-  link = g_list_find (stack->sorted, window);
-  if (link == NULL)
+
+  i = find_sorted_index (stack, window);
+  if (i < 0)
     return NULL;
-  if (link->prev == NULL)
+  if (i + 1 == (int) stack->sorted->len)
     return NULL;
 
-  above = link->prev->data;
+  above = g_array_index (stack->sorted, MetaWindow *, i + 1);
 
   if (only_within_layer &&
       above->layer != window->layer)
@@ -1354,19 +1601,16 @@ meta_stack_get_below (MetaStack      *stack,
                       MetaWindow     *window,
                       gboolean        only_within_layer)
 {
-  GList *link;
+  int i;
   MetaWindow *below;
   
   stack_ensure_sorted (stack);
 
-  link = g_list_find (stack->sorted, window);
-
-  if (link == NULL)
-    return NULL;
-  if (link->next == NULL)
+  i = find_sorted_index (stack, window);
+  if (i <= 0)
     return NULL;
   
-  below = link->next->data;
+  below = g_array_index (stack->sorted, MetaWindow *, i - 1);
 
   if (only_within_layer &&
       below->layer != window->layer)
@@ -1406,7 +1650,7 @@ get_default_focus_window (MetaStack     *stack,
   MetaWindow *topmost_in_group;
   MetaWindow *topmost_overall;
   MetaGroup *not_this_one_group;
-  GList *link;
+  int i;
   
   topmost_dock = NULL;
   transient_parent = NULL;
@@ -1419,12 +1663,10 @@ get_default_focus_window (MetaStack     *stack,
 
   stack_ensure_sorted (stack);
 
-  /* top of this layer is at the front of the list */
-  link = stack->sorted;
-      
-  while (link)
+  /* top of the stack is at the end of the array */
+  for (i = stack->sorted->len - 1; i >= 0; i--)
     {
-      MetaWindow *window = link->data;
+      MetaWindow *window = g_array_index (stack->sorted, MetaWindow *, i);
 
       if (window &&
           window != not_this_one &&
@@ -1469,8 +1711,6 @@ get_default_focus_window (MetaStack     *stack,
            * some cases, but it's just not worth the code.
            */
         }
-
-      link = link->next;
     }
 
   if (transient_parent)
@@ -1508,15 +1748,14 @@ meta_stack_list_windows (MetaStack     *stack,
                          MetaWorkspace *workspace)
 {
   GList *workspace_windows = NULL;
-  GList *link;
+  int i;
   
   stack_ensure_sorted (stack); /* do adds/removes */
   
-  link = stack->sorted;
-  
-  while (link)
+  /* Go from the top so that prepending leaves the list bottom to top */
+  for (i = stack->sorted->len - 1; i >= 0; i--)
     {
-      MetaWindow *window = link->data;
+      MetaWindow *window = g_array_index (stack->sorted, MetaWindow *, i);
       
       if (window &&
           (workspace == NULL || meta_window_located_on_workspace (window, workspace)))
@@ -1524,8 +1763,6 @@ meta_stack_list_windows (MetaStack     *stack,
           workspace_windows = g_list_prepend (workspace_windows,
                                               window);
         }
-      
-      link = link->next;
     }
 
   return workspace_windows;
@@ -1542,43 +1779,21 @@ meta_stack_windows_cmp  (MetaStack  *stack,
 
   stack_ensure_sorted (stack); /* update constraints, layers */
   
-  if (window_a->layer < window_b->layer)
-    return -1;
-  else if (window_a->layer > window_b->layer)
-    return 1;
-  else if (window_a->stack_position < window_b->stack_position)
-    return -1;
-  else if (window_a->stack_position > window_b->stack_position)
-    return 1;
-  else
-    return 0; /* not reached */
-}
-
-static int
-compare_just_window_stack_position (void *a,
-                                    void *b)
-{
-  MetaWindow *window_a = a;
-  MetaWindow *window_b = b;
-
-  if (window_a->stack_position < window_b->stack_position)
-    return -1; /* move window_a earlier in list */
-  else if (window_a->stack_position > window_b->stack_position)
-    return 1;
-  else
-    return 0; /* not reached */
+  return compare_window_position (window_a, window_b);
 }
 
 GList*
 meta_stack_get_positions (MetaStack *stack)
 {
   GList *tmp;
+  int i;
 
   /* Make sure to handle any adds or removes */
   stack_ensure_sorted (stack);
 
-  tmp = g_list_copy (stack->sorted);
-  tmp = g_list_sort (tmp, (GCompareFunc) compare_just_window_stack_position);
+  tmp = NULL;
+  for (i = stack->n_positions - 1; i >= 0; i--)
+    tmp = g_list_prepend (tmp, g_array_index (stack->by_position, MetaWindow *, i));
 
   return tmp;
 }
@@ -1626,21 +1841,23 @@ meta_stack_set_positions (MetaStack *stack,
 {
   int i;
   GList *tmp;
+  GList *current;
+  gboolean same;
 
   /* Make sure any adds or removes aren't in limbo -- is this needed? */
   stack_ensure_sorted (stack);
   
-  if (!lists_contain_same_windows (windows, stack->sorted))
+  current = meta_stack_get_positions (stack);
+  same = lists_contain_same_windows (windows, current);
+  g_list_free (current);
+
+  if (!same)
     {
       meta_warning ("This list of windows has somehow changed; not resetting "
                     "positions of the windows.\n");
       return;
     }
 
-  g_list_free (stack->sorted);
-  stack->sorted = g_list_copy (windows);
-
-  stack->need_resort = TRUE;
   stack->need_constrain = TRUE;
    
   i = 0;
@@ -1648,9 +1865,13 @@ meta_stack_set_positions (MetaStack *stack,
   while (tmp != NULL)
     {
       MetaWindow *w = tmp->data;
-      w->stack_position = i++;
+      w->stack_position = i;
+      g_array_index (stack->by_position, MetaWindow *, i) = w;
+      i++;
       tmp = tmp->next;
     }
+
+  g_array_sort (stack->sorted, compare_sorted_windows);
   
   meta_topic (META_DEBUG_STACK,
               "Reset the stack positions of (nearly) all windows\n");
@@ -1662,8 +1883,9 @@ void
 meta_window_set_stack_position_no_sync (MetaWindow *window,
                                         int         position)
 {
-  int low, high, delta;
-  GList *tmp;
+  MetaStack *stack;
+  MetaWindow **by_position;
+  int i, sorted_index;
   
   g_return_if_fail (window->screen->stack != NULL);
   g_return_if_fail (window->stack_position >= 0);
@@ -1677,35 +1899,37 @@ meta_window_set_stack_position_no_sync (MetaWindow *window,
       return;
     }
 
-  window->screen->stack->need_resort = TRUE;
-  window->screen->stack->need_constrain = TRUE;
-  
+  stack = window->screen->stack;
+
+  /* Has to be looked up before anything changes */
+  sorted_index = find_sorted_index (stack, window);
+
+  /* Shift the windows in between by one to fill the gap */
+  by_position = (MetaWindow **) stack->by_position->data;
   if (position < window->stack_position)
     {
-      low = position;
-      high = window->stack_position - 1;
-      delta = 1;
+      for (i = window->stack_position; i > position; i--)
+        {
+          by_position[i] = by_position[i - 1];
+          by_position[i]->stack_position = i;
+        }
     }
   else
     {
-      low = window->stack_position + 1;
-      high = position;
-      delta = -1;
+      for (i = window->stack_position; i < position; i++)
+        {
+          by_position[i] = by_position[i + 1];
+          by_position[i]->stack_position = i;
+        }
     }
 
-  tmp = window->screen->stack->sorted;
-  while (tmp != NULL)
-    {
-      MetaWindow *w = tmp->data;
+  by_position[position] = window;
+  window->stack_position = position;
 
-      if (w->stack_position >= low &&
-          w->stack_position <= high)
-        w->stack_position += delta;
+  if (sorted_index >= 0)
+    reposition_sorted_window (stack, sorted_index);
 
-      tmp = tmp->next;
-    }
-  
-  window->stack_position = position;
+  queue_constrain (stack, window);
 
   meta_topic (META_DEBUG_STACK,
               "Window %s had stack_position set to %d\n",
@@ -61,8 +61,19 @@ struct _MetaStack
    */
   GArray *windows;
 
-  /** The MetaWindows of the windows we manage, sorted in order. */
-  GList *sorted;
+  /**
+   * The MetaWindows of the windows we manage, from bottom to top.  This is
+   * kept ordered by layer and then by stack_position at all times, so each
+   * layer is a contiguous run of the array and moving a window only shifts
+   * the windows between its old and new place.
+   */
+  GArray *sorted;
+
+  /**
+   * Every window with a stack position, including those still in "added",
+   * indexed by stack_position.
+   */
+  GArray *by_position;
 
   /**
    * MetaWindows waiting to be added to the "sorted" and "windows" list, after
@@ -101,13 +112,35 @@ struct _MetaStack
   GArray *last_root_children_stacked;
 
   /**
-   * Number of stack positions; same as the length of added, but
+   * The hidden windows we last pushed below the guard window, guard
+   * window first; they only need pushing down again if this changes.
+   */
+  GArray *last_all_hidden;
+
+  /**
+   * What we last set _NET_CLIENT_LIST_STACKING to, so we don't set it
+   * again when nothing changed.
+   */
+  GArray *last_client_list_stacking;
+
+  /**
+   * Number of stack positions; same as the length of by_position, but
    * kept for quick reference.
    */
   gint n_positions;
 
-  /** Is the stack in need of re-sorting? */
-  unsigned int need_resort : 1;
+  /**
+   * The transiency constraints between the windows in the stack, mapping
+   * each window to the constraints it takes part in.  NULL until first
+   * computed.
+   */
+  GHashTable *constraints;
+
+  /**
+   * Windows which have moved since constraints were last applied.  Only the
+   * constraints involving these can have been broken by the move.
+   */
+  GList *constrain_pending;
 
   /**
    * Are the windows in the stack in need of having their
@@ -116,10 +149,16 @@ struct _MetaStack
   unsigned int need_relayer : 1;
 
   /**
-   * Are the windows in the stack in need of having their positions
-   * recalculated with respect to transiency (parent and child windows)?
+   * Do the transiency constraints (parent and child windows) need to be
+   * worked out again from scratch?
    */
   unsigned int need_constrain : 1;
+
+  /** Are we in the middle of applying constraints? */
+  unsigned int constraining : 1;
+
+  /** Have windows been added or removed since _NET_CLIENT_LIST was set? */
+  unsigned int need_client_list : 1;
 };
 
 /**
@@ -170,6 +209,8 @@ void       meta_stack_update_layer    (MetaStack      *stack,
 /**
  * Recalculates the correct stacking order for all windows in the stack
  * according to their transience, and moves them about accordingly.
+ * Also to be called when the type or group of a window changes, since
+ * those decide its constraints too.
  *
  * \param window  Dummy parameter
  * \param stack   The stack to recalculate
@@ -337,8 +378,6 @@ GList*      meta_stack_list_windows (MetaStack *stack,
  * the screen of window A, and complain if the stack of the screen of
  * window B differed; then this would be a usable general comparison function.)
  *
- * (FIXME: Apparently identical to compare_window_position(). Merge them.)
- *
  * \param stack  A stack containing both window_a and window_b
  * \param window_a  A window
  * \param window_b  Another window
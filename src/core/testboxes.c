@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <X11/Xutil.h> /* Just for the definition of the various gravities */
 #include <time.h>      /* To initialize random seed */
 
@@ -1386,9 +1387,152 @@ test_find_closest_point_to_line ()
   printf ("%s passed.\n", G_STRFUNC);
 }
 
+/* Monitors of 1920x1080 in a columns x rows grid, each with a panel
+ * across the top and a few partial struts (docks and the like) along the
+ * bottom, since partial struts are what makes the regions grow.
+ */
+static void
+get_timing_layout (int            columns,
+                   int            rows,
+                   int            struts_per_monitor,
+                   MetaRectangle *screen,
+                   GList        **monitors,
+                   GSList       **struts)
+{
+  int column, row, i;
+
+  *screen = meta_rect (0, 0, columns * 1920, rows * 1080);
+  *monitors = NULL;
+  *struts = NULL;
+
+  for (row = 0; row < rows; row++)
+    for (column = 0; column < columns; column++)
+      {
+        int x = column * 1920;
+        int y = row * 1080;
+        int width = 1920 / (2 * struts_per_monitor);
+
+        *monitors = g_list_prepend (*monitors,
+                                    new_meta_rect (x, y, 1920, 1080));
+        *struts = g_slist_prepend (*struts,
+                                   new_meta_strut (x, y, 1920, 24,
+                                                   META_SIDE_TOP));
+        for (i = 0; i < struts_per_monitor; i++)
+          *struts = g_slist_prepend (*struts,
+                                     new_meta_strut (x + (2 * i + 1) * width,
+                                                     y + 1080 - 48 - 8 * i,
+                                                     width, 48 + 8 * i,
+                                                     META_SIDE_BOTTOM));
+      }
+}
+
+typedef void (*TimingFunc) (const MetaRectangle *screen,
+                            GList               *monitors,
+                            GSList              *struts);
+
+/* Everything a workspace computes when its work area is invalidated */
+static void
+time_regions (const MetaRectangle *screen,
+              GList               *monitors,
+              GSList              *struts)
+{
+  GList *tmp;
+
+  meta_rectangle_free_list_and_elements (
+    meta_rectangle_get_minimal_spanning_set_for_region (screen, struts));
+  for (tmp = monitors; tmp; tmp = tmp->next)
+    meta_rectangle_free_list_and_elements (
+      meta_rectangle_get_minimal_spanning_set_for_region (tmp->data, struts));
+}
+
+static void
+time_screen_edges (const MetaRectangle *screen,
+                   GList               *monitors,
+                   GSList              *struts)
+{
+  meta_rectangle_free_list_and_elements (
+    meta_rectangle_find_onscreen_edges (screen, struts));
+}
+
+static void
+time_monitor_edges (const MetaRectangle *screen,
+                    GList               *monitors,
+                    GSList              *struts)
+{
+  meta_rectangle_free_list_and_elements (
+    meta_rectangle_find_nonintersected_monitor_edges (monitors, struts));
+}
+
+/* Returns microseconds per call, running func for at least a quarter
+ * of a second.
+ */
+static double
+time_func (TimingFunc           func,
+           const MetaRectangle *screen,
+           GList               *monitors,
+           GSList              *struts)
+{
+  GTimer *timer;
+  double elapsed;
+  int runs;
+
+  timer = g_timer_new ();
+  runs = 0;
+  do
+    {
+      func (screen, monitors, struts);
+      runs++;
+      elapsed = g_timer_elapsed (timer, NULL);
+    }
+  while (elapsed < 0.25);
+  g_timer_destroy (timer);
+
+  return elapsed * 1e6 / runs;
+}
+
+static void
+time_layout (int columns,
+             int rows,
+             int struts_per_monitor)
+{
+  MetaRectangle screen;
+  GList *monitors;
+  GSList *struts;
+
+  get_timing_layout (columns, rows, struts_per_monitor,
+                     &screen, &monitors, &struts);
+
+  printf ("%2d monitors, %3d struts: regions %10.1f us, "
+          "screen edges %7.1f us, monitor edges %7.1f us\n",
+          columns * rows, g_slist_length (struts),
+          time_func (time_regions, &screen, monitors, struts),
+          time_func (time_screen_edges, &screen, monitors, struts),
+          time_func (time_monitor_edges, &screen, monitors, struts));
+
+  meta_rectangle_free_list_and_elements (monitors);
+  free_strut_list (struts);
+}
+
+static void
+run_timings ()
+{
+  time_layout (1, 1, 1);
+  time_layout (2, 1, 2);
+  time_layout (2, 2, 2);
+  time_layout (3, 2, 3);
+  time_layout (3, 3, 3);
+  time_layout (4, 4, 2);
+}
+
 int
-main()
+main (int argc, char **argv)
 {
+  if (argc > 1 && strcmp (argv[1], "--timing") == 0)
+    {
+      run_timings ();
+      return 0;
+    }
+
   init_random_ness ();
   test_area ();
   test_intersect ();
@@ -0,0 +1,425 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter constraints benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <config.h>
+#include "constraints.h"
+#include "display-private.h"
+#include "screen-private.h"
+#include "workspace-private.h"
+#include "window-private.h"
+#include "frame.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_REPLAYS 200
+
+typedef struct
+{
+  int x, y;
+} Motion;
+
+typedef struct
+{
+  const char   *name;
+  MetaGrabOp    op;
+  gboolean      terminal;
+  MetaRectangle start;
+  const Motion *motions;
+  int           n_motions;
+} Drag;
+
+/* Pointer positions of the motion events of a few resize drags,
+ * relative to where the drag started.
+ */
+static const Motion se_terminal[] = {
+  { 0, 0 }, { 2, 0 }, { 1, 1 }, { 4, 2 }, { 7, 4 }, { 9, 8 }, { 14, 8 },
+  { 17, 10 }, { 23, 13 }, { 25, 18 }, { 31, 22 }, { 36, 25 }, { 42, 29 },
+  { 49, 34 }, { 56, 36 }, { 62, 41 }, { 68, 46 }, { 76, 50 }, { 82, 54 },
+  { 90, 61 }, { 98, 65 }, { 105, 70 }, { 111, 74 }, { 118, 79 },
+  { 124, 82 }, { 131, 88 }, { 137, 92 }, { 143, 94 }, { 147, 100 },
+  { 154, 102 }, { 158, 107 }, { 164, 108 }, { 166, 111 }, { 170, 113 },
+  { 174, 116 }, { 175, 116 }, { 178, 119 }, { 178, 118 }, { 180, 121 },
+  { 180, 120 }, { 181, 120 }, { 179, 120 }, { 180, 119 }, { 181, 119 },
+  { 180, 119 }, { 179, 120 }, { 180, 120 }, { 178, 117 }, { 175, 118 },
+  { 173, 115 }, { 169, 113 }, { 165, 111 }, { 160, 108 }, { 155, 104 },
+  { 149, 100 }, { 144, 96 }, { 139, 91 }, { 133, 88 }, { 126, 84 },
+  { 119, 80 }, { 115, 76 }, { 108, 72 }, { 100, 69 }, { 97, 65 },
+  { 91, 61 }, { 84, 57 }, { 81, 52 }, { 75, 49 }, { 71, 49 }, { 68, 44 },
+  { 65, 42 }, { 62, 41 }, { 61, 40 }, { 60, 39 }, { 59, 40 }, { 60, 40 },
+  { 61, 40 }, { 59, 41 }, { 60, 40 }, { 61, 40 }, { 61, 39 }, { 60, 42 },
+  { 64, 44 }, { 67, 45 }, { 68, 48 }, { 72, 51 }, { 77, 56 }, { 82, 59 },
+  { 88, 65 }, { 94, 69 }, { 100, 75 }, { 107, 82 }, { 115, 89 },
+  { 122, 95 }, { 130, 102 }, { 138, 110 }, { 146, 116 }, { 155, 124 },
+  { 161, 130 }, { 170, 139 }, { 178, 145 }, { 185, 152 }, { 193, 158 },
+  { 199, 164 }, { 205, 170 }, { 213, 175 }, { 218, 180 }, { 224, 184 },
+  { 228, 189 }, { 230, 191 }, { 235, 195 }, { 238, 197 }, { 240, 199 },
+  { 239, 201 }, { 241, 201 }, { 240, 200 }
+};
+
+static const Motion e_across_monitors[] = {
+  { 0, 0 }, { 2, 0 }, { 5, 0 }, { 11, 0 }, { 16, 0 }, { 22, 0 },
+  { 28, -1 }, { 37, 1 }, { 49, 1 }, { 59, 0 }, { 70, 1 }, { 82, 1 },
+  { 96, 1 }, { 110, 2 }, { 122, 2 }, { 139, 3 }, { 153, 2 }, { 168, 4 },
+  { 184, 2 }, { 200, 3 }, { 216, 4 }, { 230, 2 }, { 247, 5 }, { 261, 3 },
+  { 277, 4 }, { 291, 3 }, { 303, 6 }, { 317, 4 }, { 331, 5 }, { 341, 5 },
+  { 353, 6 }, { 362, 5 }, { 371, 7 }, { 378, 7 }, { 384, 7 }, { 391, 6 },
+  { 393, 6 }, { 399, 5 }, { 399, 6 }, { 400, 6 }, { 401, 7 }, { 401, 6 },
+  { 399, 6 }, { 399, 7 }, { 399, 6 }, { 400, 5 }, { 401, 5 }, { 400, 7 },
+  { 403, 6 }, { 405, 6 }, { 408, 6 }, { 411, 6 }, { 417, 6 }, { 425, 7 },
+  { 430, 7 }, { 439, 6 }, { 447, 5 }, { 457, 5 }, { 467, 7 }, { 479, 6 },
+  { 491, 7 }, { 503, 8 }, { 516, 8 }, { 530, 8 }, { 544, 6 }, { 558, 6 },
+  { 573, 8 }, { 587, 8 }, { 602, 7 }, { 619, 7 }, { 634, 7 }, { 650, 7 },
+  { 667, 7 }, { 681, 9 }, { 697, 8 }, { 711, 8 }, { 726, 9 }, { 742, 8 },
+  { 756, 9 }, { 770, 9 }, { 784, 9 }, { 798, 9 }, { 809, 9 }, { 820, 9 },
+  { 831, 8 }, { 842, 10 }, { 853, 10 }, { 862, 9 }, { 870, 11 },
+  { 877, 10 }, { 882, 10 }, { 888, 10 }, { 892, 11 }, { 896, 9 },
+  { 898, 9 }, { 899, 10 }, { 901, 10 }, { 900, 10 }, { 899, 9 },
+  { 901, 10 }, { 901, 11 }, { 900, 11 }, { 899, 11 }, { 900, 9 },
+  { 899, 10 }, { 900, 9 }, { 900, 10 }, { 899, 10 }, { 895, 9 },
+  { 889, 10 }, { 881, 9 }, { 870, 9 }, { 860, 8 }, { 846, 8 }, { 831, 8 },
+  { 815, 6 }, { 800, 6 }, { 784, 8 }, { 768, 7 }, { 754, 6 }, { 741, 5 },
+  { 728, 5 }, { 720, 5 }, { 712, 4 }, { 705, 4 }, { 700, 5 }, { 700, 3 },
+  { 700, 4 }
+};
+
+static const Motion n_into_panel[] = {
+  { 0, -2 }, { -1, -3 }, { 0, -5 }, { -1, -7 }, { 1, -14 }, { -1, -18 },
+  { 1, -25 }, { -1, -31 }, { 0, -41 }, { 0, -48 }, { 1, -59 }, { 1, -68 },
+  { 1, -79 }, { 2, -89 }, { 3, -102 }, { 3, -113 }, { 1, -124 },
+  { 1, -136 }, { 2, -147 }, { 2, -159 }, { 2, -169 }, { 2, -180 },
+  { 3, -193 }, { 3, -201 }, { 3, -211 }, { 4, -219 }, { 5, -229 },
+  { 4, -235 }, { 3, -241 }, { 3, -247 }, { 5, -253 }, { 5, -255 },
+  { 5, -258 }, { 4, -260 }, { 3, -260 }, { 4, -260 }, { 5, -259 },
+  { 4, -260 }, { 3, -259 }, { 5, -259 }, { 4, -261 }, { 5, -260 },
+  { 3, -260 }, { 4, -260 }, { 3, -261 }, { 3, -260 }, { 5, -260 },
+  { 4, -260 }, { 4, -258 }, { 4, -256 }, { 4, -253 }, { 4, -248 },
+  { 4, -239 }, { 5, -232 }, { 3, -223 }, { 3, -212 }, { 3, -202 },
+  { 4, -189 }, { 2, -179 }, { 4, -168 }, { 2, -158 }, { 1, -150 },
+  { 2, -141 }, { 2, -133 }, { 3, -128 }, { 2, -123 }, { 3, -122 },
+  { 3, -120 }, { 2, -120 }
+};
+
+static const Motion w_below_min[] = {
+  { 0, -1 }, { 4, 1 }, { 7, 0 }, { 14, -1 }, { 20, 0 }, { 29, 1 },
+  { 38, 0 }, { 50, 0 }, { 62, 1 }, { 76, 0 }, { 92, 0 }, { 106, -1 },
+  { 124, -2 }, { 142, 0 }, { 161, 0 }, { 180, 0 }, { 200, -1 },
+  { 219, -1 }, { 239, -1 }, { 260, -2 }, { 280, -2 }, { 301, -2 },
+  { 321, -3 }, { 341, -1 }, { 360, -2 }, { 379, -2 }, { 396, -3 },
+  { 414, -2 }, { 429, -2 }, { 444, -4 }, { 458, -3 }, { 471, -2 },
+  { 483, -2 }, { 492, -4 }, { 500, -4 }, { 508, -2 }, { 514, -4 },
+  { 516, -2 }, { 520, -2 }, { 520, -4 }, { 520, -3 }, { 519, -4 },
+  { 519, -2 }, { 521, -4 }, { 521, -2 }, { 521, -3 }, { 519, -2 },
+  { 519, -4 }, { 521, -4 }, { 521, -2 }, { 519, -3 }, { 517, -2 },
+  { 511, -4 }, { 505, -3 }, { 499, -2 }, { 490, -3 }, { 479, -3 },
+  { 469, -1 }, { 457, -2 }, { 444, -1 }, { 431, -2 }, { 416, -1 },
+  { 403, -2 }, { 388, -1 }, { 377, 0 }, { 362, -1 }, { 351, 0 },
+  { 340, -1 }, { 331, -1 }, { 321, 1 }, { 314, 1 }, { 308, -1 },
+  { 303, -1 }, { 301, 1 }, { 300, 0 }
+};
+
+static const Drag drags[] = {
+  { "terminal, bottom right corner", META_GRAB_OP_RESIZING_SE, TRUE,
+    { 200, 150, 724, 459 }, se_terminal, G_N_ELEMENTS (se_terminal) },
+  { "right edge onto second monitor", META_GRAB_OP_RESIZING_E, FALSE,
+    { 1100, 300, 640, 480 }, e_across_monitors,
+    G_N_ELEMENTS (e_across_monitors) },
+  { "top edge into the panel", META_GRAB_OP_RESIZING_N, FALSE,
+    { 500, 240, 640, 480 }, n_into_panel, G_N_ELEMENTS (n_into_panel) },
+  { "left edge past the minimum size", META_GRAB_OP_RESIZING_W, FALSE,
+    { 300, 200, 640, 480 }, w_below_min, G_N_ELEMENTS (w_below_min) }
+};
+
+static MetaFrame fake_frame;
+
+static MetaScreen*
+fake_screen (void)
+{
+  MetaDisplay *display;
+  MetaScreen *screen;
+  MetaWorkspace *workspace;
+  MetaStrut *panel;
+  int i;
+
+  display = g_new0 (MetaDisplay, 1);
+  display->window_ids = meta_xid_map_new ();
+
+  /* Two monitors side by side, and a panel along the top of the first */
+  screen = g_new0 (MetaScreen, 1);
+  screen->display = display;
+  screen->rect.width = 3840;
+  screen->rect.height = 1080;
+  screen->n_monitor_infos = 2;
+  screen->monitor_infos = g_new0 (MetaMonitorInfo, 2);
+  for (i = 0; i < 2; i++)
+    {
+      screen->monitor_infos[i].number = i;
+      screen->monitor_infos[i].rect.x = 1920 * i;
+      screen->monitor_infos[i].rect.width = 1920;
+      screen->monitor_infos[i].rect.height = 1080;
+    }
+  screen->monitor_infos[0].is_primary = TRUE;
+
+  workspace = meta_workspace_new (screen);
+  screen->active_workspace = workspace;
+
+  panel = g_new0 (MetaStrut, 1);
+  panel->rect.width = 1920;
+  panel->rect.height = 28;
+  panel->side = META_SIDE_TOP;
+  workspace->builtin_struts = g_slist_prepend (NULL, panel);
+
+  return screen;
+}
+
+static MetaWindow*
+fake_window (MetaScreen *screen,
+             gboolean    terminal)
+{
+  MetaWindow *window;
+
+  /* Nothing here talks to an X server; the window is just enough of a
+   * MetaWindow for the constraints.
+   */
+  window = g_object_new (META_TYPE_WINDOW, NULL);
+  window->display = screen->display;
+  window->screen = screen;
+  window->workspace = screen->active_workspace;
+  window->xwindow = 0x1000000;
+  window->desc = g_strdup ("0x1000000");
+  window->type = META_WINDOW_NORMAL;
+  window->frame = &fake_frame;
+  window->decorated = TRUE;
+  window->placed = TRUE;
+  window->require_fully_onscreen = TRUE;
+  window->require_on_single_monitor = TRUE;
+  window->require_titlebar_visible = TRUE;
+
+  window->size_hints.min_width = 1;
+  window->size_hints.min_height = 1;
+  window->size_hints.max_width = G_MAXINT;
+  window->size_hints.max_height = G_MAXINT;
+  window->size_hints.width_inc = 1;
+  window->size_hints.height_inc = 1;
+  window->size_hints.min_aspect.x = 1;
+  window->size_hints.min_aspect.y = G_MAXINT;
+  window->size_hints.max_aspect.x = G_MAXINT;
+  window->size_hints.max_aspect.y = 1;
+
+  if (terminal)
+    {
+      /* 80x24 cells of 9x19 pixels */
+      window->size_hints.base_width = 4;
+      window->size_hints.base_height = 3;
+      window->size_hints.width_inc = 9;
+      window->size_hints.height_inc = 19;
+      window->size_hints.min_width = 4 + 9;
+      window->size_hints.min_height = 3 + 19;
+    }
+  else
+    {
+      window->size_hints.min_width = 320;
+      window->size_hints.min_height = 240;
+    }
+
+  return window;
+}
+
+/* Does what update_resize() in window.c does for one pointer position */
+static void
+resize_to (MetaWindow             *window,
+           const Drag             *drag,
+           const Motion           *motion,
+           const MetaFrameBorders *borders)
+{
+  MetaFrameBorders frame_borders = *borders;
+  MetaRectangle old, new;
+  int gravity;
+
+  if (motion->x == 0 && motion->y == 0)
+    return;
+
+  old = window->rect;
+  new = old;
+  new.width = drag->start.width;
+  new.height = drag->start.height;
+
+  switch (drag->op)
+    {
+    case META_GRAB_OP_RESIZING_SE:
+      new.width += motion->x;
+      new.height += motion->y;
+      break;
+    case META_GRAB_OP_RESIZING_E:
+      new.width += motion->x;
+      new.height = old.height;
+      break;
+    case META_GRAB_OP_RESIZING_N:
+      new.width = old.width;
+      new.height -= motion->y;
+      break;
+    case META_GRAB_OP_RESIZING_W:
+      new.width -= motion->x;
+      new.height = old.height;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  gravity = meta_resize_gravity_from_grab_op (drag->op);
+  meta_rectangle_resize_with_gravity (&old, &new, gravity,
+                                      new.width, new.height);
+
+  meta_window_constrain (window, &frame_borders,
+                         META_IS_USER_ACTION | META_IS_RESIZE_ACTION,
+                         gravity, &old, &new);
+
+  window->rect = new;
+}
+
+/* Where the window is after each resize of a replay */
+#define N_STEPS(drag) ((drag)->n_motions * 2 + 1)
+
+static void
+check_step (MetaWindow          *window,
+            const Drag          *drag,
+            int                  step,
+            MetaRectangle       *record,
+            const MetaRectangle *expect)
+{
+  if (record)
+    record[step] = window->rect;
+
+  if (expect && !meta_rectangle_equal (&window->rect, &expect[step]))
+    {
+      g_printerr ("%s: step %d ends at %d,%d %dx%d with the memo, "
+                  "%d,%d %dx%d without\n",
+                  drag->name, step,
+                  window->rect.x, window->rect.y,
+                  window->rect.width, window->rect.height,
+                  expect[step].x, expect[step].y,
+                  expect[step].width, expect[step].height);
+      exit (1);
+    }
+}
+
+static void
+replay (MetaWindow             *window,
+        const Drag             *drag,
+        const MetaFrameBorders *borders,
+        MetaRectangle          *record,
+        const MetaRectangle    *expect)
+{
+  int i, step;
+
+  window->rect = drag->start;
+  step = 0;
+
+  /* Each motion event resizes the window, and then resizes it again for
+   * the same pointer position once the client has caught up, as happens
+   * for clients using _NET_WM_SYNC_REQUEST; releasing the button does it
+   * once more.
+   */
+  for (i = 0; i < drag->n_motions; i++)
+    {
+      resize_to (window, drag, &drag->motions[i], borders);
+      check_step (window, drag, step++, record, expect);
+      resize_to (window, drag, &drag->motions[i], borders);
+      check_step (window, drag, step++, record, expect);
+    }
+  resize_to (window, drag, &drag->motions[drag->n_motions - 1], borders);
+  check_step (window, drag, step++, record, expect);
+}
+
+static double
+time_replays (MetaWindow             *window,
+              const Drag             *drag,
+              const MetaFrameBorders *borders,
+              const MetaRectangle    *expect)
+{
+  GTimer *timer;
+  double elapsed;
+  int i;
+
+  timer = g_timer_new ();
+
+  g_timer_start (timer);
+  for (i = 0; i < NUM_REPLAYS; i++)
+    replay (window, drag, borders, NULL, expect);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+
+  return elapsed * 1e6 / (NUM_REPLAYS * drag->n_motions);
+}
+
+static void
+run_benchmark (MetaScreen *screen,
+               const Drag *drag)
+{
+  MetaWindow *window;
+  MetaFrameBorders borders;
+  MetaRectangle *expected;
+  double without_memo, with_memo;
+
+  meta_frame_borders_clear (&borders);
+  borders.visible.top = 28;
+  borders.visible.left = borders.visible.right = 1;
+  borders.visible.bottom = 1;
+  borders.total = borders.visible;
+
+  window = fake_window (screen, drag->terminal);
+  expected = g_new (MetaRectangle, N_STEPS (drag));
+
+  /* Every step with the memo has to match running the constraints */
+  meta_constraints_set_memo_enabled (FALSE);
+  replay (window, drag, &borders, expected, NULL);
+  without_memo = time_replays (window, drag, &borders, expected);
+
+  meta_constraints_set_memo_enabled (TRUE);
+  with_memo = time_replays (window, drag, &borders, expected);
+
+  printf ("%-32s %7.2f us per motion without the memo, %7.2f with, "
+          "ends at %d,%d %dx%d\n",
+          drag->name, without_memo, with_memo,
+          window->rect.x, window->rect.y,
+          window->rect.width, window->rect.height);
+
+  g_free (expected);
+  window->frame = NULL;
+  g_object_unref (window);
+}
+
+int
+main (int argc, char **argv)
+{
+  MetaScreen *screen;
+  int i;
+
+  g_type_init ();
+
+  screen = fake_screen ();
+
+  for (i = 0; i < (int) G_N_ELEMENTS (drags); i++)
+    run_benchmark (screen, &drags[i]);
+
+  return 0;
+}
@@ -0,0 +1,113 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter icon conversion test program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <config.h>
+#include "iconcache.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_PIXELS (256 * 256 + 7)
+
+/* The conversion meta_icon_argb_to_rgba() replaced, a byte at a time */
+static void
+argb_to_rgba_bytewise (const gulong *argb_data,
+                       int           len,
+                       guchar       *p)
+{
+  int i;
+
+  i = 0;
+  while (i < len)
+    {
+      guint argb;
+      guint rgba;
+
+      argb = argb_data[i];
+      rgba = (argb << 8) | (argb >> 24);
+
+      *p = rgba >> 24;
+      ++p;
+      *p = (rgba >> 16) & 0xff;
+      ++p;
+      *p = (rgba >> 8) & 0xff;
+      ++p;
+      *p = rgba & 0xff;
+      ++p;
+
+      ++i;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  gulong *argb_data;
+  guchar *expected;
+  guchar *actual;
+  GRand *rand;
+  int len;
+  int i;
+
+  argb_data = g_new (gulong, MAX_PIXELS);
+  expected = g_new (guchar, MAX_PIXELS * 4);
+  actual = g_new (guchar, MAX_PIXELS * 4);
+  rand = g_rand_new_with_seed (1);
+
+  /* Where longs are 64 bits wide the upper half is garbage, which
+   * mustn't leak into the pixels.
+   */
+  for (i = 0; i < MAX_PIXELS; i++)
+    {
+      argb_data[i] = g_rand_int (rand);
+      if (sizeof (gulong) > 4)
+        argb_data[i] |= (gulong) g_rand_int (rand) << 16 << 16;
+    }
+
+  /* Every short length, for any tail the compiler leaves over */
+  for (len = 0; len <= MAX_PIXELS; len = len < 64 ? len + 1 : len * 4 + 3)
+    {
+      if (len > MAX_PIXELS)
+        len = MAX_PIXELS;
+
+      argb_to_rgba_bytewise (argb_data, len, expected);
+      meta_icon_argb_to_rgba (argb_data, len, actual);
+
+      if (memcmp (expected, actual, len * 4) != 0)
+        {
+          g_printerr ("Converting %d pixels differs from the bytewise loop\n",
+                      len);
+          return 1;
+        }
+
+      if (len == MAX_PIXELS)
+        break;
+    }
+
+  printf ("Icon conversion matches the bytewise loop\n");
+
+  g_rand_free (rand);
+  g_free (actual);
+  g_free (expected);
+  g_free (argb_data);
+
+  return 0;
+}
@@ -0,0 +1,184 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter keybinding lookup benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <config.h>
+#include "keybindings-private.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <X11/Xlib.h>
+
+#define NUM_LOOKUPS 1000000
+
+/* What an ignored modifier mask usually looks like: Lock + NumLock */
+#define IGNORED_MASK (LockMask | Mod2Mask)
+
+static MetaKeyHandler global_handler = { "global", NULL, NULL, 0, 0, NULL, NULL };
+static MetaKeyHandler window_handler = { "per-window", NULL, NULL, 0,
+                                         META_KEY_BINDING_PER_WINDOW,
+                                         NULL, NULL };
+
+static const unsigned int interesting_masks[] = {
+  0, ShiftMask, ControlMask, Mod1Mask, Mod4Mask,
+  ControlMask | Mod1Mask, ShiftMask | Mod1Mask, ShiftMask | Mod4Mask
+};
+
+typedef struct
+{
+  unsigned int keycode;
+  unsigned int state;
+  gboolean     on_window;
+} FakeKeyPress;
+
+/* What process_event() used to do */
+static int
+linear_lookup (MetaKeyBinding *bindings,
+               int             n_bindings,
+               unsigned int    keycode,
+               unsigned int    mask,
+               gboolean        on_window)
+{
+  int i;
+
+  for (i = 0; i < n_bindings; i++)
+    {
+      if ((!on_window && bindings[i].handler->flags & META_KEY_BINDING_PER_WINDOW) ||
+          bindings[i].keycode != keycode ||
+          bindings[i].mask != mask)
+        continue;
+
+      return i;
+    }
+
+  return -1;
+}
+
+static unsigned int
+random_mask (void)
+{
+  return interesting_masks[g_random_int_range (0, G_N_ELEMENTS (interesting_masks))];
+}
+
+static void
+fill_bindings (MetaKeyBinding *bindings,
+               int             n_bindings)
+{
+  int i;
+
+  for (i = 0; i < n_bindings; i++)
+    {
+      bindings[i].name = "fake";
+      bindings[i].keysym = 0;
+      bindings[i].keycode = g_random_int_range (8, 256);
+      bindings[i].modifiers = 0;
+      bindings[i].mask = random_mask ();
+      bindings[i].handler = g_random_boolean () ? &global_handler : &window_handler;
+    }
+}
+
+static void
+fill_presses (FakeKeyPress *presses,
+              int           n_presses)
+{
+  int i;
+
+  for (i = 0; i < n_presses; i++)
+    {
+      presses[i].keycode = g_random_int_range (8, 256);
+      presses[i].state = random_mask ();
+      if (g_random_boolean ())
+        presses[i].state |= Mod2Mask;
+      presses[i].on_window = g_random_boolean ();
+    }
+}
+
+static void
+run_benchmark (int n_bindings)
+{
+  MetaKeyBinding *bindings;
+  MetaKeyBindingIndex index = { NULL, 0 };
+  FakeKeyPress *presses;
+  GTimer *timer;
+  double linear_time, index_time;
+  int i, hits;
+
+  bindings = g_new0 (MetaKeyBinding, n_bindings);
+  presses = g_new (FakeKeyPress, NUM_LOOKUPS);
+  fill_bindings (bindings, n_bindings);
+  fill_presses (presses, NUM_LOOKUPS);
+
+  meta_key_binding_index_rebuild (&index, bindings, n_bindings, IGNORED_MASK);
+
+  /* Check before timing, so a fast wrong answer doesn't go unnoticed */
+  for (i = 0; i < NUM_LOOKUPS; i++)
+    {
+      unsigned int mask = presses[i].state & 0xff & ~IGNORED_MASK;
+
+      g_assert (linear_lookup (bindings, n_bindings,
+                               presses[i].keycode, mask,
+                               presses[i].on_window) ==
+                meta_key_binding_index_lookup (&index,
+                                               presses[i].keycode, mask,
+                                               presses[i].on_window));
+    }
+
+  timer = g_timer_new ();
+
+  hits = 0;
+  g_timer_start (timer);
+  for (i = 0; i < NUM_LOOKUPS; i++)
+    if (linear_lookup (bindings, n_bindings, presses[i].keycode,
+                       presses[i].state & 0xff & ~IGNORED_MASK,
+                       presses[i].on_window) >= 0)
+      hits++;
+  linear_time = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (i = 0; i < NUM_LOOKUPS; i++)
+    if (meta_key_binding_index_lookup (&index, presses[i].keycode,
+                                       presses[i].state & 0xff & ~IGNORED_MASK,
+                                       presses[i].on_window) >= 0)
+      hits--;
+  index_time = g_timer_elapsed (timer, NULL);
+
+  g_assert (hits == 0);
+
+  printf ("%6d bindings: linear %8.1f ns/lookup, indexed %6.1f ns/lookup\n",
+          n_bindings,
+          linear_time * 1e9 / NUM_LOOKUPS,
+          index_time * 1e9 / NUM_LOOKUPS);
+
+  g_timer_destroy (timer);
+  meta_key_binding_index_free (&index);
+  g_free (presses);
+  g_free (bindings);
+}
+
+int
+main (int argc, char **argv)
+{
+  int n_bindings;
+
+  for (n_bindings = 16; n_bindings <= 4096; n_bindings *= 4)
+    run_benchmark (n_bindings);
+
+  return 0;
+}
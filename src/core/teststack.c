@@ -0,0 +1,172 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter window stack benchmark */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <config.h>
+#include "stack.h"
+#include "display-private.h"
+#include "window-private.h"
+#include <glib.h>
+#include <stdio.h>
+
+#define NUM_RAISES 10000
+
+/* The stack never gets thawed, so nothing here talks to an X server;
+ * the windows are just enough of a MetaWindow for the stack code.
+ */
+static MetaWindow*
+fake_window (MetaScreen *screen,
+             int         i)
+{
+  MetaWindow *window;
+  int kind;
+
+  window = g_new0 (MetaWindow, 1);
+  window->display = screen->display;
+  window->screen = screen;
+  window->xwindow = 0x1000000 + i;
+  window->desc = g_strdup_printf ("0x%lx", window->xwindow);
+  window->stack_position = -1;
+  window->layer = META_LAYER_LAST;
+  window->type = META_WINDOW_NORMAL;
+  window->input = TRUE;
+
+  kind = g_random_int_range (0, 20);
+  if (kind == 0)
+    window->wm_state_above = TRUE;
+  else if (kind == 1)
+    window->wm_state_below = TRUE;
+  else if (kind < 5 && i > 0)
+    {
+      /* A dialog for one of the windows before it */
+      window->type = META_WINDOW_DIALOG;
+      window->xtransient_for = 0x1000000 + g_random_int_range (0, i);
+    }
+
+  meta_display_register_x_window (screen->display, &window->xwindow, window);
+
+  return window;
+}
+
+static void
+check_stack (MetaStack   *stack,
+             MetaDisplay *display)
+{
+  GList *windows;
+  GList *tmp;
+
+  windows = meta_stack_list_windows (stack, NULL);
+
+  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *window = tmp->data;
+      MetaWindow *parent;
+
+      if (tmp->next)
+        g_assert (meta_stack_windows_cmp (stack, window, tmp->next->data) < 0);
+
+      if (window->xtransient_for == None)
+        continue;
+
+      parent = meta_display_lookup_x_window (display, window->xtransient_for);
+      g_assert (window->stack_position > parent->stack_position);
+      g_assert (window->layer >= parent->layer);
+    }
+
+  g_list_free (windows);
+}
+
+static void
+run_benchmark (int n_windows)
+{
+  MetaDisplay *display;
+  MetaScreen *screen;
+  MetaWindow **windows;
+  GTimer *timer;
+  double elapsed;
+  int i;
+
+  display = g_new0 (MetaDisplay, 1);
+  display->window_ids = meta_xid_map_new ();
+  screen = g_new0 (MetaScreen, 1);
+  screen->display = display;
+  screen->stack = meta_stack_new (screen);
+  meta_stack_freeze (screen->stack);
+
+  windows = g_new (MetaWindow *, n_windows);
+  for (i = 0; i < n_windows; i++)
+    {
+      windows[i] = fake_window (screen, i);
+      meta_stack_add (screen->stack, windows[i]);
+    }
+
+  meta_stack_get_top (screen->stack);
+  check_stack (screen->stack, display);
+
+  timer = g_timer_new ();
+
+  /* Raise and lower the way clicking around does, bringing the stack
+   * up to date after each one.
+   */
+  g_timer_start (timer);
+  for (i = 0; i < NUM_RAISES; i++)
+    {
+      MetaWindow *window = windows[g_random_int_range (0, n_windows)];
+
+      if (i % 8 == 0)
+        meta_stack_lower (screen->stack, window);
+      else
+        meta_stack_raise (screen->stack, window);
+
+      meta_stack_get_top (screen->stack);
+    }
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  check_stack (screen->stack, display);
+
+  printf ("%5d windows: %7.2f us per raise\n",
+          n_windows, elapsed * 1e6 / NUM_RAISES);
+
+  g_timer_destroy (timer);
+
+  for (i = 0; i < n_windows; i++)
+    {
+      meta_stack_remove (screen->stack, windows[i]);
+      g_free (windows[i]->desc);
+      g_free (windows[i]);
+    }
+
+  g_free (windows);
+  meta_stack_free (screen->stack);
+  meta_xid_map_free (display->window_ids);
+  g_free (screen);
+  g_free (display);
+}
+
+int
+main (int argc, char **argv)
+{
+  int n_windows;
+
+  for (n_windows = 50; n_windows <= 1600; n_windows *= 2)
+    run_benchmark (n_windows);
+
+  return 0;
+}
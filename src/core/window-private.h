@@ -62,6 +62,8 @@ typedef enum {
 
 #define NUMBER_OF_QUEUES 3
 
+typedef struct _MetaConstraintMemo MetaConstraintMemo;
+
 struct _MetaWindow
 {
   GObject parent_instance;
@@ -166,6 +168,9 @@ struct _MetaWindow
   /* Whether we're trying to constrain the window's titlebar to be onscreen */
   guint require_titlebar_visible : 1;
 
+  /* Recent results of meta_window_constrain(), see constraints.c */
+  MetaConstraintMemo *constraint_memo;
+
   /* Whether we're sticky in the multi-workspace sense
    * (vs. the not-scroll-with-viewport sense, we don't
    * have no stupid viewports)
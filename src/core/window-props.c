@@ -443,6 +443,7 @@ set_title_text (MetaWindow  *window,
                        window->xwindow,
                        atom);
       meta_error_trap_pop (window->display);
+      meta_prop_cache_invalidate (window->display, window->xwindow, atom);
     }
 
   return modified;
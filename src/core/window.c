@@ -223,6 +223,7 @@ meta_window_finalize (GObject *object)
   g_free (window->title);
   g_free (window->icon_name);
   g_free (window->desc);
+  g_free (window->constraint_memo);
   g_free (window->gtk_theme_variant);
   g_free (window->dbus_application_id);
   g_free (window->dbus_unique_name);
@@ -1014,6 +1015,7 @@ meta_window_new_with_attrs (MetaDisplay       *display,
   window->require_fully_onscreen = TRUE;
   window->require_on_single_monitor = TRUE;
   window->require_titlebar_visible = TRUE;
+  window->constraint_memo = NULL;
   window->on_all_workspaces = FALSE;
   window->on_all_workspaces_requested = FALSE;
   window->tile_mode = META_TILE_NONE;
@@ -1744,6 +1746,8 @@ meta_window_unmanage (MetaWindow  *window,
 
       tmp = tmp->next;
     }
+
+  g_assert (g_list_find (window->screen->sticky_windows, window) == NULL);
 #endif
 
   if (window->monitor)
@@ -1783,6 +1787,13 @@ meta_window_unmanage (MetaWindow  *window,
                        window->display->atom__NET_WM_FULLSCREEN_MONITORS);
       set_wm_state (window, WithdrawnState);
       meta_error_trap_pop (window->display);
+
+      meta_prop_cache_invalidate (window->display, window->xwindow,
+                                  window->display->atom__NET_WM_DESKTOP);
+      meta_prop_cache_invalidate (window->display, window->xwindow,
+                                  window->display->atom__NET_WM_STATE);
+      meta_prop_cache_invalidate (window->display, window->xwindow,
+                                  window->display->atom__NET_WM_FULLSCREEN_MONITORS);
     }
   else
     {
@@ -1883,6 +1894,9 @@ meta_window_update_on_all_workspaces (MetaWindow *window)
   if (window->on_all_workspaces != old_value &&
       !window->override_redirect)
     {
+      if (window->workspace)
+        meta_workspace_window_sticky_changed (window);
+
       if (window->on_all_workspaces)
         {
           GList* tmp = window->screen->workspaces;
@@ -1933,6 +1947,9 @@ set_wm_state_on_xwindow (MetaDisplay *display,
                    display->atom_WM_STATE,
                    32, PropModeReplace, (guchar*) data, 2);
   meta_error_trap_pop (display);
+
+  /* Don't hand back the old value before the PropertyNotify arrives */
+  meta_prop_cache_invalidate (display, xwindow, display->atom_WM_STATE);
 }
 
 static void
@@ -2026,6 +2043,8 @@ set_net_wm_state (MetaWindow *window)
                    XA_ATOM,
                    32, PropModeReplace, (guchar*) data, i);
   meta_error_trap_pop (window->display);
+  meta_prop_cache_invalidate (window->display, window->xwindow,
+                              window->display->atom__NET_WM_STATE);
 
   if (window->fullscreen)
     {
@@ -2042,6 +2061,8 @@ set_net_wm_state (MetaWindow *window)
                        XA_CARDINAL, 32, PropModeReplace,
                        (guchar*) data, 4);
       meta_error_trap_pop (window->display);
+      meta_prop_cache_invalidate (window->display, window->xwindow,
+                                  window->display->atom__NET_WM_FULLSCREEN_MONITORS);
     }
 }
 
@@ -2218,8 +2239,10 @@ idle_calc_showing (gpointer data)
   GSList *should_show;
   GSList *should_hide;
   GSList *unplaced;
-  GSList *displays;
+  GSList *screens;
   MetaWindow *first_window;
+  gboolean need_sentinel;
+  GTimer *timer;
   guint queue_index = GPOINTER_TO_INT (data);
 
   g_return_val_if_fail (queue_pending[queue_index] != NULL, FALSE);
@@ -2231,6 +2254,8 @@ idle_calc_showing (gpointer data)
    * complete; destroying a window while we're in here would result in
    * badness. But it's OK to queue/unqueue calc_showings.
    */
+  timer = meta_is_verbose () ? g_timer_new () : NULL;
+
   copy = g_slist_copy (queue_pending[queue_index]);
   g_slist_free (queue_pending[queue_index]);
   queue_pending[queue_index] = NULL;
@@ -2246,7 +2271,7 @@ idle_calc_showing (gpointer data)
   should_show = NULL;
   should_hide = NULL;
   unplaced = NULL;
-  displays = NULL;
+  screens = NULL;
 
   tmp = copy;
   while (tmp != NULL)
@@ -2255,6 +2280,9 @@ idle_calc_showing (gpointer data)
 
       window = tmp->data;
 
+      if (!g_slist_find (screens, window->screen))
+        screens = g_slist_prepend (screens, window->screen);
+
       if (!window->placed)
         unplaced = g_slist_prepend (unplaced, window);
       else if (meta_window_should_be_showing (window))
@@ -2276,6 +2304,15 @@ idle_calc_showing (gpointer data)
 
   meta_display_grab (first_window->display);
 
+  /* Showing or hiding a window restacks it (always with live hidden
+   * windows, and for any window that gets placed), and each restack
+   * syncs the whole stack to the server and the compositor. Hold the
+   * stacks frozen so a workspace switch costs one sync, not one per
+   * window.
+   */
+  for (tmp = screens; tmp != NULL; tmp = tmp->next)
+    meta_stack_freeze (((MetaScreen *) tmp->data)->stack);
+
   tmp = unplaced;
   while (tmp != NULL)
     {
@@ -2336,26 +2373,48 @@ idle_calc_showing (gpointer data)
        * that, we set a sentinel property on the root window if we're
        * not in mouse_mode.
        */
+      need_sentinel = FALSE;
+
       tmp = should_show;
       while (tmp != NULL)
         {
           MetaWindow *window = tmp->data;
 
           if (!window->display->mouse_mode)
-            meta_display_increment_focus_sentinel (window->display);
+            need_sentinel = TRUE;
 
           tmp = tmp->next;
         }
+
+      /* Only the last PropertyNotify matters, so one is enough for
+       * the whole batch.
+       */
+      if (need_sentinel)
+        meta_display_increment_focus_sentinel (first_window->display);
     }
 
+  for (tmp = screens; tmp != NULL; tmp = tmp->next)
+    meta_stack_thaw (((MetaScreen *) tmp->data)->stack);
+
   meta_display_ungrab (first_window->display);
 
+  if (timer)
+    {
+      meta_topic (META_DEBUG_WINDOW_STATE,
+                  "calc_showing: %d unplaced, %d shown, %d hidden in %g ms\n",
+                  g_slist_length (unplaced),
+                  g_slist_length (should_show),
+                  g_slist_length (should_hide),
+                  g_timer_elapsed (timer, NULL) * 1000.0);
+      g_timer_destroy (timer);
+    }
+
   g_slist_free (copy);
 
   g_slist_free (unplaced);
   g_slist_free (should_show);
   g_slist_free (should_hide);
-  g_slist_free (displays);
+  g_slist_free (screens);
 
   destroying_windows_disallowed -= 1;
 
@@ -5748,6 +5807,8 @@ update_net_frame_extents (MetaWindow *window)
                    XA_CARDINAL,
                    32, PropModeReplace, (guchar*) data, 4);
   meta_error_trap_pop (window->display);
+  meta_prop_cache_invalidate (window->display, window->xwindow,
+                              window->display->atom__NET_FRAME_EXTENTS);
 }
 
 void
@@ -5775,6 +5836,8 @@ meta_window_set_current_workspace_hint (MetaWindow *window)
                    XA_CARDINAL,
                    32, PropModeReplace, (guchar*) data, 1);
   meta_error_trap_pop (window->display);
+  meta_prop_cache_invalidate (window->display, window->xwindow,
+                              window->display->atom__NET_WM_DESKTOP);
 }
 
 static gboolean
@@ -7339,8 +7402,11 @@ meta_window_update_icon_now (MetaWindow *window)
 static gboolean
 idle_update_icon (gpointer data)
 {
-  GSList *tmp;
+  GSList *tmp, *tmp2;
   GSList *copy;
+  GSList *tasks = NULL;
+  GSList *fetching = NULL;
+  int n_tasks;
   guint queue_index = GPOINTER_TO_INT (data);
 
   meta_topic (META_DEBUG_GEOMETRY, "Clearing the update_icon queue\n");
@@ -7356,6 +7422,54 @@ idle_update_icon (gpointer data)
 
   destroying_windows_disallowed += 1;
 
+  /* Ask for all the _NET_WM_ICON properties up front so they come
+   * back in one round trip instead of one per window.
+   */
+  n_tasks = 0;
+  tmp = copy;
+  while (tmp != NULL)
+    {
+      MetaWindow *window;
+      AgGetPropertyTask *task;
+
+      window = tmp->data;
+
+      task = meta_icon_cache_begin_fetch (&window->icon_cache,
+                                          window->display,
+                                          window->xwindow);
+      if (task)
+        {
+          tasks = g_slist_prepend (tasks, task);
+          fetching = g_slist_prepend (fetching, window);
+          ++n_tasks;
+        }
+
+      tmp = tmp->next;
+    }
+
+  if (n_tasks > 0)
+    {
+      MetaWindow *window = fetching->data;
+
+      meta_topic (META_DEBUG_SYNC, "Syncing to get %d icon replies in %s\n",
+                  n_tasks, G_STRFUNC);
+      XSync (window->display->xdisplay, False);
+
+      tasks = g_slist_reverse (tasks);
+      fetching = g_slist_reverse (fetching);
+
+      for (tmp = tasks, tmp2 = fetching;
+           tmp != NULL;
+           tmp = tmp->next, tmp2 = tmp2->next)
+        {
+          window = tmp2->data;
+          meta_icon_cache_finish_fetch (&window->icon_cache, tmp->data);
+        }
+
+      g_slist_free (tasks);
+      g_slist_free (fetching);
+    }
+
   tmp = copy;
   while (tmp != NULL)
     {
@@ -7707,6 +7821,7 @@ recalc_window_type (MetaWindow *window)
         meta_window_destroy_frame (window);
 
       /* update stacking constraints */
+      meta_stack_update_transient (window->screen->stack, window);
       meta_window_update_layer (window);
 
       meta_window_grab_keys (window);
@@ -7790,6 +7905,8 @@ set_allowed_actions_hint (MetaWindow *window)
                    XA_ATOM,
                    32, PropModeReplace, (guchar*) data, i);
   meta_error_trap_pop (window->display);
+  meta_prop_cache_invalidate (window->display, window->xwindow,
+                              window->display->atom__NET_WM_ALLOWED_ACTIONS);
 #undef MAX_N_ACTIONS
 }
 
@@ -9958,8 +10075,9 @@ void
 meta_window_set_demands_attention (MetaWindow *window)
 {
   MetaRectangle candidate_rect, other_rect;
-  GList *stack = window->screen->stack->sorted;
+  GArray *stack = window->screen->stack->sorted;
   MetaWindow *other_window;
+  int i;
   gboolean obscured = FALSE;
 
   MetaWorkspace *workspace = window->screen->active_workspace;
@@ -9980,12 +10098,13 @@ meta_window_set_demands_attention (MetaWindow *window)
     {
       meta_window_get_outer_rect (window, &candidate_rect);
 
-      /* The stack is sorted with the top windows first. */
+      /* The stack is sorted with the top windows last. */
 
-      while (stack != NULL && stack->data != window)
+      for (i = stack->len - 1; i >= 0; i--)
         {
-          other_window = stack->data;
-          stack = stack->next;
+          other_window = g_array_index (stack, MetaWindow *, i);
+          if (other_window == window)
+            break;
 
           if (other_window->on_all_workspaces ||
               window->on_all_workspaces ||
@@ -36,6 +36,8 @@
 #include <meta/workspace.h>
 #include "window-private.h"
 
+typedef struct _MetaWorkAreas MetaWorkAreas;
+
 struct _MetaWorkspace
 {
   GObject parent_instance;
@@ -46,6 +48,10 @@ struct _MetaWorkspace
 
   GList  *list_containing_self;
 
+  /* The fields below point into work_areas, which may be shared with
+   * other workspaces that have the same struts; never free them.
+   */
+  MetaWorkAreas *work_areas;
   MetaRectangle work_area_screen;
   MetaRectangle *work_area_monitor;
   GList  *screen_region;
@@ -73,8 +79,10 @@ void           meta_workspace_remove_window (MetaWorkspace *workspace,
                                              MetaWindow    *window);
 void           meta_workspace_relocate_windows (MetaWorkspace *workspace,
                                                 MetaWorkspace *new_home);
+void           meta_workspace_window_sticky_changed (MetaWindow *window);
 
 void meta_workspace_invalidate_work_area (MetaWorkspace *workspace);
+void meta_workspace_free_work_area_cache (MetaScreen    *screen);
 
 
 void meta_workspace_get_work_area_for_monitor   (MetaWorkspace *workspace,
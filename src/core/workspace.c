@@ -51,6 +51,7 @@ static void focus_ancestor_or_mru_window (MetaWorkspace *workspace,
                                           guint32        timestamp);
 static void free_this                    (gpointer candidate,
                                           gpointer dummy);
+static void workspace_release_work_areas (MetaWorkspace *workspace);
 
 G_DEFINE_TYPE (MetaWorkspace, meta_workspace, G_TYPE_OBJECT);
 
@@ -172,6 +173,7 @@ meta_workspace_new (MetaScreen *screen)
   meta_screen_foreach_window (screen, maybe_add_to_list, &workspace->mru_list);
 
   workspace->work_areas_invalid = TRUE;
+  workspace->work_areas = NULL;
   workspace->work_area_monitor = NULL;
   workspace->work_area_screen.x = 0;
   workspace->work_area_screen.y = 0;
@@ -199,22 +201,6 @@ free_this (gpointer candidate, gpointer dummy)
   g_free (candidate);
 }
 
-/**
- * Frees the combined struts list of a workspace.
- *
- * \param workspace  The workspace.
- */
-static void
-workspace_free_all_struts (MetaWorkspace *workspace)
-{
-  if (workspace->all_struts == NULL)
-    return;
-    
-  g_slist_foreach (workspace->all_struts, free_this, NULL);
-  g_slist_free (workspace->all_struts);
-  workspace->all_struts = NULL;
-}
-
 /**
  * Frees the struts list set with meta_workspace_set_builtin_struts
  *
@@ -235,8 +221,6 @@ void
 meta_workspace_remove (MetaWorkspace *workspace)
 {
   GList *tmp;
-  MetaScreen *screen;
-  int i;
 
   g_return_if_fail (workspace != workspace->screen->active_workspace);
 
@@ -260,13 +244,9 @@ meta_workspace_remove (MetaWorkspace *workspace)
 
   g_assert (workspace->windows == NULL);
 
-  screen = workspace->screen;
-  
   workspace->screen->workspaces =
     g_list_remove (workspace->screen->workspaces, workspace);
   
-  g_free (workspace->work_area_monitor);
-
   g_list_free (workspace->mru_list);
   g_list_free (workspace->list_containing_self);
 
@@ -274,21 +254,13 @@ meta_workspace_remove (MetaWorkspace *workspace)
 
   /* screen.c:update_num_workspaces(), which calls us, removes windows from
    * workspaces first, which can cause the workareas on the workspace to be
-   * invalidated (and hence for struts/regions/edges to be freed).
-   * So, no point trying to double free it; that causes a crash
+   * invalidated (and hence for struts/regions/edges to be released).
+   * So, no point trying to release them twice; that causes a crash
    * anyway.  #361804.
    */
 
   if (!workspace->work_areas_invalid)
-    {
-      workspace_free_all_struts (workspace);
-      for (i = 0; i < screen->n_monitor_infos; i++)
-        meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
-      g_free (workspace->monitor_region);
-      meta_rectangle_free_list_and_elements (workspace->screen_region);
-      meta_rectangle_free_list_and_elements (workspace->screen_edges);
-      meta_rectangle_free_list_and_elements (workspace->monitor_edges);
-    }
+    workspace_release_work_areas (workspace);
 
   g_object_unref (workspace);
 
@@ -329,6 +301,10 @@ meta_workspace_add_window (MetaWorkspace *workspace,
 
   workspace->windows = g_list_prepend (workspace->windows, window);
 
+  if (window->on_all_workspaces)
+    window->screen->sticky_windows =
+      g_list_prepend (window->screen->sticky_windows, window);
+
   window->workspace = workspace;
 
   meta_window_set_current_workspace_hint (window);
@@ -359,6 +335,10 @@ meta_workspace_remove_window (MetaWorkspace *workspace,
   workspace->windows = g_list_remove (workspace->windows, window);
   window->workspace = NULL;
 
+  if (window->on_all_workspaces)
+    window->screen->sticky_windows =
+      g_list_remove (window->screen->sticky_windows, window);
+
   /* If the window is on all workspaces, we don't want to remove it
    * from the MRU list unless this causes it to be removed from all 
    * workspaces
@@ -725,37 +705,45 @@ meta_workspace_update_window_hints (MetaWorkspace *workspace)
 GList*
 meta_workspace_list_windows (MetaWorkspace *workspace)
 {
-  GSList *display_windows;
-  GSList *tmp;
+  GList *tmp;
   GList *workspace_windows;
-  
-  display_windows = meta_display_list_windows (workspace->screen->display,
-                                               META_LIST_DEFAULT);
 
-  workspace_windows = NULL;
-  tmp = display_windows;
-  while (tmp != NULL)
+  /* Sticky windows whose home is this workspace are already in
+   * workspace->windows.
+   */
+  workspace_windows = g_list_copy (workspace->windows);
+  for (tmp = workspace->screen->sticky_windows; tmp != NULL; tmp = tmp->next)
     {
       MetaWindow *window = tmp->data;
 
-      if (meta_window_located_on_workspace (window, workspace))
-        workspace_windows = g_list_prepend (workspace_windows,
-                                            window);
-
-      tmp = tmp->next;
+      if (window->workspace != workspace)
+        workspace_windows = g_list_prepend (workspace_windows, window);
     }
 
-  g_slist_free (display_windows);
-
   return workspace_windows;
 }
 
+/* Called when window->on_all_workspaces changes on a window that
+ * belongs to a workspace.
+ */
+void
+meta_workspace_window_sticky_changed (MetaWindow *window)
+{
+  g_return_if_fail (window->workspace != NULL);
+
+  if (window->on_all_workspaces)
+    window->screen->sticky_windows =
+      g_list_prepend (window->screen->sticky_windows, window);
+  else
+    window->screen->sticky_windows =
+      g_list_remove (window->screen->sticky_windows, window);
+}
+
 void
 meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
 {
   GList *tmp;
   GList *windows;
-  int i;
   
   if (workspace->work_areas_invalid)
     {
@@ -774,21 +762,7 @@ meta_workspace_invalidate_work_area (MetaWorkspace *workspace)
   if (workspace == workspace->screen->active_workspace)
     meta_display_cleanup_edges (workspace->screen->display);
 
-  g_free (workspace->work_area_monitor);
-  workspace->work_area_monitor = NULL;
-      
-  workspace_free_all_struts (workspace);
-
-  for (i = 0; i < workspace->screen->n_monitor_infos; i++)
-    meta_rectangle_free_list_and_elements (workspace->monitor_region[i]);
-  g_free (workspace->monitor_region);
-  meta_rectangle_free_list_and_elements (workspace->screen_region);
-  meta_rectangle_free_list_and_elements (workspace->screen_edges);
-  meta_rectangle_free_list_and_elements (workspace->monitor_edges);
-  workspace->monitor_region = NULL;
-  workspace->screen_region = NULL;
-  workspace->screen_edges = NULL;
-  workspace->monitor_edges = NULL;
+  workspace_release_work_areas (workspace);
   
   workspace->work_areas_invalid = TRUE;
 
@@ -829,68 +803,245 @@ copy_strut_list(GSList *original)
   return g_slist_reverse (result);
 }
 
+/* Work areas only depend on the struts and the monitor layout, and
+ * usually every workspace has the same struts since panels are sticky,
+ * so the computed regions, work areas and edges are shared between
+ * workspaces through a cache on the screen, keyed on the strut list.
+ * The spanning set of a single monitor only depends on the struts that
+ * overlap it, so those are cached separately too and survive a strut
+ * change on some other monitor.  A few entries nobody uses any more are
+ * kept around, because struts tend to flip between the same couple of
+ * states (e.g. autohiding panels).
+ */
+#define MAX_UNUSED_WORK_AREAS 8
+
+typedef struct
+{
+  int            ref_count;
+  MetaRectangle  rect;
+  GSList        *struts;        /* the struts overlapping rect */
+  GList         *region;
+} MonitorRegion;
+
+struct _MetaWorkAreas
+{
+  int             ref_count;
+  guint           hash;
+  MetaRectangle   screen_rect;
+  int             n_monitors;
+  GSList         *struts;
+  MetaRectangle   work_area_screen;
+  MetaRectangle  *work_area_monitor;
+  MonitorRegion **monitors;
+  GList         **monitor_region;  /* the regions of monitors */
+  GList          *screen_region;
+  GList          *screen_edges;
+  GList          *monitor_edges;
+};
+
+static gboolean
+strut_lists_equal (GSList *l,
+                   GSList *m)
+{
+  for (; l && m; l = l->next, m = m->next)
+    {
+      MetaStrut *a = l->data;
+      MetaStrut *b = m->data;
+
+      if (a->side != b->side ||
+          !meta_rectangle_equal (&a->rect, &b->rect))
+        return FALSE;
+    }
+
+  return l == NULL && m == NULL;
+}
+
+static guint
+hash_rect (guint                hash,
+           const MetaRectangle *rect)
+{
+  hash = hash * 31 + rect->x;
+  hash = hash * 31 + rect->y;
+  hash = hash * 31 + rect->width;
+  hash = hash * 31 + rect->height;
+
+  return hash;
+}
+
+static guint
+hash_work_areas_key (MetaScreen *screen,
+                     GSList     *struts)
+{
+  guint hash;
+  int i;
+
+  hash = hash_rect (screen->n_monitor_infos, &screen->rect);
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    hash = hash_rect (hash, &screen->monitor_infos[i].rect);
+
+  for (; struts; struts = struts->next)
+    {
+      MetaStrut *strut = struts->data;
+
+      hash = hash_rect (hash * 31 + strut->side, &strut->rect);
+    }
+
+  return hash;
+}
+
 static void
-ensure_work_areas_validated (MetaWorkspace *workspace)
+free_strut_list (GSList *struts)
 {
-  GList         *windows;
-  GList         *tmp;
-  MetaRectangle  work_area;
-  int            i;  /* C89 absolutely sucks... */
+  g_slist_foreach (struts, free_this, NULL);
+  g_slist_free (struts);
+}
 
-  if (!workspace->work_areas_invalid)
+static void
+monitor_region_unref (MonitorRegion *monitor)
+{
+  if (--monitor->ref_count > 0)
     return;
 
-  g_assert (workspace->all_struts == NULL);
-  g_assert (workspace->monitor_region == NULL);
-  g_assert (workspace->screen_region == NULL);
-  g_assert (workspace->screen_edges == NULL);
-  g_assert (workspace->monitor_edges == NULL);
+  free_strut_list (monitor->struts);
+  meta_rectangle_free_list_and_elements (monitor->region);
+  g_slice_free (MonitorRegion, monitor);
+}
 
-  /* STEP 1: Get the list of struts */
+static void
+work_areas_unref (MetaWorkAreas *work_areas)
+{
+  int i;
 
-  workspace->all_struts = copy_strut_list (workspace->builtin_struts);
+  if (--work_areas->ref_count > 0)
+    return;
 
-  windows = meta_workspace_list_windows (workspace);
-  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+  for (i = 0; i < work_areas->n_monitors; i++)
+    monitor_region_unref (work_areas->monitors[i]);
+  g_free (work_areas->monitors);
+  g_free (work_areas->monitor_region);
+  g_free (work_areas->work_area_monitor);
+  free_strut_list (work_areas->struts);
+  meta_rectangle_free_list_and_elements (work_areas->screen_region);
+  meta_rectangle_free_list_and_elements (work_areas->screen_edges);
+  meta_rectangle_free_list_and_elements (work_areas->monitor_edges);
+  g_slice_free (MetaWorkAreas, work_areas);
+}
+
+/* Drops the entries past the first MAX_UNUSED_WORK_AREAS ones that only
+ * the cache itself still holds.  Both kinds of entries start with their
+ * reference count.
+ */
+static GList*
+trim_cache (GList          *cache,
+            GDestroyNotify  unref)
+{
+  GList *l, *next;
+  int n_unused;
+
+  n_unused = 0;
+  for (l = cache; l != NULL; l = next)
     {
-      MetaWindow *win = tmp->data;
-      GSList *s_iter;
+      int *ref_count = l->data;
 
-      for (s_iter = win->struts; s_iter != NULL; s_iter = s_iter->next) {
-        workspace->all_struts = g_slist_prepend (workspace->all_struts,
-                                                 copy_strut(s_iter->data));
-      }
+      next = l->next;
+
+      if (*ref_count == 1 && ++n_unused > MAX_UNUSED_WORK_AREAS)
+        {
+          unref (l->data);
+          cache = g_list_delete_link (cache, l);
+        }
     }
-  g_list_free (windows);
+
+  return cache;
+}
+
+static MonitorRegion*
+get_monitor_region (MetaScreen          *screen,
+                    const MetaRectangle *rect,
+                    GSList              *all_struts)
+{
+  MonitorRegion *monitor;
+  GSList *struts;
+  GList *l;
+
+  struts = NULL;
+  for (; all_struts; all_struts = all_struts->next)
+    {
+      MetaStrut *strut = all_struts->data;
+
+      if (meta_rectangle_overlap (&strut->rect, rect))
+        struts = g_slist_prepend (struts, strut);
+    }
+  struts = g_slist_reverse (struts);
+
+  for (l = screen->monitor_region_cache; l != NULL; l = l->next)
+    {
+      monitor = l->data;
+
+      if (meta_rectangle_equal (&monitor->rect, rect) &&
+          strut_lists_equal (monitor->struts, struts))
+        {
+          g_slist_free (struts);
+
+          screen->monitor_region_cache =
+            g_list_remove_link (screen->monitor_region_cache, l);
+          screen->monitor_region_cache =
+            g_list_concat (l, screen->monitor_region_cache);
+
+          monitor->ref_count++;
+          return monitor;
+        }
+    }
+
+  monitor = g_slice_new (MonitorRegion);
+  monitor->ref_count = 2; /* the cache and the caller */
+  monitor->rect = *rect;
+  monitor->struts = copy_strut_list (struts);
+  monitor->region =
+    meta_rectangle_get_minimal_spanning_set_for_region (rect, struts);
+  g_slist_free (struts);
+
+  screen->monitor_region_cache =
+    g_list_prepend (screen->monitor_region_cache, monitor);
+
+  return monitor;
+}
+
+static void
+compute_work_areas (MetaWorkspace *workspace,
+                    MetaWorkAreas *work_areas)
+{
+  MetaScreen    *screen = workspace->screen;
+  GList         *tmp;
+  MetaRectangle  work_area;
+  int            i;
 
   /* STEP 2: Get the maximal/spanning rects for the onscreen and
    *         on-single-monitor regions
    */  
-  g_assert (workspace->monitor_region == NULL);
-  g_assert (workspace->screen_region   == NULL);
-
-  workspace->monitor_region = g_new (GList*,
-                                      workspace->screen->n_monitor_infos);
-  for (i = 0; i < workspace->screen->n_monitor_infos; i++)
+  work_areas->monitors = g_new (MonitorRegion*, screen->n_monitor_infos);
+  work_areas->monitor_region = g_new (GList*, screen->n_monitor_infos);
+  for (i = 0; i < screen->n_monitor_infos; i++)
     {
-      workspace->monitor_region[i] =
-        meta_rectangle_get_minimal_spanning_set_for_region (
-          &workspace->screen->monitor_infos[i].rect,
-          workspace->all_struts);
+      work_areas->monitors[i] =
+        get_monitor_region (screen,
+                            &screen->monitor_infos[i].rect,
+                            work_areas->struts);
+      work_areas->monitor_region[i] = work_areas->monitors[i]->region;
     }
-  workspace->screen_region =
+  work_areas->screen_region =
     meta_rectangle_get_minimal_spanning_set_for_region (
-      &workspace->screen->rect,
-      workspace->all_struts);
+      &screen->rect,
+      work_areas->struts);
 
   /* STEP 3: Get the work areas (region-to-maximize-to) for the screen and
    *         monitors.
    */
-  work_area = workspace->screen->rect;  /* start with the screen */
-  if (workspace->screen_region == NULL)
+  work_area = screen->rect;  /* start with the screen */
+  if (work_areas->screen_region == NULL)
     work_area = meta_rect (0, 0, -1, -1);
   else
-    meta_rectangle_clip_to_region (workspace->screen_region,
+    meta_rectangle_clip_to_region (work_areas->screen_region,
                                    FIXED_DIRECTION_NONE,
                                    &work_area);
 
@@ -903,7 +1054,7 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
                     work_area.width, MIN_SANE_AREA);
       if (work_area.width < 1)
         {
-          work_area.x = (workspace->screen->rect.width - MIN_SANE_AREA)/2;
+          work_area.x = (screen->rect.width - MIN_SANE_AREA)/2;
           work_area.width = MIN_SANE_AREA;
         }
       else
@@ -920,7 +1071,7 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
                     work_area.height, MIN_SANE_AREA);
       if (work_area.height < 1)
         {
-          work_area.y = (workspace->screen->rect.height - MIN_SANE_AREA)/2;
+          work_area.y = (screen->rect.height - MIN_SANE_AREA)/2;
           work_area.height = MIN_SANE_AREA;
         }
       else
@@ -930,70 +1081,221 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
           work_area.height += 2*amount;
         }
     }
-  workspace->work_area_screen = work_area;
+  work_areas->work_area_screen = work_area;
   meta_topic (META_DEBUG_WORKAREA,
               "Computed work area for workspace %d: %d,%d %d x %d\n",
               meta_workspace_index (workspace),
-              workspace->work_area_screen.x,
-              workspace->work_area_screen.y,
-              workspace->work_area_screen.width,
-              workspace->work_area_screen.height);    
+              work_areas->work_area_screen.x,
+              work_areas->work_area_screen.y,
+              work_areas->work_area_screen.width,
+              work_areas->work_area_screen.height);    
 
   /* Now find the work areas for each monitor */
-  g_free (workspace->work_area_monitor);
-  workspace->work_area_monitor = g_new (MetaRectangle,
-                                         workspace->screen->n_monitor_infos);
+  work_areas->work_area_monitor = g_new (MetaRectangle,
+                                         screen->n_monitor_infos);
 
-  for (i = 0; i < workspace->screen->n_monitor_infos; i++)
+  for (i = 0; i < screen->n_monitor_infos; i++)
     {
-      work_area = workspace->screen->monitor_infos[i].rect;
+      work_area = screen->monitor_infos[i].rect;
 
-      if (workspace->monitor_region[i] == NULL)
+      if (work_areas->monitor_region[i] == NULL)
         /* FIXME: constraints.c untested with this, but it might be nice for
          * a screen reader or magnifier.
          */
         work_area = meta_rect (work_area.x, work_area.y, -1, -1);
       else
-        meta_rectangle_clip_to_region (workspace->monitor_region[i],
+        meta_rectangle_clip_to_region (work_areas->monitor_region[i],
                                        FIXED_DIRECTION_NONE,
                                        &work_area);
 
-      workspace->work_area_monitor[i] = work_area;
+      work_areas->work_area_monitor[i] = work_area;
       meta_topic (META_DEBUG_WORKAREA,
                   "Computed work area for workspace %d "
                   "monitor %d: %d,%d %d x %d\n",
                   meta_workspace_index (workspace),
                   i,
-                  workspace->work_area_monitor[i].x,
-                  workspace->work_area_monitor[i].y,
-                  workspace->work_area_monitor[i].width,
-                  workspace->work_area_monitor[i].height);
+                  work_areas->work_area_monitor[i].x,
+                  work_areas->work_area_monitor[i].y,
+                  work_areas->work_area_monitor[i].width,
+                  work_areas->work_area_monitor[i].height);
     }
 
   /* STEP 4: Make sure the screen_region is nonempty (separate from step 2
    *         since it relies on step 3).
    */  
-  if (workspace->screen_region == NULL)
+  if (work_areas->screen_region == NULL)
     {
       MetaRectangle *nonempty_region;
       nonempty_region = g_new (MetaRectangle, 1);
-      *nonempty_region = workspace->work_area_screen;
-      workspace->screen_region = g_list_prepend (NULL, nonempty_region);
+      *nonempty_region = work_areas->work_area_screen;
+      work_areas->screen_region = g_list_prepend (NULL, nonempty_region);
     }
 
   /* STEP 5: Cache screen and monitor edges for edge resistance and snapping */
-  g_assert (workspace->screen_edges    == NULL);
-  g_assert (workspace->monitor_edges  == NULL);
-  workspace->screen_edges =
-    meta_rectangle_find_onscreen_edges (&workspace->screen->rect,
-                                        workspace->all_struts);
+  work_areas->screen_edges =
+    meta_rectangle_find_onscreen_edges (&screen->rect,
+                                        work_areas->struts);
   tmp = NULL;
-  for (i = 0; i < workspace->screen->n_monitor_infos; i++)
-    tmp = g_list_prepend (tmp, &workspace->screen->monitor_infos[i].rect);
-  workspace->monitor_edges =
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    tmp = g_list_prepend (tmp, &screen->monitor_infos[i].rect);
+  work_areas->monitor_edges =
     meta_rectangle_find_nonintersected_monitor_edges (tmp,
-                                                       workspace->all_struts);
+                                                       work_areas->struts);
   g_list_free (tmp);
+}
+
+static gboolean
+work_areas_match (MetaWorkAreas *work_areas,
+                  MetaScreen    *screen,
+                  guint          hash,
+                  GSList        *struts)
+{
+  int i;
+
+  if (work_areas->hash != hash ||
+      work_areas->n_monitors != screen->n_monitor_infos ||
+      !meta_rectangle_equal (&work_areas->screen_rect, &screen->rect))
+    return FALSE;
+
+  for (i = 0; i < screen->n_monitor_infos; i++)
+    if (!meta_rectangle_equal (&work_areas->monitors[i]->rect,
+                               &screen->monitor_infos[i].rect))
+      return FALSE;
+
+  return strut_lists_equal (work_areas->struts, struts);
+}
+
+/* Takes ownership of struts */
+static MetaWorkAreas*
+get_work_areas (MetaWorkspace *workspace,
+                GSList        *struts)
+{
+  MetaScreen    *screen = workspace->screen;
+  MetaWorkAreas *work_areas;
+  GList         *l;
+  guint          hash;
+
+  hash = hash_work_areas_key (screen, struts);
+
+  for (l = screen->work_area_cache; l != NULL; l = l->next)
+    {
+      work_areas = l->data;
+
+      if (work_areas_match (work_areas, screen, hash, struts))
+        {
+          meta_topic (META_DEBUG_WORKAREA,
+                      "Reusing work areas for workspace %d\n",
+                      meta_workspace_index (workspace));
+
+          free_strut_list (struts);
+
+          screen->work_area_cache =
+            g_list_remove_link (screen->work_area_cache, l);
+          screen->work_area_cache = g_list_concat (l, screen->work_area_cache);
+
+          work_areas->ref_count++;
+          return work_areas;
+        }
+    }
+
+  work_areas = g_slice_new0 (MetaWorkAreas);
+  work_areas->ref_count = 2; /* the cache and the caller */
+  work_areas->hash = hash;
+  work_areas->screen_rect = screen->rect;
+  work_areas->n_monitors = screen->n_monitor_infos;
+  work_areas->struts = struts;
+
+  compute_work_areas (workspace, work_areas);
+
+  /* The new entry may have taken the place of one that was freed, so
+   * anything remembering regions by address has to be told.
+   */
+  screen->work_area_generation++;
+
+  screen->work_area_cache = g_list_prepend (screen->work_area_cache,
+                                            work_areas);
+  screen->work_area_cache = trim_cache (screen->work_area_cache,
+                                        (GDestroyNotify) work_areas_unref);
+  screen->monitor_region_cache =
+    trim_cache (screen->monitor_region_cache,
+                (GDestroyNotify) monitor_region_unref);
+
+  return work_areas;
+}
+
+static void
+workspace_release_work_areas (MetaWorkspace *workspace)
+{
+  if (workspace->work_areas == NULL)
+    return;
+
+  work_areas_unref (workspace->work_areas);
+  workspace->work_areas = NULL;
+
+  workspace->all_struts = NULL;
+  workspace->work_area_monitor = NULL;
+  workspace->monitor_region = NULL;
+  workspace->screen_region = NULL;
+  workspace->screen_edges = NULL;
+  workspace->monitor_edges = NULL;
+}
+
+void
+meta_workspace_free_work_area_cache (MetaScreen *screen)
+{
+  /* Workspaces still using an entry keep it alive */
+  g_list_foreach (screen->work_area_cache, (GFunc) work_areas_unref, NULL);
+  g_list_free (screen->work_area_cache);
+  screen->work_area_cache = NULL;
+
+  g_list_foreach (screen->monitor_region_cache,
+                  (GFunc) monitor_region_unref, NULL);
+  g_list_free (screen->monitor_region_cache);
+  screen->monitor_region_cache = NULL;
+}
+
+static void
+ensure_work_areas_validated (MetaWorkspace *workspace)
+{
+  GList         *windows;
+  GList         *tmp;
+  GSList        *struts;
+  MetaWorkAreas *work_areas;
+
+  if (!workspace->work_areas_invalid)
+    return;
+
+  g_assert (workspace->work_areas == NULL);
+
+  /* STEP 1: Get the list of struts */
+
+  struts = copy_strut_list (workspace->builtin_struts);
+
+  windows = meta_workspace_list_windows (workspace);
+  for (tmp = windows; tmp != NULL; tmp = tmp->next)
+    {
+      MetaWindow *win = tmp->data;
+      GSList *s_iter;
+
+      for (s_iter = win->struts; s_iter != NULL; s_iter = s_iter->next) {
+        struts = g_slist_prepend (struts, copy_strut(s_iter->data));
+      }
+    }
+  g_list_free (windows);
+
+  /* The remaining steps are in compute_work_areas(), unless some other
+   * workspace already did them for the same struts.
+   */
+  work_areas = get_work_areas (workspace, struts);
+
+  workspace->work_areas = work_areas;
+  workspace->all_struts = work_areas->struts;
+  workspace->work_area_screen = work_areas->work_area_screen;
+  workspace->work_area_monitor = work_areas->work_area_monitor;
+  workspace->monitor_region = work_areas->monitor_region;
+  workspace->screen_region = work_areas->screen_region;
+  workspace->screen_edges = work_areas->screen_edges;
+  workspace->monitor_edges = work_areas->monitor_edges;
 
   /* We're all done, YAAY!  Record that everything has been validated. */
   workspace->work_areas_invalid = FALSE;
@@ -1011,23 +1313,6 @@ ensure_work_areas_validated (MetaWorkspace *workspace)
   }
 }
 
-static gboolean
-strut_lists_equal (GSList *l,
-                   GSList *m)
-{
-  for (; l && m; l = l->next, m = m->next)
-    {
-      MetaStrut *a = l->data;
-      MetaStrut *b = m->data;
-
-      if (a->side != b->side ||
-          !meta_rectangle_equal (&a->rect, &b->rect))
-        return FALSE;
-    }
-
-  return l == NULL && m == NULL;
-}
-
 /**
  * meta_workspace_set_builtin_struts:
  * @workspace: a #MetaWorkspace
@@ -0,0 +1,224 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter map from X resource IDs to objects */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <config.h>
+#include "xid-map.h"
+
+/* XIDs handed out to one client share their high bits and are mostly
+ * small consecutive numbers in the low bits, so we scramble them with
+ * a Fibonacci multiply and take the top bits as the slot.  Collisions
+ * are resolved by linear probing, and removal shifts the following
+ * entries of the cluster back, so there are never any tombstones and
+ * a lookup stops at the first empty slot.
+ */
+
+#define INITIAL_BITS 6
+
+typedef struct
+{
+  XID      xid;
+  gpointer value;
+} MetaXidMapSlot;
+
+struct _MetaXidMap
+{
+  MetaXidMapSlot *slots;
+  guint bits;
+  guint n_entries;
+};
+
+static inline guint
+slot_for_xid (const MetaXidMap *map,
+              XID               xid)
+{
+  return (guint) (((guint64) xid * G_GUINT64_CONSTANT (0x9E3779B97F4A7C15))
+                  >> (64 - map->bits));
+}
+
+static inline guint
+find_slot (const MetaXidMap *map,
+           XID               xid)
+{
+  guint mask = (1u << map->bits) - 1;
+  guint i;
+
+  i = slot_for_xid (map, xid);
+  while (map->slots[i].xid != None && map->slots[i].xid != xid)
+    i = (i + 1) & mask;
+
+  return i;
+}
+
+static void
+resize (MetaXidMap *map,
+        guint       bits)
+{
+  MetaXidMapSlot *old_slots = map->slots;
+  guint old_size = 1u << map->bits;
+  guint i;
+
+  map->slots = g_new0 (MetaXidMapSlot, 1u << bits);
+  map->bits = bits;
+
+  if (old_slots == NULL)
+    return;
+
+  for (i = 0; i < old_size; i++)
+    if (old_slots[i].xid != None)
+      map->slots[find_slot (map, old_slots[i].xid)] = old_slots[i];
+
+  g_free (old_slots);
+}
+
+MetaXidMap*
+meta_xid_map_new (void)
+{
+  MetaXidMap *map;
+
+  map = g_new0 (MetaXidMap, 1);
+  resize (map, INITIAL_BITS);
+
+  return map;
+}
+
+void
+meta_xid_map_free (MetaXidMap *map)
+{
+  g_free (map->slots);
+  g_free (map);
+}
+
+gpointer
+meta_xid_map_lookup (MetaXidMap *map,
+                     XID         xid)
+{
+  if (xid == None)
+    return NULL;
+
+  return map->slots[find_slot (map, xid)].value;
+}
+
+void
+meta_xid_map_insert (MetaXidMap *map,
+                     XID         xid,
+                     gpointer    value)
+{
+  guint i;
+
+  g_return_if_fail (xid != None);
+
+  i = find_slot (map, xid);
+  if (map->slots[i].xid == None)
+    {
+      /* Keep the load factor at or below one half */
+      if ((map->n_entries + 1) * 2 > (1u << map->bits))
+        {
+          resize (map, map->bits + 1);
+          i = find_slot (map, xid);
+        }
+
+      map->slots[i].xid = xid;
+      map->n_entries++;
+    }
+
+  map->slots[i].value = value;
+}
+
+gboolean
+meta_xid_map_remove (MetaXidMap *map,
+                     XID         xid)
+{
+  guint mask = (1u << map->bits) - 1;
+  guint i, j;
+
+  if (xid == None)
+    return FALSE;
+
+  i = find_slot (map, xid);
+  if (map->slots[i].xid == None)
+    return FALSE;
+
+  /* Pull back any later entry of the cluster whose home slot doesn't
+   * lie cyclically in (i, j], since the hole at i would otherwise cut
+   * it off from its home.
+   */
+  j = i;
+  while (TRUE)
+    {
+      guint home;
+
+      j = (j + 1) & mask;
+      if (map->slots[j].xid == None)
+        break;
+
+      home = slot_for_xid (map, map->slots[j].xid);
+      if (((j - home) & mask) >= ((j - i) & mask))
+        {
+          map->slots[i] = map->slots[j];
+          i = j;
+        }
+    }
+
+  map->slots[i].xid = None;
+  map->slots[i].value = NULL;
+  map->n_entries--;
+
+  return TRUE;
+}
+
+guint
+meta_xid_map_size (MetaXidMap *map)
+{
+  return map->n_entries;
+}
+
+void
+meta_xid_map_iter_init (MetaXidMapIter *iter,
+                        MetaXidMap     *map)
+{
+  iter->map = map;
+  iter->position = 0;
+}
+
+gboolean
+meta_xid_map_iter_next (MetaXidMapIter *iter,
+                        XID            *xid,
+                        gpointer       *value)
+{
+  MetaXidMap *map = iter->map;
+  guint size = 1u << map->bits;
+
+  while (iter->position < size)
+    {
+      MetaXidMapSlot *slot = &map->slots[iter->position++];
+
+      if (slot->xid != None)
+        {
+          if (xid)
+            *xid = slot->xid;
+          if (value)
+            *value = slot->value;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
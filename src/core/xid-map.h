@@ -0,0 +1,59 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter map from X resource IDs to objects */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifndef META_XID_MAP_H
+#define META_XID_MAP_H
+
+#include <glib.h>
+#include <X11/Xlib.h>
+
+/* An open-addressing hash table keyed directly on XIDs.  Keys live
+ * inline in the slot array, so inserting doesn't allocate anything
+ * unless the table has to grow.  None can't be used as a key.
+ */
+typedef struct _MetaXidMap MetaXidMap;
+
+typedef struct
+{
+  MetaXidMap *map;
+  guint       position;
+} MetaXidMapIter;
+
+MetaXidMap* meta_xid_map_new    (void);
+void        meta_xid_map_free   (MetaXidMap *map);
+
+gpointer    meta_xid_map_lookup (MetaXidMap *map,
+                                 XID         xid);
+void        meta_xid_map_insert (MetaXidMap *map,
+                                 XID         xid,
+                                 gpointer    value);
+gboolean    meta_xid_map_remove (MetaXidMap *map,
+                                 XID         xid);
+guint       meta_xid_map_size   (MetaXidMap *map);
+
+/* The map must not be modified while iterating */
+void        meta_xid_map_iter_init (MetaXidMapIter *iter,
+                                    MetaXidMap     *map);
+gboolean    meta_xid_map_iter_next (MetaXidMapIter *iter,
+                                    XID            *xid,
+                                    gpointer       *value);
+
+#endif
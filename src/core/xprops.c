@@ -103,6 +103,326 @@ typedef struct
   unsigned char *prop;
 } GetPropertyResults;
 
+/* Upper bound on the property data we keep around; the least
+ * recently used entries are thrown out once we go past it.
+ */
+#define PROP_CACHE_MAX_BYTES (256 * 1024)
+
+typedef struct
+{
+  Window         xwindow;
+  Atom           xatom;
+  Atom           req_type;
+  Atom           type;
+  int            format;
+  unsigned long  n_items;
+  unsigned long  bytes_after;
+  gsize          n_bytes;
+  unsigned char *data;    /* g_malloc copy of the reply, NULL if unset */
+  GList          lru_link;
+} PropCacheEntry;
+
+typedef struct
+{
+  Window  xwindow;
+  GSList *entries;
+} PropCacheWindow;
+
+struct _MetaPropCache
+{
+  GHashTable *windows;    /* Window -> PropCacheWindow */
+  GQueue      lru;        /* most recently used entry at the head */
+  gsize       n_bytes;
+  gulong      hits;
+  gulong      misses;
+};
+
+static MetaPropCache*
+prop_cache_get (MetaDisplay *display)
+{
+  if (display->prop_cache == NULL)
+    {
+      display->prop_cache = g_new0 (MetaPropCache, 1);
+      display->prop_cache->windows =
+        g_hash_table_new (meta_unsigned_long_hash, meta_unsigned_long_equal);
+      g_queue_init (&display->prop_cache->lru);
+    }
+
+  return display->prop_cache;
+}
+
+/* We can only trust a remembered value if we are going to be told
+ * when it changes, i.e. if we have PropertyChangeMask selected on
+ * the window.
+ */
+static gboolean
+prop_cache_covers (MetaDisplay *display,
+                   Window       xwindow)
+{
+  MetaWindow *window;
+
+  window = meta_display_lookup_x_window (display, xwindow);
+
+  return window != NULL &&
+    (xwindow == window->xwindow || xwindow == window->user_time_window);
+}
+
+static PropCacheEntry*
+prop_cache_find (MetaDisplay *display,
+                 Window       xwindow,
+                 Atom         xatom)
+{
+  PropCacheWindow *cache_window;
+  GSList *tmp;
+
+  if (display->prop_cache == NULL)
+    return NULL;
+
+  cache_window = g_hash_table_lookup (display->prop_cache->windows, &xwindow);
+  if (cache_window == NULL)
+    return NULL;
+
+  for (tmp = cache_window->entries; tmp != NULL; tmp = tmp->next)
+    {
+      PropCacheEntry *entry = tmp->data;
+
+      if (entry->xatom == xatom)
+        return entry;
+    }
+
+  return NULL;
+}
+
+static void
+prop_cache_entry_free (MetaPropCache  *cache,
+                       PropCacheEntry *entry)
+{
+  g_queue_unlink (&cache->lru, &entry->lru_link);
+  cache->n_bytes -= entry->n_bytes;
+
+  g_free (entry->data);
+  g_free (entry);
+}
+
+static void
+prop_cache_remove (MetaPropCache  *cache,
+                   PropCacheEntry *entry)
+{
+  PropCacheWindow *cache_window;
+
+  cache_window = g_hash_table_lookup (cache->windows, &entry->xwindow);
+  g_assert (cache_window != NULL);
+
+  cache_window->entries = g_slist_remove (cache_window->entries, entry);
+  if (cache_window->entries == NULL)
+    {
+      g_hash_table_remove (cache->windows, &cache_window->xwindow);
+      g_free (cache_window);
+    }
+
+  prop_cache_entry_free (cache, entry);
+}
+
+static gsize
+results_n_bytes (const GetPropertyResults *results)
+{
+  /* Xlib hands format 16 and 32 data back as shorts and longs */
+  switch (results->format)
+    {
+    case 8:
+      return results->n_items;
+    case 16:
+      return results->n_items * sizeof (short);
+    case 32:
+      return results->n_items * sizeof (long);
+    default:
+      return 0;
+    }
+}
+
+/* Fills in @results from the cache, with results->prop being a fresh
+ * Xmalloc copy the caller owns, just as if it had come from the
+ * server.  Returns FALSE if we need to ask the server.
+ */
+static gboolean
+prop_cache_lookup (MetaDisplay        *display,
+                   Window              xwindow,
+                   Atom                xatom,
+                   Atom                req_type,
+                   GetPropertyResults *results)
+{
+  MetaPropCache *cache;
+  PropCacheEntry *entry;
+
+  if (!prop_cache_covers (display, xwindow))
+    return FALSE;
+
+  cache = prop_cache_get (display);
+
+  entry = prop_cache_find (display, xwindow, xatom);
+  if (entry == NULL || entry->req_type != req_type)
+    {
+      cache->misses += 1;
+      return FALSE;
+    }
+
+  results->display = display;
+  results->xwindow = xwindow;
+  results->xatom = xatom;
+  results->type = entry->type;
+  results->format = entry->format;
+  results->n_items = entry->n_items;
+  results->bytes_after = entry->bytes_after;
+  results->prop = NULL;
+
+  if (entry->data != NULL)
+    {
+      /* Keep the nul that XGetWindowProperty always appends */
+      results->prop = ag_Xmalloc (entry->n_bytes + 1);
+      if (results->prop == NULL)
+        return FALSE;
+      memcpy (results->prop, entry->data, entry->n_bytes + 1);
+    }
+
+  cache->hits += 1;
+
+  g_queue_unlink (&cache->lru, &entry->lru_link);
+  g_queue_push_head_link (&cache->lru, &entry->lru_link);
+
+  return TRUE;
+}
+
+/* Remembers a successful reply; results->prop is copied, not taken */
+static void
+prop_cache_store (MetaDisplay              *display,
+                  Atom                      req_type,
+                  const GetPropertyResults *results)
+{
+  MetaPropCache *cache;
+  PropCacheEntry *entry;
+  PropCacheWindow *cache_window;
+  gsize n_bytes;
+
+  if (!prop_cache_covers (display, results->xwindow))
+    return;
+
+  n_bytes = results->type != None ? results_n_bytes (results) : 0;
+
+  /* Don't let a single huge property (_NET_WM_ICON, say) flush
+   * everything else out.
+   */
+  if (n_bytes > PROP_CACHE_MAX_BYTES / 8)
+    return;
+
+  cache = prop_cache_get (display);
+
+  entry = prop_cache_find (display, results->xwindow, results->xatom);
+  if (entry != NULL)
+    prop_cache_remove (cache, entry);
+
+  entry = g_new0 (PropCacheEntry, 1);
+  entry->xwindow = results->xwindow;
+  entry->xatom = results->xatom;
+  entry->req_type = req_type;
+  entry->type = results->type;
+  entry->format = results->format;
+  entry->n_items = results->n_items;
+  entry->bytes_after = results->bytes_after;
+  entry->lru_link.data = entry;
+
+  if (results->type != None)
+    {
+      entry->n_bytes = n_bytes;
+      entry->data = g_malloc0 (n_bytes + 1);
+      if (results->prop != NULL)
+        memcpy (entry->data, results->prop, n_bytes);
+    }
+
+  cache_window = g_hash_table_lookup (cache->windows, &entry->xwindow);
+  if (cache_window == NULL)
+    {
+      cache_window = g_new0 (PropCacheWindow, 1);
+      cache_window->xwindow = entry->xwindow;
+      g_hash_table_insert (cache->windows, &cache_window->xwindow,
+                           cache_window);
+    }
+
+  cache_window->entries = g_slist_prepend (cache_window->entries, entry);
+  g_queue_push_head_link (&cache->lru, &entry->lru_link);
+  cache->n_bytes += entry->n_bytes;
+
+  while (cache->n_bytes > PROP_CACHE_MAX_BYTES)
+    prop_cache_remove (cache, g_queue_peek_tail_link (&cache->lru)->data);
+}
+
+void
+meta_prop_cache_invalidate (MetaDisplay *display,
+                            Window       xwindow,
+                            Atom         xatom)
+{
+  PropCacheEntry *entry;
+
+  entry = prop_cache_find (display, xwindow, xatom);
+  if (entry != NULL)
+    prop_cache_remove (display->prop_cache, entry);
+}
+
+void
+meta_prop_cache_forget_window (MetaDisplay *display,
+                               Window       xwindow)
+{
+  PropCacheWindow *cache_window;
+  GSList *tmp;
+
+  if (display->prop_cache == NULL)
+    return;
+
+  cache_window = g_hash_table_lookup (display->prop_cache->windows, &xwindow);
+  if (cache_window == NULL)
+    return;
+
+  g_hash_table_remove (display->prop_cache->windows, &cache_window->xwindow);
+
+  for (tmp = cache_window->entries; tmp != NULL; tmp = tmp->next)
+    prop_cache_entry_free (display->prop_cache, tmp->data);
+
+  g_slist_free (cache_window->entries);
+  g_free (cache_window);
+}
+
+void
+meta_prop_cache_get_stats (MetaDisplay *display,
+                           gulong      *hits_p,
+                           gulong      *misses_p)
+{
+  if (hits_p)
+    *hits_p = display->prop_cache ? display->prop_cache->hits : 0;
+  if (misses_p)
+    *misses_p = display->prop_cache ? display->prop_cache->misses : 0;
+}
+
+void
+meta_prop_cache_free (MetaDisplay *display)
+{
+  MetaPropCache *cache;
+
+  cache = display->prop_cache;
+  if (cache == NULL)
+    return;
+
+  meta_topic (META_DEBUG_SYNC,
+              "Property cache: %lu hits, %lu misses, %" G_GSIZE_FORMAT " bytes held\n",
+              cache->hits, cache->misses, cache->n_bytes);
+
+  while (!g_queue_is_empty (&cache->lru))
+    prop_cache_remove (cache, g_queue_peek_head_link (&cache->lru)->data);
+
+  g_hash_table_destroy (cache->windows);
+  g_free (cache);
+
+  display->prop_cache = NULL;
+}
+
 static gboolean
 validate_or_free_results (GetPropertyResults *results,
                           int                 expected_format,
@@ -192,6 +512,9 @@ get_property (MetaDisplay        *display,
   results->type = None;
   results->bytes_after = 0;
   results->format = 0;
+
+  if (prop_cache_lookup (display, xwindow, xatom, req_type, results))
+    return results->type != None;
   
   meta_error_trap_push_with_return (display);
   if (XGetWindowProperty (display->xdisplay, xwindow, xatom,
@@ -199,8 +522,7 @@ get_property (MetaDisplay        *display,
                           False, req_type, &results->type, &results->format,
                           &results->n_items,
                           &results->bytes_after,
-                          &results->prop) != Success ||
-      results->type == None)
+                          &results->prop) != Success)
     {
       if (results->prop)
         XFree (results->prop);
@@ -215,6 +537,16 @@ get_property (MetaDisplay        *display,
       return FALSE;
     }
 
+  /* An unset property is worth remembering too */
+  prop_cache_store (display, req_type, results);
+
+  if (results->type == None)
+    {
+      if (results->prop)
+        XFree (results->prop);
+      return FALSE;
+    }
+
   return TRUE;
 }
 
@@ -548,6 +880,9 @@ meta_prop_set_utf8_string_hint (MetaDisplay *display,
                    display->atom_UTF8_STRING, 
                    8, PropModeReplace, (guchar*) val, strlen (val));
   meta_error_trap_pop (display);
+
+  /* Don't hand back the old value before the PropertyNotify arrives */
+  meta_prop_cache_invalidate (display, xwindow, atom);
 }
 
 static gboolean
@@ -954,7 +1289,10 @@ meta_prop_get_values (MetaDisplay   *display,
                       int            n_values)
 {
   int i;
+  int n_tasks;
   AgGetPropertyTask **tasks;
+  GetPropertyResults *cached;
+  gboolean *from_cache;
 
   meta_verbose ("Requesting %d properties of 0x%lx at once\n",
                 n_values, xwindow);
@@ -963,6 +1301,9 @@ meta_prop_get_values (MetaDisplay   *display,
     return;
   
   tasks = g_new0 (AgGetPropertyTask*, n_values);
+  cached = g_new0 (GetPropertyResults, n_values);
+  from_cache = g_new0 (gboolean, n_values);
+  n_tasks = 0;
 
   /* Start up tasks. The "values" array can have values
    * with atom == None, which means to ignore that element.
@@ -1021,16 +1362,29 @@ meta_prop_get_values (MetaDisplay   *display,
         }
 
       if (values[i].atom != None)
-        tasks[i] = get_task (display, xwindow,
-                             values[i].atom, values[i].required_type);
+        {
+          if (prop_cache_lookup (display, xwindow,
+                                 values[i].atom, values[i].required_type,
+                                 &cached[i]))
+            from_cache[i] = TRUE;
+          else
+            {
+              tasks[i] = get_task (display, xwindow,
+                                   values[i].atom, values[i].required_type);
+              ++n_tasks;
+            }
+        }
       
       ++i;
     }  
   
   /* Get replies for all our tasks */
-  meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
-              n_values, G_STRFUNC);
-  XSync (display->xdisplay, False);
+  if (n_tasks > 0)
+    {
+      meta_topic (META_DEBUG_SYNC, "Syncing to get %d GetProperty replies in %s\n",
+                  n_tasks, G_STRFUNC);
+      XSync (display->xdisplay, False);
+    }
   
   /* Collect results, should arrive in order requested */
   i = 0;
@@ -1038,6 +1392,18 @@ meta_prop_get_values (MetaDisplay   *display,
     {
       AgGetPropertyTask *task;
       GetPropertyResults results;
+      Status status;
+
+      if (from_cache[i])
+        {
+          results = cached[i];
+          if (results.type == None)
+            {
+              values[i].type = META_PROP_VALUE_INVALID;
+              goto next;
+            }
+          goto convert;
+        }
       
       if (tasks[i] == NULL)
         {
@@ -1061,11 +1427,15 @@ meta_prop_get_values (MetaDisplay   *display,
       results.bytes_after = 0;
       results.format = 0;
       
-      if (ag_task_get_reply_and_free (task,
-                                      &results.type, &results.format,
-                                      &results.n_items,
-                                      &results.bytes_after,
-                                      &results.prop) != Success ||
+      status = ag_task_get_reply_and_free (task,
+                                           &results.type, &results.format,
+                                           &results.n_items,
+                                           &results.bytes_after,
+                                           &results.prop);
+      if (status == Success)
+        prop_cache_store (display, values[i].required_type, &results);
+
+      if (status != Success ||
           results.type == None)
         {
           values[i].type = META_PROP_VALUE_INVALID;
@@ -1077,6 +1447,8 @@ meta_prop_get_values (MetaDisplay   *display,
           goto next;
         }
 
+    convert:
+
       switch (values[i].type)
         {
         case META_PROP_VALUE_INVALID:
@@ -1186,6 +1558,8 @@ meta_prop_get_values (MetaDisplay   *display,
     }
 
   g_free (tasks);
+  g_free (cached);
+  g_free (from_cache);
 }
 
 static void
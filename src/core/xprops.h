@@ -220,6 +220,22 @@ void meta_prop_get_values (MetaDisplay   *display,
 void meta_prop_free_values (MetaPropValue *values,
                             int            n_values);
 
+/* Raw replies for properties of windows we get PropertyNotify for
+ * (managed client windows and their _NET_WM_USER_TIME_WINDOW) are
+ * remembered, so that asking for the same property twice doesn't
+ * cost a second round trip. An entry is dropped when the
+ * PropertyNotify for it arrives, or when the window is unregistered.
+ */
+void meta_prop_cache_invalidate    (MetaDisplay *display,
+                                    Window       xwindow,
+                                    Atom         xatom);
+void meta_prop_cache_forget_window (MetaDisplay *display,
+                                    Window       xwindow);
+void meta_prop_cache_get_stats     (MetaDisplay *display,
+                                    gulong      *hits_p,
+                                    gulong      *misses_p);
+void meta_prop_cache_free          (MetaDisplay *display);
+
 #endif
 
 
@@ -61,5 +61,14 @@ void meta_gradient_add_alpha (GdkPixbuf       *pixbuf,
                               int              n_alphas,
                               MetaGradientType type);
 
+cairo_surface_t* meta_gradient_create_surface (int               width,
+                                               int               height,
+                                               const GdkRGBA    *colors,
+                                               int               n_colors,
+                                               MetaGradientType  style,
+                                               const guchar     *alphas,
+                                               int               n_alphas,
+                                               MetaGradientType  alpha_style);
+
 
 #endif
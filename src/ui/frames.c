@@ -73,7 +73,8 @@ static void meta_frames_attach_style (MetaFrames  *frames,
 
 static void meta_frames_paint        (MetaFrames   *frames,
                                       MetaUIFrame  *frame,
-                                      cairo_t      *cr);
+                                      cairo_t      *cr,
+                                      gboolean      use_draw_plan);
 
 static void meta_frames_set_window_background (MetaFrames   *frames,
                                                MetaUIFrame  *frame);
@@ -100,6 +101,12 @@ static MetaFrameControl get_control  (MetaFrames        *frames,
                                       int                y);
 static void clear_tip (MetaFrames *frames);
 static void invalidate_all_caches (MetaFrames *frames);
+static void flush_shared_pieces (MetaFrames *frames);
+static void flush_title_layouts (MetaFrames *frames);
+static GHashTable *text_heights_new (void);
+static void get_button_states (MetaFrames      *frames,
+                               MetaUIFrame     *frame,
+                               MetaButtonState  button_states[META_BUTTON_TYPE_LAST]);
 static void invalidate_whole_window (MetaFrames *frames,
                                      MetaUIFrame *frame);
 
@@ -259,7 +266,7 @@ update_style_contexts (MetaFrames *frames)
 static void
 meta_frames_init (MetaFrames *frames)
 {
-  frames->text_heights = g_hash_table_new (NULL, NULL);
+  frames->text_heights = text_heights_new ();
   
   frames->frames = g_hash_table_new (unsigned_long_hash, unsigned_long_equal);
 
@@ -270,6 +277,10 @@ meta_frames_init (MetaFrames *frames)
   frames->invalidate_cache_timeout_id = 0;
   frames->invalidate_frames = NULL;
   frames->cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  frames->shared_pieces = NULL;
+  frames->shared_piece_lru = g_queue_new ();
+  frames->title_layouts = NULL;
+  frames->title_layout_lru = g_queue_new ();
 
   frames->style_variants = g_hash_table_new_full (g_str_hash, g_str_equal,
                                                   g_free, g_object_unref);
@@ -346,6 +357,10 @@ meta_frames_finalize (GObject *object)
   g_assert (g_hash_table_size (frames->frames) == 0);
   g_hash_table_destroy (frames->frames);
   g_hash_table_destroy (frames->cache);
+  flush_shared_pieces (frames);
+  g_queue_free (frames->shared_piece_lru);
+  flush_title_layouts (frames);
+  g_queue_free (frames->title_layout_lru);
 
   G_OBJECT_CLASS (meta_frames_parent_class)->finalize (object);
 }
@@ -354,6 +369,14 @@ typedef struct
 {
   cairo_rectangle_int_t rect;
   cairo_surface_t *pixmap;
+
+  /* When only part of the piece changed, its previous contents and
+   * the changed area (in frame coordinates) so that just that area
+   * needs to be drawn again.
+   */
+  cairo_surface_t *stale;
+  cairo_rectangle_int_t stale_rect;
+  cairo_region_t *damage;
 } CachedFramePiece;
 
 typedef struct
@@ -389,13 +412,61 @@ invalidate_cache (MetaFrames *frames,
   int i;
   
   for (i = 0; i < 4; i++)
-    if (pixels->piece[i].pixmap)
-      cairo_surface_destroy (pixels->piece[i].pixmap);
+    {
+      if (pixels->piece[i].pixmap)
+        cairo_surface_destroy (pixels->piece[i].pixmap);
+      if (pixels->piece[i].stale)
+        cairo_surface_destroy (pixels->piece[i].stale);
+      if (pixels->piece[i].damage)
+        cairo_region_destroy (pixels->piece[i].damage);
+    }
   
   g_free (pixels);
   g_hash_table_remove (frames->cache, frame);
 }
 
+/* Like invalidate_cache(), but for a change confined to @rect: only
+ * the pieces it touches are dropped, and they keep their old contents
+ * around so that populate_cache() can redraw just @rect.
+ */
+static void
+invalidate_cache_rect (MetaFrames                  *frames,
+                       MetaUIFrame                 *frame,
+                       const cairo_rectangle_int_t *rect)
+{
+  CachedPixels *pixels;
+  int i;
+
+  pixels = g_hash_table_lookup (frames->cache, frame);
+  if (pixels == NULL)
+    return;
+
+  for (i = 0; i < 4; i++)
+    {
+      CachedFramePiece *piece = &pixels->piece[i];
+      cairo_rectangle_int_t damage;
+
+      if (!gdk_rectangle_intersect (&piece->rect, rect, &damage))
+        continue;
+
+      if (piece->pixmap)
+        {
+          if (piece->stale)
+            cairo_surface_destroy (piece->stale);
+          if (piece->damage)
+            cairo_region_destroy (piece->damage);
+
+          piece->stale = piece->pixmap;
+          piece->stale_rect = piece->rect;
+          piece->damage = cairo_region_create ();
+          piece->pixmap = NULL;
+        }
+
+      if (piece->damage)
+        cairo_region_union_rectangle (piece->damage, &damage);
+    }
+}
+
 static void
 invalidate_all_caches (MetaFrames *frames)
 {
@@ -418,6 +489,7 @@ invalidate_cache_timeout (gpointer data)
   MetaFrames *frames = data;
   
   invalidate_all_caches (frames);
+  flush_shared_pieces (frames);
   frames->invalidate_cache_timeout_id = 0;
   return FALSE;
 }
@@ -458,8 +530,11 @@ meta_frames_font_changed (MetaFrames *frames)
   if (g_hash_table_size (frames->text_heights) > 0)
     {
       g_hash_table_destroy (frames->text_heights);
-      frames->text_heights = g_hash_table_new (NULL, NULL);
+      frames->text_heights = text_heights_new ();
     }
+
+  flush_shared_pieces (frames);
+  flush_title_layouts (frames);
   
   /* Queue a draw/resize on all frames */
   g_hash_table_foreach (frames->frames,
@@ -488,6 +563,8 @@ queue_draw_func (gpointer key, gpointer value, gpointer data)
 static void
 meta_frames_button_layout_changed (MetaFrames *frames)
 {
+  flush_shared_pieces (frames);
+
   g_hash_table_foreach (frames->frames,
                         queue_draw_func, frames);
 }
@@ -513,6 +590,9 @@ meta_frames_style_updated  (GtkWidget *widget)
 
   meta_frames_font_changed (frames);
 
+  /* Colors may have changed without the style contexts changing */
+  meta_theme_invalidate_draw_plans ();
+
   update_style_contexts (frames);
 
   g_hash_table_foreach (frames->frames,
@@ -521,6 +601,123 @@ meta_frames_style_updated  (GtkWidget *widget)
   GTK_WIDGET_CLASS (meta_frames_parent_class)->style_updated (widget);
 }
 
+static GHashTable *
+text_heights_new (void)
+{
+  return g_hash_table_new_full ((GHashFunc) pango_font_description_hash,
+                                (GEqualFunc) pango_font_description_equal,
+                                (GDestroyNotify) pango_font_description_free,
+                                NULL);
+}
+
+/* Laying out a title means shaping it, and many frames show the same
+ * title in the same font (think of a row of terminals), so the layouts
+ * are shared through a small table.  Frames never change the text or
+ * font of a layout once they have it; a new title gets a new layout.
+ */
+#define MAX_TITLE_LAYOUTS 64
+
+typedef struct
+{
+  PangoFontDescription *font_desc;
+  char *title;
+  PangoLayout *layout;
+  GList *link; /* in frames->title_layout_lru */
+} TitleLayout;
+
+static guint
+title_layout_hash (gconstpointer data)
+{
+  const TitleLayout *entry = data;
+
+  return pango_font_description_hash (entry->font_desc) ^
+    g_str_hash (entry->title);
+}
+
+static gboolean
+title_layout_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const TitleLayout *ea = a;
+  const TitleLayout *eb = b;
+
+  return strcmp (ea->title, eb->title) == 0 &&
+    pango_font_description_equal (ea->font_desc, eb->font_desc);
+}
+
+static void
+title_layout_free (gpointer data)
+{
+  TitleLayout *entry = data;
+
+  pango_font_description_free (entry->font_desc);
+  g_free (entry->title);
+  g_object_unref (G_OBJECT (entry->layout));
+  g_free (entry);
+}
+
+static void
+flush_title_layouts (MetaFrames *frames)
+{
+  if (frames->title_layouts == NULL)
+    return;
+
+  /* Frames keep their own references to the layouts they use */
+  g_hash_table_destroy (frames->title_layouts);
+  frames->title_layouts = NULL;
+  g_queue_clear (frames->title_layout_lru);
+}
+
+/* Returns a new reference to a layout of @title in @font_desc */
+static PangoLayout *
+get_title_layout (MetaFrames           *frames,
+                  PangoFontDescription *font_desc,
+                  const char           *title)
+{
+  TitleLayout lookup;
+  TitleLayout *entry;
+
+  if (title == NULL)
+    title = "";
+
+  if (frames->title_layouts == NULL)
+    frames->title_layouts = g_hash_table_new_full (title_layout_hash,
+                                                   title_layout_equal,
+                                                   title_layout_free,
+                                                   NULL);
+
+  lookup.font_desc = font_desc;
+  lookup.title = (char *) title;
+
+  entry = g_hash_table_lookup (frames->title_layouts, &lookup);
+  if (entry)
+    {
+      g_queue_unlink (frames->title_layout_lru, entry->link);
+      g_queue_push_head_link (frames->title_layout_lru, entry->link);
+
+      return g_object_ref (G_OBJECT (entry->layout));
+    }
+
+  entry = g_new (TitleLayout, 1);
+  entry->font_desc = pango_font_description_copy (font_desc);
+  entry->title = g_strdup (title);
+  entry->layout = gtk_widget_create_pango_layout (GTK_WIDGET (frames), title);
+
+  pango_layout_set_ellipsize (entry->layout, PANGO_ELLIPSIZE_END);
+  pango_layout_set_auto_dir (entry->layout, FALSE);
+  pango_layout_set_font_description (entry->layout, font_desc);
+
+  g_queue_push_head (frames->title_layout_lru, entry);
+  entry->link = frames->title_layout_lru->head;
+  g_hash_table_insert (frames->title_layouts, entry, entry);
+
+  while (g_queue_get_length (frames->title_layout_lru) > MAX_TITLE_LAYOUTS)
+    g_hash_table_remove (frames->title_layouts,
+                         g_queue_pop_tail (frames->title_layout_lru));
+
+  return g_object_ref (G_OBJECT (entry->layout));
+}
+
 static void
 meta_frames_ensure_layout (MetaFrames  *frames,
                            MetaUIFrame *frame)
@@ -560,28 +757,20 @@ meta_frames_ensure_layout (MetaFrames  *frames,
   
   if (frame->layout == NULL)
     {
-      gpointer key, value;
+      gpointer value;
       PangoFontDescription *font_desc;
       double scale;
-      int size;
       
       scale = meta_theme_get_title_scale (meta_theme_get_current (),
                                           type,
                                           flags);
       
-      frame->layout = gtk_widget_create_pango_layout (widget, frame->title);
-
-      pango_layout_set_ellipsize (frame->layout, PANGO_ELLIPSIZE_END);
-      pango_layout_set_auto_dir (frame->layout, FALSE);
-      
       font_desc = meta_gtk_widget_get_font_desc (widget, scale,
                                                  meta_prefs_get_titlebar_font ());
 
-      size = pango_font_description_get_size (font_desc);
-
       if (g_hash_table_lookup_extended (frames->text_heights,
-                                        GINT_TO_POINTER (size),
-                                        &key, &value))
+                                        font_desc,
+                                        NULL, &value))
         {
           frame->text_height = GPOINTER_TO_INT (value);
         }
@@ -592,12 +781,11 @@ meta_frames_ensure_layout (MetaFrames  *frames,
                                                   gtk_widget_get_pango_context (widget));
 
           g_hash_table_replace (frames->text_heights,
-                                GINT_TO_POINTER (size),
+                                pango_font_description_copy (font_desc),
                                 GINT_TO_POINTER (frame->text_height));
         }
       
-      pango_layout_set_font_description (frame->layout, 
-                                         font_desc);
+      frame->layout = get_title_layout (frames, font_desc, frame->title);
       
       pango_font_description_free (font_desc);
 
@@ -1075,6 +1263,8 @@ meta_frames_set_title (MetaFrames *frames,
                        const char *title)
 {
   MetaUIFrame *frame;
+  MetaFrameGeometry fgeom;
+  GdkRectangle titlebar;
   
   frame = meta_frames_lookup_window (frames, xwindow);
 
@@ -1089,7 +1279,17 @@ meta_frames_set_title (MetaFrames *frames,
       frame->layout = NULL;
     }
 
-  invalidate_whole_window (frames, frame);
+  /* Only the titlebar shows the title */
+  meta_frames_calc_geometry (frames, frame, &fgeom);
+
+  titlebar.x = fgeom.borders.invisible.left;
+  titlebar.y = fgeom.borders.invisible.top;
+  titlebar.width = fgeom.width - fgeom.borders.invisible.left -
+    fgeom.borders.invisible.right;
+  titlebar.height = fgeom.borders.visible.top;
+
+  gdk_window_invalidate_rect (frame->window, &titlebar, FALSE);
+  invalidate_cache_rect (frames, frame, &titlebar);
 }
 
 void
@@ -1284,7 +1484,10 @@ redraw_control (MetaFrames *frames,
   rect = control_rect (control, &fgeom);
 
   gdk_window_invalidate_rect (frame->window, rect, FALSE);
-  invalidate_cache (frames, frame);
+  if (rect)
+    invalidate_cache_rect (frames, frame, rect);
+  else
+    invalidate_cache (frames, frame);
 }
 
 static gboolean
@@ -2093,13 +2296,320 @@ generate_pixmap (MetaFrames            *frames,
   setup_bg_cr (cr, frame->window, 0, 0);
   cairo_paint (cr);
 
-  meta_frames_paint (frames, frame, cr);
+  meta_frames_paint (frames, frame, cr, TRUE);
 
   cairo_destroy (cr);
 
   return result;
 }
 
+static void
+forget_stale (CachedFramePiece *piece)
+{
+  if (piece->stale)
+    {
+      cairo_surface_destroy (piece->stale);
+      cairo_region_destroy (piece->damage);
+      piece->stale = NULL;
+      piece->damage = NULL;
+    }
+}
+
+/* Returns a pixmap for @piece, reusing its stale contents outside the
+ * damaged area when there are any, and forgets those.
+ */
+static cairo_surface_t *
+render_piece (MetaFrames       *frames,
+              MetaUIFrame      *frame,
+              CachedFramePiece *piece)
+{
+  cairo_surface_t *result;
+  cairo_t *cr;
+  cairo_rectangle_int_t *rect = &piece->rect;
+
+  if (piece->stale == NULL ||
+      piece->stale_rect.x != rect->x ||
+      piece->stale_rect.y != rect->y ||
+      piece->stale_rect.width != rect->width ||
+      piece->stale_rect.height != rect->height)
+    result = generate_pixmap (frames, frame, rect);
+  else
+    {
+      result = gdk_window_create_similar_surface (frame->window,
+                                                  CAIRO_CONTENT_COLOR,
+                                                  rect->width, rect->height);
+
+      cr = cairo_create (result);
+
+      cairo_set_source_surface (cr, piece->stale, 0, 0);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      cairo_paint (cr);
+      cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+      cairo_translate (cr, -rect->x, -rect->y);
+      gdk_cairo_region (cr, piece->damage);
+      cairo_clip (cr);
+
+      setup_bg_cr (cr, frame->window, 0, 0);
+      cairo_paint (cr);
+
+      /* A draw plan would replay the whole frame; drawing directly
+       * lets the clip skip everything outside the damage.
+       */
+      meta_frames_paint (frames, frame, cr, FALSE);
+
+      cairo_destroy (cr);
+    }
+
+  forget_stale (piece);
+
+  return result;
+}
+
+/* Frames with the same style, state, size and title draw exactly the
+ * same pixels (think of a row of terminals), so the rendered pieces are
+ * kept in a small table shared by all frames.  The key holds references
+ * on everything it points to, so a freed style or pixbuf can never be
+ * mistaken for a new one at the same address.
+ */
+#define MAX_SHARED_PIECES 32
+
+typedef struct
+{
+  MetaFrameStyle *style;
+  GtkStyleContext *style_gtk;
+  GdkVisual *visual;
+  MetaFrameType type;
+  MetaFrameFlags flags;
+  int client_width;
+  int client_height;
+  int text_height;
+  char *title;
+  /* Only set when the style draws icons; the sizes always matter
+   * since they are available to the geometry expressions.
+   */
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  int mini_icon_width;
+  int mini_icon_height;
+  int icon_width;
+  int icon_height;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+  int piece;
+} SharedPieceKey;
+
+typedef struct
+{
+  SharedPieceKey key;
+  cairo_surface_t *pixmap;
+  GList *link; /* in frames->shared_piece_lru */
+} SharedPiece;
+
+static guint
+shared_piece_key_hash (gconstpointer data)
+{
+  const SharedPieceKey *key = data;
+  guint hash;
+  int i;
+
+  hash = GPOINTER_TO_UINT (key->style) ^ GPOINTER_TO_UINT (key->style_gtk);
+  hash = hash * 31 + key->type;
+  hash = hash * 31 + key->flags;
+  hash = hash * 31 + key->client_width;
+  hash = hash * 31 + key->client_height;
+  hash = hash * 31 + key->text_height;
+  hash = hash * 31 + key->piece;
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    hash = hash * 3 + key->button_states[i];
+  if (key->title)
+    hash ^= g_str_hash (key->title);
+
+  return hash;
+}
+
+static gboolean
+shared_piece_key_equal (gconstpointer a,
+                        gconstpointer b)
+{
+  const SharedPieceKey *ka = a;
+  const SharedPieceKey *kb = b;
+
+  return
+    ka->style == kb->style &&
+    ka->style_gtk == kb->style_gtk &&
+    ka->visual == kb->visual &&
+    ka->type == kb->type &&
+    ka->flags == kb->flags &&
+    ka->client_width == kb->client_width &&
+    ka->client_height == kb->client_height &&
+    ka->text_height == kb->text_height &&
+    ka->mini_icon == kb->mini_icon &&
+    ka->icon == kb->icon &&
+    ka->mini_icon_width == kb->mini_icon_width &&
+    ka->mini_icon_height == kb->mini_icon_height &&
+    ka->icon_width == kb->icon_width &&
+    ka->icon_height == kb->icon_height &&
+    ka->piece == kb->piece &&
+    memcmp (ka->button_states, kb->button_states,
+            sizeof (ka->button_states)) == 0 &&
+    g_strcmp0 (ka->title, kb->title) == 0;
+}
+
+static void
+shared_piece_free (gpointer data)
+{
+  SharedPiece *shared = data;
+
+  meta_frame_style_unref (shared->key.style);
+  g_object_unref (shared->key.style_gtk);
+  if (shared->key.mini_icon)
+    g_object_unref (shared->key.mini_icon);
+  if (shared->key.icon)
+    g_object_unref (shared->key.icon);
+  g_free (shared->key.title);
+
+  cairo_surface_destroy (shared->pixmap);
+
+  g_free (shared);
+}
+
+static void
+flush_shared_pieces (MetaFrames *frames)
+{
+  if (frames->shared_pieces == NULL)
+    return;
+
+  /* Frames keep their own references to the pixmaps they use */
+  g_hash_table_destroy (frames->shared_pieces);
+  frames->shared_pieces = NULL;
+  g_queue_clear (frames->shared_piece_lru);
+}
+
+/* Fills in everything but the piece number; returns FALSE if the
+ * frame's pixels can't be shared with other frames.
+ */
+static gboolean
+get_shared_piece_key (MetaFrames     *frames,
+                      MetaUIFrame    *frame,
+                      MetaFrameType   type,
+                      MetaFrameFlags  flags,
+                      int             client_width,
+                      int             client_height,
+                      SharedPieceKey *key)
+{
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+
+  /* A frame without a background of its own is painted over whatever
+   * lies behind it, which depends on where the frame is.
+   */
+  if (gdk_window_get_background_pattern (frame->window) == NULL)
+    return FALSE;
+
+  meta_frames_ensure_layout (frames, frame);
+
+  meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
+                 frame->xwindow,
+                 META_CORE_GET_MINI_ICON, &mini_icon,
+                 META_CORE_GET_ICON, &icon,
+                 META_CORE_GET_END);
+
+  memset (key, 0, sizeof (*key));
+
+  key->style = frame->cache_style;
+  key->style_gtk = frame->style;
+  key->visual = gdk_window_get_visual (frame->window);
+  key->type = type;
+  key->flags = flags;
+  key->client_width = client_width;
+  key->client_height = client_height;
+  key->text_height = frame->text_height;
+  key->title = (char *) pango_layout_get_text (frame->layout);
+
+  if (meta_frame_style_uses_icons (key->style))
+    {
+      key->mini_icon = mini_icon;
+      key->icon = icon;
+    }
+  if (mini_icon)
+    {
+      key->mini_icon_width = gdk_pixbuf_get_width (mini_icon);
+      key->mini_icon_height = gdk_pixbuf_get_height (mini_icon);
+    }
+  if (icon)
+    {
+      key->icon_width = gdk_pixbuf_get_width (icon);
+      key->icon_height = gdk_pixbuf_get_height (icon);
+    }
+
+  get_button_states (frames, frame, key->button_states);
+
+  return TRUE;
+}
+
+/* Returns a new reference to the shared pixmap for the piece,
+ * rendering it from this frame if no other frame has yet.
+ */
+static cairo_surface_t *
+get_shared_pixmap (MetaFrames       *frames,
+                   MetaUIFrame      *frame,
+                   SharedPieceKey   *key,
+                   int               index,
+                   CachedFramePiece *piece)
+{
+  SharedPiece *shared;
+  cairo_surface_t *pixmap;
+
+  if (piece->rect.width <= 0 || piece->rect.height <= 0)
+    return NULL;
+
+  key->piece = index;
+
+  if (frames->shared_pieces == NULL)
+    frames->shared_pieces = g_hash_table_new_full (shared_piece_key_hash,
+                                                   shared_piece_key_equal,
+                                                   NULL,
+                                                   shared_piece_free);
+
+  shared = g_hash_table_lookup (frames->shared_pieces, key);
+  if (shared)
+    {
+      g_queue_unlink (frames->shared_piece_lru, shared->link);
+      g_queue_push_head_link (frames->shared_piece_lru, shared->link);
+
+      forget_stale (piece);
+
+      return cairo_surface_reference (shared->pixmap);
+    }
+
+  pixmap = render_piece (frames, frame, piece);
+  if (pixmap == NULL)
+    return NULL;
+
+  shared = g_new (SharedPiece, 1);
+  shared->key = *key;
+  shared->key.title = g_strdup (key->title);
+  meta_frame_style_ref (shared->key.style);
+  g_object_ref (shared->key.style_gtk);
+  if (shared->key.mini_icon)
+    g_object_ref (shared->key.mini_icon);
+  if (shared->key.icon)
+    g_object_ref (shared->key.icon);
+  shared->pixmap = pixmap;
+
+  g_queue_push_head (frames->shared_piece_lru, shared);
+  shared->link = frames->shared_piece_lru->head;
+  g_hash_table_insert (frames->shared_pieces, &shared->key, shared);
+
+  while (g_queue_get_length (frames->shared_piece_lru) > MAX_SHARED_PIECES)
+    {
+      SharedPiece *oldest = g_queue_pop_tail (frames->shared_piece_lru);
+
+      g_hash_table_remove (frames->shared_pieces, &oldest->key);
+    }
+
+  return cairo_surface_reference (pixmap);
+}
 
 static void
 populate_cache (MetaFrames *frames,
@@ -2111,6 +2621,8 @@ populate_cache (MetaFrames *frames,
   CachedPixels *pixels;
   MetaFrameType frame_type;
   MetaFrameFlags frame_flags;
+  SharedPieceKey key;
+  gboolean shareable;
   int i;
 
   meta_core_get (GDK_DISPLAY_XDISPLAY (gdk_display_get_default ()),
@@ -2175,13 +2687,29 @@ populate_cache (MetaFrames *frames,
   pixels->piece[3].rect.width = width + borders.visible.left + borders.visible.right;
   pixels->piece[3].rect.height = borders.visible.bottom;
 
+  shareable = FALSE;
+  for (i = 0; i < 4; i++)
+    if (!pixels->piece[i].pixmap)
+      {
+        shareable = get_shared_piece_key (frames, frame,
+                                          frame_type, frame_flags,
+                                          width, height, &key);
+        break;
+      }
+
   for (i = 0; i < 4; i++)
     {
       CachedFramePiece *piece = &pixels->piece[i];
       /* generate_pixmap() returns NULL for 0 width/height pieces, but
        * does so cheaply so we don't need to cache the NULL return */
       if (!piece->pixmap)
-        piece->pixmap = generate_pixmap (frames, frame, &piece->rect);
+        {
+          if (shareable)
+            piece->pixmap = get_shared_pixmap (frames, frame, &key,
+                                               i, piece);
+          else
+            piece->pixmap = render_piece (frames, frame, piece);
+        }
     }
   
   if (frames->invalidate_cache_timeout_id)
@@ -2340,7 +2868,7 @@ meta_frames_draw (GtkWidget *widget,
 
       cairo_push_group (cr);
 
-      meta_frames_paint (frames, frame, cr);
+      meta_frames_paint (frames, frame, cr, TRUE);
 
       cairo_pop_group_to_source (cr);
       cairo_paint (cr);
@@ -2354,24 +2882,15 @@ meta_frames_draw (GtkWidget *widget,
 }
 
 static void
-meta_frames_paint (MetaFrames   *frames,
-                   MetaUIFrame  *frame,
-                   cairo_t      *cr)
+get_button_states (MetaFrames      *frames,
+                   MetaUIFrame     *frame,
+                   MetaButtonState  button_states[META_BUTTON_TYPE_LAST])
 {
-  GtkWidget *widget;
-  MetaFrameFlags flags;
-  MetaFrameType type;
-  GdkPixbuf *mini_icon;
-  GdkPixbuf *icon;
-  int w, h;
-  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
   Window grab_frame;
   int i;
-  MetaButtonLayout button_layout;
   MetaGrabOp grab_op;
   Display *display;
-  
-  widget = GTK_WIDGET (frames);
+
   display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
 
   for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
@@ -2454,7 +2973,29 @@ meta_frames_paint (MetaFrames   *frames,
     default:
       break;
     }
+}
+
+static void
+meta_frames_paint (MetaFrames   *frames,
+                   MetaUIFrame  *frame,
+                   cairo_t      *cr,
+                   gboolean      use_draw_plan)
+{
+  GtkWidget *widget;
+  MetaFrameFlags flags;
+  MetaFrameType type;
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  int w, h;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+  MetaButtonLayout button_layout;
+  Display *display;
   
+  widget = GTK_WIDGET (frames);
+  display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+
+  get_button_states (frames, frame, button_states);
+
   meta_core_get (display, frame->xwindow,
                  META_CORE_GET_FRAME_FLAGS, &flags,
                  META_CORE_GET_FRAME_TYPE, &type,
@@ -2479,7 +3020,8 @@ meta_frames_paint (MetaFrames   *frames,
                                     frame->text_height,
                                     &button_layout,
                                     button_states,
-                                    mini_icon, icon);
+                                    mini_icon, icon,
+                                    use_draw_plan);
 }
 
 static void
@@ -106,6 +106,18 @@ struct _MetaFrames
   int invalidate_cache_timeout_id;
   GList *invalidate_frames;
   GHashTable *cache;
+
+  /* Rendered frame pieces shared between frames that would draw
+   * identical pixels, most recently used at the head of the queue.
+   */
+  GHashTable *shared_pieces;
+  GQueue *shared_piece_lru;
+
+  /* Title layouts shared between frames with the same title and font,
+   * most recently used at the head of the queue.
+   */
+  GHashTable *title_layouts;
+  GQueue *title_layout_lru;
 };
 
 struct _MetaFramesClass
@@ -863,3 +863,418 @@ meta_gradient_add_alpha (GdkPixbuf       *pixbuf,
       break;
     }
 }
+
+/*
+ * Gradients straight into cairo image surfaces.
+ *
+ * The pixbuf functions above produce 24-bit RGB which then has to be
+ * converted to premultiplied ARGB by gdk_cairo_set_source_pixbuf()
+ * every time it is drawn.  The functions below compute the same
+ * colors, stepping along a single line with the same fixed-point
+ * arithmetic, and then fill whole rows of 32-bit pixels at a time,
+ * so the result is pixel for pixel what the pixbuf route draws.
+ */
+
+#define ARGB_OPAQUE 0xff000000
+
+/* Matches the premultiplication done by gdk_cairo_set_source_pixbuf() */
+#define MULT(c, a, t) ((t) = (c) * (a) + 0x80, (((t) >> 8) + (t)) >> 8)
+
+/* Same steps as meta_gradient_create_horizontal() along @n pixels */
+static void
+line_simple (guint32       *line,
+             int            n,
+             const GdkRGBA *from,
+             const GdkRGBA *to)
+{
+  int i;
+  long r, g, b, dr, dg, db;
+  int r0, g0, b0;
+  int rf, gf, bf;
+
+  r0 = (guchar) (from->red * 0xff);
+  g0 = (guchar) (from->green * 0xff);
+  b0 = (guchar) (from->blue * 0xff);
+  rf = (guchar) (to->red * 0xff);
+  gf = (guchar) (to->green * 0xff);
+  bf = (guchar) (to->blue * 0xff);
+
+  r = r0 << 16;
+  g = g0 << 16;
+  b = b0 << 16;
+
+  dr = ((rf-r0)<<16)/(int)n;
+  dg = ((gf-g0)<<16)/(int)n;
+  db = ((bf-b0)<<16)/(int)n;
+
+  for (i = 0; i < n; i++)
+    {
+      line[i] = ARGB_OPAQUE |
+        ((guint32) (guchar) (r >> 16) << 16) |
+        ((guint32) (guchar) (g >> 16) << 8) |
+        (guint32) (guchar) (b >> 16);
+      r += dr;
+      g += dg;
+      b += db;
+    }
+}
+
+/* Same steps as meta_gradient_create_multi_horizontal() along @n pixels */
+static void
+line_multi (guint32       *line,
+            int            n,
+            const GdkRGBA *colors,
+            int            count)
+{
+  int i, j, k;
+  long r, g, b, dr, dg, db;
+  int n2;
+
+  if (count > n)
+    count = n;
+
+  if (count > 1)
+    n2 = n/(count-1);
+  else
+    n2 = n;
+
+  k = 0;
+
+  r = (long)(colors[0].red * 0xffffff);
+  g = (long)(colors[0].green * 0xffffff);
+  b = (long)(colors[0].blue * 0xffffff);
+
+  for (i=1; i<count; i++)
+    {
+      dr = (int)((colors[i].red   - colors[i-1].red)  *0xffffff)/(int)n2;
+      dg = (int)((colors[i].green - colors[i-1].green)*0xffffff)/(int)n2;
+      db = (int)((colors[i].blue  - colors[i-1].blue) *0xffffff)/(int)n2;
+      for (j=0; j<n2; j++)
+        {
+          line[k++] = ARGB_OPAQUE |
+            ((guint32) (guchar) (r >> 16) << 16) |
+            ((guint32) (guchar) (g >> 16) << 8) |
+            (guint32) (guchar) (b >> 16);
+          r += dr;
+          g += dg;
+          b += db;
+        }
+      r = (long)(colors[i].red   * 0xffffff);
+      g = (long)(colors[i].green * 0xffffff);
+      b = (long)(colors[i].blue  * 0xffffff);
+    }
+
+  for (; k<n; k++)
+    line[k] = ARGB_OPAQUE |
+      ((guint32) (guchar) (r >> 16) << 16) |
+      ((guint32) (guchar) (g >> 16) << 8) |
+      (guint32) (guchar) (b >> 16);
+}
+
+/* Same values as meta_gradient_add_alpha_horizontal() multiplies in */
+static void
+line_alpha (guchar       *line,
+            int           n,
+            const guchar *alphas,
+            int           n_alphas)
+{
+  int i, j, k;
+  long a, da;
+  int n2;
+
+  if (n_alphas == 1)
+    {
+      memset (line, alphas[0], n);
+      return;
+    }
+
+  if (n_alphas > n)
+    n_alphas = n;
+
+  if (n_alphas > 1)
+    n2 = n / (n_alphas - 1);
+  else
+    n2 = n;
+
+  a = alphas[0] << 8;
+  k = 0;
+
+  for (i = 1; i < n_alphas; i++)
+    {
+      da = (((int)(alphas[i] - (int) alphas[i-1])) << 8) / (int) n2;
+
+      for (j = 0; j < n2; j++)
+        {
+          line[k++] = (a >> 8);
+
+          a += da;
+        }
+
+      a = alphas[i] << 8;
+    }
+
+  for (; k < n; k++)
+    line[k] = a >> 8;
+}
+
+/* The pixel loops below are kept free of branches and calls so that
+ * the compiler can vectorize them.
+ */
+static void
+premultiply_span (guint32       *dest,
+                  const guint32 *src,
+                  const guchar  *alpha,
+                  int            n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      guint32 p = src[i];
+      guint32 a = alpha[i];
+      guint32 t1, t2, t3;
+
+      dest[i] = (a << 24) |
+        (MULT ((p >> 16) & 0xff, a, t1) << 16) |
+        (MULT ((p >> 8) & 0xff, a, t2) << 8) |
+        MULT (p & 0xff, a, t3);
+    }
+}
+
+static void
+premultiply_fill (guint32       *dest,
+                  guint32        p,
+                  const guchar  *alpha,
+                  int            n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      guint32 a = alpha[i];
+      guint32 t1, t2, t3;
+
+      dest[i] = (a << 24) |
+        (MULT ((p >> 16) & 0xff, a, t1) << 16) |
+        (MULT ((p >> 8) & 0xff, a, t2) << 8) |
+        MULT (p & 0xff, a, t3);
+    }
+}
+
+static void
+fill_span (guint32 *dest,
+           guint32  p,
+           int      n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = p;
+}
+
+/* Writes @line (premultiplied by @alpha if given) to every row */
+static void
+fill_rows_from_line (guchar        *data,
+                     int            stride,
+                     int            width,
+                     int            height,
+                     const guint32 *line,
+                     const guchar  *alpha)
+{
+  int y;
+
+  if (alpha)
+    premultiply_span ((guint32 *) data, line, alpha, width);
+  else
+    memcpy (data, line, width * 4);
+
+  for (y = 1; y < height; y++)
+    memcpy (data + y * stride, data, width * 4);
+}
+
+/* Fills row y with the single color column[y] */
+static void
+fill_rows_from_column (guchar        *data,
+                       int            stride,
+                       int            width,
+                       int            height,
+                       const guint32 *column,
+                       const guchar  *alpha)
+{
+  int y;
+
+  for (y = 0; y < height; y++)
+    {
+      guint32 *row = (guint32 *) (data + y * stride);
+
+      if (y > 0 && column[y] == column[y - 1])
+        memcpy (row, data + (y - 1) * stride, width * 4);
+      else if (alpha)
+        premultiply_fill (row, column[y], alpha, width);
+      else
+        fill_span (row, column[y], width);
+    }
+}
+
+/* Each row is a window of @line shifted along with the row, as in
+ * meta_gradient_create_diagonal()
+ */
+static void
+fill_rows_diagonal (guchar        *data,
+                    int            stride,
+                    int            width,
+                    int            height,
+                    const guint32 *line,
+                    const guchar  *alpha)
+{
+  float a, offset;
+  int y;
+
+  a = ((float)(width - 1))/((float)(height - 1));
+
+  for (y = 0, offset = 0.0; y < height; y++)
+    {
+      guint32 *row = (guint32 *) (data + y * stride);
+
+      if (alpha)
+        premultiply_span (row, &line[(int) offset], alpha, width);
+      else
+        memcpy (row, &line[(int) offset], width * 4);
+      offset += a;
+    }
+}
+
+/**
+ * meta_gradient_create_surface: (skip)
+ * @width: Width in pixels
+ * @height: Height in pixels
+ * @colors: (array length=n_colors): Array of colors
+ * @n_colors: Number of colors
+ * @style: Gradient style
+ * @alphas: (array length=n_alphas) (allow-none): Alpha gradient, or %NULL
+ * @n_alphas: Number of alphas
+ * @alpha_style: Alpha gradient style
+ *
+ * Renders the gradient meta_gradient_create_multi() would, with the alpha
+ * gradient meta_gradient_add_alpha() would multiply in, as a premultiplied
+ * ARGB image surface.
+ *
+ * Returns: (transfer full): A new image surface, or %NULL on failure
+ */
+cairo_surface_t*
+meta_gradient_create_surface (int              width,
+                              int              height,
+                              const GdkRGBA   *colors,
+                              int              n_colors,
+                              MetaGradientType style,
+                              const guchar    *alphas,
+                              int              n_alphas,
+                              MetaGradientType alpha_style)
+{
+  cairo_surface_t *surface;
+  guchar *data;
+  int stride;
+  guint32 *line;
+  guchar *alpha;
+  int line_length;
+
+  g_return_val_if_fail (width > 0, NULL);
+  g_return_val_if_fail (height > 0, NULL);
+  g_return_val_if_fail (n_colors > 0, NULL);
+
+  alpha = NULL;
+  if (alphas && n_alphas > 0)
+    {
+      switch (alpha_style)
+        {
+        case META_GRADIENT_HORIZONTAL:
+          alpha = g_new (guchar, width);
+          line_alpha (alpha, width, alphas, n_alphas);
+          break;
+
+        case META_GRADIENT_VERTICAL:
+          g_printerr ("metacity: vertical alpha channel gradient not implemented yet\n");
+          break;
+
+        case META_GRADIENT_DIAGONAL:
+          g_printerr ("metacity: diagonal alpha channel gradient not implemented yet\n");
+          break;
+
+        case META_GRADIENT_LAST:
+          g_assert_not_reached ();
+          break;
+        }
+    }
+
+  surface = cairo_image_surface_create (alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+                                        width, height);
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      g_free (alpha);
+      return NULL;
+    }
+
+  cairo_surface_flush (surface);
+  data = cairo_image_surface_get_data (surface);
+  stride = cairo_image_surface_get_stride (surface);
+
+  /* A diagonal that is one pixel thick is just a straight gradient */
+  if (style == META_GRADIENT_DIAGONAL && width == 1)
+    style = META_GRADIENT_VERTICAL;
+  else if (style == META_GRADIENT_DIAGONAL && height == 1)
+    style = META_GRADIENT_HORIZONTAL;
+
+  switch (style)
+    {
+    case META_GRADIENT_HORIZONTAL:
+      line_length = width;
+      break;
+    case META_GRADIENT_VERTICAL:
+      line_length = height;
+      break;
+    case META_GRADIENT_DIAGONAL:
+      line_length = 2 * width - 1;
+      /* meta_gradient_create_multi_diagonal() clamps to both sides */
+      if (n_colors > width)
+        n_colors = width;
+      if (n_colors > height)
+        n_colors = height;
+      break;
+    default:
+      g_assert_not_reached ();
+      line_length = 0;
+      break;
+    }
+
+  line = g_new (guint32, line_length);
+
+  if (n_colors > 2)
+    line_multi (line, line_length, colors, n_colors);
+  else if (n_colors > 1)
+    line_simple (line, line_length, &colors[0], &colors[1]);
+  else
+    line_simple (line, line_length, &colors[0], &colors[0]);
+
+  switch (style)
+    {
+    case META_GRADIENT_HORIZONTAL:
+      fill_rows_from_line (data, stride, width, height, line, alpha);
+      break;
+    case META_GRADIENT_VERTICAL:
+      fill_rows_from_column (data, stride, width, height, line, alpha);
+      break;
+    case META_GRADIENT_DIAGONAL:
+      fill_rows_diagonal (data, stride, width, height, line, alpha);
+      break;
+    default:
+      break;
+    }
+
+  cairo_surface_mark_dirty (surface);
+
+  g_free (line);
+  g_free (alpha);
+
+  return surface;
+}
@@ -46,10 +46,12 @@ struct _TabEntry
   MetaTabEntryKey  key;
   char            *title;
   GdkPixbuf       *icon, *dimmed_icon;
-  GtkWidget       *widget;
+  GtkWidget       *widget; /* the cell showing this entry, if any */
   GdkRectangle     rect;
   GdkRectangle     inner_rect;
+  int              index;
   guint blank : 1;
+  guint hidden : 1;
 };
 
 struct _MetaTabPopup
@@ -61,6 +63,25 @@ struct _MetaTabPopup
   TabEntry *current_selected_entry;
   GtkWidget *outline_window;
   gboolean outline;
+
+  TabEntry **entry_array;
+  int n_entries;
+
+  /* Cells are only made for the rows that fit on screen, and are
+   * handed to other entries as the selection scrolls through them.
+   */
+  GtkWidget **cells;
+  TabEntry **cell_entries;
+  int width;
+  int visible_rows;
+  int first_row;
+
+  guint fill_idle;
+
+  /* Monotonic time the popup was asked for, to log how long it took
+   * to show up; 0 once that has been logged.
+   */
+  gint64 requested_time;
 };
 
 static GtkWidget* selectable_image_new (GdkPixbuf *pixbuf);
@@ -68,6 +89,8 @@ static void       select_image         (GtkWidget *widget);
 static void       unselect_image       (GtkWidget *widget);
 
 static GtkWidget* selectable_workspace_new (MetaWorkspace *workspace);
+static void       set_workspace            (GtkWidget     *widget,
+                                            MetaWorkspace *workspace);
 static void       select_workspace         (GtkWidget *widget);
 static void       unselect_workspace       (GtkWidget *widget);
 
@@ -186,13 +209,10 @@ tab_entry_new (const MetaTabEntry *entry,
   te->widget = NULL;
   te->icon = entry->icon;
   te->blank = entry->blank;
+  te->hidden = entry->hidden;
   te->dimmed_icon = NULL;
   if (te->icon)
-    {
-      g_object_ref (G_OBJECT (te->icon));
-      if (entry->hidden)
-        te->dimmed_icon = dimm_icon (entry->icon);
-    }
+    g_object_ref (G_OBJECT (te->icon));
   
   if (outline)
     {
@@ -209,12 +229,174 @@ tab_entry_new (const MetaTabEntry *entry,
   return te;
 }
 
+static GdkPixbuf*
+get_dimmed_icon (GdkPixbuf *icon)
+{
+  GdkPixbuf *dimmed;
+
+  /* Windows of one application share their icon, and the popup comes
+   * and goes, so the dimmed copy is kept with the icon.
+   */
+  dimmed = g_object_get_data (G_OBJECT (icon), "meta-dimmed-icon");
+  if (dimmed == NULL)
+    {
+      dimmed = dimm_icon (icon);
+      g_object_set_data_full (G_OBJECT (icon), "meta-dimmed-icon",
+                              dimmed, g_object_unref);
+    }
+
+  return g_object_ref (G_OBJECT (dimmed));
+}
+
+static gboolean
+entry_needs_dimming (TabEntry *te)
+{
+  return te->hidden && te->icon != NULL && te->dimmed_icon == NULL;
+}
+
+/* Shows the entry assigned to cell @i; returns TRUE if its dimmed
+ * icon has yet to be made and the cell was left as a placeholder.
+ */
+static gboolean
+update_cell (MetaTabPopup *popup,
+             int           i,
+             gboolean      make_dimmed)
+{
+  TabEntry *te;
+  GtkWidget *cell;
+
+  te = popup->cell_entries[i];
+  cell = popup->cells[i];
+
+  if (!popup->outline)
+    {
+      set_workspace (cell, te ? (MetaWorkspace *) te->key : NULL);
+      return FALSE;
+    }
+
+  if (te == NULL || te->icon == NULL)
+    {
+      gtk_image_clear (GTK_IMAGE (cell));
+      return FALSE;
+    }
+
+  if (entry_needs_dimming (te))
+    {
+      if (!make_dimmed &&
+          g_object_get_data (G_OBJECT (te->icon), "meta-dimmed-icon") == NULL)
+        {
+          gtk_image_clear (GTK_IMAGE (cell));
+          return TRUE;
+        }
+
+      te->dimmed_icon = get_dimmed_icon (te->icon);
+    }
+
+  gtk_image_set_from_pixbuf (GTK_IMAGE (cell),
+                             te->dimmed_icon ? te->dimmed_icon : te->icon);
+  return FALSE;
+}
+
+#define CELLS_PER_FILL 8
+
+static gboolean
+fill_cells_idle (gpointer data)
+{
+  MetaTabPopup *popup;
+  int i, n_cells;
+  int filled;
+
+  popup = data;
+  n_cells = popup->width * popup->visible_rows;
+  filled = 0;
+
+  for (i = 0; i < n_cells; i++)
+    {
+      TabEntry *te = popup->cell_entries[i];
+
+      if (te == NULL || !entry_needs_dimming (te))
+        continue;
+
+      if (filled == CELLS_PER_FILL)
+        return TRUE;
+
+      update_cell (popup, i, TRUE);
+      ++filled;
+    }
+
+  popup->fill_idle = 0;
+
+  return FALSE;
+}
+
+static void
+assign_cells (MetaTabPopup *popup)
+{
+  int i, n_cells;
+  gboolean pending;
+
+  n_cells = popup->width * popup->visible_rows;
+  pending = FALSE;
+
+  for (i = 0; i < n_cells; i++)
+    {
+      TabEntry *te;
+      int index;
+
+      if (popup->cell_entries[i])
+        popup->cell_entries[i]->widget = NULL;
+
+      index = popup->first_row * popup->width + i;
+
+      te = NULL;
+      if (index < popup->n_entries && !popup->entry_array[index]->blank)
+        te = popup->entry_array[index];
+
+      popup->cell_entries[i] = te;
+      if (te)
+        te->widget = popup->cells[i];
+
+      if (popup->outline)
+        unselect_image (popup->cells[i]);
+      else
+        unselect_workspace (popup->cells[i]);
+
+      if (update_cell (popup, i, FALSE))
+        pending = TRUE;
+    }
+
+  if (pending && popup->fill_idle == 0)
+    popup->fill_idle = g_idle_add (fill_cells_idle, popup);
+}
+
+static gboolean
+popup_window_draw (GtkWidget *widget,
+                   cairo_t   *cr,
+                   gpointer   data)
+{
+  MetaTabPopup *popup;
+
+  popup = data;
+
+  if (popup->requested_time != 0)
+    {
+      meta_verbose ("Tab popup with %d entries first painted %g ms "
+                    "after it was requested\n",
+                    popup->n_entries,
+                    (g_get_monotonic_time () - popup->requested_time) / 1000.0);
+      popup->requested_time = 0;
+    }
+
+  return FALSE;
+}
+
 MetaTabPopup*
 meta_ui_tab_popup_new (const MetaTabEntry *entries,
                        int                 screen_number,
                        int                 entry_count,
                        int                 width,
-                       gboolean            outline)
+                       gboolean            outline,
+                       gint64              requested_time)
 {
   MetaTabPopup *popup;
   int i, left, top;
@@ -228,9 +410,20 @@ meta_ui_tab_popup_new (const MetaTabEntry *entries,
   AtkObject *obj;
   GdkScreen *screen;
   int screen_width;
+  PangoLayout *layout;
+  int xpad, ypad;
+  int cell_width, cell_height;
+  MetaWorkspace *workspace;
   
   popup = g_new (MetaTabPopup, 1);
 
+  if (!meta_is_verbose ())
+    popup->requested_time = 0;
+  else if (requested_time != 0)
+    popup->requested_time = requested_time;
+  else
+    popup->requested_time = g_get_monotonic_time ();
+
   popup->outline_window = gtk_window_new (GTK_WINDOW_POPUP);
 
   screen = gdk_display_get_screen (gdk_display_get_default (),
@@ -254,16 +447,44 @@ meta_ui_tab_popup_new (const MetaTabEntry *entries,
   /* enable resizing, to get never-shrink behavior */
   gtk_window_set_resizable (GTK_WINDOW (popup->window),
                             TRUE);
+
+  g_signal_connect (G_OBJECT (popup->window), "draw",
+                    G_CALLBACK (popup_window_draw), popup);
+
   popup->current = NULL;
   popup->entries = NULL;
   popup->current_selected_entry = NULL;
   popup->outline = outline;
+  popup->fill_idle = 0;
+
+  popup->entry_array = g_new (TabEntry *, MAX (entry_count, 1));
+  popup->n_entries = entry_count;
+
+  /* Icons are laid out in a grid of equal cells, so placeholders and
+   * reused cells never change the size of the popup.
+   */
+  cell_width = 0;
+  cell_height = 0;
+  workspace = NULL;
 
   screen_width = gdk_screen_get_width (screen);
   for (i = 0; i < entry_count; ++i)
     {
       TabEntry* new_entry = tab_entry_new (&entries[i], screen_width, outline);
+      new_entry->index = i;
+      popup->entry_array[i] = new_entry;
       popup->entries = g_list_prepend (popup->entries, new_entry);
+
+      if (!new_entry->blank && workspace == NULL)
+        workspace = (MetaWorkspace *) new_entry->key;
+
+      if (new_entry->icon)
+        {
+          cell_width = MAX (cell_width,
+                            gdk_pixbuf_get_width (new_entry->icon));
+          cell_height = MAX (cell_height,
+                             gdk_pixbuf_get_height (new_entry->icon));
+        }
     }
 
   popup->entries = g_list_reverse (popup->entries);
@@ -273,6 +494,25 @@ meta_ui_tab_popup_new (const MetaTabEntry *entries,
   if (i % width)
     height += 1;
 
+  cell_width += (INSIDE_SELECT_RECT + OUTSIDE_SELECT_RECT + 1) * 2;
+  cell_height += (INSIDE_SELECT_RECT + OUTSIDE_SELECT_RECT + 1) * 2;
+
+  popup->width = width;
+  popup->first_row = 0;
+
+  /* Workspace popups are never long; window lists are limited to
+   * what fits in most of the screen height.
+   */
+  if (outline)
+    popup->visible_rows = MIN (height,
+                               MAX (1, gdk_screen_get_height (screen) * 3 / 4 /
+                                    cell_height));
+  else
+    popup->visible_rows = height;
+
+  popup->cells = g_new (GtkWidget *, MAX (width * popup->visible_rows, 1));
+  popup->cell_entries = g_new0 (TabEntry *, MAX (width * popup->visible_rows, 1));
+
   grid = gtk_grid_new ();
   vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
   
@@ -304,71 +544,63 @@ meta_ui_tab_popup_new (const MetaTabEntry *entries,
 
   gtk_box_pack_end (GTK_BOX (vbox), popup->label, FALSE, FALSE, 0);
 
-  max_label_width = 0;
-  top = 0;
-  tmp = popup->entries;
-
-  while (tmp && top < height)
-    {      
-      left = 0;
-
-      while (tmp && left < width)
+  for (top = 0; top < popup->visible_rows; ++top)
+    {
+      for (left = 0; left < width; ++left)
         {
           GtkWidget *image;
-          GtkRequisition req;
 
-          TabEntry *te;
-
-          te = tmp->data;
-
-          if (te->blank)
+          if (outline)
             {
-              /* just stick a widget here to avoid special cases */
-              image = gtk_alignment_new (0.0, 0.0, 0.0, 0.0);
-            }
-          else if (outline)
-            {
-              if (te->dimmed_icon)
-                {
-                  image = selectable_image_new (te->dimmed_icon);
-                }
-              else 
-                {
-                  image = selectable_image_new (te->icon);
-                }
+              image = selectable_image_new (NULL);
 
               gtk_misc_set_padding (GTK_MISC (image),
                                     INSIDE_SELECT_RECT + OUTSIDE_SELECT_RECT + 1,
                                     INSIDE_SELECT_RECT + OUTSIDE_SELECT_RECT + 1);
               gtk_misc_set_alignment (GTK_MISC (image), 0.5, 0.5);
+              gtk_widget_set_size_request (image, cell_width, cell_height);
             }   
           else
             {
-              image = selectable_workspace_new ((MetaWorkspace *) te->key);
+              /* Every cell is the shape of the screen */
+              image = selectable_workspace_new (workspace);
             }
 
-          te->widget = image;
+          popup->cells[top * width + left] = image;
 
           gtk_grid_attach (GTK_GRID (grid),
-                           te->widget,
+                           image,
                            left, top, 1, 1);
-
-          /* Efficiency rules! */
-          gtk_label_set_markup (GTK_LABEL (popup->label),
-                              te->title);
-          gtk_widget_get_preferred_size (popup->label, &req, NULL);
-          max_label_width = MAX (max_label_width, req.width);
-          
-          tmp = tmp->next;
-          
-          ++left;
         }
-      
-      ++top;
     }
 
-  /* remove all the temporary text */
-  gtk_label_set_text (GTK_LABEL (popup->label), "");
+  assign_cells (popup);
+
+  /* Measure the titles without going through the label, which would
+   * relayout and announce itself for every one of them; stop once
+   * the width limit is reached.
+   */
+  gtk_misc_get_padding (GTK_MISC (popup->label), &xpad, &ypad);
+  layout = gtk_widget_create_pango_layout (popup->label, NULL);
+
+  max_label_width = 0;
+  for (tmp = popup->entries;
+       tmp != NULL && max_label_width < screen_width / 4;
+       tmp = tmp->next)
+    {
+      TabEntry *te = tmp->data;
+      int label_width;
+
+      if (te->title == NULL)
+        continue;
+
+      pango_layout_set_markup (layout, te->title, -1);
+      pango_layout_get_pixel_size (layout, &label_width, NULL);
+      max_label_width = MAX (max_label_width, label_width + xpad * 2);
+    }
+
+  g_object_unref (G_OBJECT (layout));
+
   /* Make it so that we ellipsize if the text is too long */
   gtk_label_set_ellipsize (GTK_LABEL (popup->label), PANGO_ELLIPSIZE_END);
 
@@ -414,12 +646,18 @@ meta_ui_tab_popup_free (MetaTabPopup *popup)
       return;
     }
   
+  if (popup->fill_idle)
+    g_source_remove (popup->fill_idle);
+
   gtk_widget_destroy (popup->outline_window);
   gtk_widget_destroy (popup->window);
   
   g_list_foreach (popup->entries, free_tab_entry, NULL);
 
   g_list_free (popup->entries);
+  g_free (popup->entry_array);
+  g_free (popup->cells);
+  g_free (popup->cell_entries);
   
   g_free (popup);
 }
@@ -444,6 +682,31 @@ meta_ui_tab_popup_set_showing (MetaTabPopup *popup,
     }
 }
 
+static void
+scroll_to_entry (MetaTabPopup *popup,
+                 TabEntry     *te)
+{
+  int row, first_row;
+
+  row = te->index / popup->width;
+  first_row = popup->first_row;
+
+  if (row < first_row)
+    first_row = row;
+  else if (row >= first_row + popup->visible_rows)
+    first_row = row - popup->visible_rows + 1;
+
+  if (first_row != popup->first_row)
+    {
+      popup->first_row = first_row;
+      assign_cells (popup);
+    }
+
+  /* Don't leave the selection as a placeholder */
+  if (entry_needs_dimming (te))
+    update_cell (popup, te->index - popup->first_row * popup->width, TRUE);
+}
+
 static void
 display_entry (MetaTabPopup *popup,
                TabEntry     *te)
@@ -452,13 +715,16 @@ display_entry (MetaTabPopup *popup,
   GdkWindow *window;
 
   
-  if (popup->current_selected_entry)
+  if (popup->current_selected_entry &&
+      popup->current_selected_entry->widget)
   {
     if (popup->outline)
       unselect_image (popup->current_selected_entry->widget);
     else
       unselect_workspace (popup->current_selected_entry->widget);
   }
+
+  scroll_to_entry (popup, te);
   
   gtk_label_set_markup (GTK_LABEL (popup->label), te->title);
 
@@ -785,6 +1051,14 @@ selectable_workspace_new (MetaWorkspace *workspace)
   return widget;
 }
 
+static void
+set_workspace (GtkWidget     *widget,
+               MetaWorkspace *workspace)
+{
+  META_SELECT_WORKSPACE (widget)->workspace = workspace;
+  gtk_widget_queue_draw (widget);
+}
+
 static void
 select_workspace (GtkWidget *widget)
 {
@@ -888,6 +1162,10 @@ meta_select_workspace_draw (GtkWidget *widget,
   GList *tmp, *list;
 
   workspace = META_SELECT_WORKSPACE (widget)->workspace;
+
+  /* A cell past the last workspace */
+  if (workspace == NULL)
+    return TRUE;
               
   list = meta_stack_list_windows (workspace->screen->stack, workspace);
   n_windows = g_list_length (list);
@@ -52,7 +52,8 @@ MetaTabPopup*   meta_ui_tab_popup_new          (const MetaTabEntry *entries,
                                                 int                 screen_number,
                                                 int                 entry_count,
                                                 int                 width,
-                                                gboolean            outline);
+                                                gboolean            outline,
+                                                gint64              requested_time);
 void            meta_ui_tab_popup_free         (MetaTabPopup       *popup);
 void            meta_ui_tab_popup_set_showing  (MetaTabPopup       *popup,
                                                 gboolean            showing);
@@ -22,6 +22,7 @@
 
 #include <meta/gradient.h>
 #include <gtk/gtk.h>
+#include <string.h>
 
 typedef void (* RenderGradientFunc) (cairo_t     *cr,
                                      int          width,
@@ -303,11 +304,258 @@ meta_gradient_test (void)
 
 }
 
+/* Benchmark mode: compare rendering titlebar sized gradients through
+ * a GdkPixbuf against rendering them straight into a cairo surface,
+ * after checking that both come out the same to the pixel.
+ */
+#define BENCHMARK_WIDTH 3840
+#define BENCHMARK_HEIGHT 32
+#define BENCHMARK_ITERATIONS 200
+
+static void
+benchmark_pixbuf (cairo_t         *cr,
+                  int              width,
+                  int              height,
+                  const GdkRGBA   *colors,
+                  int              n_colors,
+                  MetaGradientType type,
+                  const guchar    *alphas,
+                  int              n_alphas)
+{
+  GdkPixbuf *pixbuf;
+
+  pixbuf = meta_gradient_create_multi (width, height,
+                                       colors, n_colors, type);
+
+  if (alphas)
+    {
+      GdkPixbuf *new_pixbuf;
+
+      new_pixbuf = gdk_pixbuf_add_alpha (pixbuf, FALSE, 0, 0, 0);
+      g_object_unref (G_OBJECT (pixbuf));
+      pixbuf = new_pixbuf;
+
+      meta_gradient_add_alpha (pixbuf, alphas, n_alphas,
+                               META_GRADIENT_HORIZONTAL);
+    }
+
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+  cairo_paint (cr);
+
+  g_object_unref (G_OBJECT (pixbuf));
+}
+
+static void
+benchmark_surface (cairo_t         *cr,
+                   int              width,
+                   int              height,
+                   const GdkRGBA   *colors,
+                   int              n_colors,
+                   MetaGradientType type,
+                   const guchar    *alphas,
+                   int              n_alphas)
+{
+  cairo_surface_t *surface;
+
+  surface = meta_gradient_create_surface (width, height,
+                                          colors, n_colors, type,
+                                          alphas, n_alphas,
+                                          META_GRADIENT_HORIZONTAL);
+
+  cairo_set_source_surface (cr, surface, 0, 0);
+  cairo_paint (cr);
+
+  cairo_surface_destroy (surface);
+}
+
+static cairo_surface_t*
+render_once (gboolean         use_surface,
+             int              width,
+             int              height,
+             const GdkRGBA   *colors,
+             int              n_colors,
+             MetaGradientType type,
+             const guchar    *alphas,
+             int              n_alphas)
+{
+  cairo_surface_t *target;
+  cairo_t *cr;
+
+  target = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cr = cairo_create (target);
+
+  if (use_surface)
+    benchmark_surface (cr, width, height,
+                       colors, n_colors, type, alphas, n_alphas);
+  else
+    benchmark_pixbuf (cr, width, height,
+                      colors, n_colors, type, alphas, n_alphas);
+
+  cairo_destroy (cr);
+  cairo_surface_flush (target);
+
+  return target;
+}
+
+/* Returns FALSE, after saying where, if the two paths differ anywhere */
+static gboolean
+benchmark_compare (int              width,
+                   int              height,
+                   const GdkRGBA   *colors,
+                   int              n_colors,
+                   MetaGradientType type,
+                   const guchar    *alphas,
+                   int              n_alphas)
+{
+  cairo_surface_t *expected, *actual;
+  guchar *expected_data, *actual_data;
+  int stride;
+  int x, y;
+  gboolean same;
+
+  expected = render_once (FALSE, width, height,
+                          colors, n_colors, type, alphas, n_alphas);
+  actual = render_once (TRUE, width, height,
+                        colors, n_colors, type, alphas, n_alphas);
+
+  expected_data = cairo_image_surface_get_data (expected);
+  actual_data = cairo_image_surface_get_data (actual);
+  stride = cairo_image_surface_get_stride (expected);
+
+  same = TRUE;
+  for (y = 0; y < height && same; y++)
+    for (x = 0; x < width && same; x++)
+      {
+        guint32 e = ((guint32 *) (expected_data + y * stride))[x];
+        guint32 a = ((guint32 *) (actual_data + y * stride))[x];
+
+        if (e != a)
+          {
+            g_printerr ("%dx%d gradient type %d with %d colors%s differs "
+                        "at %d,%d: pixbuf 0x%08x, surface 0x%08x\n",
+                        width, height, type, n_colors,
+                        alphas ? " and alpha" : "",
+                        x, y, e, a);
+            same = FALSE;
+          }
+      }
+
+  cairo_surface_destroy (expected);
+  cairo_surface_destroy (actual);
+
+  return same;
+}
+
+static double
+benchmark_run (gboolean         use_surface,
+               const GdkRGBA   *colors,
+               int              n_colors,
+               MetaGradientType type,
+               const guchar    *alphas,
+               int              n_alphas)
+{
+  cairo_surface_t *target;
+  cairo_t *cr;
+  GTimer *timer;
+  double elapsed;
+  int i;
+
+  target = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                       BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+  cr = cairo_create (target);
+
+  timer = g_timer_new ();
+
+  for (i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+      if (use_surface)
+        benchmark_surface (cr, BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+                           colors, n_colors, type, alphas, n_alphas);
+      else
+        benchmark_pixbuf (cr, BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+                          colors, n_colors, type, alphas, n_alphas);
+    }
+
+  cairo_surface_flush (target);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_destroy (timer);
+  cairo_destroy (cr);
+  cairo_surface_destroy (target);
+
+  /* megapixels per second */
+  return (double) BENCHMARK_WIDTH * BENCHMARK_HEIGHT * BENCHMARK_ITERATIONS /
+    elapsed / 1000000.;
+}
+
+static gboolean
+meta_gradient_benchmark (void)
+{
+  const char *type_names[] = { "vertical", "horizontal", "diagonal" };
+  const guchar alphas[] = { 0xff, 0xaa, 0x2f, 0x0, 0xcc, 0xff, 0xff };
+#define N_COLORS 5
+  GdkRGBA colors[N_COLORS];
+  int type;
+  int n_colors;
+  int with_alpha;
+  gboolean same;
+
+  gdk_rgba_parse (&colors[0], "red");
+  gdk_rgba_parse (&colors[1], "blue");
+  gdk_rgba_parse (&colors[2], "orange");
+  gdk_rgba_parse (&colors[3], "pink");
+  gdk_rgba_parse (&colors[4], "green");
+
+  /* The titlebar size, and an odd one that doesn't divide evenly */
+  same = TRUE;
+  for (type = META_GRADIENT_VERTICAL; type < META_GRADIENT_LAST; type++)
+    for (n_colors = 2; n_colors <= N_COLORS; n_colors++)
+      for (with_alpha = 0; with_alpha < 2; with_alpha++)
+        {
+          const guchar *a = with_alpha ? alphas : NULL;
+          int n_alphas = with_alpha ? G_N_ELEMENTS (alphas) : 0;
+
+          if (!benchmark_compare (BENCHMARK_WIDTH, BENCHMARK_HEIGHT,
+                                  colors, n_colors, type, a, n_alphas) ||
+              !benchmark_compare (97, 13,
+                                  colors, n_colors, type, a, n_alphas))
+            same = FALSE;
+        }
+
+  if (!same)
+    return FALSE;
+
+  g_print ("%dx%d gradients, Mpixels/s\n", BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+  g_print ("%-12s %-7s %-6s %10s %10s\n",
+           "type", "colors", "alpha", "pixbuf", "surface");
+
+  for (type = META_GRADIENT_VERTICAL; type < META_GRADIENT_LAST; type++)
+    for (n_colors = 2; n_colors <= N_COLORS; n_colors += N_COLORS - 2)
+      for (with_alpha = 0; with_alpha < 2; with_alpha++)
+        {
+          const guchar *a = with_alpha ? alphas : NULL;
+          int n_alphas = with_alpha ? G_N_ELEMENTS (alphas) : 0;
+
+          g_print ("%-12s %-7d %-6s %10.1f %10.1f\n",
+                   type_names[type], n_colors, with_alpha ? "yes" : "no",
+                   benchmark_run (FALSE, colors, n_colors, type, a, n_alphas),
+                   benchmark_run (TRUE, colors, n_colors, type, a, n_alphas));
+        }
+#undef N_COLORS
+
+  return TRUE;
+}
+
 int
 main (int argc, char **argv)
 {
   gtk_init (&argc, &argv);
 
+  if (argc > 1 && strcmp (argv[1], "--benchmark") == 0)
+    {
+      return meta_gradient_benchmark () ? 0 : 1;
+    }
+
   meta_gradient_test ();
 
   gtk_main ();
@@ -0,0 +1,283 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*- */
+
+/* Mutter theme image cache test program */
+
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <config.h>
+#include "theme-private.h"
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IMAGE_NAME "image.bmp"
+#define IMAGE_WIDTH 7
+#define IMAGE_HEIGHT 5
+
+static char *theme_dir;
+static char *image_path;
+static char *themes_cache_dir;
+
+/* BMP keeps the file the same size whatever the pixels are */
+static void
+write_image (guchar shade)
+{
+  GdkPixbuf *pixbuf;
+  GError *err = NULL;
+  guchar *pixels;
+  int rowstride;
+  int x, y;
+
+  pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8,
+                           IMAGE_WIDTH, IMAGE_HEIGHT);
+  pixels = gdk_pixbuf_get_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  for (y = 0; y < IMAGE_HEIGHT; y++)
+    for (x = 0; x < IMAGE_WIDTH; x++)
+      {
+        guchar *p = pixels + y * rowstride + x * 3;
+
+        p[0] = shade;
+        p[1] = x * 30;
+        p[2] = y * 40;
+      }
+
+  if (!gdk_pixbuf_save (pixbuf, image_path, "bmp", &err, NULL))
+    g_error ("Could not write %s: %s", image_path, err->message);
+
+  g_object_unref (G_OBJECT (pixbuf));
+}
+
+static gboolean
+same_pixels (GdkPixbuf *a,
+             GdkPixbuf *b)
+{
+  int width, height, n_channels;
+  int y;
+
+  width = gdk_pixbuf_get_width (a);
+  height = gdk_pixbuf_get_height (a);
+  n_channels = gdk_pixbuf_get_n_channels (a);
+
+  if (width != gdk_pixbuf_get_width (b) ||
+      height != gdk_pixbuf_get_height (b) ||
+      n_channels != gdk_pixbuf_get_n_channels (b))
+    return FALSE;
+
+  for (y = 0; y < height; y++)
+    if (memcmp (gdk_pixbuf_get_pixels (a) + y * gdk_pixbuf_get_rowstride (a),
+                gdk_pixbuf_get_pixels (b) + y * gdk_pixbuf_get_rowstride (b),
+                width * n_channels) != 0)
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Loads the image through a new theme, checks it against decoding the
+ * file directly, and returns whether it came out of the cache.  The
+ * cache is written again afterwards, as loading a theme does.
+ */
+static gboolean
+load_image (const char *what)
+{
+  MetaTheme *theme;
+  GdkPixbuf *pixbuf;
+  GdkPixbuf *expected;
+  GError *err = NULL;
+  gboolean from_cache;
+
+  theme = meta_theme_new ();
+  theme->dirname = g_strdup (theme_dir);
+
+  pixbuf = meta_theme_load_image (theme, IMAGE_NAME, 0, &err);
+  if (pixbuf == NULL)
+    g_error ("%s: could not load image: %s", what, err->message);
+
+  expected = gdk_pixbuf_new_from_file (image_path, &err);
+  if (expected == NULL)
+    g_error ("%s: could not decode image: %s", what, err->message);
+
+  if (!same_pixels (pixbuf, expected))
+    g_error ("%s: loaded the wrong pixels", what);
+
+  from_cache = !theme->image_cache_dirty;
+  meta_theme_save_image_cache (theme);
+
+  g_object_unref (G_OBJECT (expected));
+  g_object_unref (G_OBJECT (pixbuf));
+  meta_theme_free (theme);
+
+  return from_cache;
+}
+
+static char *
+find_cache_file (void)
+{
+  GDir *dir;
+  const char *name;
+  char *path = NULL;
+
+  dir = g_dir_open (themes_cache_dir, 0, NULL);
+  if (dir == NULL)
+    g_error ("No image cache was written to %s", themes_cache_dir);
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    if (g_str_has_suffix (name, ".images"))
+      path = g_build_filename (themes_cache_dir, name, NULL);
+
+  g_dir_close (dir);
+
+  if (path == NULL)
+    g_error ("No image cache was written to %s", themes_cache_dir);
+
+  return path;
+}
+
+/* Writes a damaged copy of @contents over the cache, which has to be
+ * ignored rather than trusted.
+ */
+static void
+check_rejected (const char *what,
+                const char *cache_path,
+                const char *contents,
+                gsize       length)
+{
+  GError *err = NULL;
+
+  if (!g_file_set_contents (cache_path, contents, length, &err))
+    g_error ("Could not write %s: %s", cache_path, err->message);
+
+  if (load_image (what))
+    g_error ("%s: the damaged image cache was used", what);
+
+  g_print ("%s: ignored\n", what);
+}
+
+static void
+test_damaged_caches (void)
+{
+  MetaImageCacheHeader *header;
+  MetaImageCacheEntry *entry;
+  char *cache_path;
+  char *contents;
+  char *copy;
+  gsize length;
+  GError *err = NULL;
+
+  cache_path = find_cache_file ();
+  if (!g_file_get_contents (cache_path, &contents, &length, &err))
+    g_error ("Could not read %s: %s", cache_path, err->message);
+
+  g_assert (length > sizeof (MetaImageCacheHeader) + sizeof (MetaImageCacheEntry));
+
+  copy = g_malloc (length);
+
+#define DAMAGE(what, n, change)                         \
+  G_STMT_START {                                        \
+    memcpy (copy, contents, length);                    \
+    header = (MetaImageCacheHeader *) copy;             \
+    entry = (MetaImageCacheEntry *) (header + 1);       \
+    change;                                             \
+    check_rejected (what, cache_path, copy, n);         \
+  } G_STMT_END
+
+  DAMAGE ("empty file", 0, );
+  DAMAGE ("truncated header", sizeof (MetaImageCacheHeader) / 2, );
+  DAMAGE ("truncated entries", sizeof (MetaImageCacheHeader) + 4, );
+  DAMAGE ("truncated pixels", length - 1, );
+  DAMAGE ("bad magic", length, header->magic[0] ^= 0xff);
+  DAMAGE ("wrong entry size", length, header->entry_size += 8);
+  DAMAGE ("too many entries", length, header->n_entries = G_MAXUINT32);
+  DAMAGE ("name offset out of range", length,
+          entry->name_offset = length + 100);
+  DAMAGE ("name length out of range", length,
+          entry->name_length = G_MAXUINT32);
+  DAMAGE ("data offset out of range", length, entry->data_offset = length);
+  DAMAGE ("data offset leaving too few rows", length,
+          entry->data_offset = length - entry->rowstride);
+  DAMAGE ("rowstride shorter than a row", length, entry->rowstride = 1);
+  DAMAGE ("width out of range", length, entry->width = G_MAXUINT32);
+  DAMAGE ("height out of range", length, entry->height = G_MAXUINT32);
+  DAMAGE ("zero height", length, entry->height = 0);
+
+#undef DAMAGE
+
+  /* And the undamaged cache is still good */
+  if (!g_file_set_contents (cache_path, contents, length, &err))
+    g_error ("Could not write %s: %s", cache_path, err->message);
+  if (!load_image ("undamaged cache"))
+    g_error ("undamaged cache: the image was decoded again");
+
+  g_unlink (cache_path);
+  g_free (copy);
+  g_free (contents);
+  g_free (cache_path);
+}
+
+int
+main (int argc, char **argv)
+{
+  char *root;
+  char *cache_home;
+
+  g_type_init ();
+
+  root = g_build_filename (g_get_tmp_dir (), "testimagecache-XXXXXX", NULL);
+  if (mkdtemp (root) == NULL)
+    g_error ("Could not create %s", root);
+
+  /* Before anything asks GLib for the cache directory */
+  cache_home = g_build_filename (root, "cache", NULL);
+  g_setenv ("XDG_CACHE_HOME", cache_home, TRUE);
+  themes_cache_dir = g_build_filename (cache_home, "mutter", "themes", NULL);
+
+  theme_dir = g_build_filename (root, "theme", NULL);
+  g_mkdir (theme_dir, 0755);
+  image_path = g_build_filename (theme_dir, IMAGE_NAME, NULL);
+
+  write_image (0x10);
+  if (load_image ("first load"))
+    g_error ("first load: the image came from an empty cache");
+  if (!load_image ("second load"))
+    g_error ("second load: the image was decoded again");
+
+  /* Same name, same size and most likely the same second */
+  write_image (0x20);
+  if (load_image ("rewritten image"))
+    g_error ("rewritten image: the stale cache entry was used");
+
+  test_damaged_caches ();
+
+  g_unlink (image_path);
+  g_rmdir (theme_dir);
+  g_rmdir (themes_cache_dir);
+  g_free (themes_cache_dir);
+  themes_cache_dir = g_build_filename (cache_home, "mutter", NULL);
+  g_rmdir (themes_cache_dir);
+  g_rmdir (cache_home);
+  g_rmdir (root);
+
+  g_free (themes_cache_dir);
+  g_free (image_path);
+  g_free (theme_dir);
+  g_free (cache_home);
+  g_free (root);
+
+  return 0;
+}
@@ -4233,6 +4233,9 @@ load_theme (const char *theme_dir,
   retval = info.theme;
   info.theme = NULL;
 
+  if (retval)
+    meta_theme_save_image_cache (retval);
+
  out:
   if (*error && !theme_error_is_fatal (*error))
     {
@@ -441,16 +441,23 @@ typedef struct
   } d;
 } PosToken;
 
+/**
+ * Postfix bytecode for a non-constant expression, with variables
+ * resolved to offsets into MetaPositionExprEnv. Private to theme.c.
+ * \ingroup parser
+ */
+typedef struct _PosCode PosCode;
+
 /**
  * MetaDrawSpec: (skip)
  *
  * A computed expression in our simple vector drawing language.
- * While it appears to take the form of a tree, this is actually
- * merely a list; concerns such as precedence of operators are
- * currently recomputed on every recalculation.
+ * The tokens are merely a list; concerns such as precedence of
+ * operators are recomputed every time they are interpreted, so
+ * expressions with variables are also compiled to bytecode when
+ * the spec is created.
  *
  * Created by meta_draw_spec_new(), destroyed by meta_draw_spec_free().
- * pos_eval() fills this with ...FIXME. Are tokens a tree or a list?
  * \ingroup parser
  */
 typedef struct _MetaDrawSpec MetaDrawSpec;
@@ -468,6 +475,14 @@ struct _MetaDrawSpec
   /** How many tokens are in the tokens list. */
   int n_tokens;
 
+  /**
+   * The compiled expression, or NULL if it is constant or could not
+   * be compiled; the tokens are interpreted in that case, and also
+   * whenever the compiled code runs into an error, so that errors
+   * are always reported the same way.
+   */
+  PosCode *code;
+
   /** Does the expression contain any variables? */
   gboolean constant : 1;
 };
@@ -755,6 +770,11 @@ struct _MetaFrameStyle
    * Transparency of the window background. 0=transparent; 255=opaque.
    */
   guint8 window_background_alpha;
+  /**
+   * Recorded drawings of this style, most recently used first, so
+   * frames that look the same don't have to run the op lists again.
+   */
+  GList *draw_plans;
 };
 
 /* Kinds of frame...
@@ -875,6 +895,13 @@ struct _MetaTheme
   GHashTable *style_sets_by_name;
   MetaFrameStyleSet *style_sets_by_type[META_FRAME_TYPE_LAST];
 
+  /** Mapped image cache file holding decoded theme images, or NULL */
+  GMappedFile *image_cache;
+  /** Whether opening the image cache has been attempted */
+  guint image_cache_opened : 1;
+  /** Whether images were decoded that are missing from the image cache */
+  guint image_cache_dirty : 1;
+
   GQuark quark_width;
   GQuark quark_height;
   GQuark quark_object_width;
@@ -1044,7 +1071,15 @@ void meta_frame_style_draw_with_style (MetaFrameStyle          *style,
                                        int                      text_height,
                                        MetaButtonState          button_states[META_BUTTON_TYPE_LAST],
                                        GdkPixbuf               *mini_icon,
-                                       GdkPixbuf               *icon);
+                                       GdkPixbuf               *icon,
+                                       gboolean                 use_draw_plan);
+
+void meta_theme_invalidate_draw_plans (void);
+
+/* TRUE if any piece or button of the style (or its parents) draws
+ * the window icon or mini icon.
+ */
+gboolean meta_frame_style_uses_icons (const MetaFrameStyle *style);
 
 
 gboolean       meta_frame_style_validate (MetaFrameStyle    *style,
@@ -1058,10 +1093,39 @@ void               meta_frame_style_set_unref (MetaFrameStyleSet *style_set);
 gboolean       meta_frame_style_set_validate  (MetaFrameStyleSet *style_set,
                                                GError           **error);
 
+/* Layout of the image cache file meta_theme_save_image_cache() writes,
+ * here so that testimagecache can take it apart.
+ */
+typedef struct
+{
+  char    magic[8];
+  guint32 n_entries;
+  guint32 entry_size;
+} MetaImageCacheHeader;
+
+typedef struct
+{
+  guint32 name_offset;
+  guint32 name_length;
+  guint64 inode;
+  gint64  size;
+  gint64  mtime;
+  gint64  mtime_nsec;
+  gint64  ctime;
+  gint64  ctime_nsec;
+  guint32 width;
+  guint32 height;
+  guint32 rowstride;
+  guint32 has_alpha;
+  guint64 data_offset;
+} MetaImageCacheEntry;
+
 GdkPixbuf* meta_theme_load_image (MetaTheme  *theme,
                                   const char *filename,
                                   guint       size_of_theme_icons,
                                   GError    **error);
+void       meta_theme_save_image_cache (MetaTheme *theme);
+void       meta_theme_set_image_cache_enabled (gboolean enabled);
 
 MetaFrameStyle* meta_theme_get_frame_style (MetaTheme     *theme,
                                             MetaFrameType  type,
@@ -1098,7 +1162,8 @@ void meta_theme_draw_frame_with_style (MetaTheme              *theme,
                                        const MetaButtonLayout *button_layout,
                                        MetaButtonState         button_states[META_BUTTON_TYPE_LAST],
                                        GdkPixbuf              *mini_icon,
-                                       GdkPixbuf              *icon);
+                                       GdkPixbuf              *icon,
+                                       gboolean                use_draw_plan);
 
 void meta_theme_get_frame_borders (MetaTheme         *theme,
                                    MetaFrameType      type,
@@ -64,9 +64,7 @@ static GtkWidget *previews[META_FRAME_TYPE_LAST*FONT_SIZE_LAST + BUTTON_LAYOUT_C
 static double milliseconds_to_draw_frame = 0.0;
 
 static void run_position_expression_tests (void);
-#if 0
 static void run_position_expression_timings (void);
-#endif
 static void run_theme_benchmark (void);
 
 
@@ -790,9 +788,6 @@ main (int argc, char **argv)
   bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
 
   run_position_expression_tests ();
-#if 0
-  run_position_expression_timings ();
-#endif
 
   gtk_init (&argc, &argv);
 
@@ -827,7 +822,10 @@ main (int argc, char **argv)
            global_theme->name,
            (end - start) / (double) CLOCKS_PER_SEC);
 
+  run_image_cache_timings ();
   run_theme_benchmark ();
+  run_draw_plan_tests ();
+  run_position_expression_timings ();
   
   window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
   gtk_window_set_default_size (GTK_WINDOW (window), 350, 350);
@@ -946,6 +944,26 @@ create_title_layout (GtkWidget *widget)
   return layout;
 }
 
+static void
+get_button_layout (MetaButtonLayout *button_layout)
+{
+  int i;
+
+  i = 0;
+  while (i < MAX_BUTTONS_PER_CORNER)
+    {
+      button_layout->left_buttons[i] = META_BUTTON_FUNCTION_LAST;
+      button_layout->right_buttons[i] = META_BUTTON_FUNCTION_LAST;
+      ++i;
+    }
+  
+  button_layout->left_buttons[0] = META_BUTTON_FUNCTION_MENU;
+
+  button_layout->right_buttons[0] = META_BUTTON_FUNCTION_MINIMIZE;
+  button_layout->right_buttons[1] = META_BUTTON_FUNCTION_MAXIMIZE;
+  button_layout->right_buttons[2] = META_BUTTON_FUNCTION_CLOSE;
+}
+
 static void
 run_theme_benchmark (void)
 {
@@ -982,19 +1000,7 @@ run_theme_benchmark (void)
   
   layout = create_title_layout (widget);
   
-  i = 0;
-  while (i < MAX_BUTTONS_PER_CORNER)
-    {
-      button_layout.left_buttons[i] = META_BUTTON_FUNCTION_LAST;
-      button_layout.right_buttons[i] = META_BUTTON_FUNCTION_LAST;
-      ++i;
-    }
-  
-  button_layout.left_buttons[0] = META_BUTTON_FUNCTION_MENU;
-
-  button_layout.right_buttons[0] = META_BUTTON_FUNCTION_MINIMIZE;
-  button_layout.right_buttons[1] = META_BUTTON_FUNCTION_MAXIMIZE;
-  button_layout.right_buttons[2] = META_BUTTON_FUNCTION_CLOSE;
+  get_button_layout (&button_layout);
 
   timer = g_timer_new ();
   start = clock ();
@@ -1058,6 +1064,167 @@ run_theme_benchmark (void)
 #undef ITERATIONS
 }
 
+/* Loading a theme from its image cache skips decoding the images, so
+ * the difference between these is what decoding them costs.
+ */
+static void
+run_image_cache_timings (void)
+{
+  MetaTheme *theme;
+  GError *err;
+  GTimer *timer;
+  double elapsed[2];
+  int pass;
+
+  timer = g_timer_new ();
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      meta_theme_set_image_cache_enabled (pass == 1);
+
+      err = NULL;
+      g_timer_start (timer);
+      theme = meta_theme_load (global_theme->name, &err);
+      elapsed[pass] = g_timer_elapsed (timer, NULL);
+
+      if (theme == NULL)
+        {
+          g_printerr (_("Error loading theme: %s\n"), err->message);
+          g_error_free (err);
+          break;
+        }
+
+      meta_theme_free (theme);
+    }
+
+  meta_theme_set_image_cache_enabled (TRUE);
+  g_timer_destroy (timer);
+
+  if (pass == 2)
+    g_print (_("Loaded theme in %g seconds decoding its images, "
+               "%g seconds from the image cache\n"),
+             elapsed[0], elapsed[1]);
+}
+
+/* The window manager paints the four visible borders of a frame one at
+ * a time, each into a surface of its own (see populate_cache() in
+ * frames.c). The first one records a draw plan, and the other three
+ * have to replay it rather than record their own.
+ */
+static void
+run_draw_plan_tests (void)
+{
+  GtkWidget *widget;
+  MetaFrameBorders borders;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST] =
+  {
+    META_BUTTON_STATE_NORMAL,
+    META_BUTTON_STATE_NORMAL,
+    META_BUTTON_STATE_NORMAL,
+    META_BUTTON_STATE_NORMAL
+  };
+  MetaButtonLayout button_layout;
+  PangoLayout *layout;
+  MetaFrameStyle *style;
+  GdkRectangle pieces[4];
+  gpointer plan;
+  guint n_plans;
+  int client_width;
+  int client_height;
+  int i;
+
+  widget = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+  gtk_widget_realize (widget);
+
+  meta_theme_get_frame_borders (global_theme,
+                                META_FRAME_TYPE_NORMAL,
+                                get_text_height (widget),
+                                get_flags (widget),
+                                &borders);
+
+  layout = create_title_layout (widget);
+  get_button_layout (&button_layout);
+
+  style = meta_theme_get_frame_style (global_theme,
+                                      META_FRAME_TYPE_NORMAL,
+                                      get_flags (widget));
+
+  client_width = 400;
+  client_height = 300;
+
+  /* top, left, right and bottom, as populate_cache() lays them out */
+  pieces[0].x = borders.invisible.left;
+  pieces[0].y = borders.invisible.top;
+  pieces[0].width = client_width + borders.visible.left + borders.visible.right;
+  pieces[0].height = borders.visible.top;
+
+  pieces[1].x = borders.invisible.left;
+  pieces[1].y = borders.total.top;
+  pieces[1].width = borders.visible.left;
+  pieces[1].height = client_height;
+
+  pieces[2].x = borders.total.left + client_width;
+  pieces[2].y = borders.total.top;
+  pieces[2].width = borders.visible.right;
+  pieces[2].height = client_height;
+
+  pieces[3].x = borders.invisible.left;
+  pieces[3].y = borders.total.top + client_height;
+  pieces[3].width = client_width + borders.visible.left + borders.visible.right;
+  pieces[3].height = borders.visible.bottom;
+
+  meta_theme_invalidate_draw_plans ();
+
+  plan = NULL;
+  n_plans = 0;
+  for (i = 0; i < 4; i++)
+    {
+      cairo_surface_t *pixmap;
+      cairo_t *cr;
+
+      if (pieces[i].width <= 0 || pieces[i].height <= 0)
+        continue;
+
+      pixmap = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+                                           pieces[i].width,
+                                           pieces[i].height);
+      cr = cairo_create (pixmap);
+      cairo_translate (cr, -pieces[i].x, -pieces[i].y);
+
+      meta_theme_draw_frame (global_theme,
+                             widget,
+                             cr,
+                             META_FRAME_TYPE_NORMAL,
+                             get_flags (widget),
+                             client_width, client_height,
+                             layout,
+                             get_text_height (widget),
+                             &button_layout,
+                             button_states,
+                             meta_preview_get_mini_icon (),
+                             meta_preview_get_icon ());
+
+      cairo_destroy (cr);
+      cairo_surface_destroy (pixmap);
+
+      if (style->draw_plans == NULL)
+        g_error (_("frame piece %d was drawn without a draw plan"), i);
+
+      if (plan == NULL)
+        {
+          plan = style->draw_plans->data;
+          n_plans = g_list_length (style->draw_plans);
+        }
+      else if (style->draw_plans->data != plan ||
+               g_list_length (style->draw_plans) != n_plans)
+        g_error (_("frame piece %d recorded a new draw plan instead of "
+                   "replaying the first piece's"), i);
+    }
+
+  g_object_unref (G_OBJECT (layout));
+  gtk_widget_destroy (widget);
+}
+
 typedef struct
 {
   GdkRectangle rect;
@@ -1296,63 +1463,260 @@ run_position_expression_tests (void)
 #endif
 }
 
-#if 0
+static void collect_op_list_specs (MetaDrawOpList *op_list,
+                                   GHashTable     *seen,
+                                   GPtrArray      *specs);
+
 static void
-run_position_expression_timings (void)
+collect_spec (MetaDrawSpec *spec,
+              GHashTable   *seen,
+              GPtrArray    *specs)
+{
+  /* Constants are never evaluated, so there is nothing to time */
+  if (spec == NULL || spec->constant || g_hash_table_lookup (seen, spec))
+    return;
+
+  g_hash_table_insert (seen, spec, spec);
+  g_ptr_array_add (specs, spec);
+}
+
+static void
+collect_op_specs (MetaDrawOp *op,
+                  GHashTable *seen,
+                  GPtrArray  *specs)
+{
+  switch (op->type)
+    {
+    case META_DRAW_LINE:
+      collect_spec (op->data.line.x1, seen, specs);
+      collect_spec (op->data.line.y1, seen, specs);
+      collect_spec (op->data.line.x2, seen, specs);
+      collect_spec (op->data.line.y2, seen, specs);
+      break;
+    case META_DRAW_RECTANGLE:
+      collect_spec (op->data.rectangle.x, seen, specs);
+      collect_spec (op->data.rectangle.y, seen, specs);
+      collect_spec (op->data.rectangle.width, seen, specs);
+      collect_spec (op->data.rectangle.height, seen, specs);
+      break;
+    case META_DRAW_ARC:
+      collect_spec (op->data.arc.x, seen, specs);
+      collect_spec (op->data.arc.y, seen, specs);
+      collect_spec (op->data.arc.width, seen, specs);
+      collect_spec (op->data.arc.height, seen, specs);
+      break;
+    case META_DRAW_CLIP:
+      collect_spec (op->data.clip.x, seen, specs);
+      collect_spec (op->data.clip.y, seen, specs);
+      collect_spec (op->data.clip.width, seen, specs);
+      collect_spec (op->data.clip.height, seen, specs);
+      break;
+    case META_DRAW_TINT:
+      collect_spec (op->data.tint.x, seen, specs);
+      collect_spec (op->data.tint.y, seen, specs);
+      collect_spec (op->data.tint.width, seen, specs);
+      collect_spec (op->data.tint.height, seen, specs);
+      break;
+    case META_DRAW_GRADIENT:
+      collect_spec (op->data.gradient.x, seen, specs);
+      collect_spec (op->data.gradient.y, seen, specs);
+      collect_spec (op->data.gradient.width, seen, specs);
+      collect_spec (op->data.gradient.height, seen, specs);
+      break;
+    case META_DRAW_IMAGE:
+      collect_spec (op->data.image.x, seen, specs);
+      collect_spec (op->data.image.y, seen, specs);
+      collect_spec (op->data.image.width, seen, specs);
+      collect_spec (op->data.image.height, seen, specs);
+      break;
+    case META_DRAW_GTK_ARROW:
+      collect_spec (op->data.gtk_arrow.x, seen, specs);
+      collect_spec (op->data.gtk_arrow.y, seen, specs);
+      collect_spec (op->data.gtk_arrow.width, seen, specs);
+      collect_spec (op->data.gtk_arrow.height, seen, specs);
+      break;
+    case META_DRAW_GTK_BOX:
+      collect_spec (op->data.gtk_box.x, seen, specs);
+      collect_spec (op->data.gtk_box.y, seen, specs);
+      collect_spec (op->data.gtk_box.width, seen, specs);
+      collect_spec (op->data.gtk_box.height, seen, specs);
+      break;
+    case META_DRAW_GTK_VLINE:
+      collect_spec (op->data.gtk_vline.x, seen, specs);
+      collect_spec (op->data.gtk_vline.y1, seen, specs);
+      collect_spec (op->data.gtk_vline.y2, seen, specs);
+      break;
+    case META_DRAW_ICON:
+      collect_spec (op->data.icon.x, seen, specs);
+      collect_spec (op->data.icon.y, seen, specs);
+      collect_spec (op->data.icon.width, seen, specs);
+      collect_spec (op->data.icon.height, seen, specs);
+      break;
+    case META_DRAW_TITLE:
+      collect_spec (op->data.title.x, seen, specs);
+      collect_spec (op->data.title.y, seen, specs);
+      collect_spec (op->data.title.ellipsize_width, seen, specs);
+      break;
+    case META_DRAW_OP_LIST:
+      collect_spec (op->data.op_list.x, seen, specs);
+      collect_spec (op->data.op_list.y, seen, specs);
+      collect_spec (op->data.op_list.width, seen, specs);
+      collect_spec (op->data.op_list.height, seen, specs);
+      collect_op_list_specs (op->data.op_list.op_list, seen, specs);
+      break;
+    case META_DRAW_TILE:
+      collect_spec (op->data.tile.x, seen, specs);
+      collect_spec (op->data.tile.y, seen, specs);
+      collect_spec (op->data.tile.width, seen, specs);
+      collect_spec (op->data.tile.height, seen, specs);
+      collect_spec (op->data.tile.tile_xoffset, seen, specs);
+      collect_spec (op->data.tile.tile_yoffset, seen, specs);
+      collect_spec (op->data.tile.tile_width, seen, specs);
+      collect_spec (op->data.tile.tile_height, seen, specs);
+      collect_op_list_specs (op->data.tile.op_list, seen, specs);
+      break;
+    }
+}
+
+static void
+collect_op_list_specs (MetaDrawOpList *op_list,
+                       GHashTable     *seen,
+                       GPtrArray      *specs)
 {
   int i;
-  int iters;
-  clock_t start;
-  clock_t end;
-  MetaPositionExprEnv env;
 
-#define ITERATIONS 100000
+  /* Op lists are shared by name, so only walk each one once */
+  if (op_list == NULL || g_hash_table_lookup (seen, op_list))
+    return;
 
-  start = clock ();
+  g_hash_table_insert (seen, op_list, op_list);
 
-  iters = 0;
-  i = 0;
-  while (iters < ITERATIONS)
-    {
-      const PositionExpressionTest *test;
-      int x, y;
+  for (i = 0; i < op_list->n_ops; i++)
+    collect_op_specs (op_list->ops[i], seen, specs);
+}
 
-      test = &position_expression_tests[i];
+static void
+collect_named_op_list_specs (gpointer key,
+                             gpointer value,
+                             gpointer data)
+{
+  gpointer *closure = data;
 
-      env.x = test->rect.x;
-      env.y = test->rect.y;
-      env.width = test->rect.width;
-      env.height = test->rect.height;
-      env.object_width = -1;
-      env.object_height = -1;
-      env.left_width = 0;
-      env.right_width = 0;
-      env.top_height = 0;
-      env.bottom_height = 0;
-      env.title_width = 5;
-      env.title_height = 5;
-      env.icon_width = 32;
-      env.icon_height = 32;
-      env.mini_icon_width = 16;
-      env.mini_icon_height = 16;
-      env.theme = NULL;
+  collect_op_list_specs (value, closure[0], closure[1]);
+}
+
+static void
+collect_style_specs (gpointer key,
+                     gpointer value,
+                     gpointer data)
+{
+  MetaFrameStyle *style = value;
+  gpointer *closure = data;
+  int i, j;
 
-      meta_parse_position_expression (test->expr,
-                                      &env,
-                                      &x, &y, NULL);
+  for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+    collect_op_list_specs (style->pieces[i], closure[0], closure[1]);
 
-      ++iters;
-      ++i;
-      if (i == G_N_ELEMENTS (position_expression_tests))
-        i = 0;
+  for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+    for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+      collect_op_list_specs (style->buttons[i][j], closure[0], closure[1]);
+}
+
+/* Times evaluating the coordinate expressions of the loaded theme's
+ * draw ops, interpreted and compiled.
+ */
+static void
+run_position_expression_timings (void)
+{
+  GPtrArray *specs;
+  GHashTable *seen;
+  PosCode **code;
+  gpointer closure[2];
+  MetaPositionExprEnv env;
+  int n_compiled;
+  int pass;
+  int i;
+
+#define EXPRESSION_ITERATIONS 1000000
+
+  seen = g_hash_table_new (NULL, NULL);
+  specs = g_ptr_array_new ();
+
+  closure[0] = seen;
+  closure[1] = specs;
+  g_hash_table_foreach (global_theme->draw_op_lists_by_name,
+                        collect_named_op_list_specs, closure);
+  g_hash_table_foreach (global_theme->styles_by_name,
+                        collect_style_specs, closure);
+
+  g_hash_table_destroy (seen);
+
+  if (specs->len == 0)
+    {
+      g_print (_("Theme has no coordinate expressions to time\n"));
+      g_ptr_array_free (specs, TRUE);
+      return;
     }
 
-  end = clock ();
+  code = g_new (PosCode *, specs->len);
+  n_compiled = 0;
+  for (i = 0; i < (int) specs->len; i++)
+    {
+      code[i] = ((MetaDrawSpec *) g_ptr_array_index (specs, i))->code;
+      if (code[i])
+        n_compiled++;
+    }
 
-  g_print (_("%d coordinate expressions parsed in %g seconds (%g seconds average)\n"),
-           ITERATIONS,
-           ((double)end - (double)start) / CLOCKS_PER_SEC,
-           ((double)end - (double)start) / CLOCKS_PER_SEC / (double) ITERATIONS);
+  env.rect.x = 0;
+  env.rect.y = 0;
+  env.rect.width = 300;
+  env.rect.height = 30;
+  env.object_width = 16;
+  env.object_height = 16;
+  env.left_width = 4;
+  env.right_width = 4;
+  env.top_height = 24;
+  env.bottom_height = 4;
+  env.title_width = 100;
+  env.title_height = 14;
+  env.frame_x_center = 150;
+  env.frame_y_center = 15;
+  env.mini_icon_width = 16;
+  env.mini_icon_height = 16;
+  env.icon_width = 32;
+  env.icon_height = 32;
+  env.theme = global_theme;
+
+  g_print (_("Theme draw ops have %d coordinate expressions, %d of them compiled\n"),
+           (int) specs->len, n_compiled);
+
+  /* First interpret the tokens, as happens when there is no code,
+   * then run the compiled code.
+   */
+  for (pass = 0; pass < 2; pass++)
+    {
+      GTimer *timer;
+      double elapsed;
+      int val;
+
+      for (i = 0; i < (int) specs->len; i++)
+        ((MetaDrawSpec *) g_ptr_array_index (specs, i))->code =
+          pass == 0 ? NULL : code[i];
+
+      timer = g_timer_new ();
+      for (i = 0; i < EXPRESSION_ITERATIONS; i++)
+        meta_parse_size_expression (g_ptr_array_index (specs, i % specs->len),
+                                    &env, &val, NULL);
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      g_print (_("%s coordinate expressions: %g evaluations per second\n"),
+               pass == 0 ? _("Interpreted") : _("Compiled"),
+               EXPRESSION_ITERATIONS / elapsed);
+    }
+
+  g_free (code);
+  g_ptr_array_free (specs, TRUE);
 
+#undef EXPRESSION_ITERATIONS
 }
-#endif
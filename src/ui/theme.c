@@ -58,8 +58,10 @@
 #include <meta/gradient.h>
 #include <meta/prefs.h>
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <math.h>
 
 #define GDK_COLOR_RGBA(color)                                           \
@@ -1054,6 +1056,56 @@ meta_gradient_spec_render (const MetaGradientSpec *spec,
   return pixbuf;
 }
 
+/* Renders the gradient with its alpha gradient, if any, straight into
+ * an image surface; draws the same pixels as meta_gradient_spec_render()
+ * followed by apply_alpha().
+ */
+static cairo_surface_t*
+gradient_spec_render_surface (const MetaGradientSpec      *spec,
+                              const MetaAlphaGradientSpec *alpha_spec,
+                              GtkStyleContext             *style,
+                              int                          width,
+                              int                          height)
+{
+  int n_colors;
+  GdkRGBA *colors;
+  GSList *tmp;
+  int i;
+  cairo_surface_t *surface;
+  gboolean needs_alpha;
+
+  n_colors = g_slist_length (spec->color_specs);
+
+  if (n_colors == 0)
+    return NULL;
+
+  colors = g_new (GdkRGBA, n_colors);
+
+  i = 0;
+  tmp = spec->color_specs;
+  while (tmp != NULL)
+    {
+      meta_color_spec_render (tmp->data, style, &colors[i]);
+
+      tmp = tmp->next;
+      ++i;
+    }
+
+  needs_alpha = alpha_spec && (alpha_spec->n_alphas > 1 ||
+                               alpha_spec->alphas[0] != 0xff);
+
+  surface = meta_gradient_create_surface (width, height,
+                                          colors, n_colors,
+                                          spec->type,
+                                          needs_alpha ? alpha_spec->alphas : NULL,
+                                          needs_alpha ? alpha_spec->n_alphas : 0,
+                                          needs_alpha ? alpha_spec->type : META_GRADIENT_HORIZONTAL);
+
+  g_free (colors);
+
+  return surface;
+}
+
 gboolean
 meta_gradient_spec_validate (MetaGradientSpec *spec,
                              GError          **error)
@@ -2627,201 +2679,772 @@ pos_eval_helper (PosToken                   *tokens,
   return TRUE;
 }
 
-/*
- *   expr = int | double | expr * expr | expr / expr |
- *          expr + expr | expr - expr | (expr)
- *
- *   so very not worth fooling with bison, yet so very painful by hand.
- */
 /**
- * Evaluates an expression.
- *
- * \param spec  The expression to evaluate.
- * \param env   The environment context to evaluate the expression in.
- * \param[out] val_p  The integer value of the expression; if the expression
- *                    is of type float, this will be rounded. If we return
- *                    FALSE because the expression is invalid, this will be
- *                    zero.
- * \param[out] err    The error, if anything went wrong.
- *
- * \return  True if we evaluated the expression successfully; false otherwise.
- *
- * \bug Shouldn't spec be const?
+ * The instructions of a compiled expression. Operands are on a stack;
+ * the binary operators pop two and push the result. The type of every
+ * operand is known when compiling, so there are separate integer and
+ * floating-point operators, and integers are converted explicitly.
  * \ingroup parser
  */
-static gboolean
-pos_eval (MetaDrawSpec              *spec,
-          const MetaPositionExprEnv *env,
-          int                       *val_p,
-          GError                   **err)
+typedef enum
 {
-  PosExpr expr;
+  POS_CODE_INT,
+  POS_CODE_DOUBLE,
+  POS_CODE_VARIABLE,
+  POS_CODE_OBJECT_VARIABLE,
+  POS_CODE_TO_DOUBLE,
+  POS_CODE_INT_ADD,
+  POS_CODE_INT_SUBTRACT,
+  POS_CODE_INT_MULTIPLY,
+  POS_CODE_INT_DIVIDE,
+  POS_CODE_INT_MOD,
+  POS_CODE_INT_MAX,
+  POS_CODE_INT_MIN,
+  POS_CODE_DOUBLE_ADD,
+  POS_CODE_DOUBLE_SUBTRACT,
+  POS_CODE_DOUBLE_MULTIPLY,
+  POS_CODE_DOUBLE_DIVIDE,
+  POS_CODE_DOUBLE_MAX,
+  POS_CODE_DOUBLE_MIN
+} PosCodeOp;
 
-  *val_p = 0;
+typedef struct
+{
+  PosCodeOp op;
+  union
+  {
+    int int_val;
+    double double_val;
+    /* of the variable's int in MetaPositionExprEnv */
+    int offset;
+  } d;
+} PosInstr;
 
-  if (pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
-    {
-      switch (expr.type)
-        {
-        case POS_EXPR_INT:
-          *val_p = expr.d.int_val;
-          break;
-        case POS_EXPR_DOUBLE:
-          *val_p = expr.d.double_val;
-          break;
-        case POS_EXPR_OPERATOR:
-          g_assert_not_reached ();
-          break;
-        }
-      return TRUE;
-    }
-  else
-    {
-      return FALSE;
-    }
-}
+struct _PosCode
+{
+  gboolean is_double;
+  int n_instrs;
+  PosInstr instrs[1];
+};
 
-/* We always return both X and Y, but only one will be meaningful in
- * most contexts.
+typedef union
+{
+  int int_val;
+  double double_val;
+} PosValue;
+
+/**
+ * The variables pos_eval_get_variable() knows about. The object size
+ * is only defined when the env says so, which is checked at run time.
  */
+static const struct
+{
+  const char *name;
+  int offset;
+  gboolean is_object;
+} pos_variables[] = {
+  { "width", G_STRUCT_OFFSET (MetaPositionExprEnv, rect.width), FALSE },
+  { "height", G_STRUCT_OFFSET (MetaPositionExprEnv, rect.height), FALSE },
+  { "object_width", G_STRUCT_OFFSET (MetaPositionExprEnv, object_width), TRUE },
+  { "object_height", G_STRUCT_OFFSET (MetaPositionExprEnv, object_height), TRUE },
+  { "left_width", G_STRUCT_OFFSET (MetaPositionExprEnv, left_width), FALSE },
+  { "right_width", G_STRUCT_OFFSET (MetaPositionExprEnv, right_width), FALSE },
+  { "top_height", G_STRUCT_OFFSET (MetaPositionExprEnv, top_height), FALSE },
+  { "bottom_height", G_STRUCT_OFFSET (MetaPositionExprEnv, bottom_height), FALSE },
+  { "mini_icon_width", G_STRUCT_OFFSET (MetaPositionExprEnv, mini_icon_width), FALSE },
+  { "mini_icon_height", G_STRUCT_OFFSET (MetaPositionExprEnv, mini_icon_height), FALSE },
+  { "icon_width", G_STRUCT_OFFSET (MetaPositionExprEnv, icon_width), FALSE },
+  { "icon_height", G_STRUCT_OFFSET (MetaPositionExprEnv, icon_height), FALSE },
+  { "title_width", G_STRUCT_OFFSET (MetaPositionExprEnv, title_width), FALSE },
+  { "title_height", G_STRUCT_OFFSET (MetaPositionExprEnv, title_height), FALSE },
+  { "frame_x_center", G_STRUCT_OFFSET (MetaPositionExprEnv, frame_x_center), FALSE },
+  { "frame_y_center", G_STRUCT_OFFSET (MetaPositionExprEnv, frame_y_center), FALSE }
+};
 
 /**
- * meta_parse_position_expression: (skip)
- *
+ * A node of the expression tree built while compiling. Leaves are
+ * constants or variables; constant subtrees are folded into a leaf.
+ * \ingroup parser
  */
-gboolean
-meta_parse_position_expression (MetaDrawSpec              *spec,
-                                const MetaPositionExprEnv *env,
-                                int                       *x_return,
-                                int                       *y_return,
-                                GError                   **err)
+typedef struct
 {
-  /* All positions are in a coordinate system with x, y at the origin.
-   * The expression can have -, +, *, / as operators, floating point
-   * or integer constants, and the variables "width" and "height" and
-   * optionally "object_width" and object_height". Negative numbers
-   * aren't allowed.
-   */
-  int val;
-
-  if (spec->constant)
-    val = spec->value;
-  else
-    {
-      if (pos_eval (spec, env, &spec->value, err) == FALSE)
-        {
-          g_assert (err == NULL || *err != NULL);
-          return FALSE;
-        }
+  PosCodeOp op;
+  PosOperatorType operator;
+  gboolean is_double;
+  /* for POS_CODE_INT, POS_CODE_DOUBLE and the variables */
+  PosInstr leaf;
+  int left;
+  int right;
+} PosNode;
 
-      val = spec->value;
-    }
+static int
+pos_compile_leaf (PosNode        *nodes,
+                  int            *n_nodes,
+                  const PosInstr *leaf,
+                  gboolean        is_double)
+{
+  PosNode *node = &nodes[*n_nodes];
 
-  if (x_return)
-    *x_return = env->rect.x + val;
-  if (y_return)
-    *y_return = env->rect.y + val;
+  node->op = leaf->op;
+  node->operator = POS_OP_NONE;
+  node->is_double = is_double;
+  node->leaf = *leaf;
+  node->left = -1;
+  node->right = -1;
 
-  return TRUE;
+  return (*n_nodes)++;
 }
 
+static gboolean
+pos_node_is_constant (const PosNode *node)
+{
+  return node->op == POS_CODE_INT || node->op == POS_CODE_DOUBLE;
+}
 
 /**
- * meta_parse_size_expression: (skip)
+ * Combines two operands the way do_operation() would, folding them
+ * if both are constant.
  *
+ * \return  the new node, or -1 if the operation always fails.
+ * \ingroup parser
  */
-gboolean
-meta_parse_size_expression (MetaDrawSpec              *spec,
-                            const MetaPositionExprEnv *env,
-                            int                       *val_return,
-                            GError                   **err)
+static int
+pos_compile_operation (PosNode        *nodes,
+                       int            *n_nodes,
+                       int             left,
+                       int             right,
+                       PosOperatorType operator)
 {
-  int val;
+  PosNode *a = &nodes[left];
+  PosNode *b = &nodes[right];
+  gboolean is_double;
+  PosNode *node;
 
-  if (spec->constant)
-    val = spec->value;
-  else 
+  is_double = a->is_double || b->is_double;
+
+  if (is_double && operator == POS_OP_MOD)
+    return -1;
+
+  if (pos_node_is_constant (a) && pos_node_is_constant (b))
     {
-      if (pos_eval (spec, env, &spec->value, err) == FALSE)
+      PosExpr ea, eb;
+      PosInstr folded;
+
+      ea.type = a->is_double ? POS_EXPR_DOUBLE : POS_EXPR_INT;
+      if (a->is_double)
+        ea.d.double_val = a->leaf.d.double_val;
+      else
+        ea.d.int_val = a->leaf.d.int_val;
+
+      eb.type = b->is_double ? POS_EXPR_DOUBLE : POS_EXPR_INT;
+      if (b->is_double)
+        eb.d.double_val = b->leaf.d.double_val;
+      else
+        eb.d.int_val = b->leaf.d.int_val;
+
+      if (!do_operation (&ea, &eb, operator, NULL))
+        return -1;
+
+      if (ea.type == POS_EXPR_DOUBLE)
         {
-          g_assert (err == NULL || *err != NULL);
-          return FALSE;
+          folded.op = POS_CODE_DOUBLE;
+          folded.d.double_val = ea.d.double_val;
+        }
+      else
+        {
+          folded.op = POS_CODE_INT;
+          folded.d.int_val = ea.d.int_val;
         }
 
-      val = spec->value;
+      return pos_compile_leaf (nodes, n_nodes, &folded, is_double);
     }
 
-  if (val_return)
-    *val_return = MAX (val, 1); /* require that sizes be at least 1x1 */
+  node = &nodes[*n_nodes];
+  node->operator = operator;
+  node->is_double = is_double;
+  node->left = left;
+  node->right = right;
 
-  return TRUE;
+  switch (operator)
+    {
+    case POS_OP_ADD:
+      node->op = is_double ? POS_CODE_DOUBLE_ADD : POS_CODE_INT_ADD;
+      break;
+    case POS_OP_SUBTRACT:
+      node->op = is_double ? POS_CODE_DOUBLE_SUBTRACT : POS_CODE_INT_SUBTRACT;
+      break;
+    case POS_OP_MULTIPLY:
+      node->op = is_double ? POS_CODE_DOUBLE_MULTIPLY : POS_CODE_INT_MULTIPLY;
+      break;
+    case POS_OP_DIVIDE:
+      node->op = is_double ? POS_CODE_DOUBLE_DIVIDE : POS_CODE_INT_DIVIDE;
+      break;
+    case POS_OP_MOD:
+      node->op = POS_CODE_INT_MOD;
+      break;
+    case POS_OP_MAX:
+      node->op = is_double ? POS_CODE_DOUBLE_MAX : POS_CODE_INT_MAX;
+      break;
+    case POS_OP_MIN:
+      node->op = is_double ? POS_CODE_DOUBLE_MIN : POS_CODE_INT_MIN;
+      break;
+    case POS_OP_NONE:
+      return -1;
+    }
+
+  return (*n_nodes)++;
 }
 
-/* To do this we tokenize, replace variable tokens
- * that are constants, then reassemble. The purpose
- * here is to optimize expressions so we don't do hash
- * lookups to eval them. Obviously it's a tradeoff that
- * slows down theme load times.
+/**
+ * Builds the expression tree for a sequence of tokens, accepting
+ * exactly the expressions pos_eval_helper() can evaluate without an
+ * error in any environment, except for the errors that depend on the
+ * values of variables.
+ *
+ * \return  the root node, or -1 if the expression can't be compiled.
+ * \ingroup parser
  */
-gboolean
-meta_theme_replace_constants (MetaTheme   *theme,
-                              PosToken    *tokens,
-                              int          n_tokens,
-                              GError     **err)
-{
-  int i;
-  double dval;
-  int ival;
-  gboolean is_constant = TRUE;
-  
-  /* Loop through tokenized string looking for variables to replace */
+static int
+pos_compile_helper (PosToken *tokens,
+                    int       n_tokens,
+                    PosNode  *nodes,
+                    int      *n_nodes)
+{
+  int items[MAX_EXPRS];
+  PosOperatorType operators[MAX_EXPRS];
+  int n_items;
+  int paren_level;
+  int first_paren;
+  int precedence;
+  int i, j;
+
+  first_paren = 0;
+  paren_level = 0;
+  n_items = 0;
   for (i = 0; i < n_tokens; i++)
     {
-      PosToken *t = &tokens[i];      
+      PosToken *t = &tokens[i];
+      PosInstr leaf;
 
-      if (t->type == POS_TOKEN_VARIABLE)
+      if (n_items >= MAX_EXPRS)
+        return -1;
+
+      if (paren_level > 0)
         {
-          if (meta_theme_lookup_int_constant (theme, t->d.v.name, &ival))
-            {
-              g_free (t->d.v.name);
-              t->type = POS_TOKEN_INT;
-              t->d.i.val = ival;
-            }
-          else if (meta_theme_lookup_float_constant (theme, t->d.v.name, &dval))
-            {
-              g_free (t->d.v.name);
-              t->type = POS_TOKEN_DOUBLE;
-              t->d.d.val = dval;
-            }
-          else 
+          if (t->type == POS_TOKEN_OPEN_PAREN)
+            ++paren_level;
+          else if (t->type == POS_TOKEN_CLOSE_PAREN)
             {
-              /* If we've found a variable that cannot be replaced then the
-                 expression is not a constant expression and we want to 
-                 replace it with a GQuark */
-
-              t->d.v.name_quark = g_quark_from_string (t->d.v.name);
-              is_constant = FALSE;
+              if (paren_level == 1)
+                {
+                  items[n_items] = pos_compile_helper (&tokens[first_paren+1],
+                                                       i - first_paren - 1,
+                                                       nodes, n_nodes);
+                  if (items[n_items] < 0)
+                    return -1;
+                  operators[n_items] = POS_OP_NONE;
+                  ++n_items;
+                }
+              --paren_level;
             }
+          continue;
         }
-    }  
 
-  return is_constant;
-}
+      operators[n_items] = POS_OP_NONE;
 
-static int
-parse_x_position_unchecked (MetaDrawSpec              *spec,
-                            const MetaPositionExprEnv *env)
-{
-  int retval;
-  GError *error;
+      switch (t->type)
+        {
+        case POS_TOKEN_INT:
+          leaf.op = POS_CODE_INT;
+          leaf.d.int_val = t->d.i.val;
+          items[n_items++] = pos_compile_leaf (nodes, n_nodes, &leaf, FALSE);
+          break;
 
-  retval = 0;
-  error = NULL;
-  if (!meta_parse_position_expression (spec, env, &retval, NULL, &error))
-    {
-      meta_warning (_("Theme contained an expression that resulted in an error: %s\n"),
-                    error->message);
-      
+        case POS_TOKEN_DOUBLE:
+          leaf.op = POS_CODE_DOUBLE;
+          leaf.d.double_val = t->d.d.val;
+          items[n_items++] = pos_compile_leaf (nodes, n_nodes, &leaf, TRUE);
+          break;
+
+        case POS_TOKEN_OPEN_PAREN:
+          ++paren_level;
+          first_paren = i;
+          break;
+
+        case POS_TOKEN_CLOSE_PAREN:
+          return -1;
+
+        case POS_TOKEN_VARIABLE:
+          for (j = 0; j < (int) G_N_ELEMENTS (pos_variables); j++)
+            if (strcmp (t->d.v.name, pos_variables[j].name) == 0)
+              break;
+
+          if (j == G_N_ELEMENTS (pos_variables))
+            return -1;
+
+          leaf.op = pos_variables[j].is_object ?
+            POS_CODE_OBJECT_VARIABLE : POS_CODE_VARIABLE;
+          leaf.d.offset = pos_variables[j].offset;
+          items[n_items++] = pos_compile_leaf (nodes, n_nodes, &leaf, FALSE);
+          break;
+
+        case POS_TOKEN_OPERATOR:
+          items[n_items] = -1;
+          operators[n_items] = t->d.o.op;
+          ++n_items;
+          break;
+        }
+    }
+
+  if (paren_level > 0 || n_items % 2 == 0)
+    return -1;
+
+  /* Operands and operators have to alternate */
+  for (i = 0; i < n_items; i++)
+    if ((operators[i] != POS_OP_NONE) != (i % 2 == 1))
+      return -1;
+
+  /* Same order of reduction as do_operations() */
+  for (precedence = 2; precedence >= 0; precedence--)
+    {
+      i = 1;
+      while (i < n_items)
+        {
+          gboolean reduce;
+
+          switch (operators[i])
+            {
+            case POS_OP_DIVIDE:
+            case POS_OP_MOD:
+            case POS_OP_MULTIPLY:
+              reduce = precedence == 2;
+              break;
+            case POS_OP_ADD:
+            case POS_OP_SUBTRACT:
+              reduce = precedence == 1;
+              break;
+            default:
+              reduce = precedence == 0;
+              break;
+            }
+
+          if (!reduce)
+            {
+              i += 2;
+              continue;
+            }
+
+          items[i-1] = pos_compile_operation (nodes, n_nodes,
+                                              items[i-1], items[i+1],
+                                              operators[i]);
+          if (items[i-1] < 0)
+            return -1;
+
+          for (j = i + 2; j < n_items; j++)
+            {
+              items[j-2] = items[j];
+              operators[j-2] = operators[j];
+            }
+          n_items -= 2;
+        }
+    }
+
+  g_assert (n_items == 1);
+
+  return items[0];
+}
+
+/**
+ * Appends the postfix code for a subtree.
+ *
+ * \return  how deep the subtree makes the stack.
+ * \ingroup parser
+ */
+static int
+pos_compile_emit (const PosNode *nodes,
+                  int            root,
+                  PosCode       *code)
+{
+  const PosNode *node = &nodes[root];
+  int left_depth, right_depth;
+
+  if (node->left < 0)
+    {
+      code->instrs[code->n_instrs++] = node->leaf;
+      return 1;
+    }
+
+  left_depth = pos_compile_emit (nodes, node->left, code);
+  if (node->is_double && !nodes[node->left].is_double)
+    code->instrs[code->n_instrs++].op = POS_CODE_TO_DOUBLE;
+
+  right_depth = pos_compile_emit (nodes, node->right, code);
+  if (node->is_double && !nodes[node->right].is_double)
+    code->instrs[code->n_instrs++].op = POS_CODE_TO_DOUBLE;
+
+  code->instrs[code->n_instrs++].op = node->op;
+
+  return MAX (left_depth, right_depth + 1);
+}
+
+/**
+ * Compiles an expression, after meta_theme_replace_constants() has
+ * replaced the constants in it.
+ *
+ * \return  the code, or NULL if the expression is invalid or too deep;
+ *          it is left to pos_eval_helper() to report the error then.
+ * \ingroup parser
+ */
+static PosCode *
+pos_compile (PosToken *tokens,
+             int       n_tokens)
+{
+  PosNode *nodes;
+  int n_nodes;
+  int root;
+  PosCode *code;
+
+  if (n_tokens == 0)
+    return NULL;
+
+  nodes = g_new (PosNode, n_tokens);
+  n_nodes = 0;
+
+  root = pos_compile_helper (tokens, n_tokens, nodes, &n_nodes);
+  if (root < 0)
+    {
+      g_free (nodes);
+      return NULL;
+    }
+
+  /* Every node may be followed by a conversion */
+  code = g_malloc (G_STRUCT_OFFSET (PosCode, instrs) +
+                   sizeof (PosInstr) * 2 * n_nodes);
+  code->is_double = nodes[root].is_double;
+  code->n_instrs = 0;
+
+  if (pos_compile_emit (nodes, root, code) > MAX_EXPRS)
+    {
+      g_free (code);
+      code = NULL;
+    }
+
+  g_free (nodes);
+
+  return code;
+}
+
+/**
+ * Runs compiled code.
+ *
+ * \return  FALSE if the expression failed in this environment, in which
+ *          case it should be interpreted to find out why.
+ * \ingroup parser
+ */
+static gboolean
+pos_code_run (const PosCode             *code,
+              const MetaPositionExprEnv *env,
+              int                       *val_p)
+{
+  PosValue stack[MAX_EXPRS];
+  const PosInstr *instr;
+  const PosInstr *end;
+  int sp;
+
+  sp = -1;
+  end = code->instrs + code->n_instrs;
+  for (instr = code->instrs; instr < end; instr++)
+    {
+      switch (instr->op)
+        {
+        case POS_CODE_INT:
+          stack[++sp].int_val = instr->d.int_val;
+          break;
+        case POS_CODE_DOUBLE:
+          stack[++sp].double_val = instr->d.double_val;
+          break;
+        case POS_CODE_VARIABLE:
+          stack[++sp].int_val = G_STRUCT_MEMBER (int, env, instr->d.offset);
+          break;
+        case POS_CODE_OBJECT_VARIABLE:
+          stack[++sp].int_val = G_STRUCT_MEMBER (int, env, instr->d.offset);
+          if (stack[sp].int_val < 0)
+            return FALSE;
+          break;
+        case POS_CODE_TO_DOUBLE:
+          stack[sp].double_val = stack[sp].int_val;
+          break;
+
+        case POS_CODE_INT_ADD:
+          stack[sp-1].int_val = stack[sp-1].int_val + stack[sp].int_val;
+          --sp;
+          break;
+        case POS_CODE_INT_SUBTRACT:
+          stack[sp-1].int_val = stack[sp-1].int_val - stack[sp].int_val;
+          --sp;
+          break;
+        case POS_CODE_INT_MULTIPLY:
+          stack[sp-1].int_val = stack[sp-1].int_val * stack[sp].int_val;
+          --sp;
+          break;
+        case POS_CODE_INT_DIVIDE:
+          if (stack[sp].int_val == 0)
+            return FALSE;
+          stack[sp-1].int_val = stack[sp-1].int_val / stack[sp].int_val;
+          --sp;
+          break;
+        case POS_CODE_INT_MOD:
+          if (stack[sp].int_val == 0)
+            return FALSE;
+          stack[sp-1].int_val = stack[sp-1].int_val % stack[sp].int_val;
+          --sp;
+          break;
+        case POS_CODE_INT_MAX:
+          stack[sp-1].int_val = MAX (stack[sp-1].int_val, stack[sp].int_val);
+          --sp;
+          break;
+        case POS_CODE_INT_MIN:
+          stack[sp-1].int_val = MIN (stack[sp-1].int_val, stack[sp].int_val);
+          --sp;
+          break;
+
+        case POS_CODE_DOUBLE_ADD:
+          stack[sp-1].double_val = stack[sp-1].double_val + stack[sp].double_val;
+          --sp;
+          break;
+        case POS_CODE_DOUBLE_SUBTRACT:
+          stack[sp-1].double_val = stack[sp-1].double_val - stack[sp].double_val;
+          --sp;
+          break;
+        case POS_CODE_DOUBLE_MULTIPLY:
+          stack[sp-1].double_val = stack[sp-1].double_val * stack[sp].double_val;
+          --sp;
+          break;
+        case POS_CODE_DOUBLE_DIVIDE:
+          if (stack[sp].double_val == 0.0)
+            return FALSE;
+          stack[sp-1].double_val = stack[sp-1].double_val / stack[sp].double_val;
+          --sp;
+          break;
+        case POS_CODE_DOUBLE_MAX:
+          stack[sp-1].double_val = MAX (stack[sp-1].double_val, stack[sp].double_val);
+          --sp;
+          break;
+        case POS_CODE_DOUBLE_MIN:
+          stack[sp-1].double_val = MIN (stack[sp-1].double_val, stack[sp].double_val);
+          --sp;
+          break;
+        }
+    }
+
+  g_assert (sp == 0);
+
+  if (code->is_double)
+    *val_p = stack[0].double_val;
+  else
+    *val_p = stack[0].int_val;
+
+  return TRUE;
+}
+
+/*
+ *   expr = int | double | expr * expr | expr / expr |
+ *          expr + expr | expr - expr | (expr)
+ *
+ *   so very not worth fooling with bison, yet so very painful by hand.
+ */
+/**
+ * Evaluates an expression.
+ *
+ * \param spec  The expression to evaluate.
+ * \param env   The environment context to evaluate the expression in.
+ * \param[out] val_p  The integer value of the expression; if the expression
+ *                    is of type float, this will be rounded. If we return
+ *                    FALSE because the expression is invalid, this will be
+ *                    zero.
+ * \param[out] err    The error, if anything went wrong.
+ *
+ * \return  True if we evaluated the expression successfully; false otherwise.
+ *
+ * \bug Shouldn't spec be const?
+ * \ingroup parser
+ */
+static gboolean
+pos_eval (MetaDrawSpec              *spec,
+          const MetaPositionExprEnv *env,
+          int                       *val_p,
+          GError                   **err)
+{
+  PosExpr expr;
+
+  if (spec->code && pos_code_run (spec->code, env, val_p))
+    return TRUE;
+
+  *val_p = 0;
+
+  if (pos_eval_helper (spec->tokens, spec->n_tokens, env, &expr, err))
+    {
+      switch (expr.type)
+        {
+        case POS_EXPR_INT:
+          *val_p = expr.d.int_val;
+          break;
+        case POS_EXPR_DOUBLE:
+          *val_p = expr.d.double_val;
+          break;
+        case POS_EXPR_OPERATOR:
+          g_assert_not_reached ();
+          break;
+        }
+      return TRUE;
+    }
+  else
+    {
+      return FALSE;
+    }
+}
+
+/* We always return both X and Y, but only one will be meaningful in
+ * most contexts.
+ */
+
+/**
+ * meta_parse_position_expression: (skip)
+ *
+ */
+gboolean
+meta_parse_position_expression (MetaDrawSpec              *spec,
+                                const MetaPositionExprEnv *env,
+                                int                       *x_return,
+                                int                       *y_return,
+                                GError                   **err)
+{
+  /* All positions are in a coordinate system with x, y at the origin.
+   * The expression can have -, +, *, / as operators, floating point
+   * or integer constants, and the variables "width" and "height" and
+   * optionally "object_width" and object_height". Negative numbers
+   * aren't allowed.
+   */
+  int val;
+
+  if (spec->constant)
+    val = spec->value;
+  else
+    {
+      if (pos_eval (spec, env, &spec->value, err) == FALSE)
+        {
+          g_assert (err == NULL || *err != NULL);
+          return FALSE;
+        }
+
+      val = spec->value;
+    }
+
+  if (x_return)
+    *x_return = env->rect.x + val;
+  if (y_return)
+    *y_return = env->rect.y + val;
+
+  return TRUE;
+}
+
+
+/**
+ * meta_parse_size_expression: (skip)
+ *
+ */
+gboolean
+meta_parse_size_expression (MetaDrawSpec              *spec,
+                            const MetaPositionExprEnv *env,
+                            int                       *val_return,
+                            GError                   **err)
+{
+  int val;
+
+  if (spec->constant)
+    val = spec->value;
+  else 
+    {
+      if (pos_eval (spec, env, &spec->value, err) == FALSE)
+        {
+          g_assert (err == NULL || *err != NULL);
+          return FALSE;
+        }
+
+      val = spec->value;
+    }
+
+  if (val_return)
+    *val_return = MAX (val, 1); /* require that sizes be at least 1x1 */
+
+  return TRUE;
+}
+
+/* To do this we tokenize, replace variable tokens
+ * that are constants, then reassemble. The purpose
+ * here is to optimize expressions so we don't do hash
+ * lookups to eval them. Obviously it's a tradeoff that
+ * slows down theme load times.
+ */
+gboolean
+meta_theme_replace_constants (MetaTheme   *theme,
+                              PosToken    *tokens,
+                              int          n_tokens,
+                              GError     **err)
+{
+  int i;
+  double dval;
+  int ival;
+  gboolean is_constant = TRUE;
+  
+  /* Loop through tokenized string looking for variables to replace */
+  for (i = 0; i < n_tokens; i++)
+    {
+      PosToken *t = &tokens[i];      
+
+      if (t->type == POS_TOKEN_VARIABLE)
+        {
+          if (meta_theme_lookup_int_constant (theme, t->d.v.name, &ival))
+            {
+              g_free (t->d.v.name);
+              t->type = POS_TOKEN_INT;
+              t->d.i.val = ival;
+            }
+          else if (meta_theme_lookup_float_constant (theme, t->d.v.name, &dval))
+            {
+              g_free (t->d.v.name);
+              t->type = POS_TOKEN_DOUBLE;
+              t->d.d.val = dval;
+            }
+          else 
+            {
+              /* If we've found a variable that cannot be replaced then the
+                 expression is not a constant expression and we want to 
+                 replace it with a GQuark */
+
+              t->d.v.name_quark = g_quark_from_string (t->d.v.name);
+              is_constant = FALSE;
+            }
+        }
+    }  
+
+  return is_constant;
+}
+
+static int
+parse_x_position_unchecked (MetaDrawSpec              *spec,
+                            const MetaPositionExprEnv *env)
+{
+  int retval;
+  GError *error;
+
+  retval = 0;
+  error = NULL;
+  if (!meta_parse_position_expression (spec, env, &retval, NULL, &error))
+    {
+      meta_warning (_("Theme contained an expression that resulted in an error: %s\n"),
+                    error->message);
+      
       g_error_free (error);
     }
   
@@ -2873,6 +3496,7 @@ meta_draw_spec_free (MetaDrawSpec *spec)
 {
   if (!spec) return;
   free_tokens (spec->tokens, spec->n_tokens);
+  g_free (spec->code);
   g_slice_free (MetaDrawSpec, spec);
 }
 
@@ -2904,6 +3528,8 @@ meta_draw_spec_new (MetaTheme  *theme,
           return NULL;
         }
     }
+  else
+    spec->code = pos_compile (spec->tokens, spec->n_tokens);
     
   return spec;
 }
@@ -3397,6 +4023,275 @@ scale_and_alpha_pixbuf (GdkPixbuf             *src,
   return pixbuf;
 }
 
+/* The results of scale_and_alpha_pixbuf() are kept as cairo surfaces,
+ * so redrawing a frame (or each of the pieces frames.c renders it in)
+ * doesn't rescale and convert the same images over and over.  Entries
+ * hold a reference on their source pixbuf and a copy of the alpha
+ * values, so they can't be confused with a new image or spec that
+ * happens to get the same address.
+ */
+#define MAX_SCALED_IMAGES 32
+#define MAX_SCALED_IMAGE_PIXELS (2048 * 1024)
+
+typedef struct
+{
+  GdkPixbuf *src;
+  int width;
+  int height;
+  MetaImageFillType fill_type;
+  gboolean vertical_stripes;
+  gboolean horizontal_stripes;
+  MetaGradientType alpha_type;
+  int n_alphas; /* 0 if no alpha is applied */
+  guchar *alphas;
+
+  cairo_surface_t *surface;
+} MetaScaledImage;
+
+/* Most recently used first */
+static GList *scaled_images = NULL;
+static int scaled_image_pixels = 0;
+
+static void
+scaled_image_free (MetaScaledImage *image)
+{
+  scaled_image_pixels -= image->width * image->height;
+
+  g_object_unref (G_OBJECT (image->src));
+  g_free (image->alphas);
+  cairo_surface_destroy (image->surface);
+
+  g_free (image);
+}
+
+static void
+flush_scaled_images (void)
+{
+  g_list_foreach (scaled_images, (GFunc) scaled_image_free, NULL);
+  g_list_free (scaled_images);
+  scaled_images = NULL;
+}
+
+static cairo_surface_t*
+surface_from_pixbuf (GdkPixbuf *pixbuf)
+{
+  cairo_surface_t *surface;
+  cairo_t *cr;
+
+  surface = cairo_image_surface_create (gdk_pixbuf_get_has_alpha (pixbuf) ?
+                                        CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+                                        gdk_pixbuf_get_width (pixbuf),
+                                        gdk_pixbuf_get_height (pixbuf));
+
+  cr = cairo_create (surface);
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  return surface;
+}
+
+/* Returns a new reference to a surface holding what
+ * scale_and_alpha_pixbuf() would return for these arguments.
+ */
+static cairo_surface_t*
+scale_and_alpha_surface (GdkPixbuf             *src,
+                         MetaAlphaGradientSpec *alpha_spec,
+                         MetaImageFillType      fill_type,
+                         int                    width,
+                         int                    height,
+                         gboolean               vertical_stripes,
+                         gboolean               horizontal_stripes)
+{
+  MetaScaledImage *image;
+  GdkPixbuf *pixbuf;
+  cairo_surface_t *surface;
+  gboolean needs_alpha;
+  GList *l;
+
+  if (width <= 0 || height <= 0)
+    return NULL;
+
+  needs_alpha = alpha_spec && (alpha_spec->n_alphas > 1 ||
+                               alpha_spec->alphas[0] != 0xff);
+
+  for (l = scaled_images; l != NULL; l = l->next)
+    {
+      image = l->data;
+
+      if (image->src == src &&
+          image->width == width &&
+          image->height == height &&
+          image->fill_type == fill_type &&
+          image->vertical_stripes == vertical_stripes &&
+          image->horizontal_stripes == horizontal_stripes &&
+          (needs_alpha ?
+           (image->alpha_type == alpha_spec->type &&
+            image->n_alphas == alpha_spec->n_alphas &&
+            memcmp (image->alphas, alpha_spec->alphas,
+                    alpha_spec->n_alphas) == 0) :
+           image->n_alphas == 0))
+        {
+          if (l != scaled_images)
+            {
+              scaled_images = g_list_remove_link (scaled_images, l);
+              scaled_images = g_list_concat (l, scaled_images);
+            }
+
+          return cairo_surface_reference (image->surface);
+        }
+    }
+
+  pixbuf = scale_and_alpha_pixbuf (src, alpha_spec, fill_type,
+                                   width, height,
+                                   vertical_stripes, horizontal_stripes);
+  if (pixbuf == NULL)
+    return NULL;
+
+  surface = surface_from_pixbuf (pixbuf);
+  g_object_unref (G_OBJECT (pixbuf));
+
+  if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (surface);
+      return NULL;
+    }
+
+  /* Don't let one huge image push out everything else */
+  if (width * height > MAX_SCALED_IMAGE_PIXELS / 4)
+    return surface;
+
+  image = g_new0 (MetaScaledImage, 1);
+  image->src = g_object_ref (G_OBJECT (src));
+  image->width = width;
+  image->height = height;
+  image->fill_type = fill_type;
+  image->vertical_stripes = vertical_stripes;
+  image->horizontal_stripes = horizontal_stripes;
+  if (needs_alpha)
+    {
+      image->alpha_type = alpha_spec->type;
+      image->n_alphas = alpha_spec->n_alphas;
+      image->alphas = g_memdup (alpha_spec->alphas, alpha_spec->n_alphas);
+    }
+  image->surface = cairo_surface_reference (surface);
+
+  scaled_images = g_list_prepend (scaled_images, image);
+  scaled_image_pixels += width * height;
+
+  while (g_list_length (scaled_images) > MAX_SCALED_IMAGES ||
+         scaled_image_pixels > MAX_SCALED_IMAGE_PIXELS)
+    {
+      l = g_list_last (scaled_images);
+
+      scaled_image_free (l->data);
+      scaled_images = g_list_delete_link (scaled_images, l);
+    }
+
+  return surface;
+}
+
+/* Paints @src at (x, y) scaled, tiled or striped to width x height */
+static void
+paint_scaled_image (cairo_t               *cr,
+                    GdkPixbuf             *src,
+                    MetaAlphaGradientSpec *alpha_spec,
+                    MetaImageFillType      fill_type,
+                    int                    x,
+                    int                    y,
+                    int                    width,
+                    int                    height,
+                    gboolean               vertical_stripes,
+                    gboolean               horizontal_stripes)
+{
+  cairo_surface_t *surface;
+  gboolean needs_alpha;
+
+  needs_alpha = alpha_spec && (alpha_spec->n_alphas > 1 ||
+                               alpha_spec->alphas[0] != 0xff);
+
+  /* Tiles are painted by repeating the image itself rather than
+   * building a copy tiled to the full size; that is only possible
+   * without an alpha gradient, which spans the whole area.
+   */
+  if (fill_type == META_IMAGE_FILL_TILE && !needs_alpha &&
+      width > 0 && height > 0)
+    {
+      surface = scale_and_alpha_surface (src, NULL, fill_type,
+                                         gdk_pixbuf_get_width (src),
+                                         gdk_pixbuf_get_height (src),
+                                         FALSE, FALSE);
+      if (surface == NULL)
+        return;
+
+      cairo_save (cr);
+      cairo_set_source_surface (cr, surface, x, y);
+      cairo_pattern_set_extend (cairo_get_source (cr), CAIRO_EXTEND_REPEAT);
+      cairo_rectangle (cr, x, y, width, height);
+      cairo_fill (cr);
+      cairo_restore (cr);
+
+      cairo_surface_destroy (surface);
+      return;
+    }
+
+  surface = scale_and_alpha_surface (src, alpha_spec, fill_type,
+                                     width, height,
+                                     vertical_stripes, horizontal_stripes);
+  if (surface == NULL)
+    return;
+
+  cairo_set_source_surface (cr, surface, x, y);
+  cairo_paint (cr);
+
+  cairo_surface_destroy (surface);
+}
+
+/* The image an image draw op draws, colorized if it asks for it */
+static GdkPixbuf*
+image_op_source (const MetaDrawOp *op,
+                 GtkStyleContext  *context)
+{
+  GdkRGBA color;
+
+  if (!op->data.image.colorize_spec)
+    return op->data.image.pixbuf;
+
+  meta_color_spec_render (op->data.image.colorize_spec,
+                          context, &color);
+
+  if (op->data.image.colorize_cache_pixbuf == NULL ||
+      op->data.image.colorize_cache_pixel != GDK_COLOR_RGB (color))
+    {
+      if (op->data.image.colorize_cache_pixbuf)
+        g_object_unref (G_OBJECT (op->data.image.colorize_cache_pixbuf));
+
+      /* const cast here */
+      ((MetaDrawOp*)op)->data.image.colorize_cache_pixbuf =
+        colorize_pixbuf (op->data.image.pixbuf,
+                         &color);
+      ((MetaDrawOp*)op)->data.image.colorize_cache_pixel =
+        GDK_COLOR_RGB (color);
+    }
+
+  return op->data.image.colorize_cache_pixbuf;
+}
+
+/* The window icon an icon draw op of the given size draws */
+static GdkPixbuf*
+icon_op_source (const MetaDrawInfo *info,
+                int                 width,
+                int                 height)
+{
+  if (info->mini_icon &&
+      width <= gdk_pixbuf_get_width (info->mini_icon) &&
+      height <= gdk_pixbuf_get_height (info->mini_icon))
+    return info->mini_icon;
+  else
+    return info->icon;
+}
+
 static GdkPixbuf*
 draw_op_as_pixbuf (const MetaDrawOp    *op,
                    GtkStyleContext     *context,
@@ -3501,46 +4396,17 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
       
     case META_DRAW_IMAGE:
       {
-	if (op->data.image.colorize_spec)
-	  {
-	    GdkRGBA color;
+        GdkPixbuf *src;
 
-            meta_color_spec_render (op->data.image.colorize_spec,
-                                    context, &color);
-            
-            if (op->data.image.colorize_cache_pixbuf == NULL ||
-                op->data.image.colorize_cache_pixel != GDK_COLOR_RGB (color))
-              {
-                if (op->data.image.colorize_cache_pixbuf)
-                  g_object_unref (G_OBJECT (op->data.image.colorize_cache_pixbuf));
-                
-                /* const cast here */
-                ((MetaDrawOp*)op)->data.image.colorize_cache_pixbuf =
-                  colorize_pixbuf (op->data.image.pixbuf,
-                                   &color);
-                ((MetaDrawOp*)op)->data.image.colorize_cache_pixel =
-                  GDK_COLOR_RGB (color);
-              }
-            
-            if (op->data.image.colorize_cache_pixbuf)
-              {
-                pixbuf = scale_and_alpha_pixbuf (op->data.image.colorize_cache_pixbuf,
-                                                 op->data.image.alpha_spec,
-                                                 op->data.image.fill_type,
-                                                 width, height,
-                                                 op->data.image.vertical_stripes,
-                                                 op->data.image.horizontal_stripes);
-              }
-	  }
-	else
-	  {
-	    pixbuf = scale_and_alpha_pixbuf (op->data.image.pixbuf,
-                                             op->data.image.alpha_spec,
-                                             op->data.image.fill_type,
-                                             width, height,
-                                             op->data.image.vertical_stripes,
-                                             op->data.image.horizontal_stripes);
-	  }
+        src = image_op_source (op, context);
+
+        if (src)
+          pixbuf = scale_and_alpha_pixbuf (src,
+                                           op->data.image.alpha_spec,
+                                           op->data.image.fill_type,
+                                           width, height,
+                                           op->data.image.vertical_stripes,
+                                           op->data.image.horizontal_stripes);
         break;
       }
       
@@ -3550,20 +4416,18 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
       break;
 
     case META_DRAW_ICON:
-      if (info->mini_icon &&
-          width <= gdk_pixbuf_get_width (info->mini_icon) &&
-          height <= gdk_pixbuf_get_height (info->mini_icon))
-        pixbuf = scale_and_alpha_pixbuf (info->mini_icon,
-                                         op->data.icon.alpha_spec,
-                                         op->data.icon.fill_type,
-                                         width, height,
-                                         FALSE, FALSE);
-      else if (info->icon)
-        pixbuf = scale_and_alpha_pixbuf (info->icon,
-                                         op->data.icon.alpha_spec,
-                                         op->data.icon.fill_type,
-                                         width, height,
-                                         FALSE, FALSE);
+      {
+        GdkPixbuf *src;
+
+        src = icon_op_source (info, width, height);
+
+        if (src)
+          pixbuf = scale_and_alpha_pixbuf (src,
+                                           op->data.icon.alpha_spec,
+                                           op->data.icon.fill_type,
+                                           width, height,
+                                           FALSE, FALSE);
+      }
       break;
 
     case META_DRAW_TITLE:
@@ -3579,6 +4443,112 @@ draw_op_as_pixbuf (const MetaDrawOp    *op,
   return pixbuf;
 }
 
+/* Ellipsizing a title means laying it out again at the new width, and
+ * the same title is usually drawn at the same few widths (focused and
+ * unfocused, maximized and not), so the ellipsized copies are kept on
+ * the layout they were made from, most recently used first.
+ */
+#define MAX_ELLIPSIZED_TITLES 4
+
+typedef struct
+{
+  int width;
+  PangoLayout *layout;
+} EllipsizedTitle;
+
+static void
+free_ellipsized_titles (gpointer data)
+{
+  GList *titles = data;
+  GList *l;
+
+  for (l = titles; l != NULL; l = l->next)
+    {
+      EllipsizedTitle *title = l->data;
+
+      g_object_unref (G_OBJECT (title->layout));
+      g_free (title);
+    }
+
+  g_list_free (titles);
+}
+
+static gboolean
+ellipsized_title_matches (PangoLayout *copy,
+                          PangoLayout *layout)
+{
+  const PangoFontDescription *copy_desc, *desc;
+
+  /* The layout may have been given new text or a new font since
+   * the copy was made.
+   */
+  if (strcmp (pango_layout_get_text (copy),
+              pango_layout_get_text (layout)) != 0)
+    return FALSE;
+
+  copy_desc = pango_layout_get_font_description (copy);
+  desc = pango_layout_get_font_description (layout);
+
+  if (copy_desc == NULL || desc == NULL)
+    return copy_desc == desc;
+
+  return pango_font_description_equal (copy_desc, desc);
+}
+
+static PangoLayout *
+get_ellipsized_title (PangoLayout *layout,
+                      int          width)
+{
+  GList *titles;
+  GList *l;
+  EllipsizedTitle *title;
+
+  titles = g_object_steal_data (G_OBJECT (layout), "meta-ellipsized-titles");
+
+  for (l = titles; l != NULL; l = l->next)
+    {
+      title = l->data;
+
+      if (title->width == width)
+        break;
+    }
+
+  if (l != NULL && !ellipsized_title_matches (title->layout, layout))
+    {
+      free_ellipsized_titles (titles);
+      titles = NULL;
+      l = NULL;
+    }
+
+  if (l != NULL)
+    {
+      titles = g_list_remove_link (titles, l);
+      titles = g_list_concat (l, titles);
+    }
+  else
+    {
+      title = g_new (EllipsizedTitle, 1);
+      title->width = width;
+      title->layout = pango_layout_copy (layout);
+      pango_layout_set_width (title->layout, PANGO_SCALE * width);
+
+      titles = g_list_prepend (titles, title);
+
+      l = g_list_nth (titles, MAX_ELLIPSIZED_TITLES);
+      if (l != NULL)
+        {
+          l->prev->next = NULL;
+          l->prev = NULL;
+          free_ellipsized_titles (l);
+        }
+    }
+
+  g_object_set_data_full (G_OBJECT (layout), "meta-ellipsized-titles",
+                          titles, free_ellipsized_titles);
+
+  return title->layout;
+}
+
 static void
 fill_env (MetaPositionExprEnv *env,
           const MetaDrawInfo  *info,
@@ -3841,22 +4811,23 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
     case META_DRAW_GRADIENT:
       {
         int rx, ry, rwidth, rheight;
-        GdkPixbuf *pixbuf;
+        cairo_surface_t *surface;
 
         rx = parse_x_position_unchecked (op->data.gradient.x, env);
         ry = parse_y_position_unchecked (op->data.gradient.y, env);
         rwidth = parse_size_unchecked (op->data.gradient.width, env);
         rheight = parse_size_unchecked (op->data.gradient.height, env);
 
-        pixbuf = draw_op_as_pixbuf (op, style_gtk, info,
-                                    rwidth, rheight);
+        surface = gradient_spec_render_surface (op->data.gradient.gradient_spec,
+                                                op->data.gradient.alpha_spec,
+                                                style_gtk, rwidth, rheight);
 
-        if (pixbuf)
+        if (surface)
           {
-            gdk_cairo_set_source_pixbuf (cr, pixbuf, rx, ry);
+            cairo_set_source_surface (cr, surface, rx, ry);
             cairo_paint (cr);
 
-            g_object_unref (G_OBJECT (pixbuf));
+            cairo_surface_destroy (surface);
           }
       }
       break;
@@ -3864,7 +4835,7 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
     case META_DRAW_IMAGE:
       {
         int rx, ry, rwidth, rheight;
-        GdkPixbuf *pixbuf;
+        GdkPixbuf *src;
 
         if (op->data.image.pixbuf)
           {
@@ -3875,18 +4846,19 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
         rwidth = parse_size_unchecked (op->data.image.width, env);
         rheight = parse_size_unchecked (op->data.image.height, env);
         
-        pixbuf = draw_op_as_pixbuf (op, style_gtk, info,
-                                    rwidth, rheight);
+        src = image_op_source (op, style_gtk);
 
-        if (pixbuf)
+        if (src)
           {
             rx = parse_x_position_unchecked (op->data.image.x, env);
-            ry = parse_y_position_unchecked (op->data.image.y, env);
-
-            gdk_cairo_set_source_pixbuf (cr, pixbuf, rx, ry);
-            cairo_paint (cr);
+            ry = parse_y_position_unchecked (op->data.image.y, env);
 
-            g_object_unref (G_OBJECT (pixbuf));
+            paint_scaled_image (cr, src,
+                                op->data.image.alpha_spec,
+                                op->data.image.fill_type,
+                                rx, ry, rwidth, rheight,
+                                op->data.image.vertical_stripes,
+                                op->data.image.horizontal_stripes);
           }
       }
       break;
@@ -3957,23 +4929,23 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
     case META_DRAW_ICON:
       {
         int rx, ry, rwidth, rheight;
-        GdkPixbuf *pixbuf;
+        GdkPixbuf *src;
 
         rwidth = parse_size_unchecked (op->data.icon.width, env);
         rheight = parse_size_unchecked (op->data.icon.height, env);
         
-        pixbuf = draw_op_as_pixbuf (op, style_gtk, info,
-                                    rwidth, rheight);
+        src = icon_op_source (info, rwidth, rheight);
 
-        if (pixbuf)
+        if (src)
           {
             rx = parse_x_position_unchecked (op->data.icon.x, env);
             ry = parse_y_position_unchecked (op->data.icon.y, env);
 
-            gdk_cairo_set_source_pixbuf (cr, pixbuf, rx, ry);
-            cairo_paint (cr);
-
-            g_object_unref (G_OBJECT (pixbuf));
+            paint_scaled_image (cr, src,
+                                op->data.icon.alpha_spec,
+                                op->data.icon.fill_type,
+                                rx, ry, rwidth, rheight,
+                                FALSE, FALSE);
           }
       }
       break;
@@ -3983,6 +4955,7 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
         {
           int rx, ry;
           PangoRectangle ink_rect, logical_rect;
+          PangoLayout *title_layout = info->title_layout;
 
           meta_color_spec_render (op->data.title.color_spec,
                                   style_gtk, &color);
@@ -4000,7 +4973,6 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
               /* HACK: parse_x_position_unchecked adds in env->rect.x, subtract out again */
               ellipsize_width -= env->rect.x;
 
-              pango_layout_set_width (info->title_layout, -1);
               pango_layout_get_pixel_extents (info->title_layout,
                                               &ink_rect, &logical_rect);
 
@@ -4016,20 +4988,17 @@ meta_draw_op_draw_with_env (const MetaDrawOp    *op,
               ellipsize_width -= right_bearing;
               ellipsize_width = MAX (ellipsize_width, 0);
 
-              /* Only ellipsizing when necessary is a performance optimization -
-               * pango_layout_set_width() will force a relayout if it isn't the
-               * same as the current width of -1.
+              /* Only ellipsizing when necessary is a performance optimization;
+               * the ellipsized copies are kept, so the title layout itself
+               * is never relaid out.
                */
               if (ellipsize_width < logical_rect.width)
-                pango_layout_set_width (info->title_layout, PANGO_SCALE * ellipsize_width);
+                title_layout = get_ellipsized_title (info->title_layout,
+                                                     ellipsize_width);
             }
 
           cairo_move_to (cr, rx, ry);
-          pango_cairo_show_layout (cr, info->title_layout);
-
-          /* Remove any ellipsization we might have set; will short-circuit
-           * if the width is already -1 */
-          pango_layout_set_width (info->title_layout, -1);
+          pango_cairo_show_layout (cr, title_layout);
         }
       break;
 
@@ -4312,6 +5281,69 @@ meta_draw_op_list_contains (MetaDrawOpList    *op_list,
   return FALSE;
 }
 
+/* A frame drawn by meta_frame_style_draw_with_style(), recorded along
+ * with everything the drawing depended on.
+ */
+typedef struct
+{
+  guint serial;
+  GtkStyleContext *style_gtk;
+  MetaFrameGeometry fgeom;
+  MetaButtonState button_states[META_BUTTON_TYPE_LAST];
+
+  PangoContext *title_context;
+  char *title;
+  PangoFontDescription *title_font;
+  int title_width;
+  int title_height;
+
+  /* The icons themselves only matter if the style draws them;
+   * otherwise only their sizes can make a difference.
+   */
+  gboolean uses_icons;
+  GdkPixbuf *mini_icon;
+  GdkPixbuf *icon;
+  int mini_icon_width;
+  int mini_icon_height;
+  int icon_width;
+  int icon_height;
+
+  cairo_surface_t *recording;
+} MetaDrawPlan;
+
+/* Enough for the sizes a style is typically on screen at */
+#define MAX_DRAW_PLANS 8
+
+/* Bumped to throw away all the plans when the GTK+ style changes */
+static guint draw_plan_serial = 0;
+
+static void
+draw_plan_free (MetaDrawPlan *plan)
+{
+  g_object_unref (plan->style_gtk);
+  if (plan->title_context)
+    g_object_unref (plan->title_context);
+  g_free (plan->title);
+  if (plan->title_font)
+    pango_font_description_free (plan->title_font);
+  if (plan->mini_icon)
+    g_object_unref (plan->mini_icon);
+  if (plan->icon)
+    g_object_unref (plan->icon);
+  cairo_surface_destroy (plan->recording);
+  g_free (plan);
+}
+
+/**
+ * Forgets all recorded frame drawings, for when something they don't
+ * keep track of has changed, such as the colors of the GTK+ theme.
+ */
+void
+meta_theme_invalidate_draw_plans (void)
+{
+  draw_plan_serial += 1;
+}
+
 /**
  * Constructor for a MetaFrameStyle.
  *
@@ -4389,6 +5421,9 @@ meta_frame_style_unref (MetaFrameStyle *style)
       if (style->window_background_color)
         meta_color_spec_free (style->window_background_color);
 
+      g_list_foreach (style->draw_plans, (GFunc) draw_plan_free, NULL);
+      g_list_free (style->draw_plans);
+
       /* we hold a reference to any parent style */
       if (style->parent)
         meta_frame_style_unref (style->parent);
@@ -4628,19 +5663,16 @@ button_rect (MetaButtonType           type,
     }
 }
 
-void
-meta_frame_style_draw_with_style (MetaFrameStyle          *style,
-                                  GtkStyleContext         *style_gtk,
-                                  GtkWidget               *widget,
-                                  cairo_t                 *cr,
-                                  const MetaFrameGeometry *fgeom,
-                                  int                      client_width,
-                                  int                      client_height,
-                                  PangoLayout             *title_layout,
-                                  int                      text_height,
-                                  MetaButtonState          button_states[META_BUTTON_TYPE_LAST],
-                                  GdkPixbuf               *mini_icon,
-                                  GdkPixbuf               *icon)
+static void
+frame_style_draw_pieces (MetaFrameStyle          *style,
+                         GtkStyleContext         *style_gtk,
+                         GtkWidget               *widget,
+                         cairo_t                 *cr,
+                         const MetaFrameGeometry *fgeom,
+                         PangoLayout             *title_layout,
+                         MetaButtonState          button_states[META_BUTTON_TYPE_LAST],
+                         GdkPixbuf               *mini_icon,
+                         GdkPixbuf               *icon)
 {
   int i, j;
   GdkRectangle visible_rect;
@@ -4871,6 +5903,245 @@ meta_frame_style_draw_with_style (MetaFrameStyle          *style,
     }
 }
 
+static gboolean
+draw_op_list_uses_icons (const MetaDrawOpList *op_list)
+{
+  int i;
+
+  for (i = 0; i < op_list->n_ops; i++)
+    {
+      const MetaDrawOp *op = op_list->ops[i];
+
+      if (op->type == META_DRAW_ICON ||
+          (op->type == META_DRAW_OP_LIST &&
+           draw_op_list_uses_icons (op->data.op_list.op_list)) ||
+          (op->type == META_DRAW_TILE &&
+           draw_op_list_uses_icons (op->data.tile.op_list)))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+gboolean
+meta_frame_style_uses_icons (const MetaFrameStyle *style)
+{
+  int i, j;
+
+  for (; style != NULL; style = style->parent)
+    {
+      for (i = 0; i < META_FRAME_PIECE_LAST; i++)
+        if (style->pieces[i] && draw_op_list_uses_icons (style->pieces[i]))
+          return TRUE;
+
+      for (i = 0; i < META_BUTTON_TYPE_LAST; i++)
+        for (j = 0; j < META_BUTTON_STATE_LAST; j++)
+          if (style->buttons[i][j] &&
+              draw_op_list_uses_icons (style->buttons[i][j]))
+            return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+draw_plan_matches (const MetaDrawPlan      *plan,
+                   GtkStyleContext         *style_gtk,
+                   const MetaFrameGeometry *fgeom,
+                   PangoLayout             *title_layout,
+                   const PangoRectangle    *title_extents,
+                   MetaButtonState          button_states[META_BUTTON_TYPE_LAST],
+                   GdkPixbuf               *mini_icon,
+                   GdkPixbuf               *icon)
+{
+  if (plan->serial != draw_plan_serial ||
+      plan->style_gtk != style_gtk ||
+      memcmp (&plan->fgeom, fgeom, sizeof (MetaFrameGeometry)) != 0 ||
+      memcmp (plan->button_states, button_states,
+              sizeof (plan->button_states)) != 0)
+    return FALSE;
+
+  if (title_layout)
+    {
+      const PangoFontDescription *font;
+
+      font = pango_layout_get_font_description (title_layout);
+
+      if (plan->title == NULL ||
+          plan->title_context != pango_layout_get_context (title_layout) ||
+          plan->title_width != title_extents->width ||
+          plan->title_height != title_extents->height ||
+          strcmp (plan->title, pango_layout_get_text (title_layout)) != 0 ||
+          (plan->title_font == NULL) != (font == NULL) ||
+          (font && !pango_font_description_equal (plan->title_font, font)))
+        return FALSE;
+    }
+  else if (plan->title != NULL)
+    return FALSE;
+
+  if (plan->mini_icon_width != (mini_icon ? gdk_pixbuf_get_width (mini_icon) : 0) ||
+      plan->mini_icon_height != (mini_icon ? gdk_pixbuf_get_height (mini_icon) : 0) ||
+      plan->icon_width != (icon ? gdk_pixbuf_get_width (icon) : 0) ||
+      plan->icon_height != (icon ? gdk_pixbuf_get_height (icon) : 0))
+    return FALSE;
+
+  if (plan->uses_icons &&
+      (plan->mini_icon != mini_icon || plan->icon != icon))
+    return FALSE;
+
+  return TRUE;
+}
+
+static MetaDrawPlan *
+draw_plan_new (MetaFrameStyle          *style,
+               GtkStyleContext         *style_gtk,
+               GtkWidget               *widget,
+               const MetaFrameGeometry *fgeom,
+               PangoLayout             *title_layout,
+               const PangoRectangle    *title_extents,
+               MetaButtonState          button_states[META_BUTTON_TYPE_LAST],
+               GdkPixbuf               *mini_icon,
+               GdkPixbuf               *icon)
+{
+  MetaDrawPlan *plan;
+  cairo_rectangle_t extents;
+  cairo_t *cr;
+
+  extents.x = 0;
+  extents.y = 0;
+  extents.width = fgeom->width;
+  extents.height = fgeom->height;
+
+  plan = g_new0 (MetaDrawPlan, 1);
+  plan->recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA,
+                                                    &extents);
+  if (cairo_surface_status (plan->recording) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy (plan->recording);
+      g_free (plan);
+      return NULL;
+    }
+
+  cr = cairo_create (plan->recording);
+  frame_style_draw_pieces (style, style_gtk, widget, cr, fgeom,
+                           title_layout, button_states, mini_icon, icon);
+  cairo_destroy (cr);
+
+  plan->serial = draw_plan_serial;
+  plan->style_gtk = g_object_ref (style_gtk);
+  plan->fgeom = *fgeom;
+  memcpy (plan->button_states, button_states, sizeof (plan->button_states));
+
+  if (title_layout)
+    {
+      const PangoFontDescription *font;
+
+      font = pango_layout_get_font_description (title_layout);
+
+      plan->title_context = g_object_ref (pango_layout_get_context (title_layout));
+      plan->title = g_strdup (pango_layout_get_text (title_layout));
+      plan->title_font = font ? pango_font_description_copy (font) : NULL;
+      plan->title_width = title_extents->width;
+      plan->title_height = title_extents->height;
+    }
+
+  plan->mini_icon_width = mini_icon ? gdk_pixbuf_get_width (mini_icon) : 0;
+  plan->mini_icon_height = mini_icon ? gdk_pixbuf_get_height (mini_icon) : 0;
+  plan->icon_width = icon ? gdk_pixbuf_get_width (icon) : 0;
+  plan->icon_height = icon ? gdk_pixbuf_get_height (icon) : 0;
+
+  /* Hold on to the icons so their addresses can't be reused */
+  plan->uses_icons = meta_frame_style_uses_icons (style);
+  if (plan->uses_icons)
+    {
+      plan->mini_icon = mini_icon ? g_object_ref (mini_icon) : NULL;
+      plan->icon = icon ? g_object_ref (icon) : NULL;
+    }
+
+  return plan;
+}
+
+/**
+ * Draws a frame. The drawing is recorded the first time, and later
+ * frames that would come out the same, such as many terminals of the
+ * same size, replay the recording instead of running the op lists and
+ * evaluating all their coordinates again.
+ *
+ * Without @use_draw_plan the pieces are drawn straight away, for
+ * redrawing a damaged area: a plan is recorded unclipped, so only a
+ * direct draw lets the clip skip the op lists it doesn't touch.
+ */
+void
+meta_frame_style_draw_with_style (MetaFrameStyle          *style,
+                                  GtkStyleContext         *style_gtk,
+                                  GtkWidget               *widget,
+                                  cairo_t                 *cr,
+                                  const MetaFrameGeometry *fgeom,
+                                  int                      client_width,
+                                  int                      client_height,
+                                  PangoLayout             *title_layout,
+                                  int                      text_height,
+                                  MetaButtonState          button_states[META_BUTTON_TYPE_LAST],
+                                  GdkPixbuf               *mini_icon,
+                                  GdkPixbuf               *icon,
+                                  gboolean                 use_draw_plan)
+{
+  PangoRectangle title_extents;
+  MetaDrawPlan *plan;
+  GList *link;
+
+  if (!use_draw_plan)
+    {
+      frame_style_draw_pieces (style, style_gtk, widget, cr, fgeom,
+                               title_layout, button_states,
+                               mini_icon, icon);
+      return;
+    }
+
+  if (title_layout)
+    pango_layout_get_pixel_extents (title_layout, NULL, &title_extents);
+
+  for (link = style->draw_plans; link != NULL; link = link->next)
+    if (draw_plan_matches (link->data, style_gtk, fgeom,
+                           title_layout, &title_extents,
+                           button_states, mini_icon, icon))
+      break;
+
+  if (link)
+    {
+      plan = link->data;
+      style->draw_plans = g_list_remove_link (style->draw_plans, link);
+      g_list_free (link);
+    }
+  else
+    {
+      plan = draw_plan_new (style, style_gtk, widget, fgeom,
+                            title_layout, &title_extents,
+                            button_states, mini_icon, icon);
+      if (plan == NULL)
+        {
+          frame_style_draw_pieces (style, style_gtk, widget, cr, fgeom,
+                                   title_layout, button_states,
+                                   mini_icon, icon);
+          return;
+        }
+
+      if (g_list_length (style->draw_plans) >= MAX_DRAW_PLANS)
+        {
+          link = g_list_last (style->draw_plans);
+          draw_plan_free (link->data);
+          style->draw_plans = g_list_delete_link (style->draw_plans, link);
+        }
+    }
+
+  style->draw_plans = g_list_prepend (style->draw_plans, plan);
+
+  cairo_save (cr);
+  cairo_set_source_surface (cr, plan->recording, 0, 0);
+  cairo_paint (cr);
+  cairo_restore (cr);
+}
+
 void
 meta_frame_style_draw (MetaFrameStyle          *style,
                        GtkWidget               *widget,
@@ -4887,7 +6158,7 @@ meta_frame_style_draw (MetaFrameStyle          *style,
   meta_frame_style_draw_with_style (style, gtk_widget_get_style_context (widget), widget,
                                     cr, fgeom, client_width, client_height,
                                     title_layout, text_height,
-                                    button_states, mini_icon, icon);
+                                    button_states, mini_icon, icon, TRUE);
 }
 
 MetaFrameStyleSet*
@@ -5221,6 +6492,12 @@ meta_theme_free (MetaTheme *theme)
 
   g_return_if_fail (theme != NULL);
 
+  /* Cached images may hold on to this theme's pixbufs */
+  flush_scaled_images ();
+
+  if (theme->image_cache)
+    g_mapped_file_unref (theme->image_cache);
+
   g_free (theme->name);
   g_free (theme->dirname);
   g_free (theme->filename);
@@ -5319,6 +6596,324 @@ meta_theme_validate (MetaTheme *theme,
   return TRUE;
 }
 
+/* Decoding a theme's images with gdk-pixbuf is most of the work of
+ * loading it, so the decoded pixels are kept in a cache file under the
+ * user cache directory, one per theme directory.  The file is mapped
+ * and the pixbufs point straight into the mapping, so loading a cached
+ * image is just a page-in.  Each entry records the inode, size, mtime
+ * and ctime of the file it was decoded from, and is ignored once any of
+ * them changes; the times are compared to the nanosecond where stat()
+ * has them, so a file rewritten within the same second is noticed.
+ *
+ * The layout (see MetaImageCacheHeader) is a header, an array of
+ * entries, the file names and then the pixel data, all in host byte
+ * order.
+ */
+#define IMAGE_CACHE_MAGIC "MTIMGC02"
+#define IMAGE_CACHE_ALIGN 16
+
+static gboolean image_cache_enabled = TRUE;
+
+/**
+ * meta_theme_set_image_cache_enabled: (skip)
+ *
+ * Turns the image cache off, so that theme-viewer can time loading a
+ * theme with every image decoded.
+ */
+void
+meta_theme_set_image_cache_enabled (gboolean enabled)
+{
+  image_cache_enabled = enabled;
+}
+
+static void
+image_cache_stamp (const struct stat   *st,
+                   MetaImageCacheEntry *entry)
+{
+  entry->inode = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtime;
+  entry->ctime = st->st_ctime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  entry->mtime_nsec = st->st_mtim.tv_nsec;
+  entry->ctime_nsec = st->st_ctim.tv_nsec;
+#else
+  entry->mtime_nsec = 0;
+  entry->ctime_nsec = 0;
+#endif
+}
+
+static gboolean
+image_cache_stamp_equal (const MetaImageCacheEntry *a,
+                         const MetaImageCacheEntry *b)
+{
+  return a->inode == b->inode &&
+         a->size == b->size &&
+         a->mtime == b->mtime &&
+         a->mtime_nsec == b->mtime_nsec &&
+         a->ctime == b->ctime &&
+         a->ctime_nsec == b->ctime_nsec;
+}
+
+static char *
+image_cache_filename (MetaTheme *theme)
+{
+  char *checksum;
+  char *basename;
+  char *path;
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1,
+                                            theme->dirname, -1);
+  basename = g_strconcat (checksum, ".images", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "mutter", "themes",
+                           basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+
+  return path;
+}
+
+static void
+image_cache_open (MetaTheme *theme)
+{
+  const MetaImageCacheHeader *header;
+  char *path;
+  gsize length;
+
+  theme->image_cache_opened = TRUE;
+
+  path = image_cache_filename (theme);
+  /* Writable gives a private copy-on-write mapping, so the pixbufs
+   * are as safe to scribble on as freshly decoded ones.
+   */
+  theme->image_cache = g_mapped_file_new (path, TRUE, NULL);
+  g_free (path);
+
+  if (theme->image_cache == NULL)
+    return;
+
+  header = (const MetaImageCacheHeader *) g_mapped_file_get_contents (theme->image_cache);
+  length = g_mapped_file_get_length (theme->image_cache);
+
+  if (length < sizeof (MetaImageCacheHeader) ||
+      memcmp (header->magic, IMAGE_CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->entry_size != sizeof (MetaImageCacheEntry) ||
+      header->n_entries > (length - sizeof (MetaImageCacheHeader)) / sizeof (MetaImageCacheEntry))
+    {
+      meta_topic (META_DEBUG_THEMES, "Ignoring invalid image cache for %s\n",
+                  theme->dirname);
+      g_mapped_file_unref (theme->image_cache);
+      theme->image_cache = NULL;
+    }
+}
+
+static void
+image_cache_pixels_free (guchar  *pixels,
+                         gpointer data)
+{
+  g_mapped_file_unref (data);
+}
+
+static GdkPixbuf *
+image_cache_lookup (MetaTheme  *theme,
+                    const char *filename,
+                    const char *full_path)
+{
+  const MetaImageCacheHeader *header;
+  const MetaImageCacheEntry *entries;
+  MetaImageCacheEntry stamp;
+  const char *contents;
+  gsize length;
+  size_t name_length;
+  struct stat st;
+  guint32 i;
+
+  if (!image_cache_enabled)
+    return NULL;
+
+  if (!theme->image_cache_opened)
+    image_cache_open (theme);
+
+  if (theme->image_cache == NULL)
+    return NULL;
+
+  if (g_stat (full_path, &st) != 0)
+    return NULL;
+
+  image_cache_stamp (&st, &stamp);
+
+  contents = g_mapped_file_get_contents (theme->image_cache);
+  length = g_mapped_file_get_length (theme->image_cache);
+  header = (const MetaImageCacheHeader *) contents;
+  entries = (const MetaImageCacheEntry *) (contents + sizeof (MetaImageCacheHeader));
+  name_length = strlen (filename);
+
+  for (i = 0; i < header->n_entries; i++)
+    {
+      const MetaImageCacheEntry *entry = &entries[i];
+      guint32 n_channels = entry->has_alpha ? 4 : 3;
+
+      if (entry->name_length != name_length ||
+          entry->name_offset > length ||
+          length - entry->name_offset < name_length ||
+          memcmp (contents + entry->name_offset, filename, name_length) != 0)
+        continue;
+
+      if (!image_cache_stamp_equal (entry, &stamp))
+        return NULL;
+
+      if (entry->width == 0 || entry->height == 0 ||
+          entry->width > G_MAXINT / n_channels ||
+          entry->rowstride < entry->width * n_channels ||
+          entry->data_offset > length ||
+          (length - entry->data_offset) / entry->height < entry->rowstride)
+        return NULL;
+
+      meta_topic (META_DEBUG_THEMES, "Loaded image %s from image cache\n",
+                  filename);
+
+      return gdk_pixbuf_new_from_data ((guchar *) contents + entry->data_offset,
+                                       GDK_COLORSPACE_RGB,
+                                       entry->has_alpha, 8,
+                                       entry->width, entry->height,
+                                       entry->rowstride,
+                                       image_cache_pixels_free,
+                                       g_mapped_file_ref (theme->image_cache));
+    }
+
+  return NULL;
+}
+
+/**
+ * meta_theme_save_image_cache: (skip)
+ *
+ * Writes the images loaded from the theme directory to the image cache,
+ * if any of them had to be decoded.
+ */
+void
+meta_theme_save_image_cache (MetaTheme *theme)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GArray *entries;
+  GPtrArray *names;
+  GPtrArray *pixbufs;
+  GString *buffer;
+  MetaImageCacheHeader header;
+  char *path;
+  char *dir;
+  GError *error = NULL;
+  guint i;
+
+  if (!image_cache_enabled || !theme->image_cache_dirty)
+    return;
+
+  theme->image_cache_dirty = FALSE;
+
+  entries = g_array_new (FALSE, TRUE, sizeof (MetaImageCacheEntry));
+  names = g_ptr_array_new ();
+  pixbufs = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, theme->images_by_filename);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const char *filename = key;
+      GdkPixbuf *pixbuf = value;
+      MetaImageCacheEntry entry = { 0, };
+      char *full_path;
+      struct stat st;
+
+      if (g_str_has_prefix (filename, "theme:") ||
+          gdk_pixbuf_get_bits_per_sample (pixbuf) != 8 ||
+          gdk_pixbuf_get_colorspace (pixbuf) != GDK_COLORSPACE_RGB ||
+          gdk_pixbuf_get_n_channels (pixbuf) !=
+          (gdk_pixbuf_get_has_alpha (pixbuf) ? 4 : 3))
+        continue;
+
+      full_path = g_build_filename (theme->dirname, filename, NULL);
+      if (g_stat (full_path, &st) != 0)
+        {
+          g_free (full_path);
+          continue;
+        }
+      g_free (full_path);
+
+      entry.name_length = strlen (filename);
+      image_cache_stamp (&st, &entry);
+      entry.width = gdk_pixbuf_get_width (pixbuf);
+      entry.height = gdk_pixbuf_get_height (pixbuf);
+      entry.has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+      entry.rowstride = entry.width * gdk_pixbuf_get_n_channels (pixbuf);
+
+      g_array_append_val (entries, entry);
+      g_ptr_array_add (names, (gpointer) filename);
+      g_ptr_array_add (pixbufs, pixbuf);
+    }
+
+  memcpy (header.magic, IMAGE_CACHE_MAGIC, sizeof (header.magic));
+  header.n_entries = entries->len;
+  header.entry_size = sizeof (MetaImageCacheEntry);
+
+  buffer = g_string_new (NULL);
+  g_string_append_len (buffer, (const char *) &header, sizeof (header));
+  /* Entries are filled in once the offsets are known */
+  g_string_set_size (buffer, buffer->len + entries->len * sizeof (MetaImageCacheEntry));
+
+  for (i = 0; i < entries->len; i++)
+    {
+      MetaImageCacheEntry *entry = &g_array_index (entries, MetaImageCacheEntry, i);
+
+      entry->name_offset = buffer->len;
+      g_string_append_len (buffer, names->pdata[i], entry->name_length);
+    }
+
+  for (i = 0; i < entries->len; i++)
+    {
+      MetaImageCacheEntry *entry = &g_array_index (entries, MetaImageCacheEntry, i);
+      GdkPixbuf *pixbuf = pixbufs->pdata[i];
+      const guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+      int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+      guint32 row;
+
+      while (buffer->len % IMAGE_CACHE_ALIGN != 0)
+        g_string_append_c (buffer, '\0');
+
+      entry->data_offset = buffer->len;
+      for (row = 0; row < entry->height; row++)
+        g_string_append_len (buffer, (const char *) pixels + row * rowstride,
+                             entry->rowstride);
+    }
+
+  if (entries->len > 0)
+    memcpy (buffer->str + sizeof (header), entries->data,
+            entries->len * sizeof (MetaImageCacheEntry));
+
+  path = image_cache_filename (theme);
+  dir = g_path_get_dirname (path);
+
+  if (g_mkdir_with_parents (dir, 0755) != 0 ||
+      !g_file_set_contents (path, buffer->str, buffer->len, &error))
+    {
+      meta_topic (META_DEBUG_THEMES, "Failed to write image cache %s: %s\n",
+                  path, error ? error->message : g_strerror (errno));
+      if (error)
+        g_error_free (error);
+    }
+  else
+    {
+      meta_topic (META_DEBUG_THEMES, "Wrote %u images to image cache %s\n",
+                  entries->len, path);
+    }
+
+  g_free (dir);
+  g_free (path);
+  g_string_free (buffer, TRUE);
+  g_ptr_array_free (pixbufs, TRUE);
+  g_ptr_array_free (names, TRUE);
+  g_array_free (entries, TRUE);
+}
+
 /**
  * meta_theme_load_image: (skip)
  *
@@ -5352,12 +6947,18 @@ meta_theme_load_image (MetaTheme  *theme,
         {
           char *full_path;
           full_path = g_build_filename (theme->dirname, filename, NULL);
-      
-          pixbuf = gdk_pixbuf_new_from_file (full_path, error);
+
+          pixbuf = image_cache_lookup (theme, filename, full_path);
           if (pixbuf == NULL)
             {
-              g_free (full_path);
-              return NULL;
+              pixbuf = gdk_pixbuf_new_from_file (full_path, error);
+              if (pixbuf == NULL)
+                {
+                  g_free (full_path);
+                  return NULL;
+                }
+
+              theme->image_cache_dirty = TRUE;
             }
       
           g_free (full_path);
@@ -5509,7 +7110,8 @@ meta_theme_draw_frame_with_style (MetaTheme              *theme,
                                   const MetaButtonLayout *button_layout,
                                   MetaButtonState         button_states[META_BUTTON_TYPE_LAST],
                                   GdkPixbuf              *mini_icon,
-                                  GdkPixbuf              *icon)
+                                  GdkPixbuf              *icon,
+                                  gboolean                use_draw_plan)
 {
   MetaFrameGeometry fgeom;
   MetaFrameStyle *style;
@@ -5540,7 +7142,8 @@ meta_theme_draw_frame_with_style (MetaTheme              *theme,
                                     title_layout,
                                     text_height,
                                     button_states,
-                                    mini_icon, icon);
+                                    mini_icon, icon,
+                                    use_draw_plan);
 }
 
 void
@@ -5563,7 +7166,7 @@ meta_theme_draw_frame (MetaTheme              *theme,
                                     client_width, client_height,
                                     title_layout, text_height,
                                     button_layout, button_states,
-                                    mini_icon, icon);
+                                    mini_icon, icon, TRUE);
 }
 
 void